@@ -0,0 +1,58 @@
+#include "arena.h"
+#include <cstring>
+
+Arena::Arena(size_t blockSize) : cur(0), end(0), blockSize(blockSize), used(0), reserved(0) {}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        delete[] blocks[i];
+    }
+    for (size_t i = 0; i < large.size(); i++) {
+        delete[] large[i];
+    }
+}
+
+void* Arena::allocateSlow(size_t n, size_t align) {
+    // Oversized requests get a dedicated block so they don't waste the tail
+    // of the current one.
+    if (n + align > blockSize / 4) {
+        char* block = new char[n + align];
+        large.push_back(block);
+        reserved += n + align;
+        size_t pad = (align - ((size_t)block & (align - 1))) & (align - 1);
+        used += n;
+        return block + pad;
+    }
+    char* block = new char[blockSize];
+    blocks.push_back(block);
+    reserved += blockSize;
+    cur = block;
+    end = block + blockSize;
+    return allocate(n, align);
+}
+
+const char* Arena::copy(const char* s, size_t n) {
+    char* p = (char*)allocate(n + 1, 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+void Arena::reset() {
+    // Keep the first block so a reused arena doesn't go back to the heap on
+    // its first allocation.
+    for (size_t i = 1; i < blocks.size(); i++) {
+        delete[] blocks[i];
+    }
+    for (size_t i = 0; i < large.size(); i++) {
+        delete[] large[i];
+    }
+    large.clear();
+    if (!blocks.empty()) {
+        blocks.resize(1);
+        cur = blocks[0];
+        end = cur + blockSize;
+    }
+    used = 0;
+    reserved = blocks.size() * blockSize;
+}
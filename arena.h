@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator. Memory is carved out of large blocks and released all at
+// once when the arena is reset or destroyed; there is no per-object free.
+class Arena {
+private:
+    std::vector<char*> blocks;
+    std::vector<char*> large;
+    char* cur;
+    char* end;
+    size_t blockSize;
+    size_t used;
+    size_t reserved;
+
+    void* allocateSlow(size_t n, size_t align);
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+public:
+    explicit Arena(size_t blockSize = 64 * 1024);
+    ~Arena();
+
+    void* allocate(size_t n, size_t align = sizeof(void*)) {
+        size_t pad = (align - ((size_t)cur & (align - 1))) & (align - 1);
+        if (cur != 0 && pad + n <= (size_t)(end - cur)) {
+            char* p = cur + pad;
+            cur = p + n;
+            used += n;
+            return p;
+        }
+        return allocateSlow(n, align);
+    }
+
+    const char* copy(const char* s, size_t n);
+    void reset();
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const { return reserved; }
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "ast.h"
+#include "lexer.h"
+
+Ast::Ast() : arena(64 * 1024), full(false), functions(AST_NONE) {
+    for (int k = 0; k < AST_KIND_COUNT; k++) {
+        counts[k] = 0;
+    }
+}
+
+// Starts a new chunk for kind, or marks the tree full when the kind has run
+// out of ids.
+bool Ast::addChunk(AstKind kind) {
+    if (counts[kind] >= AST_INDEX_LIMIT) {
+        full = true;
+        return false;
+    }
+    chunks[kind].push_back((AstNode*)arena.allocate(CHUNK_NODES * sizeof(AstNode), alignof(AstNode)));
+    return true;
+}
+
+size_t Ast::nodeCount() const {
+    size_t n = 0;
+    for (int k = 0; k < AST_KIND_COUNT; k++) {
+        n += counts[k];
+    }
+    return n;
+}
+
+uint32_t Ast::append(Ast& part, const std::vector<uint32_t>& symbolMap) {
+    uint32_t base[AST_KIND_COUNT];
+    for (int k = 0; k < AST_KIND_COUNT; k++) {
+        base[k] = counts[k];
+    }
+    // The index is the low part of an id, so shifting it is an addition.
+    auto moved = [&base](uint32_t id) {
+        return id == AST_NONE ? AST_NONE : id + base[Ast::kind(id)];
+    };
+    for (int k = 0; k < AST_KIND_COUNT; k++) {
+        AstKind kind = (AstKind)k;
+        for (uint32_t i = 0; i < part.counts[k]; i++) {
+            const AstNode& n = part.at(kind, i);
+            uint32_t a;
+            switch (kind) {
+            case AST_FUNC:
+            case AST_PARAM:
+            case AST_VAR:
+            case AST_ASSIGN:
+            case AST_NAME:
+            case AST_CALL:
+                a = n.a < symbolMap.size() ? symbolMap[n.a] : n.a;
+                break;
+            case AST_NUMBER:
+                a = n.a;
+                break;
+            default:
+                a = moved(n.a);
+                break;
+            }
+            uint32_t id = add(kind, a, moved(n.b), moved(n.c), n.op, n.offset);
+            if (id == AST_NONE) {
+                return AST_NONE;
+            }
+            node(id).next = moved(n.next);
+        }
+    }
+    return moved(part.functions);
+}
+
+void Ast::clear() {
+    arena.reset();
+    for (int k = 0; k < AST_KIND_COUNT; k++) {
+        chunks[k].clear();
+        counts[k] = 0;
+    }
+    full = false;
+    functions = AST_NONE;
+}
+
+namespace {
+
+const char* opText(uint32_t op) {
+    switch (op) {
+    case PLUS: return "+";
+    case MINUS: return "-";
+    case MULTIPLY: return "*";
+    case DIVIDE: return "/";
+    case MODULO: return "%";
+    case EQUAL: return "==";
+    case NOT_EQUAL: return "!=";
+    case LESS: return "<";
+    case LESS_EQUAL: return "<=";
+    case GREATER: return ">";
+    case GREATER_EQUAL: return ">=";
+    case AND: return "&&";
+    case OR: return "||";
+    case NOT: return "!";
+    default: return "?";
+    }
+}
+
+// Writes the tree from a stack of its own, so that nesting of any depth
+// that the parser took can be written out. A node is taken off the stack
+// and either written (leaves) or replaced by its pieces: text, names and
+// child nodes, pushed so that the first comes off first.
+class Dumper {
+private:
+    enum { TEXT, NAME, NODE };
+
+    struct Item {
+        int kind;
+        const char* text;
+        uint32_t id;        // symbol for NAME
+    };
+
+    Ast& ast;
+    SymbolTable& symbols;
+    std::ostream& out;
+    std::vector<Item> work;
+    std::vector<Item> pieces;   // of the node being taken apart, in order
+
+    void text(const char* t) {
+        Item item = { TEXT, t, 0 };
+        pieces.push_back(item);
+    }
+    void name(uint32_t sym) {
+        Item item = { NAME, NULL, sym };
+        pieces.push_back(item);
+    }
+    void child(uint32_t id) {
+        Item item = { NODE, NULL, id };
+        pieces.push_back(item);
+    }
+
+    void list(uint32_t first) {
+        text("(");
+        for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+            if (id != first) {
+                text(" ");
+            }
+            child(id);
+        }
+        text(")");
+    }
+
+    void writeName(uint32_t sym) {
+        size_t size;
+        const char* t = symbols.text(sym, size);
+        out.write(t, size);
+    }
+
+    // Writes a leaf, or puts the pieces of any other node in pieces.
+    void expand(uint32_t id) {
+        if (id == AST_NONE) {
+            out << "()";
+            return;
+        }
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_FUNC:
+            text(n.op == INT ? "(func int " : "(func void ");
+            name(n.a);
+            text(" ");
+            list(n.b);
+            text(" ");
+            child(n.c);
+            text(")");
+            break;
+        case AST_PARAM:
+        case AST_NAME:
+            writeName(n.a);
+            break;
+        case AST_BLOCK:
+            text("(block");
+            for (uint32_t s = n.a; s != AST_NONE; s = ast.node(s).next) {
+                text(" ");
+                child(s);
+            }
+            text(")");
+            break;
+        case AST_DECL:
+            text("(int");
+            for (uint32_t v = n.a; v != AST_NONE; v = ast.node(v).next) {
+                text(" ");
+                child(v);
+            }
+            text(")");
+            break;
+        case AST_VAR:
+            if (n.b == AST_NONE) {
+                writeName(n.a);
+            } else {
+                text("(");
+                name(n.a);
+                text(" ");
+                child(n.b);
+                text(")");
+            }
+            break;
+        case AST_ASSIGN:
+            text("(= ");
+            name(n.a);
+            text(" ");
+            child(n.b);
+            text(")");
+            break;
+        case AST_IF:
+            text("(if ");
+            child(n.a);
+            text(" ");
+            child(n.b);
+            if (n.c != AST_NONE) {
+                text(" ");
+                child(n.c);
+            }
+            text(")");
+            break;
+        case AST_WHILE:
+            text("(while ");
+            child(n.a);
+            text(" ");
+            child(n.b);
+            text(")");
+            break;
+        case AST_BREAK:
+            out << "(break)";
+            break;
+        case AST_CONTINUE:
+            out << "(continue)";
+            break;
+        case AST_RETURN:
+            text("(return ");
+            child(n.a);
+            text(")");
+            break;
+        case AST_EXPR_STMT:
+            text("(expr ");
+            child(n.a);
+            text(")");
+            break;
+        case AST_BINARY:
+            text("(");
+            text(opText(n.op));
+            text(" ");
+            child(n.a);
+            text(" ");
+            child(n.b);
+            text(")");
+            break;
+        case AST_UNARY:
+            text("(");
+            text(opText(n.op));
+            text(" ");
+            child(n.a);
+            text(")");
+            break;
+        case AST_NUMBER:
+            out << n.a;
+            break;
+        case AST_CALL:
+            text("(call ");
+            name(n.a);
+            text(" ");
+            list(n.b);
+            text(")");
+            break;
+        default:
+            out << "?";
+            break;
+        }
+    }
+
+public:
+    Dumper(Ast& ast, SymbolTable& symbols, std::ostream& out)
+        : ast(ast), symbols(symbols), out(out) {}
+
+    void node(uint32_t root) {
+        Item item = { NODE, NULL, root };
+        work.push_back(item);
+        while (!work.empty()) {
+            item = work.back();
+            work.pop_back();
+            if (item.kind == TEXT) {
+                out << item.text;
+            } else if (item.kind == NAME) {
+                writeName(item.id);
+            } else {
+                pieces.clear();
+                expand(item.id);
+                work.insert(work.end(), pieces.rbegin(), pieces.rend());
+            }
+        }
+    }
+};
+
+}
+
+void dumpAst(Ast& ast, SymbolTable& symbols, std::ostream& out) {
+    Dumper dumper(ast, symbols, out);
+    for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+        dumper.node(f);
+        out << "\n";
+    }
+}
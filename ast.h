@@ -0,0 +1,139 @@
+#ifndef AST_H
+#define AST_H
+
+#include "arena.h"
+#include "symbol_table.h"
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+// Syntax tree built by the Parser on request. Nodes refer to each other by
+// 32-bit id rather than by pointer: the top bits of an id hold the node's
+// kind and the rest its index among the nodes of that kind. Each kind is
+// stored in its own run of arena chunks, so a pass over, say, every call
+// touches only call nodes. Everything is released at once with clear() or
+// when the Ast is destroyed.
+//
+// Lists (function parameters, block statements, declared variables, call
+// arguments, the functions of the program) are chained through `next`.
+
+enum AstKind {
+    AST_FUNC,       // a: name sym, b: first PARAM, c: body BLOCK; op: INT or VOID
+    AST_PARAM,      // a: name sym
+    AST_BLOCK,      // a: first statement
+    AST_DECL,       // a: first VAR
+    AST_VAR,        // a: name sym, b: initializer
+    AST_ASSIGN,     // a: target sym, b: value
+    AST_IF,         // a: condition, b: then, c: else
+    AST_WHILE,      // a: condition, b: body
+    AST_BREAK,
+    AST_CONTINUE,
+    AST_RETURN,     // a: value
+    AST_EXPR_STMT,  // a: expression
+    AST_BINARY,     // op: operator TokenType, a: left, b: right
+    AST_UNARY,      // op: PLUS, MINUS or NOT, a: operand
+    AST_NAME,       // a: sym
+    AST_NUMBER,     // a: value modulo 2^32
+    AST_CALL,       // a: callee sym, b: first argument
+    AST_KIND_COUNT
+};
+
+// Absent child, end of a list, or an empty statement.
+const uint32_t AST_NONE = 0xFFFFFFFFu;
+const int AST_KIND_BITS = 5;
+const uint32_t AST_INDEX_LIMIT = 1u << (32 - AST_KIND_BITS);
+
+struct AstNode {
+    uint32_t a, b, c;
+    uint32_t next;
+    uint64_t offset : 48;   // source offset of the node's first token
+    uint64_t op : 16;
+};
+
+class Ast {
+private:
+    static const size_t CHUNK_NODES = 512;
+
+    Arena arena;
+    std::vector<AstNode*> chunks[AST_KIND_COUNT];
+    uint32_t counts[AST_KIND_COUNT];
+    bool full;
+
+    bool addChunk(AstKind kind);
+
+    Ast(const Ast&);
+    Ast& operator=(const Ast&);
+
+public:
+    uint32_t functions;     // first FUNC
+
+    Ast();
+
+    // Adds a node and returns its id. Past AST_INDEX_LIMIT nodes of one kind
+    // the tree is marked full() and AST_NONE is returned.
+    uint32_t add(AstKind kind, uint32_t a, uint32_t b, uint32_t c, uint32_t op, uint64_t offset) {
+        uint32_t i = counts[kind];
+        if (i % CHUNK_NODES == 0 && !addChunk(kind)) {
+            return AST_NONE;
+        }
+        AstNode& n = chunks[kind].back()[i % CHUNK_NODES];
+        n.a = a;
+        n.b = b;
+        n.c = c;
+        n.next = AST_NONE;
+        n.offset = offset;
+        n.op = op;
+        counts[kind] = i + 1;
+        return id(kind, i);
+    }
+
+    static AstKind kind(uint32_t id) { return (AstKind)(id >> (32 - AST_KIND_BITS)); }
+    static uint32_t index(uint32_t id) { return id & (AST_INDEX_LIMIT - 1); }
+    static uint32_t id(AstKind kind, uint32_t index) {
+        return ((uint32_t)kind << (32 - AST_KIND_BITS)) | index;
+    }
+
+    AstNode& node(uint32_t id) { return at(kind(id), index(id)); }
+    AstNode& at(AstKind kind, uint32_t index) {
+        return chunks[kind][index / CHUNK_NODES][index % CHUNK_NODES];
+    }
+    uint32_t count(AstKind kind) const { return counts[kind]; }
+    size_t nodeCount() const;
+    bool isFull() const { return full; }
+
+    // Copies every node of part to the end of this tree, renumbering the
+    // ids it refers to and mapping its names through symbolMap (part's
+    // symbol ids to ours). Returns the new id of part.functions. Trees of
+    // consecutive pieces of a program, appended in order, number their
+    // nodes exactly as the tree of the whole program would.
+    uint32_t append(Ast& part, const std::vector<uint32_t>& symbolMap);
+
+    void clear();
+    size_t bytesUsed() const { return arena.bytesUsed(); }
+    size_t bytesReserved() const { return arena.bytesReserved(); }
+};
+
+// Appends ids to a `next`-chained list.
+struct AstList {
+    uint32_t first;
+    uint32_t last;
+
+    AstList() : first(AST_NONE), last(AST_NONE) {}
+    void append(Ast* ast, uint32_t id) {
+        if (id == AST_NONE) {
+            return;
+        }
+        if (last == AST_NONE) {
+            first = id;
+        } else {
+            ast->node(last).next = id;
+        }
+        last = id;
+    }
+};
+
+// Writes the tree as one S-expression per function, e.g.
+// (func int main (a) (block (int (x 1)) (return (+ x a)))).
+void dumpAst(Ast& ast, SymbolTable& symbols, std::ostream& out);
+
+#endif
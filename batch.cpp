@@ -0,0 +1,268 @@
+#include "batch.h"
+#include "parser.h"
+#include "thread_pool.h"
+#include "verdict_cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Reads path into buf, adding a final newline if it lacks one, as the
+// single-file driver does. Most submissions are small, and for those a
+// read() into a buffer that is reused beats mapping: munmap in a process
+// with many threads has to shoot down every thread's TLB entries.
+bool readSource(const std::string& path, std::string& buf, std::string& err) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err = strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        err = strerror(errno);
+        close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        err = "not a regular file";
+        close(fd);
+        return false;
+    }
+    buf.resize((size_t)st.st_size);
+    size_t got = 0;
+    while (got < buf.size()) {
+        ssize_t n = read(fd, &buf[got], buf.size() - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            err = strerror(errno);
+            close(fd);
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(fd);
+    buf.resize(got);
+    if (!buf.empty() && buf[buf.size() - 1] != '\n') {
+        buf += '\n';
+    }
+    return true;
+}
+
+void writeJsonString(std::ostream& out, const std::string& s) {
+    static const char hex[] = "0123456789abcdef";
+    out << '"';
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out << '\\' << (char)c;
+        } else if (c == '\n') {
+            out << "\\n";
+        } else if (c == '\t') {
+            out << "\\t";
+        } else if (c < 0x20) {
+            out << "\\u00" << hex[c >> 4] << hex[c & 15];
+        } else {
+            out << (char)c;
+        }
+    }
+    out << '"';
+}
+
+// A parser and buffers kept by one pool thread for every file it takes.
+struct Worker {
+    Parser parser;
+    std::string source;
+    std::vector<ErrorInfo> cached;
+    std::string err;
+    std::ostringstream record;
+    BatchSummary counts;
+
+    Worker() : parser("", 0) {}
+};
+
+// Writes finished records, holding back those that come early when the
+// output must follow the input order.
+class Output {
+private:
+    std::ostream& out;
+    bool ordered;
+    std::mutex lock;
+    std::vector<std::string> early;
+    std::vector<bool> finished;
+    size_t next;
+
+public:
+    Output(std::ostream& o, bool inOrder, size_t files)
+        : out(o), ordered(inOrder), early(inOrder ? files : 0), finished(inOrder ? files : 0), next(0) {}
+
+    void put(size_t file, std::string record) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!ordered) {
+            out << record;
+            return;
+        }
+        early[file].swap(record);
+        finished[file] = true;
+        while (next < finished.size() && finished[next]) {
+            out << early[next];
+            std::string().swap(early[next]);
+            next++;
+        }
+    }
+};
+
+void writeRecord(Worker& w, const std::string& path, const std::vector<ErrorInfo>* errors,
+                 const BatchOptions& opt) {
+    std::ostringstream& out = w.record;
+    if (!opt.jsonLines) {
+        out << "==> " << path << " <==\n";
+        if (errors == NULL) {
+            out << "error: " << w.err << "\n";
+        } else {
+            printVerdict(*errors, opt.failFast, opt.columns, out);
+        }
+        return;
+    }
+    out << "{\"file\":";
+    writeJsonString(out, path);
+    if (errors == NULL) {
+        out << ",\"verdict\":\"error\",\"message\":";
+        writeJsonString(out, w.err);
+    } else if (errors->empty()) {
+        out << ",\"verdict\":\"accept\"";
+    } else {
+        out << ",\"verdict\":\"reject\"";
+        if (!opt.failFast) {
+            out << ",\"errors\":[";
+            for (size_t i = 0; i < errors->size(); i++) {
+                const ErrorInfo& e = (*errors)[i];
+                out << (i > 0 ? "," : "") << "{\"line\":" << e.line
+                    << ",\"column\":" << e.column << ",\"message\":";
+                writeJsonString(out, e.message);
+                out << "}";
+            }
+            out << "]";
+        }
+    }
+    out << "}\n";
+}
+
+}
+
+bool collectSources(const std::string& path, std::vector<std::string>& files, std::string& err) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        // Anything but a directory is a file to check; if it cannot be
+        // read, that is its result.
+        files.push_back(path);
+        return true;
+    }
+    DIR* d = opendir(path.c_str());
+    if (d == NULL) {
+        err = path + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    std::string dir = path[path.size() - 1] == '/' ? path : path + "/";
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string child = dir + names[i];
+        if (lstat(child.c_str(), &st) != 0) {
+            continue;
+        }
+        // Links to files count, but links to directories are not followed:
+        // one pointing back up would never end.
+        if (S_ISLNK(st.st_mode) && (stat(child.c_str(), &st) != 0 || S_ISDIR(st.st_mode))) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (!collectSources(child, files, err)) {
+                return false;
+            }
+        } else if (names[i].size() > 2 && names[i].compare(names[i].size() - 2, 2, ".c") == 0) {
+            files.push_back(child);
+        }
+    }
+    return true;
+}
+
+BatchSummary runBatch(const std::vector<std::string>& files, const BatchOptions& opt, std::ostream& out) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ThreadPool pool(opt.threads);
+    std::vector<Worker> workers(pool.size());
+    for (size_t t = 0; t < workers.size(); t++) {
+        Parser& parser = workers[t].parser;
+        parser.setMaxErrors(opt.maxErrors);
+        if (opt.failFast) {
+            parser.failFast();
+        }
+        if (opt.maxDepth != 0) {
+            parser.useExplicitStack(opt.maxDepth);
+        }
+    }
+    Output output(out, opt.ordered, files.size());
+
+    pool.run(files.size(), [&](size_t i, int thread) {
+        Worker& w = workers[thread];
+        const std::vector<ErrorInfo>* errors = NULL;
+        if (readSource(files[i], w.source, w.err)) {
+            Hash128 key = { 0, 0 };
+            if (opt.cache != NULL) {
+                key = opt.cache->key(w.source.data(), w.source.size(), opt.maxDepth);
+            }
+            if (opt.cache != NULL && opt.cache->lookup(key, opt.maxErrors, opt.failFast, w.cached)) {
+                errors = &w.cached;
+            } else {
+                w.parser.reset(w.source.data(), w.source.size());
+                w.parser.parse();
+                errors = &w.parser.errorList();
+                if (opt.cache != NULL) {
+                    opt.cache->store(key, *errors, opt.maxErrors, opt.failFast);
+                }
+            }
+            w.counts.bytes += w.source.size();
+            if (errors->empty()) {
+                w.counts.accepted++;
+            } else {
+                w.counts.rejected++;
+            }
+        } else {
+            w.counts.unreadable++;
+        }
+        w.record.str(std::string());
+        writeRecord(w, files[i], errors, opt);
+        output.put(i, w.record.str());
+    });
+
+    BatchSummary summary;
+    summary.files = files.size();
+    for (size_t t = 0; t < workers.size(); t++) {
+        summary.accepted += workers[t].counts.accepted;
+        summary.rejected += workers[t].counts.rejected;
+        summary.unreadable += workers[t].counts.unreadable;
+        summary.bytes += workers[t].counts.bytes;
+    }
+    out.flush();
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class VerdictCache;
+
+// Checks many programs in one process. Files are parsed on a ThreadPool;
+// each thread keeps one Parser and one read buffer and reuses them for
+// every file it takes, so a file costs no process, no mapping and, once
+// the buffers have grown, no allocation.
+
+struct BatchOptions {
+    int threads;
+    bool jsonLines;     // one JSON object per file instead of printErrors() text
+    bool ordered;       // results in input order rather than as they finish
+    bool columns;
+    size_t maxErrors;   // 0: no limit
+    bool failFast;
+    size_t maxDepth;    // 0: recursive parser
+    VerdictCache* cache;    // NULL: parse every file
+
+    BatchOptions() : threads(1), jsonLines(false), ordered(true), columns(false), maxErrors(0),
+                     failFast(false), maxDepth(0), cache(NULL) {}
+};
+
+struct BatchSummary {
+    size_t files;
+    size_t accepted;
+    size_t rejected;
+    size_t unreadable;
+    uint64_t bytes;
+    double seconds;
+
+    BatchSummary() : files(0), accepted(0), rejected(0), unreadable(0), bytes(0), seconds(0) {}
+};
+
+// Adds path to files, or, for a directory, every *.c file below it in
+// sorted order, not following symbolic links to directories below path.
+// False, with err set, if a directory cannot be listed.
+bool collectSources(const std::string& path, std::vector<std::string>& files, std::string& err);
+
+// Parses every file and writes one result per file to out. In text form a
+// result is a "==> path <==" line followed by exactly what printErrors()
+// prints; a file that cannot be read gets "error: <reason>" instead.
+BatchSummary runBatch(const std::vector<std::string>& files, const BatchOptions& opt, std::ostream& out);
+
+#endif
@@ -0,0 +1,124 @@
+#include "batch.h"
+#include "parser.h"
+#include "verdict_cache.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int usage() {
+    std::cerr << "usage: parser_batch [--threads=N] [--jsonl] [--unordered] [--columns]" << std::endl
+              << "                    [--max-errors=N] [--fail-fast] [--iterative] [--max-depth=N]" << std::endl
+              << "                    [--cache=PATH] [--cache-size=MB] path..." << std::endl
+              << "checks every file given, and every *.c file below each directory given;" << std::endl
+              << "- reads more paths from stdin, one per line;" << std::endl
+              << "--threads defaults to one per hardware thread;" << std::endl
+              << "--jsonl writes one JSON object per file instead of the parser's text;" << std::endl
+              << "--unordered writes results as they finish instead of in input order;" << std::endl
+              << "--cache reuses the verdicts of files seen before, kept in a file at PATH that" << std::endl
+              << "holds about --cache-size MB (default " << (VerdictCache::DEFAULT_SIZE >> 20) << ");" << std::endl
+              << "the other options are the parser's. A summary goes to stderr." << std::endl;
+    return 2;
+}
+
+static bool parseCount(const char* text, size_t& value) {
+    char* end;
+    value = strtoul(text, &end, 10);
+    return *end == '\0' && value != 0;
+}
+
+int main(int argc, char** argv) {
+    BatchOptions opt;
+    opt.threads = std::thread::hardware_concurrency();
+    if (opt.threads < 1) {
+        opt.threads = 1;
+    }
+    std::vector<std::string> paths;
+    std::string cachePath;
+    size_t cacheSize = VerdictCache::DEFAULT_SIZE >> 20;
+    for (int i = 1; i < argc; i++) {
+        size_t n;
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            if (!parseCount(argv[i] + 10, n)) {
+                return usage();
+            }
+            opt.threads = (int)n;
+        } else if (strcmp(argv[i], "--jsonl") == 0) {
+            opt.jsonLines = true;
+        } else if (strcmp(argv[i], "--unordered") == 0) {
+            opt.ordered = false;
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            opt.columns = true;
+        } else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            if (!parseCount(argv[i] + 13, opt.maxErrors)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--fail-fast") == 0) {
+            opt.failFast = true;
+        } else if (strcmp(argv[i], "--iterative") == 0) {
+            if (opt.maxDepth == 0) {
+                opt.maxDepth = Parser::DEFAULT_MAX_DEPTH;
+            }
+        } else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+            if (!parseCount(argv[i] + 12, opt.maxDepth)) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8] != '\0') {
+            cachePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            if (!parseCount(argv[i] + 13, cacheSize)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "-") == 0 || argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        } else {
+            return usage();
+        }
+    }
+    if (paths.empty()) {
+        return usage();
+    }
+
+    std::vector<std::string> files;
+    for (size_t i = 0; i < paths.size(); i++) {
+        std::string err;
+        if (paths[i] == "-") {
+            std::string line;
+            while (std::getline(std::cin, line)) {
+                if (!line.empty() && !collectSources(line, files, err)) {
+                    std::cerr << "parser_batch: " << err << std::endl;
+                    return 2;
+                }
+            }
+        } else if (!collectSources(paths[i], files, err)) {
+            std::cerr << "parser_batch: " << err << std::endl;
+            return 2;
+        }
+    }
+
+    VerdictCache cache;
+    if (!cachePath.empty()) {
+        std::string err;
+        if (!cache.open(cachePath, cacheSize << 20, err)) {
+            std::cerr << "parser_batch: " << err << std::endl;
+            return 2;
+        }
+        opt.cache = &cache;
+    }
+
+    std::ios::sync_with_stdio(false);
+    BatchSummary s = runBatch(files, opt, std::cout);
+    double mb = s.bytes / 1048576.0;
+    fprintf(stderr, "%zu files (%zu accepted, %zu rejected, %zu unreadable), %.1f MB in %.3f s on %d threads: "
+            "%.0f files/s, %.1f MB/s\n", s.files, s.accepted, s.rejected, s.unreadable, mb, s.seconds,
+            opt.threads, s.seconds > 0 ? s.files / s.seconds : 0.0, s.seconds > 0 ? mb / s.seconds : 0.0);
+    if (cache.isOpen()) {
+        fprintf(stderr, "cache: %llu hits, %llu misses (%llu and %llu by every user of %s)\n",
+                (unsigned long long)cache.hits(), (unsigned long long)cache.misses(),
+                (unsigned long long)cache.sharedHits(), (unsigned long long)cache.sharedMisses(), cachePath.c_str());
+    }
+    return s.unreadable == 0 ? 0 : 1;
+}
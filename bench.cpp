@@ -0,0 +1,1473 @@
+#include "incremental.h"
+#include "ir.h"
+#include "parser.h"
+#include "parallel_lexer.h"
+#include "token_buffer.h"
+#include "scan.h"
+#include "semantic.h"
+#include "native.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Global allocation counter so benchmarks can report heap traffic.
+static unsigned long long allocCount = 0;
+
+void* operator new(size_t n) {
+    allocCount++;
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - since).count();
+}
+
+static const char* sourceHead = "int main() {\n";
+static const char* sourceTail = "    return 0;\n}\n";
+
+static std::string sourceBlock() {
+    std::string body =
+        "    int a = 1, b = 22, accumulated_total = 0, loop_iteration_count = 0;\n"
+        "    // generated code tends to use long, descriptive names\n"
+        "    while (a <= 100 && b != 0) {\n"
+        "        accumulated_total = accumulated_total + a * (b - 3) / 7 % 11;\n"
+        "        if (!(a >= 50) || b < 10) { a = a + 1; loop_iteration_count = loop_iteration_count + 1; } else { b = b - 1; }\n"
+        "    }\n";
+    return "    {\n" + body + "    }\n";
+}
+
+// One valid function whose body is a statement pattern repeated until the
+// source reaches the requested size.
+static std::string makeSource(size_t bytes) {
+    std::string block = sourceBlock();
+    std::string src = sourceHead;
+    src.reserve(bytes + block.size() + 64);
+    while (src.size() < bytes) {
+        src += block;
+    }
+    src += sourceTail;
+    return src;
+}
+
+// Streams the same program as makeSource() to stdout without holding it in
+// memory, for inputs larger than RAM.
+static int benchGen(int argc, char** argv) {
+    unsigned long long bytes = (argc > 0 ? strtoull(argv[0], 0, 10) : 64) << 20;
+    std::string block = sourceBlock();
+    std::string chunk;
+    while (chunk.size() < (1 << 20)) {
+        chunk += block;
+    }
+    unsigned long long written = fwrite(sourceHead, 1, strlen(sourceHead), stdout);
+    while (written < bytes) {
+        written += fwrite(chunk.data(), 1, chunk.size(), stdout);
+        if (ferror(stdout)) {
+            return 1;
+        }
+    }
+    fwrite(sourceTail, 1, strlen(sourceTail), stdout);
+    return 0;
+}
+
+static int benchAlloc(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 8;
+    std::string src = makeSource(mb << 20);
+    double size = src.size() / 1048576.0;
+
+    Lexer lexer(src);
+    unsigned long long before = allocCount;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned long long tokens = 0;
+    Token t;
+    do {
+        t = lexer.nextToken();
+        tokens++;
+    } while (t.type != END_OF_FILE);
+    double lexMs = elapsedMs(start);
+    unsigned long long lexAllocs = allocCount - before;
+
+    Parser parser(src);
+    before = allocCount;
+    start = std::chrono::steady_clock::now();
+    bool ok = parser.parse();
+    double parseMs = elapsedMs(start);
+    unsigned long long parseAllocs = allocCount - before;
+
+    printf("source: %.1f MB, %llu tokens\n", size, tokens);
+    printf("lex:   %8.1f ms  %10llu allocs  %10.1f allocs/MB\n", lexMs, lexAllocs, lexAllocs / size);
+    printf("parse: %8.1f ms  %10llu allocs  %10.1f allocs/MB  (%s)\n", parseMs, parseAllocs,
+           parseAllocs / size, ok ? "accept" : "reject");
+    return 0;
+}
+
+// Comment- and indentation-heavy input in the style of f16_complex_syntax.c.
+static std::string makeCommentedSource(size_t bytes) {
+    std::string body =
+        "        /* Multi-line comment with tricky symbols: (){};\n"
+        "         * // nested line comment marker\n"
+        "         * and several lines of prose explaining the loop below\n"
+        "         */\n"
+        "        while/*nested*/(n/*comment*/>/*gt*/1/*comment*/) {\n"
+        "                result = result */*multiply*/n; // keep the running product\n"
+        "                n = n - /*decrement*/1;\n"
+        "        }\n"
+        "\n";
+    std::string src = "int main() {\n    int result = 1, n = 5;\n";
+    src.reserve(bytes + body.size() + 64);
+    while (src.size() < bytes) {
+        src += body;
+    }
+    src += "    return result;\n}\n";
+    return src;
+}
+
+static double lexMs(const std::string& src, int reps, unsigned long long* tokens,
+                    LexerEngine engine = LEX_CLASSIC) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        Lexer lexer(src, engine);
+        Token t;
+        *tokens = 0;
+        do {
+            t = lexer.nextToken();
+            (*tokens)++;
+        } while (t.type != END_OF_FILE);
+    }
+    return elapsedMs(start) / reps;
+}
+
+static int benchScan(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 16;
+    std::string src = makeCommentedSource(mb << 20);
+    double size = src.size() / 1048576.0;
+    ScanKernel saved = scanKernel();
+    ScanKernel kernels[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+
+    printf("source: %.1f MB, comment-heavy\n", size);
+    for (int i = 0; i < 3; i++) {
+        if (!setScanKernel(kernels[i])) {
+            printf("%-7s unsupported\n", scanKernelName(kernels[i]));
+            continue;
+        }
+        unsigned long long tokens = 0;
+        double ms = lexMs(src, 3, &tokens);
+        printf("%-7s %8.1f ms  %8.1f MB/s  %llu tokens\n", scanKernelName(kernels[i]), ms,
+               size / (ms / 1000.0), tokens);
+    }
+    setScanKernel(saved);
+    return 0;
+}
+
+static int benchEngines(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 16;
+    std::string plain = makeSource(mb << 20);
+    std::string commented = makeCommentedSource(mb << 20);
+    const std::string* inputs[] = { &plain, &commented };
+    const char* names[] = { "plain", "commented" };
+
+    for (int i = 0; i < 2; i++) {
+        double size = inputs[i]->size() / 1048576.0;
+        unsigned long long tokens = 0;
+        double classic = lexMs(*inputs[i], 3, &tokens, LEX_CLASSIC);
+        double table = lexMs(*inputs[i], 3, &tokens, LEX_TABLE);
+        printf("%-9s %.1f MB, %llu tokens\n", names[i], size, tokens);
+        printf("  classic %8.1f ms  %8.1f MB/s\n", classic, size / (classic / 1000.0));
+        printf("  table   %8.1f ms  %8.1f MB/s\n", table, size / (table / 1000.0));
+    }
+    return 0;
+}
+
+static std::string readFile(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// The per-lexer keyword map Lexer used to build, kept here as the reference
+// point for the perfect-hash lookup.
+static TokenType mapKeywordType(const std::map<std::string, TokenType>& keywords, StrView id) {
+    std::map<std::string, TokenType>::const_iterator it = keywords.find(id.str());
+    return it != keywords.end() ? it->second : IDENTIFIER;
+}
+
+static void fillKeywordMap(std::map<std::string, TokenType>& keywords) {
+    keywords["int"] = INT;
+    keywords["void"] = VOID;
+    keywords["if"] = IF;
+    keywords["else"] = ELSE;
+    keywords["while"] = WHILE;
+    keywords["break"] = BREAK;
+    keywords["continue"] = CONTINUE;
+    keywords["return"] = RETURN;
+}
+
+static int benchKeywords(int argc, char** argv) {
+    const char* path = argc > 0 ? argv[0] : "parser_testcases/functional/f18_many_variables.c";
+    int reps = argc > 1 ? atoi(argv[1]) : 2000;
+    std::string src = readFile(path);
+    if (src.empty()) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+
+    Lexer lexer(src);
+    std::vector<StrView> words;
+    for (Token t = lexer.nextToken(); t.type != END_OF_FILE; t = lexer.nextToken()) {
+        if (t.type == IDENTIFIER || lookupKeyword(t.value) != IDENTIFIER) {
+            words.push_back(t.value);
+        }
+    }
+
+    // Classification only: one keyword map per "lexer" versus the static
+    // perfect hash, over the same identifier stream.
+    unsigned long long sink = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        std::map<std::string, TokenType> keywords;
+        fillKeywordMap(keywords);
+        for (size_t i = 0; i < words.size(); i++) {
+            sink += mapKeywordType(keywords, words[i]);
+        }
+    }
+    double mapMs = elapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < words.size(); i++) {
+            sink += lookupKeyword(words[i]);
+        }
+    }
+    double hashMs = elapsedMs(start);
+
+    // End to end: a fresh parser per run, as in a request-per-parser server.
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        Parser parser(src);
+        sink += parser.parse();
+    }
+    double parseMs = elapsedMs(start);
+
+    double lookups = (double)words.size() * reps;
+    printf("%s: %d identifiers/keywords per file, %d runs\n", path, (int)words.size(), reps);
+    printf("map build + find  %8.1f ms  %6.2f ns/lookup\n", mapMs, mapMs * 1e6 / lookups);
+    printf("perfect hash      %8.1f ms  %6.2f ns/lookup\n", hashMs, hashMs * 1e6 / lookups);
+    printf("parse per file    %8.2f us  (%.0f parsers/s)\n", parseMs * 1000 / reps,
+           reps / (parseMs / 1000.0));
+    return sink == 0 ? 1 : 0;
+}
+
+static int benchParallel(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 64;
+    std::string src = makeCommentedSource(mb << 20);
+    double size = src.size() / 1048576.0;
+    int threadCounts[] = { 1, 2, 4, 8, 16 };
+
+    printf("source: %.1f MB, %u hardware threads\n", size, std::thread::hardware_concurrency());
+    Lexer lexer(src.data(), src.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t tokens = lexer.getAllTokens().size();
+    double sequential = elapsedMs(start);
+    printf("Lexer::getAllTokens  %8.1f ms  %8.1f MB/s  %zu tokens\n", sequential,
+           size / (sequential / 1000.0), tokens);
+    for (int i = 0; i < 5; i++) {
+        ThreadPool pool(threadCounts[i]);
+        start = std::chrono::steady_clock::now();
+        tokens = lexParallel(src.data(), src.size(), pool).size();
+        double ms = elapsedMs(start);
+        printf("%2d threads           %8.1f ms  %8.1f MB/s  %.2fx\n", threadCounts[i], ms,
+               size / (ms / 1000.0), sequential / ms);
+    }
+    return 0;
+}
+
+// A valid program whose statements are long expressions of the given
+// style: "flat" chains every binary operator at the same depth, "nested"
+// wraps operands in parentheses, "unary" stacks prefix operators.
+static std::string makeExprSource(size_t bytes, const std::string& style) {
+    static const char* ops[] = { "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+    std::string src = "int main() {\n    int a = 1, b = 2, c = 3;\n";
+    unsigned seed = 1;
+    while (src.size() < bytes) {
+        std::string expr = "a";
+        for (int i = 0; i < 40; i++) {
+            seed = seed * 1103515245 + 12345;
+            const char* op = ops[(seed >> 16) % 13];
+            const char* operand = i % 3 == 0 ? "b" : i % 3 == 1 ? "17" : "c";
+            if (style == "nested") {
+                expr = "(" + expr + " " + op + " " + operand + ")";
+            } else if (style == "unary") {
+                expr += std::string(" ") + op + " -!+" + operand;
+            } else {
+                expr += std::string(" ") + op + " " + operand;
+            }
+        }
+        src += "    a = " + expr + ";\n";
+    }
+    src += "    return a;\n}\n";
+    return src;
+}
+
+// Expression-heavy parsing: f17_complex_expressions.c (a fresh parser per
+// run) and generated programs in each expression style.
+static int benchExpr(int argc, char** argv) {
+    const char* path = argc > 0 ? argv[0] : "parser_testcases/functional/f17_complex_expressions.c";
+    int reps = argc > 1 ? atoi(argv[1]) : 5000;
+    std::string file = readFile(path);
+    if (file.empty()) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+    unsigned long long sink = 0;
+    double best = 1e30;
+    for (int round = 0; round < 3; round++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reps; r++) {
+            Parser parser(file.data(), file.size());
+            sink += parser.parse();
+        }
+        double ms = elapsedMs(start);
+        best = ms < best ? ms : best;
+    }
+    printf("%s: %8.2f us per parse\n", path, best * 1000 / reps);
+
+    const char* styles[] = { "flat", "nested", "unary" };
+    for (int k = 0; k < 3; k++) {
+        std::string src = makeExprSource(4 << 20, styles[k]);
+        best = 1e30;
+        for (int round = 0; round < 3; round++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            Parser parser(src.data(), src.size());
+            if (!parser.parse()) {
+                fprintf(stderr, "generated %s program was rejected\n", styles[k]);
+                return 1;
+            }
+            double ms = elapsedMs(start);
+            best = ms < best ? ms : best;
+        }
+        printf("generated %-6s %5.1f MB: %8.1f ms  %7.1f MB/s\n", styles[k], src.size() / 1048576.0,
+               best, src.size() / 1048576.0 / (best / 1000.0));
+    }
+    return sink == (unsigned long long)-1 ? 1 : 0;
+}
+
+// Recognize-only parsing against building the tree, on a valid program.
+static int benchAst(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 16;
+    std::string src = makeSource(mb << 20);
+    double size = src.size() / 1048576.0;
+    const int runs = 5;
+    double plainMs = 1e30, treeMs = 1e30;
+    size_t nodes = 0, used = 0, reserved = 0;
+    for (int r = 0; r < runs; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        {
+            Parser parser(src.data(), src.size());
+            parser.parse();
+        }
+        double ms = elapsedMs(start);
+        plainMs = ms < plainMs ? ms : plainMs;
+
+        Ast tree;
+        start = std::chrono::steady_clock::now();
+        {
+            Parser parser(src.data(), src.size());
+            parser.parse(&tree);
+        }
+        ms = elapsedMs(start);
+        treeMs = ms < treeMs ? ms : treeMs;
+        nodes = tree.nodeCount();
+        used = tree.bytesUsed();
+        reserved = tree.bytesReserved();
+    }
+    printf("source: %.1f MB, best of %d\n", size, runs);
+    printf("recognize only  %8.1f ms  %8.1f MB/s\n", plainMs, size / (plainMs / 1000.0));
+    printf("build tree      %8.1f ms  %8.1f MB/s  +%.0f%%\n", treeMs, size / (treeMs / 1000.0),
+           (treeMs / plainMs - 1) * 100);
+    printf("tree: %zu nodes, %d bytes/node, %.2f bytes used and %.2f reserved per source byte\n",
+           nodes, (int)sizeof(AstNode), (double)used / src.size(), (double)reserved / src.size());
+    return 0;
+}
+
+// Best time of the recursive parser (maxDepth 0) or the explicit-stack one
+// over src, with or without a tree; -1 if src is rejected.
+static double timeParse(const std::string& src, size_t maxDepth, bool build, int runs) {
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        Ast tree;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Parser parser(src.data(), src.size());
+        if (maxDepth != 0) {
+            parser.useExplicitStack(maxDepth);
+        }
+        if (!parser.parse(build ? &tree : NULL)) {
+            return -1;
+        }
+        double ms = elapsedMs(start);
+        best = ms < best ? ms : best;
+    }
+    return best;
+}
+
+// The explicit-stack parser against the recursive one on ordinary code and
+// on each expression style, then alone on nesting the recursive parser
+// cannot survive.
+static int benchStack(int argc, char** argv) {
+    size_t mb = argc > 0 ? (size_t)atol(argv[0]) : 16;
+    const int runs = 5;
+    const char* names[] = { "ordinary", "flat", "nested", "unary" };
+    printf("%-9s %7s %12s %12s %12s %12s\n", "source", "MB", "recursive", "stack",
+           "rec. tree", "stack tree");
+    for (int k = 0; k < 4; k++) {
+        std::string src = k == 0 ? makeSource(mb << 20) : makeExprSource(mb << 20, names[k]);
+        printf("%-9s %7.1f", names[k], src.size() / 1048576.0);
+        for (int build = 0; build < 2; build++) {
+            for (int stack = 0; stack < 2; stack++) {
+                double ms = timeParse(src, stack ? Parser::DEFAULT_MAX_DEPTH : 0, build, runs);
+                if (ms < 0) {
+                    fprintf(stderr, "\n%s program was rejected\n", names[k]);
+                    return 1;
+                }
+                printf(" %9.1f ms", ms);
+            }
+        }
+        printf("\n");
+    }
+
+    size_t depth = 1000000;
+    std::string deep = "int main() {\n    return " + std::string(depth, '(') + "1" +
+                       std::string(depth, ')') + ";\n}\n";
+    double ms = timeParse(deep, 4 * depth, false, runs);
+    printf("%zu nested parentheses: %.1f ms on the explicit stack\n", depth, ms);
+    return ms < 0 ? 1 : 0;
+}
+
+// A program of many small functions, each calling the one before.
+static std::string makeFunctionsSource(size_t count) {
+    std::string block = sourceBlock();
+    std::string src;
+    for (size_t i = 0; i < count; i++) {
+        std::stringstream head;
+        head << "int f" << i << "(int n) {\n";
+        src += head.str() + block;
+        if (i > 0) {
+            std::stringstream call;
+            call << "    return f" << i - 1 << "(n - 1);\n";
+            src += call.str();
+        }
+        src += "    return n;\n}\n";
+    }
+    return src + sourceHead + sourceTail;
+}
+
+// Best time to parse tokens on the pool (NULL: sequentially).
+static double timeFunctions(const TokenBuffer& tokens, ThreadPool* pool, bool build, int runs) {
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        Ast tree;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Parser parser(tokens);
+        if (pool != NULL) {
+            parser.useThreads(*pool);
+        }
+        if (!parser.parse(build ? &tree : NULL)) {
+            return -1;
+        }
+        double ms = elapsedMs(start);
+        best = ms < best ? ms : best;
+    }
+    return best;
+}
+
+// Function definitions parsed on a pool against one thread. The token
+// buffer is lexed beforehand and not timed.
+static int benchFunctions(int argc, char** argv) {
+    size_t count = argc > 0 ? (size_t)atol(argv[0]) : 20000;
+    const int runs = 5;
+    int threadCounts[] = { 1, 2, 4, 8 };
+    std::string src = makeFunctionsSource(count);
+    TokenBuffer tokens;
+    tokens.lex(src.data(), src.size());
+    printf("source: %.1f MB, %zu functions, %zu tokens, %u hardware threads\n",
+           src.size() / 1048576.0, count + 1, tokens.size(), std::thread::hardware_concurrency());
+    for (int build = 0; build < 2; build++) {
+        double sequential = timeFunctions(tokens, NULL, build, runs);
+        if (sequential < 0) {
+            fprintf(stderr, "program was rejected\n");
+            return 1;
+        }
+        printf("%-10s sequential %8.1f ms\n", build ? "tree" : "recognize", sequential);
+        for (int i = 0; i < 4; i++) {
+            ThreadPool pool(threadCounts[i]);
+            double ms = timeFunctions(tokens, &pool, build, runs);
+            printf("%-10s %2d threads %8.1f ms  %.2fx\n", build ? "tree" : "recognize",
+                   threadCounts[i], ms, sequential / ms);
+        }
+    }
+    return 0;
+}
+
+// A program whose every line but the first and last is rejected.
+static std::string makeInvalidSource(size_t lines) {
+    static const char* bad[] = {
+        "    x = 1 + ;\n", "    y = ;\n", "    return (a * ;\n", "    z = f(1, );\n",
+    };
+    std::string src = "int main() {\n";
+    for (size_t i = 0; i < lines; i++) {
+        src += bad[i % 4];
+    }
+    return src + "}\n";
+}
+
+// Best time to reject src, with the diagnostics reported; maxErrors 0 is
+// no limit.
+static double timeReject(const std::string& src, size_t maxErrors, bool failFast, int runs,
+                         size_t* errorLines) {
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        std::stringstream out;
+        std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Parser parser(src.data(), src.size());
+        parser.setMaxErrors(maxErrors);
+        if (failFast) {
+            parser.failFast();
+        }
+        parser.parse();
+        parser.printErrors();
+        double ms = elapsedMs(start);
+        std::cout.rdbuf(saved);
+        best = ms < best ? ms : best;
+        const std::string& text = out.str();
+        *errorLines = std::count(text.begin(), text.end(), '\n') - 1;
+    }
+    return best;
+}
+
+// Adversarial input: one error per line. Time per line must stay flat as
+// the file grows, and a cap on errors makes the rest of the file free.
+static int benchErrors(int argc, char** argv) {
+    size_t lines = argc > 0 ? (size_t)atol(argv[0]) : 1000000;
+    const int runs = 3;
+    size_t reported;
+    printf("%10s %12s %12s %10s\n", "lines", "errors", "time", "per line");
+    for (size_t n = lines / 8; n <= lines; n *= 2) {
+        std::string src = makeInvalidSource(n);
+        double ms = timeReject(src, 0, false, runs, &reported);
+        printf("%10zu %12zu %9.1f ms %7.1f ns\n", n, reported, ms, ms * 1e6 / n);
+    }
+    std::string src = makeInvalidSource(lines);
+    double ms = timeReject(src, 100, false, runs, &reported);
+    printf("%zu lines, --max-errors=100: %zu errors in %.2f ms\n", lines, reported, ms);
+    ms = timeReject(src, 0, true, runs, &reported);
+    printf("%zu lines, --fail-fast: %.3f ms\n", lines, ms);
+    return 0;
+}
+
+// Single-character edits to a large valid program, each followed by the
+// verdict, against parsing the whole program again.
+static int benchIncremental(int argc, char** argv) {
+    size_t lines = argc > 0 ? (size_t)atol(argv[0]) : 50000;
+    const int edits = 4000;
+    std::string src = makeFunctionsSource(lines / 12);
+    size_t lineCount = std::count(src.begin(), src.end(), '\n');
+
+    double full = 1e30;
+    for (int r = 0; r < 5; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Parser parser(src.data(), src.size());
+        if (!parser.parse()) {
+            fprintf(stderr, "program was rejected\n");
+            return 1;
+        }
+        double ms = elapsedMs(start);
+        full = ms < full ? ms : full;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    IncrementalParser parser(src);
+    parser.parse();
+    double initial = elapsedMs(start);
+    printf("source: %zu lines, %.1f MB, %zu functions\n", lineCount, src.size() / 1048576.0,
+           parser.segmentCount());
+    printf("full parse %9.3f ms, first incremental parse %.3f ms\n", full, initial);
+
+    // In pairs: a space typed and deleted, a ';' deleted and typed back.
+    std::vector<double> us;
+    size_t relexed = 0;
+    bool wrong = false;
+    srand(1);
+    for (int e = 0; e < edits; e += 4) {
+        size_t at = src.find(';', (size_t)rand() % src.size());
+        if (at == std::string::npos) {
+            at = src.find(';');
+        }
+        bool expected[4] = { true, true, false, true };
+        for (int i = 0; i < 4; i++) {
+            start = std::chrono::steady_clock::now();
+            bool ok = i == 0 ? parser.edit(at, 0, " ") : i == 1 ? parser.edit(at, 1, "") :
+                      i == 2 ? parser.edit(at, 1, "") : parser.edit(at, 0, ";");
+            us.push_back(elapsedMs(start) * 1000);
+            relexed += parser.relexedBytes();
+            wrong = wrong || ok != expected[i];
+        }
+    }
+    if (wrong || parser.text() != src) {
+        fprintf(stderr, "incremental parse disagrees\n");
+        return 1;
+    }
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (size_t i = 0; i < us.size(); i++) {
+        sum += us[i];
+    }
+    printf("%d edits: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us, %zu bytes re-lexed each\n",
+           edits, sum / us.size(), us[us.size() / 2], us[us.size() * 99 / 100], us.back(), relexed / edits);
+    printf("speedup over a full parse: %.0fx at the mean\n", full * 1000 / (sum / us.size()));
+    return 0;
+}
+
+// The stack of maps a scoped symbol table is usually built as, for
+// comparison with ScopedSymbols.
+class MapScopes {
+private:
+    std::vector<std::map<uint32_t, uint32_t> > scopes;
+
+public:
+    void open() { scopes.push_back(std::map<uint32_t, uint32_t>()); }
+    void close() { scopes.pop_back(); }
+    bool declare(uint32_t sym, uint32_t value) { return scopes.back().insert(std::make_pair(sym, value)).second; }
+    bool find(uint32_t sym, uint32_t& value) const {
+        for (size_t i = scopes.size(); i > 0; i--) {
+            std::map<uint32_t, uint32_t>::const_iterator it = scopes[i - 1].find(sym);
+            if (it != scopes[i - 1].end()) {
+                value = it->second;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Declares and looks up every variable of a statement or expression in
+// table; returns how many were not found or declared twice.
+template <class Table>
+static size_t walkScopes(Ast& ast, uint32_t id, Table& table) {
+    if (id == AST_NONE) {
+        return 0;
+    }
+    size_t errors = 0;
+    uint32_t value;
+    const AstNode& n = ast.node(id);
+    switch (Ast::kind(id)) {
+    case AST_BLOCK:
+        table.open();
+        for (uint32_t s = n.a; s != AST_NONE; s = ast.node(s).next) {
+            errors += walkScopes(ast, s, table);
+        }
+        table.close();
+        break;
+    case AST_DECL:
+        for (uint32_t v = n.a; v != AST_NONE; v = ast.node(v).next) {
+            errors += walkScopes(ast, v, table);
+        }
+        break;
+    case AST_VAR:
+        errors += !table.declare(n.a, id);
+        errors += walkScopes(ast, n.b, table);
+        break;
+    case AST_ASSIGN:
+        errors += !table.find(n.a, value);
+        errors += walkScopes(ast, n.b, table);
+        break;
+    case AST_NAME:
+        errors += !table.find(n.a, value);
+        break;
+    case AST_CALL:
+        for (uint32_t arg = n.b; arg != AST_NONE; arg = ast.node(arg).next) {
+            errors += walkScopes(ast, arg, table);
+        }
+        break;
+    case AST_NUMBER:
+        break;
+    default:
+        errors += walkScopes(ast, n.a, table) + walkScopes(ast, n.b, table) + walkScopes(ast, n.c, table);
+        break;
+    }
+    return errors;
+}
+
+template <class Table>
+static double timeScopes(Ast& ast, int runs, size_t* errors) {
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Table table;
+        *errors = 0;
+        for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+            const AstNode& func = ast.node(f);
+            table.open();
+            for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+                *errors += !table.declare(ast.node(p).a, p);
+            }
+            *errors += walkScopes(ast, func.c, table);
+            table.close();
+        }
+        double ms = elapsedMs(start);
+        best = ms < best ? ms : best;
+    }
+    return best;
+}
+
+// The scope check on f18_many_variables.c, its syntax errors mended and
+// the body of main repeated in blocks of its own up to the given number of
+// declarations. The two tables are timed through the same walk; the check
+// itself walks without recursing.
+static int benchScopes(int argc, char** argv) {
+    const char* path = argc > 0 ? argv[0] : "parser_testcases/functional/f18_many_variables.c";
+    size_t declarations = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+    const int runs = 5;
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    size_t mend = text.find("int v1 = ;");
+    size_t paren = text.find("(x < 0 {");
+    size_t body = text.find("int main() {\n");
+    if (mend == std::string::npos || paren == std::string::npos || body == std::string::npos) {
+        fprintf(stderr, "%s is not the expected program\n", path);
+        return 1;
+    }
+    text.replace(mend, 10, "int v1 = 101;");
+    text.replace(paren, 8, "(x < 0) {");
+    body = text.find("int main() {\n") + 13;
+    std::string block = "{\n" + text.substr(body, text.rfind('}') - body) + "}\n";
+    size_t perBlock = 0;
+    for (size_t p = block.find("int "); p != std::string::npos; p = block.find("int ", p + 1)) {
+        perBlock++;
+    }
+    std::string src = text.substr(0, body);
+    for (size_t n = 0; n < declarations; n += perBlock) {
+        src += block;
+    }
+    src += "}\n";
+
+    Ast tree;
+    Parser parser(src.data(), src.size());
+    if (!parser.parse(&tree)) {
+        fprintf(stderr, "program was rejected\n");
+        return 1;
+    }
+    size_t uses = tree.count(AST_NAME) + tree.count(AST_ASSIGN);
+    printf("source: %.1f MB, %u declarations, %zu uses\n", src.size() / 1048576.0, tree.count(AST_VAR), uses);
+
+    size_t flatErrors, mapErrors;
+    double flat = timeScopes<ScopedSymbols>(tree, runs, &flatErrors);
+    double maps = timeScopes<MapScopes>(tree, runs, &mapErrors);
+    double check = 1e30;
+    std::vector<SemanticError> errors;
+    for (int r = 0; r < runs; r++) {
+        errors.clear();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ScopeChecker checker;
+        checker.check(tree, errors);
+        double ms = elapsedMs(start);
+        check = ms < check ? ms : check;
+    }
+    if (flatErrors != 0 || mapErrors != 0 || !errors.empty()) {
+        fprintf(stderr, "scope errors in a valid program\n");
+        return 1;
+    }
+    double names = tree.count(AST_VAR) + uses;
+    printf("stack of maps  %8.2f ms %6.1f ns per name\n", maps, maps * 1e6 / names);
+    printf("flat + undo    %8.2f ms %6.1f ns per name  %.1fx\n", flat, flat * 1e6 / names, maps / flat);
+    printf("ScopeChecker   %8.2f ms %6.1f ns per name\n", check, check * 1e6 / names);
+    return 0;
+}
+
+// What running a program usually starts as: a recursive walk over the tree
+// with a stack of maps for the variables, for comparison with the VM. It
+// only handles what fibonacci needs: no loops.
+class TreeWalker {
+private:
+    Ast& ast;
+    std::map<uint32_t, uint32_t> functions;
+    std::vector<std::map<uint32_t, int32_t> > scopes;
+    bool returning;
+    int32_t returned;
+
+    int32_t eval(uint32_t id) {
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_NUMBER:
+            return (int32_t)n.a;
+        case AST_NAME:
+            for (size_t i = scopes.size(); i > 0; i--) {
+                std::map<uint32_t, int32_t>::iterator it = scopes[i - 1].find(n.a);
+                if (it != scopes[i - 1].end()) {
+                    return it->second;
+                }
+            }
+            return 0;
+        case AST_CALL: {
+            std::vector<int32_t> args;
+            for (uint32_t a = n.b; a != AST_NONE; a = ast.node(a).next) {
+                args.push_back(eval(a));
+            }
+            return call(n.a, args);
+        }
+        default:
+            break;
+        }
+        int32_t x = eval(n.a);
+        int32_t y = eval(n.b);
+        switch (n.op) {
+        case PLUS: return (int32_t)((uint32_t)x + (uint32_t)y);
+        case MINUS: return (int32_t)((uint32_t)x - (uint32_t)y);
+        case LESS_EQUAL: return x <= y;
+        default: return 0;
+        }
+    }
+
+    void exec(uint32_t id) {
+        if (id == AST_NONE || returning) {
+            return;
+        }
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK:
+            scopes.push_back(std::map<uint32_t, int32_t>());
+            for (uint32_t s = n.a; s != AST_NONE && !returning; s = ast.node(s).next) {
+                exec(s);
+            }
+            scopes.pop_back();
+            break;
+        case AST_IF:
+            exec(eval(n.a) ? n.b : n.c);
+            break;
+        case AST_RETURN:
+            returned = eval(n.a);
+            returning = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    explicit TreeWalker(Ast& tree) : ast(tree), returning(false), returned(0) {
+        for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+            functions[ast.node(f).a] = f;
+        }
+    }
+
+    int32_t call(uint32_t sym, const std::vector<int32_t>& args) {
+        const AstNode& func = ast.node(functions[sym]);
+        scopes.push_back(std::map<uint32_t, int32_t>());
+        size_t i = 0;
+        for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+            scopes.back()[ast.node(p).a] = args[i++];
+        }
+        exec(func.c);
+        scopes.pop_back();
+        returning = false;
+        return returned;
+    }
+};
+
+// Recursive fibonacci from f20_comprehensive.c on the bytecode VM, under
+// each dispatch, on the tree walker and as native code.
+static int benchRun(int argc, char** argv) {
+    int n = argc > 0 ? atoi(argv[0]) : 27;
+    const char* path = argc > 1 ? argv[1] : "parser_testcases/functional/f20_comprehensive.c";
+    const int runs = 3;
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    size_t begin = text.find("int fibonacci(int n) {");
+    size_t end = text.find("\n}\n", begin);
+    if (begin == std::string::npos || end == std::string::npos) {
+        fprintf(stderr, "%s is not the expected program\n", path);
+        return 1;
+    }
+    std::string src = text.substr(begin, end + 3 - begin) + "int main() {\n    return fibonacci(" +
+                      std::to_string(n) + ");\n}\n";
+
+    Ast tree;
+    Parser parser(src.data(), src.size());
+    parser.checkScopes();
+    parser.checkCalls();
+    BytecodeProgram program;
+    BytecodeCompiler compiler;
+    std::string err;
+    if (!parser.parse(&tree) || !compiler.compile(tree, parser.callGraph(), program, err)) {
+        fprintf(stderr, "program was rejected\n");
+        return 1;
+    }
+    size_t insns = 0;
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        insns += program.functions[f].code.size();
+    }
+    // fibonacci(n) makes 2 fib(n + 1) - 1 calls.
+    double a = 1, b = 1;
+    for (int i = 2; i <= n; i++) {
+        double c = a + b;
+        a = b;
+        b = c;
+    }
+    double calls = 2 * b - 1;
+    printf("fibonacci(%d): %.0f calls, %zu instructions of bytecode\n", n, calls, insns);
+
+    int32_t expected = 0;
+    double walk = 1e30;
+    for (int r = 0; r < runs; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        TreeWalker walker(tree);
+        expected = walker.call(SYM_MAIN, std::vector<int32_t>());
+        double ms = elapsedMs(start);
+        walk = ms < walk ? ms : walk;
+    }
+    printf("tree walker     %9.1f ms %6.1f ns per call\n", walk, walk * 1e6 / calls);
+    for (int d = VM_SWITCH; d <= VM_THREADED; d++) {
+        Vm vm;
+        if (!vm.setDispatch((VmDispatch)d)) {
+            continue;
+        }
+        double best = 1e30;
+        for (int r = 0; r < runs; r++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int32_t result;
+            if (!vm.run(program, result, err) || result != expected) {
+                fprintf(stderr, "VM and tree walker disagree\n");
+                return 1;
+            }
+            double ms = elapsedMs(start);
+            best = ms < best ? ms : best;
+        }
+        printf("VM, %-8s    %9.1f ms %6.1f ns per call  %.1fx\n", vmDispatchName((VmDispatch)d), best,
+               best * 1e6 / calls, walk / best);
+    }
+    if (!nativeSupported()) {
+        return 0;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    NativeCompiler native;
+    NativeCode code;
+    if (!native.compile(program, code, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+    double compileMs = elapsedMs(start);
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        start = std::chrono::steady_clock::now();
+        int32_t result;
+        if (!code.run(result, err) || result != expected) {
+            fprintf(stderr, "native code and tree walker disagree\n");
+            return 1;
+        }
+        double ms = elapsedMs(start);
+        best = ms < best ? ms : best;
+    }
+    printf("native          %9.1f ms %6.1f ns per call  %.1fx (compiled in %.3f ms)\n", best, best * 1e6 / calls,
+           walk / best, compileMs);
+    return 0;
+}
+
+// SSA form on every accepted program of the corpus: instructions before and
+// after the passes, bytecode before and after, and the time each pass takes
+// per 1000 source lines, averaged over runs.
+static int benchOpt(int argc, char** argv) {
+    std::string dir = argc > 0 ? argv[0] : "parser_testcases/functional";
+    int runs = argc > 1 ? atoi(argv[1]) : 200;
+    std::vector<std::string> files;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name.size() > 2 && name.compare(name.size() - 2, 2, ".c") == 0) {
+                files.push_back(name);
+            }
+        }
+        closedir(d);
+    }
+    std::sort(files.begin(), files.end());
+    PassManager passes;
+    passes.addStandard();
+    double buildMs = 0, lowerMs = 0;
+    size_t lines = 0, before = 0, after = 0, codeBefore = 0, codeAfter = 0;
+    printf("%-32s %6s %8s %8s %10s %10s\n", "", "lines", "IR", "IR opt", "bytecode", "bytecode opt");
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string src = readFile((dir + "/" + files[i]).c_str());
+        Ast tree;
+        Parser parser(src.data(), src.size());
+        parser.checkScopes();
+        parser.checkCalls();
+        BytecodeProgram direct;
+        BytecodeCompiler compiler;
+        std::string err;
+        if (!parser.parse(&tree) || !compiler.compile(tree, parser.callGraph(), direct, err)) {
+            continue;
+        }
+        size_t n = std::count(src.begin(), src.end(), '\n');
+        size_t built = 0, optimized = 0, lowered = 0, compiled = 0;
+        for (size_t f = 0; f < direct.functions.size(); f++) {
+            compiled += direct.functions[f].code.size();
+        }
+        for (int r = 0; r < runs; r++) {
+            IrProgram ir;
+            IrBuilder builder;
+            BytecodeProgram program;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (!builder.build(tree, parser.callGraph(), ir, err)) {
+                fprintf(stderr, "%s: %s\n", files[i].c_str(), err.c_str());
+                return 1;
+            }
+            buildMs += elapsedMs(start);
+            built = ir.size();
+            if (!passes.run(ir, err)) {
+                fprintf(stderr, "%s: %s\n", files[i].c_str(), err.c_str());
+                return 1;
+            }
+            optimized = ir.size();
+            start = std::chrono::steady_clock::now();
+            if (!lowerIr(ir, program, err)) {
+                fprintf(stderr, "%s: %s\n", files[i].c_str(), err.c_str());
+                return 1;
+            }
+            lowerMs += elapsedMs(start);
+            lowered = 0;
+            for (size_t f = 0; f < program.functions.size(); f++) {
+                lowered += program.functions[f].code.size();
+            }
+        }
+        printf("%-32s %6zu %8zu %8zu %10zu %10zu\n", files[i].c_str(), n, built, optimized, compiled, lowered);
+        lines += n;
+        before += built;
+        after += optimized;
+        codeBefore += compiled;
+        codeAfter += lowered;
+    }
+    if (lines == 0) {
+        fprintf(stderr, "no accepted programs in %s\n", dir.c_str());
+        return 1;
+    }
+    printf("%-32s %6zu %8zu %8zu %10zu %10zu\n", "total", lines, before, after, codeBefore, codeAfter);
+    printf("IR instructions %.1f%% fewer, bytecode %.1f%% fewer than without SSA form\n",
+           100.0 * ((double)before - after) / before, 100.0 * ((double)codeBefore - codeAfter) / codeBefore);
+    double per = 1000.0 / lines / runs;
+    printf("ms per 1000 lines: build %.3f", buildMs * per);
+    for (int p = 0; p < IR_PASS_COUNT; p++) {
+        printf(", %s %.3f", irPassName((IrPass)p), passes.milliseconds((IrPass)p) * per);
+    }
+    printf(", lower %.3f\n", lowerMs * per);
+    return 0;
+}
+
+// The function of the corpus that starts with header, up to its closing
+// brace; empty if there is none.
+static std::string functionText(const std::string& text, const char* header) {
+    size_t begin = text.find(header);
+    size_t end = text.find("\n}\n", begin);
+    if (begin == std::string::npos || end == std::string::npos) {
+        return std::string();
+    }
+    return text.substr(begin, end + 3 - begin);
+}
+
+// The fewest registers the VM can run the program in: the limit is halved
+// between one that fails and one that does not.
+static size_t vmStackNeeded(const BytecodeProgram& program) {
+    size_t fails = 0, runs = Vm::DEFAULT_MAX_STACK;
+    while (runs - fails > 1) {
+        size_t mid = fails + (runs - fails) / 2;
+        Vm vm;
+        vm.setMaxStack(mid);
+        int32_t result;
+        std::string err;
+        if (vm.run(program, result, err)) {
+            runs = mid;
+        } else {
+            fails = mid;
+        }
+    }
+    return runs;
+}
+
+// The same for native code, in pages of stack.
+static size_t nativeStackNeeded(NativeCode& code) {
+    const size_t page = 4096;
+    size_t fails = 0, runs = NativeCode::DEFAULT_STACK / page;
+    while (runs - fails > 1) {
+        size_t mid = fails + (runs - fails) / 2;
+        code.setStackSize(mid * page);
+        int32_t result;
+        std::string err;
+        if (code.run(result, err)) {
+            runs = mid;
+        } else {
+            fails = mid;
+        }
+    }
+    code.setStackSize(NativeCode::DEFAULT_STACK);
+    return runs * page;
+}
+
+// Recursive and call-heavy programs made from functions of the corpus, run
+// as the bytecode compiler emits them, through SSA form with the passes
+// that work within a function, and with tail-recursion and inlining added:
+// time and the least stack each needs, on the VM and as native code.
+static int benchCalls(int argc, char** argv) {
+    const char* dir = argc > 0 ? argv[0] : "parser_testcases/functional";
+    const int runs = 3;
+    std::string f20 = readFile((std::string(dir) + "/f20_comprehensive.c").c_str());
+    std::string f09 = readFile((std::string(dir) + "/f09_recursion.c").c_str());
+    std::string fib = functionText(f20, "int fibonacci(int n) {");
+    std::string gcd = functionText(f20, "int gcd(int a, int b) {");
+    std::string fact = functionText(f09, "int fact(int n) {");
+    std::string helpers;
+    bool found = !fib.empty() && !gcd.empty() && !fact.empty();
+    const char* names[] = { "func1(", "func2(", "func3(", "func4(", "func5(", "func6(", "func7(", "nestedCalls(" };
+    for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+        std::string f = functionText(f20, (std::string("int ") + names[k]).c_str());
+        found = found && !f.empty();
+        helpers += f;
+    }
+    if (!found) {
+        fprintf(stderr, "%s does not hold the expected programs\n", dir);
+        return 1;
+    }
+    struct Case {
+        const char* name;
+        std::string src;
+    };
+    Case cases[] = {
+        { "fibonacci(27)", fib + "int main() {\n    return fibonacci(27);\n}\n" },
+        { "gcd, 400 x 400", gcd + "int main() {\n    int s = 0;\n    int i = 1;\n    while (i <= 400) {\n"
+                                  "        int j = 1;\n        while (j <= 400) {\n"
+                                  "            s = s + gcd(i, j);\n            j = j + 1;\n        }\n"
+                                  "        i = i + 1;\n    }\n    return s;\n}\n" },
+        { "fact(1000000)", fact + "int main() {\n    return fact(1000000);\n}\n" },
+        { "nestedCalls x 100000", helpers + "int main() {\n    int s = 0;\n    int i = 0;\n"
+                                            "    while (i < 100000) {\n"
+                                            "        s = s + nestedCalls(i, 1, 2, i, 4, 5, 6, i, 8, 9);\n"
+                                            "        i = i + 1;\n    }\n    return s;\n}\n" },
+    };
+    const char* ways[] = { "bytecode", "ssa", "ssa+ipo" };
+    printf("%-22s %-9s %10s %14s %10s %14s\n", "", "", "VM ms", "VM stack", "native ms", "native stack");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const std::string& src = cases[c].src;
+        Ast tree;
+        Parser parser(src.data(), src.size());
+        parser.checkScopes();
+        parser.checkCalls();
+        if (!parser.parse(&tree)) {
+            fprintf(stderr, "%s was rejected\n", cases[c].name);
+            return 1;
+        }
+        int32_t expected = 0;
+        for (int w = 0; w < 3; w++) {
+            BytecodeProgram program;
+            std::string err;
+            if (w == 0) {
+                BytecodeCompiler compiler;
+                if (!compiler.compile(tree, parser.callGraph(), program, err)) {
+                    fprintf(stderr, "%s\n", err.c_str());
+                    return 1;
+                }
+            } else {
+                IrProgram ir;
+                IrBuilder builder;
+                PassManager passes;
+                if (w == 1) {
+                    passes.add(PASS_SIMPLIFY_CFG);
+                    passes.add(PASS_SCCP);
+                    passes.add(PASS_SIMPLIFY_CFG);
+                    passes.add(PASS_GVN);
+                    passes.add(PASS_DCE);
+                } else {
+                    passes.addStandard();
+                }
+                if (!builder.build(tree, parser.callGraph(), ir, err) || !passes.run(ir, err) ||
+                    !lowerIr(ir, program, err)) {
+                    fprintf(stderr, "%s\n", err.c_str());
+                    return 1;
+                }
+            }
+            double vmMs = 1e30;
+            for (int r = 0; r < runs; r++) {
+                Vm vm;
+                int32_t result;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                if (!vm.run(program, result, err)) {
+                    fprintf(stderr, "%s: %s\n", cases[c].name, err.c_str());
+                    return 1;
+                }
+                double ms = elapsedMs(start);
+                vmMs = ms < vmMs ? ms : vmMs;
+                if (w == 0) {
+                    expected = result;
+                } else if (result != expected) {
+                    fprintf(stderr, "%s: %s gives %d, bytecode %d\n", cases[c].name, ways[w], result, expected);
+                    return 1;
+                }
+            }
+            printf("%-22s %-9s %10.1f %12zu B", w == 0 ? cases[c].name : "", ways[w], vmMs,
+                   vmStackNeeded(program) * 4);
+            if (nativeSupported()) {
+                NativeCompiler native;
+                NativeCode code;
+                if (!native.compile(program, code, err)) {
+                    fprintf(stderr, "%s\n", err.c_str());
+                    return 1;
+                }
+                double nativeMs = 1e30;
+                for (int r = 0; r < runs; r++) {
+                    int32_t result;
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    if (!code.run(result, err) || result != expected) {
+                        fprintf(stderr, "%s: native code and the VM disagree\n", cases[c].name);
+                        return 1;
+                    }
+                    double ms = elapsedMs(start);
+                    nativeMs = ms < nativeMs ? ms : nativeMs;
+                }
+                printf(" %10.1f %12zu B", nativeMs, nativeStackNeeded(code));
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+// Hardware cache-miss counter for this thread, via perf_event_open. Many
+// containers and VMs do not expose it; ok() is false there.
+class MissCounter {
+private:
+    int fd;
+
+public:
+    MissCounter() : fd(-1) {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    ~MissCounter() {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+    bool ok() const { return fd >= 0; }
+    void start() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    long long stop() {
+        long long misses = -1;
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+                misses = -1;
+            }
+        }
+#endif
+        return misses;
+    }
+};
+
+static void printMisses(const char* what, double ms, long long misses, size_t tokens) {
+    if (misses >= 0) {
+        printf("  %-26s %8.1f ms  %12lld cache misses  %6.3f misses/token\n", what, ms,
+               misses, (double)misses / tokens);
+    } else {
+        printf("  %-26s %8.1f ms  cache misses n/a\n", what, ms);
+    }
+}
+
+// vector<Token> against TokenBuffer on a file repeated many times: memory
+// per token, the cost of filling each, and a pass that touches every
+// token's type and text the way the parser does. (Parsing the repeated
+// file is not timed: it is dominated by the duplicate-function errors.)
+static int benchTokens(int argc, char** argv) {
+    const char* path = argc > 0 ? argv[0] : "parser_testcases/functional/f20_comprehensive.c";
+    int scale = argc > 1 ? atoi(argv[1]) : 10000;
+    std::string one = readFile(path);
+    if (one.empty()) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+    if (one[one.size() - 1] != '\n') {
+        one += '\n';
+    }
+    std::string src;
+    src.reserve(one.size() * scale);
+    for (int i = 0; i < scale; i++) {
+        src += one;
+    }
+    MissCounter counter;
+    unsigned long long sink = 0;
+    printf("%s x %d: %.1f MB\n", path, scale, src.size() / 1048576.0);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    counter.start();
+    std::vector<Token> fat;
+    {
+        // The old getAllTokens(): push_back with no capacity estimate.
+        Lexer lexer(src.data(), src.size());
+        Token t;
+        do {
+            t = lexer.nextToken();
+            fat.push_back(t);
+        } while (t.type != END_OF_FILE);
+    }
+    long long misses = counter.stop();
+    double ms = elapsedMs(start);
+    size_t count = fat.size();
+    printf("vector<Token>: %zu tokens, %.1f bytes/token (%d-byte Token)\n", count,
+           (double)fat.capacity() * sizeof(Token) / count, (int)sizeof(Token));
+    printMisses("lex", ms, misses, count);
+    start = std::chrono::steady_clock::now();
+    counter.start();
+    for (size_t i = 0; i < fat.size(); i++) {
+        sink += fat[i].type + fat[i].value.size + (unsigned char)fat[i].value[0];
+    }
+    misses = counter.stop();
+    printMisses("walk", elapsedMs(start), misses, count);
+    std::vector<Token>().swap(fat);
+
+    TokenBuffer tokens;
+    start = std::chrono::steady_clock::now();
+    counter.start();
+    tokens.lex(src.data(), src.size());
+    misses = counter.stop();
+    ms = elapsedMs(start);
+    printf("TokenBuffer: %zu tokens, %.1f bytes/token\n", tokens.size(),
+           (double)tokens.bytesUsed() / tokens.size());
+    printMisses("lex", ms, misses, count);
+    start = std::chrono::steady_clock::now();
+    counter.start();
+    for (TokenCursor c(tokens); c.type() != END_OF_FILE; c.next()) {
+        StrView text = c.text();
+        sink += c.type() + text.size + (unsigned char)text[0];
+    }
+    misses = counter.stop();
+    printMisses("walk", elapsedMs(start), misses, count);
+    return sink == 0 ? 1 : 0;
+}
+
+static int usage() {
+    fprintf(stderr, "usage: parser_bench alloc [MB]\n"
+                    "       parser_bench scan [MB]\n"
+                    "       parser_bench engines [MB]\n"
+                    "       parser_bench keywords [file] [runs]\n"
+                    "       parser_bench parallel [MB]\n"
+                    "       parser_bench tokens [file] [copies]\n"
+                    "       parser_bench ast [MB]\n"
+                    "       parser_bench expr [file] [runs]\n"
+                    "       parser_bench stack [MB]\n"
+                    "       parser_bench errors [lines]\n"
+                    "       parser_bench functions [count]\n"
+                    "       parser_bench incremental [lines]\n"
+                    "       parser_bench scopes [file] [declarations]\n"
+                    "       parser_bench run [n] [file]\n"
+                    "       parser_bench opt [dir] [runs]\n"
+                    "       parser_bench calls [dir]\n"
+                    "       parser_bench gen [MB] > file\n");
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        return usage();
+    }
+    std::string mode = argv[1];
+    if (mode == "alloc") {
+        return benchAlloc(argc - 2, argv + 2);
+    }
+    if (mode == "scan") {
+        return benchScan(argc - 2, argv + 2);
+    }
+    if (mode == "engines") {
+        return benchEngines(argc - 2, argv + 2);
+    }
+    if (mode == "parallel") {
+        return benchParallel(argc - 2, argv + 2);
+    }
+    if (mode == "expr") {
+        return benchExpr(argc - 2, argv + 2);
+    }
+    if (mode == "ast") {
+        return benchAst(argc - 2, argv + 2);
+    }
+    if (mode == "stack") {
+        return benchStack(argc - 2, argv + 2);
+    }
+    if (mode == "functions") {
+        return benchFunctions(argc - 2, argv + 2);
+    }
+    if (mode == "scopes") {
+        return benchScopes(argc - 2, argv + 2);
+    }
+    if (mode == "run") {
+        return benchRun(argc - 2, argv + 2);
+    }
+    if (mode == "opt") {
+        return benchOpt(argc - 2, argv + 2);
+    }
+    if (mode == "calls") {
+        return benchCalls(argc - 2, argv + 2);
+    }
+    if (mode == "incremental") {
+        return benchIncremental(argc - 2, argv + 2);
+    }
+    if (mode == "errors") {
+        return benchErrors(argc - 2, argv + 2);
+    }
+    if (mode == "tokens") {
+        return benchTokens(argc - 2, argv + 2);
+    }
+    if (mode == "gen") {
+        return benchGen(argc - 2, argv + 2);
+    }
+    if (mode == "keywords") {
+        return benchKeywords(argc - 2, argv + 2);
+    }
+    return usage();
+}
@@ -0,0 +1,392 @@
+#include "bytecode.h"
+#include "lexer.h"
+#include <algorithm>
+
+const size_t BytecodeCompiler::MAX_NESTING;
+
+// Operands are 16 bits wide.
+static const uint32_t OPERAND_LIMIT = 0xFFFF;
+
+BytecodeCompiler::BytecodeCompiler()
+    : ast(NULL), graph(NULL), fn(NULL), locals(0), top(0), nesting(0), failure(NULL) {}
+
+void BytecodeCompiler::emit(Opcode op, uint32_t a, uint32_t b, uint32_t c) {
+    if (fn->code.size() >= OPERAND_LIMIT) {
+        failure = "Function too large to run";
+        return;
+    }
+    Insn insn = { (uint16_t)op, (uint16_t)a, (uint16_t)b, (uint16_t)c };
+    fn->code.push_back(insn);
+}
+
+void BytecodeCompiler::emitConstant(uint32_t a, uint32_t value) {
+    emit(OP_LOADK, a, value & 0xFFFF, value >> 16);
+}
+
+void BytecodeCompiler::patch(const std::vector<size_t>& jumps, uint32_t target) {
+    for (size_t i = 0; i < jumps.size(); i++) {
+        if (jumps[i] < fn->code.size()) {
+            fn->code[jumps[i]].c = (uint16_t)target;
+        }
+    }
+}
+
+uint32_t BytecodeCompiler::temp() {
+    uint32_t r = top++;
+    if (top > OPERAND_LIMIT) {
+        failure = "Function too large to run";
+        top = OPERAND_LIMIT;
+        r = 0;
+    }
+    fn->registers = std::max(fn->registers, top);
+    return r;
+}
+
+// Counts one more level of nesting; false once it is too deep or anything
+// else has failed.
+bool BytecodeCompiler::enter() {
+    if (++nesting > MAX_NESTING && failure == NULL) {
+        failure = "Program nested too deeply to run";
+    }
+    return failure == NULL;
+}
+
+static Opcode binaryOpcode(uint32_t op) {
+    switch (op) {
+    case PLUS: return OP_ADD;
+    case MINUS: return OP_SUB;
+    case MULTIPLY: return OP_MUL;
+    case DIVIDE: return OP_DIV;
+    case MODULO: return OP_MOD;
+    case LESS: return OP_LT;
+    case LESS_EQUAL: return OP_LE;
+    case GREATER: return OP_GT;
+    case GREATER_EQUAL: return OP_GE;
+    case EQUAL: return OP_EQ;
+    default: return OP_NE;
+    }
+}
+
+static bool isComparison(uint32_t op) {
+    return op == LESS || op == LESS_EQUAL || op == GREATER || op == GREATER_EQUAL || op == EQUAL ||
+           op == NOT_EQUAL;
+}
+
+// The jump taken when a comparison holds, or when it does not.
+static Opcode comparisonJump(uint32_t op, bool when) {
+    switch (op) {
+    case LESS: return when ? OP_JLT : OP_JGE;
+    case LESS_EQUAL: return when ? OP_JLE : OP_JGT;
+    case GREATER: return when ? OP_JGT : OP_JLE;
+    case GREATER_EQUAL: return when ? OP_JGE : OP_JLT;
+    case EQUAL: return when ? OP_JEQ : OP_JNE;
+    default: return when ? OP_JNE : OP_JEQ;
+    }
+}
+
+// Emits jumps, to be patched, that are taken when the condition's truth is
+// when and fall through otherwise. && and || become jumps, so a condition
+// never materializes its value.
+void BytecodeCompiler::branch(uint32_t id, bool when, std::vector<size_t>& jumps) {
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        uint32_t saved = top;
+        AstKind kind = Ast::kind(id);
+        if (kind == AST_BINARY && (n.op == AND || n.op == OR)) {
+            if ((n.op == AND) != when) {
+                // false && ..., true || ...: either side decides.
+                branch(n.a, when, jumps);
+                branch(n.b, when, jumps);
+            } else {
+                std::vector<size_t> skip;
+                branch(n.a, !when, skip);
+                branch(n.b, when, jumps);
+                patch(skip, here());
+            }
+        } else if (kind == AST_BINARY && isComparison(n.op)) {
+            uint32_t l = expression(n.a);
+            uint32_t r = expression(n.b);
+            jumps.push_back(fn->code.size());
+            emit(comparisonJump(n.op, when), l, r, 0);
+        } else if (kind == AST_UNARY && n.op == NOT) {
+            branch(n.a, !when, jumps);
+        } else if (kind == AST_NUMBER) {
+            if ((n.a != 0) == when) {
+                jumps.push_back(fn->code.size());
+                emit(OP_JMP, 0, 0, 0);
+            }
+        } else {
+            uint32_t r = expression(id);
+            jumps.push_back(fn->code.size());
+            emit(when ? OP_JNZ : OP_JZ, r, 0, 0);
+        }
+        top = saved;
+    }
+    nesting--;
+}
+
+// The register holding the value of an expression: a variable's own, or a
+// new temporary.
+uint32_t BytecodeCompiler::expression(uint32_t id) {
+    uint32_t r;
+    if (Ast::kind(id) == AST_NAME && names.find(ast->node(id).a, r)) {
+        return r;
+    }
+    r = temp();
+    expressionTo(id, r);
+    return r;
+}
+
+// Computes an expression into dst. dst is only written once every operand
+// has been read, so it may be a variable the expression uses.
+void BytecodeCompiler::expressionTo(uint32_t id, uint32_t dst) {
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        uint32_t saved = top;
+        switch (Ast::kind(id)) {
+        case AST_NUMBER:
+            emitConstant(dst, n.a);
+            break;
+        case AST_NAME: {
+            uint32_t r = 0;
+            names.find(n.a, r);
+            if (r != dst) {
+                emit(OP_MOVE, dst, r, 0);
+            }
+            break;
+        }
+        case AST_UNARY:
+            if (n.op == PLUS) {
+                expressionTo(n.a, dst);
+            } else {
+                emit(n.op == MINUS ? OP_NEG : OP_NOT, dst, expression(n.a), 0);
+            }
+            break;
+        case AST_BINARY:
+            if (n.op == AND || n.op == OR) {
+                std::vector<size_t> no;
+                branch(id, false, no);
+                emitConstant(dst, 1);
+                std::vector<size_t> done(1, fn->code.size());
+                emit(OP_JMP, 0, 0, 0);
+                patch(no, here());
+                emitConstant(dst, 0);
+                patch(done, here());
+            } else {
+                uint32_t l = expression(n.a);
+                uint32_t r = expression(n.b);
+                emit(binaryOpcode(n.op), dst, l, r);
+            }
+            break;
+        case AST_CALL: {
+            uint32_t callee = graph->find(n.a);
+            uint32_t first = top;
+            for (uint32_t arg = n.b; arg != AST_NONE; arg = ast->node(arg).next) {
+                temp();
+            }
+            uint32_t r = first;
+            for (uint32_t arg = n.b; arg != AST_NONE; arg = ast->node(arg).next) {
+                expressionTo(arg, r++);
+            }
+            if (callee == CallGraph::NO_FUNCTION || callee > OPERAND_LIMIT) {
+                failure = callee == CallGraph::NO_FUNCTION ? "Undefined function" : "Program too large to run";
+            }
+            emit(OP_CALL, dst, callee, first);
+            break;
+        }
+        default:
+            break;
+        }
+        top = saved;
+    }
+    nesting--;
+}
+
+void BytecodeCompiler::statements(uint32_t first) {
+    for (uint32_t id = first; id != AST_NONE && failure == NULL; id = ast->node(id).next) {
+        statement(id);
+    }
+}
+
+void BytecodeCompiler::statement(uint32_t id) {
+    if (id == AST_NONE) {
+        return;
+    }
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK: {
+            uint32_t saved = locals;
+            names.open();
+            statements(n.a);
+            names.close();
+            locals = saved;
+            break;
+        }
+        case AST_DECL:
+            for (uint32_t v = n.a; v != AST_NONE; v = ast->node(v).next) {
+                const AstNode& var = ast->node(v);
+                uint32_t r = temp();
+                locals = top;
+                // The initializer sees the names from before the declaration,
+                // never the register it fills.
+                if (var.b != AST_NONE) {
+                    expressionTo(var.b, r);
+                } else {
+                    emitConstant(r, 0);
+                }
+                names.declare(var.a, r);
+            }
+            break;
+        case AST_ASSIGN: {
+            uint32_t r = 0;
+            names.find(n.a, r);
+            expressionTo(n.b, r);
+            break;
+        }
+        case AST_IF: {
+            std::vector<size_t> otherwise;
+            branch(n.a, false, otherwise);
+            statement(n.b);
+            if (n.c != AST_NONE) {
+                std::vector<size_t> done(1, fn->code.size());
+                emit(OP_JMP, 0, 0, 0);
+                patch(otherwise, here());
+                statement(n.c);
+                patch(done, here());
+            } else {
+                patch(otherwise, here());
+            }
+            break;
+        }
+        case AST_WHILE: {
+            // The test goes after the body, so an iteration takes one jump.
+            std::vector<size_t> entry(1, fn->code.size());
+            emit(OP_JMP, 0, 0, 0);
+            uint32_t body = here();
+            loops.push_back(Loop());
+            statement(n.b);
+            uint32_t test = here();
+            patch(entry, test);
+            patch(loops.back().continues, test);
+            std::vector<size_t> again;
+            branch(n.a, true, again);
+            patch(again, body);
+            patch(loops.back().breaks, here());
+            loops.pop_back();
+            break;
+        }
+        case AST_BREAK:
+        case AST_CONTINUE:
+            if (loops.empty()) {
+                // Only a program that skipped the scope check gets here.
+                failure = Ast::kind(id) == AST_BREAK ? "Break outside loop" : "Continue outside loop";
+                break;
+            }
+            (Ast::kind(id) == AST_BREAK ? loops.back().breaks : loops.back().continues).push_back(fn->code.size());
+            emit(OP_JMP, 0, 0, 0);
+            break;
+        case AST_RETURN:
+            emit(OP_RET, expression(n.a), 0, 0);
+            break;
+        case AST_EXPR_STMT:
+            expression(n.a);
+            break;
+        default:
+            break;
+        }
+        top = locals;
+    }
+    nesting--;
+}
+
+bool BytecodeCompiler::compile(Ast& tree, const CallGraph& calls, BytecodeProgram& program, std::string& err) {
+    ast = &tree;
+    graph = &calls;
+    failure = NULL;
+    nesting = 0;
+    program.functions.clear();
+    program.functions.resize(calls.size());
+    program.main = calls.find(SYM_MAIN);
+    for (uint32_t f = 0; f < calls.size() && failure == NULL; f++) {
+        const AstNode& func = tree.node(calls.node(f));
+        fn = &program.functions[f];
+        fn->sym = func.a;
+        fn->params = calls.arity(f);
+        fn->registers = 0;
+        loops.clear();
+        names.open();
+        top = 0;
+        for (uint32_t p = func.b; p != AST_NONE; p = tree.node(p).next) {
+            names.declare(tree.node(p).a, temp());
+        }
+        locals = top;
+        // The body's outermost block shares the parameters' scope.
+        statements(tree.node(func.c).a);
+        uint32_t r = temp();
+        emitConstant(r, 0);
+        emit(OP_RET, r, 0, 0);
+        names.close();
+    }
+    if (failure == NULL && program.main == CallGraph::NO_FUNCTION) {
+        failure = "Missing main function";
+    }
+    if (failure != NULL) {
+        err = failure;
+        return false;
+    }
+    return true;
+}
+
+static const char* const opcodeNames[OP_COUNT] = {
+    "move", "loadk", "add", "sub", "mul", "div", "mod", "lt", "le", "gt", "ge", "eq", "ne", "neg", "not",
+    "jmp", "jz", "jnz", "jlt", "jle", "jgt", "jge", "jeq", "jne", "call", "ret",
+};
+
+void dumpBytecode(const BytecodeProgram& program, SymbolTable& symbols, std::ostream& out) {
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        const BytecodeFunction& fn = program.functions[f];
+        size_t size;
+        const char* name = symbols.text(fn.sym, size);
+        out.write(name, size);
+        out << " (" << fn.params << " params, " << fn.registers << " registers)\n";
+        for (size_t i = 0; i < fn.code.size(); i++) {
+            const Insn& insn = fn.code[i];
+            out << "    " << i << "\t" << opcodeNames[insn.op] << "\t";
+            switch (insn.op) {
+            case OP_LOADK:
+                out << "r" << insn.a << ", " << insn.constant();
+                break;
+            case OP_MOVE:
+            case OP_NEG:
+            case OP_NOT:
+                out << "r" << insn.a << ", r" << insn.b;
+                break;
+            case OP_JMP:
+                out << insn.c;
+                break;
+            case OP_JZ:
+            case OP_JNZ:
+                out << "r" << insn.a << ", " << insn.c;
+                break;
+            case OP_CALL:
+                name = symbols.text(program.functions[insn.b].sym, size);
+                out << "r" << insn.a << ", ";
+                out.write(name, size);
+                out << ", r" << insn.c;
+                break;
+            case OP_RET:
+                out << "r" << insn.a;
+                break;
+            default:
+                if (insn.op >= OP_JLT) {
+                    out << "r" << insn.a << ", r" << insn.b << ", " << insn.c;
+                } else {
+                    out << "r" << insn.a << ", r" << insn.b << ", r" << insn.c;
+                }
+                break;
+            }
+            out << "\n";
+        }
+    }
+}
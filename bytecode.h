@@ -0,0 +1,115 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "ast.h"
+#include "callgraph.h"
+#include "semantic.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Register bytecode for accepted programs. Every function has a frame of
+// 32-bit registers: its parameters first, then its variables, then the
+// temporaries of the statement being run. A call passes its arguments in
+// consecutive registers of the caller, which become the callee's first
+// registers, so nothing is copied.
+//
+// An instruction is 8 bytes: an opcode and three 16-bit operands a, b, c.
+// Registers, jump targets (instruction indexes) and function indexes are
+// operands; a constant takes b and c together.
+enum Opcode {
+    OP_MOVE,        // a = b
+    OP_LOADK,       // a = constant(b, c)
+    OP_ADD,         // a = b + c, and so on for the other operators
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_NEG,         // a = -b
+    OP_NOT,         // a = !b
+    OP_JMP,         // go to c
+    OP_JZ,          // go to c if a == 0
+    OP_JNZ,         // go to c if a != 0
+    OP_JLT,         // go to c if a < b, and so on
+    OP_JLE,
+    OP_JGT,
+    OP_JGE,
+    OP_JEQ,
+    OP_JNE,
+    OP_CALL,        // a = function b called with the registers from c up
+    OP_RET,         // return a
+    OP_COUNT
+};
+
+struct Insn {
+    uint16_t op;
+    uint16_t a, b, c;
+
+    int32_t constant() const { return (int32_t)((uint32_t)b | (uint32_t)c << 16); }
+};
+
+struct BytecodeFunction {
+    uint32_t sym;
+    uint32_t params;
+    uint32_t registers;     // frame size
+    std::vector<Insn> code;
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> functions;   // in definition order
+    uint32_t main;
+};
+
+// Lowers the tree of a program that passed the scope and call checks (see
+// Parser::checkScopes() and checkCalls()) into bytecode. Function indexes
+// are those of graph. False, with a message, if a function needs more
+// registers or instructions than 16-bit operands reach, or nests deeper
+// than MAX_NESTING.
+class BytecodeCompiler {
+private:
+    struct Loop {
+        std::vector<size_t> breaks;     // jumps to patch
+        std::vector<size_t> continues;
+    };
+
+    Ast* ast;
+    const CallGraph* graph;
+    ScopedSymbols names;
+    BytecodeFunction* fn;
+    uint32_t locals;        // registers held by variables in scope
+    uint32_t top;           // first free register
+    std::vector<Loop> loops;
+    size_t nesting;
+    const char* failure;    // NULL until something does not fit
+
+    void emit(Opcode op, uint32_t a, uint32_t b, uint32_t c);
+    void emitConstant(uint32_t a, uint32_t value);
+    uint32_t here() const { return (uint32_t)fn->code.size(); }
+    void patch(const std::vector<size_t>& jumps, uint32_t target);
+    uint32_t temp();
+    bool enter();
+
+    void statement(uint32_t id);
+    void statements(uint32_t first);
+    void expressionTo(uint32_t id, uint32_t dst);
+    uint32_t expression(uint32_t id);
+    void branch(uint32_t id, bool when, std::vector<size_t>& jumps);
+
+public:
+    static const size_t MAX_NESTING = 10000;
+
+    BytecodeCompiler();
+    bool compile(Ast& tree, const CallGraph& calls, BytecodeProgram& program, std::string& err);
+};
+
+// Writes each function's code, one instruction per line.
+void dumpBytecode(const BytecodeProgram& program, SymbolTable& symbols, std::ostream& out);
+
+#endif
@@ -0,0 +1,184 @@
+#include "callgraph.h"
+#include <algorithm>
+
+const uint32_t CallGraph::NO_FUNCTION;
+
+static uint32_t listLength(Ast& ast, uint32_t first) {
+    uint32_t n = 0;
+    for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+        n++;
+    }
+    return n;
+}
+
+static bool bySourceOrder(const SemanticError& x, const SemanticError& y) {
+    return x.offset < y.offset;
+}
+
+void CallGraph::build(Ast& ast, std::vector<SemanticError>& errors) {
+    // Forget the last program's names without touching the rest of the table.
+    for (size_t f = 0; f < functions.size(); f++) {
+        indexOf[functions[f].sym] = NO_FUNCTION;
+    }
+    functions.clear();
+    firstSite.clear();
+    callees.clear();
+    callNodes.clear();
+
+    for (uint32_t id = ast.functions; id != AST_NONE; id = ast.node(id).next) {
+        const AstNode& n = ast.node(id);
+        Function f = { (uint32_t)n.a, id, listLength(ast, n.b), n.offset };
+        if (f.sym >= indexOf.size()) {
+            indexOf.resize(std::max((size_t)f.sym + 1, indexOf.size() * 2), NO_FUNCTION);
+        }
+        if (indexOf[f.sym] == NO_FUNCTION) {
+            indexOf[f.sym] = (uint32_t)functions.size();
+        }
+        functions.push_back(f);
+    }
+
+    // Every parser numbers the calls of a function after those of the
+    // function before, so the caller of a call is the last function to start
+    // before it. Within a function a call is numbered after the calls in its
+    // arguments.
+    size_t firstError = errors.size();
+    uint32_t caller = 0;
+    firstSite.push_back(0);
+    uint32_t calls = ast.count(AST_CALL);
+    for (uint32_t i = 0; i < calls; i++) {
+        const AstNode& call = ast.at(AST_CALL, i);
+        while (caller + 1 < functions.size() && functions[caller + 1].offset <= call.offset) {
+            firstSite.push_back((uint32_t)callees.size());
+            caller++;
+        }
+        uint32_t f = find(call.a);
+        if (f == NO_FUNCTION) {
+            errors.push_back(SemanticError(call.offset, "Undefined function"));
+            continue;
+        }
+        if (listLength(ast, call.b) != functions[f].arity) {
+            errors.push_back(SemanticError(call.offset, "Wrong number of arguments"));
+        }
+        callees.push_back(f);
+        callNodes.push_back(Ast::id(AST_CALL, i));
+    }
+    while (firstSite.size() <= functions.size()) {
+        firstSite.push_back((uint32_t)callees.size());
+    }
+    std::stable_sort(errors.begin() + firstError, errors.end(), bySourceOrder);
+}
+
+// Tarjan's algorithm with the recursion turned into a stack of frames, each
+// a function and the next of its sites to follow.
+void CallGraph::findRecursive(std::vector<bool>& recursive) const {
+    static const uint32_t UNVISITED = 0xFFFFFFFFu;
+    size_t n = functions.size();
+    recursive.assign(n, false);
+    std::vector<uint32_t> order(n, UNVISITED);
+    std::vector<uint32_t> low(n);
+    std::vector<bool> onStack(n, false);
+    std::vector<uint32_t> component;
+    std::vector<std::pair<uint32_t, uint32_t> > frames;
+    uint32_t visited = 0;
+    for (uint32_t root = 0; root < n; root++) {
+        if (order[root] != UNVISITED) {
+            continue;
+        }
+        order[root] = low[root] = visited++;
+        component.push_back(root);
+        onStack[root] = true;
+        frames.push_back(std::make_pair(root, firstSite[root]));
+        while (!frames.empty()) {
+            uint32_t f = frames.back().first;
+            uint32_t site = frames.back().second;
+            if (site < firstSite[f + 1]) {
+                frames.back().second++;
+                uint32_t g = callees[site];
+                if (g == f) {
+                    recursive[f] = true;
+                } else if (order[g] == UNVISITED) {
+                    order[g] = low[g] = visited++;
+                    component.push_back(g);
+                    onStack[g] = true;
+                    frames.push_back(std::make_pair(g, firstSite[g]));
+                } else if (onStack[g]) {
+                    low[f] = std::min(low[f], order[g]);
+                }
+                continue;
+            }
+            frames.pop_back();
+            if (!frames.empty()) {
+                uint32_t parent = frames.back().first;
+                low[parent] = std::min(low[parent], low[f]);
+            }
+            if (low[f] == order[f]) {
+                size_t begin = component.size();
+                while (component[begin - 1] != f) {
+                    begin--;
+                }
+                begin--;
+                bool cycle = component.size() - begin > 1;
+                for (size_t k = begin; k < component.size(); k++) {
+                    onStack[component[k]] = false;
+                    if (cycle) {
+                        recursive[component[k]] = true;
+                    }
+                }
+                component.resize(begin);
+            }
+        }
+    }
+}
+
+void CallGraph::findReachable(uint32_t f, std::vector<bool>& reached) const {
+    reached.assign(functions.size(), false);
+    std::vector<uint32_t> work(1, f);
+    reached[f] = true;
+    while (!work.empty()) {
+        uint32_t g = work.back();
+        work.pop_back();
+        for (uint32_t site = firstSite[g]; site < firstSite[g + 1]; site++) {
+            if (!reached[callees[site]]) {
+                reached[callees[site]] = true;
+                work.push_back(callees[site]);
+            }
+        }
+    }
+}
+
+static void writeName(SymbolTable& symbols, uint32_t sym, std::ostream& out) {
+    size_t size;
+    const char* text = symbols.text(sym, size);
+    out.write(text, size);
+}
+
+void dumpCallGraph(const CallGraph& graph, SymbolTable& symbols, std::ostream& out) {
+    std::vector<bool> recursive;
+    std::vector<bool> reached(graph.size(), false);
+    graph.findRecursive(recursive);
+    uint32_t main = graph.find(SYM_MAIN);
+    if (main != CallGraph::NO_FUNCTION) {
+        graph.findReachable(main, reached);
+    }
+    // The last function each one was listed for, to list it once per line.
+    std::vector<uint32_t> listedFor(graph.size(), CallGraph::NO_FUNCTION);
+    for (uint32_t f = 0; f < graph.size(); f++) {
+        writeName(symbols, graph.name(f), out);
+        out << ":";
+        for (uint32_t site = graph.siteBegin(f); site < graph.siteBegin(f + 1); site++) {
+            uint32_t g = graph.callee(site);
+            if (listedFor[g] != f) {
+                listedFor[g] = f;
+                out << " ";
+                writeName(symbols, graph.name(g), out);
+            }
+        }
+        if (recursive[f]) {
+            out << " [recursive]";
+        }
+        if (!reached[f]) {
+            out << " [unreachable]";
+        }
+        out << "\n";
+    }
+}
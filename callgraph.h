@@ -0,0 +1,68 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "ast.h"
+#include "semantic.h"
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+// The functions of an accepted program and the calls between them. Every
+// function gets a dense index, in definition order, and a table by symbol
+// id finds it from a name, so a call is resolved with one load whether its
+// callee is defined before or after it. The edges are kept in compressed
+// sparse row form: the call sites of function f are sites
+// [siteBegin(f), siteBegin(f + 1)), in the order of their CALL nodes (a call
+// after the calls in its arguments), each the index of the callee and the
+// CALL node. Calls to undefined functions have no edge.
+class CallGraph {
+private:
+    struct Function {
+        uint32_t sym;
+        uint32_t node;      // FUNC
+        uint32_t arity;
+        uint64_t offset;
+    };
+
+    std::vector<Function> functions;
+    std::vector<uint32_t> indexOf;      // by symbol id; NO_FUNCTION if not defined
+    std::vector<uint32_t> firstSite;    // by function, and one past the last
+    std::vector<uint32_t> callees;      // by site
+    std::vector<uint32_t> callNodes;    // by site
+
+public:
+    static const uint32_t NO_FUNCTION = 0xFFFFFFFFu;
+
+    // Builds the graph of an accepted tree in one pass over its functions
+    // and one over its calls, reporting calls to names no function has and
+    // calls with the wrong number of arguments. The errors are appended in
+    // source order.
+    void build(Ast& ast, std::vector<SemanticError>& errors);
+
+    size_t size() const { return functions.size(); }
+    // Index of the function named sym; the first one if there are several.
+    uint32_t find(uint32_t sym) const { return sym < indexOf.size() ? indexOf[sym] : NO_FUNCTION; }
+    uint32_t name(uint32_t f) const { return functions[f].sym; }
+    uint32_t node(uint32_t f) const { return functions[f].node; }
+    uint32_t arity(uint32_t f) const { return functions[f].arity; }
+
+    size_t siteCount() const { return callees.size(); }
+    uint32_t siteBegin(uint32_t f) const { return firstSite[f]; }
+    uint32_t callee(uint32_t site) const { return callees[site]; }
+    uint32_t callNode(uint32_t site) const { return callNodes[site]; }
+
+    // Marks the functions that can call themselves, directly or through
+    // others: those with a call to themselves or in a strongly connected
+    // component of more than one. Iterative, so a chain of any length is
+    // fine.
+    void findRecursive(std::vector<bool>& recursive) const;
+    // Marks the functions reachable from f, f included.
+    void findReachable(uint32_t f, std::vector<bool>& reached) const;
+};
+
+// Writes one line per function: its name, the functions it calls in the
+// order it first calls them, and whether it is recursive or unreachable
+// from main, e.g. "fact: fact [recursive]".
+void dumpCallGraph(const CallGraph& graph, SymbolTable& symbols, std::ostream& out);
+
+#endif
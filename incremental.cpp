@@ -0,0 +1,313 @@
+#include "incremental.h"
+#include "scan.h"
+#include <algorithm>
+
+IncrementalParser::IncrementalParser(const std::string& text)
+    : source(text), addedNewline(false), part("", 0, LEX_CLASSIC, &symbols), whole("", 0, LEX_CLASSIC, &symbols),
+      duplicatedNames(0), uncleanSegments(0), relexed(0), parsed(false) {
+    if (!source.empty() && source[source.size() - 1] != '\n') {
+        source += '\n';
+        addedNewline = true;
+    }
+    // A segment only needs to know whether it parses cleanly.
+    part.failFast();
+}
+
+void IncrementalParser::setMaxErrors(size_t maxErrors) {
+    whole.setMaxErrors(maxErrors);
+}
+
+void IncrementalParser::failFast() {
+    whole.failFast();
+}
+
+void IncrementalParser::useExplicitStack(size_t maxDepth) {
+    part.useExplicitStack(maxDepth);
+    whole.useExplicitStack(maxDepth);
+}
+
+std::string IncrementalParser::text() const {
+    return source.substr(0, source.size() - (addedNewline ? 1 : 0));
+}
+
+size_t IncrementalParser::segmentAt(uint64_t offset) const {
+    size_t lo = 0, hi = segments.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (segments[mid].begin <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Adds a clean segment's definitions to the name counts, or takes them
+// away.
+void IncrementalParser::count(const Segment& s, int delta) {
+    if (!s.clean) {
+        uncleanSegments += delta;
+        return;
+    }
+    for (size_t d = 0; d < s.definitions.size(); d++) {
+        uint32_t sym = s.definitions[d].sym;
+        if (sym >= definitionCount.size()) {
+            definitionCount.resize(sym + 1);
+        }
+        if (delta > 0 && ++definitionCount[sym] == 2) {
+            duplicatedNames++;
+        } else if (delta < 0 && definitionCount[sym]-- == 2) {
+            duplicatedNames--;
+        }
+    }
+}
+
+// A // comment on the last line of [begin, end) would run on past end in
+// the whole text.
+bool IncrementalParser::lineCommentAtEnd(uint64_t begin, uint64_t end) const {
+    for (uint64_t p = end; p > begin && source[p - 1] != '\n'; p--) {
+        if (p - 1 > begin && source[p - 1] == '/' && source[p - 2] == '/') {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Cuts [begin, end) into segments at the functions a parse of it finds.
+// After a function with an error, parsing starts again at the next place
+// that looks like the start of a function, "} int name (", so that one
+// error does not leave the rest of the region unclean.
+void IncrementalParser::parseRegion(uint64_t begin, uint64_t end, std::vector<Segment>& out) {
+    size_t firstOut = out.size();
+    uint64_t pos = begin;
+    while (pos < end) {
+        part.reset(source.data() + pos, end - pos);
+        part.definitions = &found;
+        starts.clear();
+        found.clear();
+        while (part.errors.empty() && !part.check(END_OF_FILE)) {
+            starts.push_back(part.current.offset);
+            if (part.maxDepth != 0) {
+                part.parseFuncDefStack<false>();
+            } else {
+                part.parseFuncDef<false>();
+            }
+        }
+        part.definitions = NULL;
+        bool ok = part.errors.empty() && !part.lexer.endedInComment() &&
+                  (end == source.size() || !lineCommentAtEnd(pos, end));
+
+        // Every function before the failed one is clean.
+        size_t clean = ok ? starts.size() : starts.empty() ? 0 : starts.size() - 1;
+        uint64_t failed = ok ? end : clean == 0 ? pos : pos + starts[clean];
+        if (ok && clean == 0) {
+            out.push_back(Segment(pos, end - pos, true));
+        }
+        size_t d = 0;
+        for (size_t i = 0; i < clean; i++) {
+            uint64_t segmentBegin = i == 0 ? pos : pos + starts[i];
+            Segment s(segmentBegin, pos + starts[i] - segmentBegin, true);
+            uint64_t segmentEnd = i + 1 < clean ? pos + starts[i + 1] : failed;
+            for (; d < found.size() && pos + found[d].offset < segmentEnd; d++) {
+                s.definitions.push_back(Parser::Definition(found[d].sym, pos + found[d].offset - s.begin));
+            }
+            out.push_back(s);
+        }
+        relexed += failed - pos;
+        if (ok) {
+            break;
+        }
+
+        part.reset(source.data() + failed, end - failed);
+        Segment s(failed, part.current.offset, false);
+        uint64_t cut = end;
+        TokenType before[3] = { END_OF_FILE, END_OF_FILE, END_OF_FILE };
+        uint64_t typeOffset = 0;
+        for (Token t = part.current; t.type != END_OF_FILE; t = part.lexer.nextToken()) {
+            if (t.type == LEFT_PAREN && before[0] == IDENTIFIER && (before[1] == INT || before[1] == VOID) &&
+                before[2] == RIGHT_BRACE) {
+                cut = failed + typeOffset;
+                break;
+            }
+            if (t.type == INT || t.type == VOID) {
+                typeOffset = t.offset;
+            }
+            before[2] = before[1];
+            before[1] = before[0];
+            before[0] = t.type;
+        }
+        out.push_back(s);
+        relexed += cut - failed;
+        pos = cut;
+    }
+    for (size_t k = firstOut; k < out.size(); k++) {
+        uint64_t segmentEnd = k + 1 < out.size() ? out[k + 1].begin : end;
+        out[k].lines = countNewlines(source.data() + out[k].begin, source.data() + segmentEnd);
+    }
+}
+
+bool IncrementalParser::parse() {
+    segments.clear();
+    definitionCount.clear();
+    duplicatedNames = 0;
+    uncleanSegments = 0;
+    relexed = 0;
+    parseRegion(0, source.size(), segments);
+    if (segments.empty()) {
+        segments.push_back(Segment(0, 0, true));
+    }
+    for (size_t k = 0; k < segments.size(); k++) {
+        count(segments[k], 1);
+    }
+    parsed = true;
+    check();
+    return whole.errorList().empty();
+}
+
+bool IncrementalParser::edit(size_t offset, size_t removed, const std::string& inserted) {
+    if (!parsed) {
+        parse();
+    }
+    size_t textSize = source.size() - (addedNewline ? 1 : 0);
+    offset = std::min(offset, textSize);
+    removed = std::min(removed, textSize - offset);
+    size_t firstSegment = segmentAt(offset);
+    size_t lastSegment = removed > 0 ? segmentAt(offset + removed - 1) : firstSegment;
+    if (offset + removed == textSize) {
+        // The added newline may come or go.
+        lastSegment = segments.size() - 1;
+    }
+    uint64_t begin = segments[firstSegment].begin;
+    uint64_t end = segmentEnd(lastSegment);
+
+    size_t before = source.size();
+    if (addedNewline) {
+        source.resize(source.size() - 1);
+    }
+    source.replace(offset, removed, inserted);
+    addedNewline = !source.empty() && source[source.size() - 1] != '\n';
+    if (addedNewline) {
+        source += '\n';
+    }
+    uint64_t delta = source.size() - before;   // modulo 2^64
+    end += delta;
+
+    for (size_t k = firstSegment; k <= lastSegment; k++) {
+        count(segments[k], -1);
+    }
+    for (size_t k = lastSegment + 1; k < segments.size(); k++) {
+        segments[k].begin += delta;
+    }
+    std::vector<Segment> fresh;
+    relexed = 0;
+    parseRegion(begin, end, fresh);
+    for (size_t k = 0; k < fresh.size(); k++) {
+        count(fresh[k], 1);
+    }
+    size_t replaced = lastSegment - firstSegment + 1;
+    size_t common = std::min(replaced, fresh.size());
+    for (size_t k = 0; k < common; k++) {
+        std::swap(segments[firstSegment + k], fresh[k]);
+    }
+    if (fresh.size() > replaced) {
+        segments.insert(segments.begin() + firstSegment + replaced, fresh.begin() + replaced, fresh.end());
+    } else {
+        segments.erase(segments.begin() + firstSegment + common, segments.begin() + firstSegment + replaced);
+    }
+    if (segments.empty()) {
+        segments.push_back(Segment(0, 0, true));
+    }
+    check();
+    return whole.errorList().empty();
+}
+
+// Brings the verdict up to date: from the counts if every segment is clean,
+// otherwise by a parse that goes through clean segments by their
+// definitions alone, just as the whole-program parse would, and parses
+// everything else.
+void IncrementalParser::check() {
+    Parser& p = whole;
+    p.reset(source.data(), source.size());
+    if (uncleanSegments == 0 && duplicatedNames == 0 && !definitionCount.empty() &&
+        definitionCount[SYM_MAIN] > 0) {
+        return;
+    }
+
+    // Lines are counted from the segments, not by indexing the whole text.
+    segmentBegins.clear();
+    linesBefore.clear();
+    uint64_t lines = 0;
+    for (size_t k = 0; k < segments.size(); k++) {
+        segmentBegins.push_back(segments[k].begin);
+        linesBefore.push_back(lines);
+        lines += segments[k].lines;
+    }
+    p.lexer.useLineCheckpoints(segmentBegins, linesBefore);
+
+    if (p.current.type == UNKNOWN) {
+        p.error("Lexical error");
+    }
+    if (p.check(END_OF_FILE)) {
+        p.error("Empty program");
+        return;
+    }
+    resumePoints.clear();
+    for (size_t k = 0; k < segments.size(); k++) {
+        if (segments[k].clean && segments[k].begin + segments[k].first < segmentEnd(k)) {
+            resumePoints.push_back(segments[k].begin + segments[k].first);
+        }
+    }
+    bool atEnd = true;
+    bool duplicate = false;
+    size_t k = 0;
+    while (k < segments.size() && !p.stopped) {
+        const Segment& s = segments[k];
+        if (s.clean) {
+            size_t errorCount = p.errors.size();
+            for (size_t d = 0; d < s.definitions.size(); d++) {
+                p.defineFunction(s.definitions[d].sym, s.begin + s.definitions[d].offset);
+            }
+            duplicate = p.errors.size() > errorCount;
+            k++;
+            continue;
+        }
+        p.lexer.seek(s.begin);
+        p.current = p.lexer.nextToken();
+        if (duplicate) {
+            // A duplicate name is an error in the function before, which
+            // parseFunctions() recovers from as from any other.
+            if (p.check(LEFT_BRACE)) {
+                atEnd = false;
+                break;
+            }
+            while (!p.check(END_OF_FILE) && !p.check(INT) && !p.check(VOID)) {
+                p.advance();
+            }
+        }
+        p.resumeAt = resumePoints.data() + (std::upper_bound(resumePoints.begin(), resumePoints.end(), s.begin) -
+                                             resumePoints.begin());
+        p.resumeEnd = resumePoints.data() + resumePoints.size();
+        AstList functions;
+        p.parseFunctions<false>(functions);
+        bool resumed = p.resumeAt != p.resumeEnd && *p.resumeAt == p.current.offset && !p.check(END_OF_FILE);
+        p.resumeAt = p.resumeEnd = NULL;
+        relexed += p.current.offset - s.begin;
+        if (p.tooDeep) {
+            return;
+        }
+        if (!resumed) {
+            // Parsing gave up here or reached the end.
+            atEnd = false;
+            break;
+        }
+        k = segmentAt(p.current.offset);
+    }
+    if (atEnd) {
+        p.lexer.stop();
+        p.current = p.lexer.nextToken();
+    }
+    if (!p.hasMain) {
+        p.error("Missing main function");
+    }
+}
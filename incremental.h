@@ -0,0 +1,87 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "parser.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A program kept parsed while it is edited. The text is cut into segments,
+// one per function definition, each parsed on its own; an edit re-lexes
+// and re-parses only the segments it touches, and moves the rest along.
+//
+// A segment is clean if its parse from its first token ends exactly where
+// the next one begins, without an error: the whole-program parse would go
+// through it the same way, so all it contributes is the functions it
+// defines. While every segment is clean, the verdict follows from counts
+// of the names defined, kept up to date edit by edit. Otherwise the
+// verdict comes from a parser run over the whole text that takes each
+// clean segment's definitions as they are and parses the rest, picking the
+// cached segments up again wherever it arrives at the start of one; the
+// errors are exactly a fresh parse's.
+class IncrementalParser {
+private:
+    struct Segment {
+        uint64_t begin;
+        uint64_t first;     // offset of its first token, from begin; its size if none
+        uint64_t lines;     // newlines in it
+        bool clean;
+        std::vector<Parser::Definition> definitions;    // offsets from begin
+
+        Segment(uint64_t b, uint64_t f, bool c) : begin(b), first(f), lines(0), clean(c) {}
+    };
+
+    std::string source;     // the text, plus a final newline if it lacks one
+    bool addedNewline;
+    SymbolTable symbols;
+    Parser part;            // parses segments
+    Parser whole;           // parses the program, around clean segments
+    std::vector<Segment> segments;
+    std::vector<uint32_t> definitionCount;  // by symbol, in clean segments
+    size_t duplicatedNames;
+    size_t uncleanSegments;
+    std::vector<uint64_t> resumePoints;
+    std::vector<uint64_t> segmentBegins;    // line checkpoints for whole
+    std::vector<uint64_t> linesBefore;
+    std::vector<uint64_t> starts;
+    std::vector<Parser::Definition> found;
+    size_t relexed;
+    bool parsed;
+
+    uint64_t segmentEnd(size_t k) const {
+        return k + 1 < segments.size() ? segments[k + 1].begin : source.size();
+    }
+    size_t segmentAt(uint64_t offset) const;
+    void count(const Segment& s, int delta);
+    void parseRegion(uint64_t begin, uint64_t end, std::vector<Segment>& out);
+    bool lineCommentAtEnd(uint64_t begin, uint64_t end) const;
+    void check();
+
+    IncrementalParser(const IncrementalParser&);
+    IncrementalParser& operator=(const IncrementalParser&);
+
+public:
+    explicit IncrementalParser(const std::string& text);
+
+    // The parser's options; call before parse().
+    void setMaxErrors(size_t maxErrors);
+    void failFast();
+    void useExplicitStack(size_t maxDepth = Parser::DEFAULT_MAX_DEPTH);
+
+    // Parses the whole text.
+    bool parse();
+    // Replaces removed bytes at offset with inserted and brings the verdict
+    // up to date. Offsets are into the text as given, without the newline
+    // added to it.
+    bool edit(size_t offset, size_t removed, const std::string& inserted);
+
+    std::string text() const;
+    void printErrors(bool columns = false, std::ostream& out = std::cout) { whole.printErrors(columns, out); }
+    const std::vector<ErrorInfo>& errorList() const { return whole.errorList(); }
+    // Bytes the last parse() or edit() lexed, for measuring how local an
+    // edit was.
+    size_t relexedBytes() const { return relexed; }
+    size_t segmentCount() const { return segments.size(); }
+};
+
+#endif
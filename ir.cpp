@@ -0,0 +1,1025 @@
+#include "ir.h"
+#include "lexer.h"
+#include <algorithm>
+
+bool irIsTerminator(uint32_t op) {
+    return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+bool irHasEffect(const IrFunction& fn, const IrInsn& insn) {
+    switch (insn.op) {
+    case IR_DIV:
+    case IR_MOD: {
+        const IrInsn& divisor = fn.insn(insn.operands[1]);
+        return divisor.op != IR_CONST || divisor.imm == 0;
+    }
+    case IR_CALL:
+    case IR_SET:
+    case IR_JMP:
+    case IR_BR:
+    case IR_RET:
+        return true;
+    default:
+        return false;
+    }
+}
+
+IrFunction::IrFunction() : arena(16 * 1024), insns(0), sym(0), params(0) {}
+
+size_t IrFunction::size() const {
+    size_t n = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (uint32_t i = blocks[b].first; i != IR_NONE; i = insn(i).next) {
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t IrFunction::blockCount() const {
+    size_t n = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        n += !blocks[b].removed;
+    }
+    return n;
+}
+
+uint32_t IrFunction::add(IrOp op, int32_t imm, uint32_t count) {
+    if (insns % CHUNK_INSNS == 0) {
+        chunks.push_back(static_cast<IrInsn*>(arena.allocate(CHUNK_INSNS * sizeof(IrInsn))));
+    }
+    uint32_t id = insns++;
+    IrInsn& i = insn(id);
+    i.op = (uint16_t)op;
+    i.removed = 0;
+    i.block = IR_NONE;
+    i.prev = i.next = IR_NONE;
+    i.imm = imm;
+    i.count = count;
+    i.operands = NULL;
+    if (count != 0) {
+        i.operands = static_cast<uint32_t*>(arena.allocate(count * sizeof(uint32_t), sizeof(uint32_t)));
+        std::fill(i.operands, i.operands + count, IR_NONE);
+    }
+    return id;
+}
+
+void IrFunction::append(uint32_t block, uint32_t id) {
+    IrBlock& b = blocks[block];
+    IrInsn& i = insn(id);
+    i.block = block;
+    i.prev = b.last;
+    i.next = IR_NONE;
+    if (b.last == IR_NONE) {
+        b.first = id;
+    } else {
+        insn(b.last).next = id;
+    }
+    b.last = id;
+}
+
+void IrFunction::prepend(uint32_t block, uint32_t id) {
+    IrBlock& b = blocks[block];
+    if (b.first == IR_NONE) {
+        append(block, id);
+        return;
+    }
+    insertBefore(b.first, id);
+}
+
+void IrFunction::addToEntry(uint32_t id) {
+    uint32_t at = blocks[0].first;
+    while (at != IR_NONE && (insn(at).op == IR_PHI || insn(at).op == IR_PARAM)) {
+        at = insn(at).next;
+    }
+    if (at == IR_NONE) {
+        append(0, id);
+    } else {
+        insertBefore(at, id);
+    }
+}
+
+void IrFunction::insertBefore(uint32_t before, uint32_t id) {
+    IrInsn& at = insn(before);
+    IrInsn& i = insn(id);
+    i.block = at.block;
+    i.prev = at.prev;
+    i.next = before;
+    if (at.prev == IR_NONE) {
+        blocks[at.block].first = id;
+    } else {
+        insn(at.prev).next = id;
+    }
+    at.prev = id;
+}
+
+void IrFunction::remove(uint32_t id) {
+    if (insn(id).removed) {
+        return;
+    }
+    detach(id);
+    insn(id).removed = 1;
+}
+
+void IrFunction::detach(uint32_t id) {
+    IrInsn& i = insn(id);
+    IrBlock& b = blocks[i.block];
+    if (i.prev == IR_NONE) {
+        b.first = i.next;
+    } else {
+        insn(i.prev).next = i.next;
+    }
+    if (i.next == IR_NONE) {
+        b.last = i.prev;
+    } else {
+        insn(i.next).prev = i.prev;
+    }
+    i.prev = i.next = IR_NONE;
+}
+
+void IrFunction::setOperands(uint32_t id, const uint32_t* operands, uint32_t count) {
+    IrInsn& i = insn(id);
+    if (count > i.count) {
+        i.operands = static_cast<uint32_t*>(arena.allocate(count * sizeof(uint32_t), sizeof(uint32_t)));
+    }
+    std::copy(operands, operands + count, i.operands);
+    i.count = count;
+}
+
+void IrFunction::eraseOperand(uint32_t id, uint32_t index) {
+    IrInsn& i = insn(id);
+    std::copy(i.operands + index + 1, i.operands + i.count, i.operands + index);
+    i.count--;
+}
+
+uint32_t IrFunction::newBlock() {
+    IrBlock b;
+    b.first = b.last = IR_NONE;
+    b.succ[0] = b.succ[1] = IR_NONE;
+    b.succCount = 0;
+    b.removed = false;
+    blocks.push_back(b);
+    return (uint32_t)blocks.size() - 1;
+}
+
+void IrFunction::addEdge(uint32_t from, uint32_t to) {
+    IrBlock& b = blocks[from];
+    b.succ[b.succCount++] = to;
+    blocks[to].preds.push_back(from);
+}
+
+uint32_t IrFunction::predIndex(uint32_t block, uint32_t pred) const {
+    const std::vector<uint32_t>& preds = blocks[block].preds;
+    for (size_t j = 0; j < preds.size(); j++) {
+        if (preds[j] == pred) {
+            return (uint32_t)j;
+        }
+    }
+    return IR_NONE;
+}
+
+void IrFunction::removeEdge(uint32_t from, uint32_t to) {
+    IrBlock& b = blocks[from];
+    for (uint32_t s = 0; s < b.succCount; s++) {
+        if (b.succ[s] == to) {
+            b.succ[s] = b.succ[b.succCount - 1];
+            b.succ[--b.succCount] = IR_NONE;
+            break;
+        }
+    }
+    uint32_t j = predIndex(to, from);
+    if (j == IR_NONE) {
+        return;
+    }
+    IrBlock& target = blocks[to];
+    target.preds.erase(target.preds.begin() + j);
+    for (uint32_t i = target.first; i != IR_NONE && insn(i).op == IR_PHI; i = insn(i).next) {
+        eraseOperand(i, j);
+    }
+}
+
+void IrFunction::removeBlock(uint32_t block) {
+    while (blocks[block].succCount != 0) {
+        removeEdge(block, blocks[block].succ[0]);
+    }
+    while (blocks[block].first != IR_NONE) {
+        remove(blocks[block].first);
+    }
+    blocks[block].preds.clear();
+    blocks[block].removed = true;
+}
+
+void IrFunction::replaceUses(const std::vector<uint32_t>& with) {
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (uint32_t id = blocks[b].first; id != IR_NONE; id = insn(id).next) {
+            IrInsn& i = insn(id);
+            for (uint32_t k = 0; k < i.count; k++) {
+                uint32_t v = i.operands[k];
+                while (v < with.size() && with[v] != IR_NONE) {
+                    v = with[v];
+                }
+                i.operands[k] = v;
+            }
+        }
+    }
+    for (uint32_t id = 0; id < with.size(); id++) {
+        if (with[id] != IR_NONE) {
+            remove(id);
+        }
+    }
+}
+
+uint32_t IrFunction::constant(int32_t value) {
+    uint32_t id = add(IR_CONST, value, 0);
+    addToEntry(id);
+    return id;
+}
+
+void IrProgram::clear() {
+    for (size_t f = 0; f < functions.size(); f++) {
+        delete functions[f];
+    }
+    functions.clear();
+    recursive.clear();
+    main = CallGraph::NO_FUNCTION;
+}
+
+void IrProgram::findRecursive() {
+    static const uint32_t UNVISITED = 0xFFFFFFFFu;
+    size_t n = functions.size();
+    std::vector<uint32_t> firstSite(n + 1, 0);
+    std::vector<uint32_t> callees;
+    for (size_t f = 0; f < n; f++) {
+        const IrFunction& fn = *functions[f];
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                if (fn.insn(id).op == IR_CALL) {
+                    callees.push_back((uint32_t)fn.insn(id).imm);
+                }
+            }
+        }
+        firstSite[f + 1] = (uint32_t)callees.size();
+    }
+    recursive.assign(n, false);
+    std::vector<uint32_t> order(n, UNVISITED);
+    std::vector<uint32_t> low(n);
+    std::vector<bool> onStack(n, false);
+    std::vector<uint32_t> component;
+    std::vector<std::pair<uint32_t, uint32_t> > frames;
+    uint32_t visited = 0;
+    for (uint32_t root = 0; root < n; root++) {
+        if (order[root] != UNVISITED) {
+            continue;
+        }
+        order[root] = low[root] = visited++;
+        component.push_back(root);
+        onStack[root] = true;
+        frames.push_back(std::make_pair(root, firstSite[root]));
+        while (!frames.empty()) {
+            uint32_t f = frames.back().first;
+            uint32_t site = frames.back().second;
+            if (site < firstSite[f + 1]) {
+                frames.back().second++;
+                uint32_t g = callees[site];
+                if (g == f) {
+                    recursive[f] = true;
+                } else if (order[g] == UNVISITED) {
+                    order[g] = low[g] = visited++;
+                    component.push_back(g);
+                    onStack[g] = true;
+                    frames.push_back(std::make_pair(g, firstSite[g]));
+                } else if (onStack[g]) {
+                    low[f] = std::min(low[f], order[g]);
+                }
+                continue;
+            }
+            frames.pop_back();
+            if (!frames.empty()) {
+                uint32_t parent = frames.back().first;
+                low[parent] = std::min(low[parent], low[f]);
+            }
+            if (low[f] == order[f]) {
+                size_t begin = component.size();
+                while (component[begin - 1] != f) {
+                    begin--;
+                }
+                begin--;
+                bool cycle = component.size() - begin > 1;
+                for (size_t k = begin; k < component.size(); k++) {
+                    onStack[component[k]] = false;
+                    if (cycle) {
+                        recursive[component[k]] = true;
+                    }
+                }
+                component.resize(begin);
+            }
+        }
+    }
+}
+
+size_t IrProgram::size() const {
+    size_t n = 0;
+    for (size_t f = 0; f < functions.size(); f++) {
+        n += functions[f]->size();
+    }
+    return n;
+}
+
+void DominatorTree::build(const IrFunction& fn) {
+    size_t n = fn.blocks.size();
+    rpoIndex.assign(n, IR_NONE);
+    order.clear();
+    // Depth-first, successors last to first, so that a block's first
+    // successor follows it in reverse postorder where it can.
+    std::vector<std::pair<uint32_t, uint32_t> > stack;     // block, successors visited
+    std::vector<bool> seen(n, false);
+    stack.push_back(std::make_pair(0u, 0u));
+    seen[0] = true;
+    while (!stack.empty()) {
+        uint32_t b = stack.back().first;
+        const IrBlock& block = fn.blocks[b];
+        if (stack.back().second == block.succCount) {
+            order.push_back(b);
+            stack.pop_back();
+            continue;
+        }
+        uint32_t s = block.succ[block.succCount - 1 - stack.back().second++];
+        if (!seen[s]) {
+            seen[s] = true;
+            stack.push_back(std::make_pair(s, 0u));
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++) {
+        rpoIndex[order[i]] = (uint32_t)i;
+    }
+
+    idom.assign(n, IR_NONE);
+    idom[0] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t k = 1; k < order.size(); k++) {
+            uint32_t b = order[k];
+            uint32_t d = IR_NONE;
+            const std::vector<uint32_t>& preds = fn.blocks[b].preds;
+            for (size_t j = 0; j < preds.size(); j++) {
+                uint32_t p = preds[j];
+                if (rpoIndex[p] == IR_NONE || idom[p] == IR_NONE) {
+                    continue;
+                }
+                if (d == IR_NONE) {
+                    d = p;
+                    continue;
+                }
+                while (p != d) {
+                    while (rpoIndex[p] > rpoIndex[d]) {
+                        p = idom[p];
+                    }
+                    while (rpoIndex[d] > rpoIndex[p]) {
+                        d = idom[d];
+                    }
+                }
+            }
+            if (idom[b] != d) {
+                idom[b] = d;
+                changed = true;
+            }
+        }
+    }
+
+    childStart.assign(n + 1, 0);
+    for (size_t k = 1; k < order.size(); k++) {
+        childStart[idom[order[k]] + 1]++;
+    }
+    for (size_t b = 0; b < n; b++) {
+        childStart[b + 1] += childStart[b];
+    }
+    children.assign(order.size() > 0 ? order.size() - 1 : 0, 0);
+    std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (size_t k = 1; k < order.size(); k++) {
+        children[fill[idom[order[k]]]++] = order[k];
+    }
+
+    enter.assign(n, 1);
+    leave.assign(n, 0);
+    uint32_t clock = 0;
+    std::vector<std::pair<uint32_t, uint32_t> > walk(1, std::make_pair(0u, childStart[0]));
+    enter[0] = clock++;
+    while (!walk.empty()) {
+        uint32_t b = walk.back().first;
+        if (walk.back().second == childStart[b + 1]) {
+            leave[b] = clock++;
+            walk.pop_back();
+            continue;
+        }
+        uint32_t c = children[walk.back().second++];
+        enter[c] = clock++;
+        walk.push_back(std::make_pair(c, childStart[c]));
+    }
+}
+
+void DominatorTree::frontiers(const IrFunction& fn, std::vector<std::vector<uint32_t> >& df) const {
+    df.assign(fn.blocks.size(), std::vector<uint32_t>());
+    for (size_t k = 0; k < order.size(); k++) {
+        uint32_t b = order[k];
+        const std::vector<uint32_t>& preds = fn.blocks[b].preds;
+        if (preds.size() < 2) {
+            continue;
+        }
+        for (size_t j = 0; j < preds.size(); j++) {
+            for (uint32_t runner = preds[j]; reachable(runner) && runner != idom[b]; runner = idom[runner]) {
+                if (!df[runner].empty() && df[runner].back() == b) {
+                    break;
+                }
+                df[runner].push_back(b);
+            }
+        }
+    }
+}
+
+IrBuilder::IrBuilder()
+    : ast(NULL), graph(NULL), fn(NULL), variables(0), current(IR_NONE), nesting(0), failure(NULL) {}
+
+// The block being filled; code that cannot be reached goes into a block of
+// its own, which is dropped before SSA construction.
+uint32_t IrBuilder::block() {
+    if (current == IR_NONE) {
+        current = fn->newBlock();
+    }
+    return current;
+}
+
+uint32_t IrBuilder::emit(IrOp op, int32_t imm, uint32_t a, uint32_t b) {
+    uint32_t count = (a != IR_NONE) + (b != IR_NONE);
+    uint32_t id = fn->add(op, imm, count);
+    IrInsn& i = fn->insn(id);
+    if (a != IR_NONE) {
+        i.operands[0] = a;
+    }
+    if (b != IR_NONE) {
+        i.operands[1] = b;
+    }
+    fn->append(block(), id);
+    return id;
+}
+
+void IrBuilder::jump(uint32_t to) {
+    if (current == IR_NONE) {
+        return;
+    }
+    uint32_t from = current;
+    emit(IR_JMP, 0);
+    fn->addEdge(from, to);
+    current = IR_NONE;
+}
+
+bool IrBuilder::enter() {
+    if (++nesting > BytecodeCompiler::MAX_NESTING && failure == NULL) {
+        failure = "Program nested too deeply to optimize";
+    }
+    return failure == NULL;
+}
+
+static IrOp binaryOp(uint32_t op) {
+    switch (op) {
+    case PLUS: return IR_ADD;
+    case MINUS: return IR_SUB;
+    case MULTIPLY: return IR_MUL;
+    case DIVIDE: return IR_DIV;
+    case MODULO: return IR_MOD;
+    case LESS: return IR_LT;
+    case LESS_EQUAL: return IR_LE;
+    case GREATER: return IR_GT;
+    case GREATER_EQUAL: return IR_GE;
+    case EQUAL: return IR_EQ;
+    default: return IR_NE;
+    }
+}
+
+uint32_t IrBuilder::expression(uint32_t id) {
+    uint32_t v = IR_NONE;
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        switch (Ast::kind(id)) {
+        case AST_NUMBER:
+            v = emit(IR_CONST, (int32_t)n.a);
+            break;
+        case AST_NAME: {
+            uint32_t var = 0;
+            names.find(n.a, var);
+            v = emit(IR_GET, (int32_t)var);
+            break;
+        }
+        case AST_UNARY:
+            v = expression(n.a);
+            if (n.op != PLUS) {
+                v = emit(n.op == MINUS ? IR_NEG : IR_NOT, 0, v);
+            }
+            break;
+        case AST_BINARY:
+            if (n.op == AND || n.op == OR) {
+                // The value of && and || is a variable set to 1 or 0 on
+                // either side of a branch.
+                uint32_t var = variables++;
+                uint32_t yes = fn->newBlock();
+                uint32_t no = fn->newBlock();
+                uint32_t join = fn->newBlock();
+                branch(id, yes, no);
+                current = yes;
+                emit(IR_SET, (int32_t)var, emit(IR_CONST, 1));
+                jump(join);
+                current = no;
+                emit(IR_SET, (int32_t)var, emit(IR_CONST, 0));
+                jump(join);
+                current = join;
+                v = emit(IR_GET, (int32_t)var);
+            } else {
+                uint32_t l = expression(n.a);
+                uint32_t r = expression(n.b);
+                v = emit(binaryOp(n.op), 0, l, r);
+            }
+            break;
+        case AST_CALL: {
+            std::vector<uint32_t> args;
+            for (uint32_t arg = n.b; arg != AST_NONE; arg = ast->node(arg).next) {
+                args.push_back(expression(arg));
+            }
+            uint32_t callee = graph->find(n.a);
+            if (callee == CallGraph::NO_FUNCTION) {
+                failure = "Undefined function";
+            }
+            v = fn->add(IR_CALL, (int32_t)callee, (uint32_t)args.size());
+            if (!args.empty()) {
+                fn->setOperands(v, &args[0], (uint32_t)args.size());
+            }
+            fn->append(block(), v);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    nesting--;
+    return v != IR_NONE ? v : emit(IR_CONST, 0);
+}
+
+// Ends the current block with a branch to yes if the condition holds and
+// to no if not. && and || become branches, so a condition never
+// materializes its value.
+void IrBuilder::branch(uint32_t id, uint32_t yes, uint32_t no) {
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        AstKind kind = Ast::kind(id);
+        if (kind == AST_BINARY && (n.op == AND || n.op == OR)) {
+            uint32_t middle = fn->newBlock();
+            if (n.op == AND) {
+                branch(n.a, middle, no);
+            } else {
+                branch(n.a, yes, middle);
+            }
+            current = middle;
+            branch(n.b, yes, no);
+        } else if (kind == AST_UNARY && n.op == NOT) {
+            branch(n.a, no, yes);
+        } else if (kind == AST_NUMBER) {
+            jump(n.a != 0 ? yes : no);
+        } else {
+            uint32_t v = expression(id);
+            uint32_t from = block();
+            emit(IR_BR, 0, v);
+            fn->addEdge(from, yes);
+            fn->addEdge(from, no);
+        }
+    }
+    nesting--;
+    current = IR_NONE;
+}
+
+void IrBuilder::statements(uint32_t first) {
+    for (uint32_t id = first; id != AST_NONE && failure == NULL; id = ast->node(id).next) {
+        statement(id);
+    }
+}
+
+void IrBuilder::statement(uint32_t id) {
+    if (id == AST_NONE) {
+        return;
+    }
+    if (enter()) {
+        const AstNode& n = ast->node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK:
+            names.open();
+            statements(n.a);
+            names.close();
+            break;
+        case AST_DECL:
+            for (uint32_t v = n.a; v != AST_NONE; v = ast->node(v).next) {
+                const AstNode& var = ast->node(v);
+                uint32_t index = variables++;
+                uint32_t value = var.b != AST_NONE ? expression(var.b) : emit(IR_CONST, 0);
+                names.declare(var.a, index);
+                emit(IR_SET, (int32_t)index, value);
+            }
+            break;
+        case AST_ASSIGN: {
+            uint32_t var = 0;
+            names.find(n.a, var);
+            emit(IR_SET, (int32_t)var, expression(n.b));
+            break;
+        }
+        case AST_IF: {
+            uint32_t then = fn->newBlock();
+            uint32_t join = fn->newBlock();
+            uint32_t otherwise = n.c != AST_NONE ? fn->newBlock() : join;
+            branch(n.a, then, otherwise);
+            current = then;
+            statement(n.b);
+            jump(join);
+            if (n.c != AST_NONE) {
+                current = otherwise;
+                statement(n.c);
+                jump(join);
+            }
+            current = join;
+            break;
+        }
+        case AST_WHILE: {
+            uint32_t header = fn->newBlock();
+            uint32_t body = fn->newBlock();
+            uint32_t exit = fn->newBlock();
+            jump(header);
+            current = header;
+            branch(n.a, body, exit);
+            Loop loop = { exit, header };
+            loops.push_back(loop);
+            current = body;
+            statement(n.b);
+            jump(header);
+            loops.pop_back();
+            current = exit;
+            break;
+        }
+        case AST_BREAK:
+        case AST_CONTINUE:
+            if (loops.empty()) {
+                // Only a program that skipped the scope check gets here.
+                failure = Ast::kind(id) == AST_BREAK ? "Break outside loop" : "Continue outside loop";
+                break;
+            }
+            jump(Ast::kind(id) == AST_BREAK ? loops.back().exit : loops.back().header);
+            break;
+        case AST_RETURN: {
+            uint32_t v = expression(n.a);
+            emit(IR_RET, 0, v);
+            current = IR_NONE;
+            break;
+        }
+        case AST_EXPR_STMT:
+            expression(n.a);
+            break;
+        default:
+            break;
+        }
+    }
+    nesting--;
+}
+
+void IrBuilder::pruneUnreachable() {
+    std::vector<bool> seen(fn->blocks.size(), false);
+    std::vector<uint32_t> work(1, 0);
+    seen[0] = true;
+    while (!work.empty()) {
+        const IrBlock& b = fn->blocks[work.back()];
+        work.pop_back();
+        for (uint32_t s = 0; s < b.succCount; s++) {
+            if (!seen[b.succ[s]]) {
+                seen[b.succ[s]] = true;
+                work.push_back(b.succ[s]);
+            }
+        }
+    }
+    for (uint32_t b = 0; b < fn->blocks.size(); b++) {
+        if (!seen[b]) {
+            fn->removeBlock(b);
+        }
+    }
+}
+
+// Semi-pruned: only variables read in some block before being set there
+// can need a phi.
+void IrBuilder::placePhis() {
+    dom.build(*fn);
+    std::vector<std::vector<uint32_t> > df;
+    dom.frontiers(*fn, df);
+    std::vector<std::vector<uint32_t> > defs(variables);
+    std::vector<bool> global(variables, false);
+    std::vector<uint32_t> setIn(variables, IR_NONE);
+    for (uint32_t b = 0; b < fn->blocks.size(); b++) {
+        for (uint32_t id = fn->blocks[b].first; id != IR_NONE; id = fn->insn(id).next) {
+            const IrInsn& i = fn->insn(id);
+            if (i.op == IR_GET && setIn[i.imm] != b) {
+                global[i.imm] = true;
+            } else if (i.op == IR_SET) {
+                if (setIn[i.imm] != b) {
+                    defs[i.imm].push_back(b);
+                }
+                setIn[i.imm] = b;
+            }
+        }
+    }
+    std::vector<uint32_t> hasPhi(fn->blocks.size(), IR_NONE);
+    std::vector<uint32_t> queued(fn->blocks.size(), IR_NONE);
+    for (uint32_t v = 0; v < variables; v++) {
+        if (!global[v]) {
+            continue;
+        }
+        std::vector<uint32_t> work(defs[v]);
+        for (size_t k = 0; k < work.size(); k++) {
+            queued[work[k]] = v;
+        }
+        while (!work.empty()) {
+            uint32_t d = work.back();
+            work.pop_back();
+            for (size_t k = 0; k < df[d].size(); k++) {
+                uint32_t b = df[d][k];
+                if (hasPhi[b] == v) {
+                    continue;
+                }
+                hasPhi[b] = v;
+                uint32_t phi = fn->add(IR_PHI, (int32_t)v, (uint32_t)fn->blocks[b].preds.size());
+                fn->prepend(b, phi);
+                if (queued[b] != v) {
+                    queued[b] = v;
+                    work.push_back(b);
+                }
+            }
+        }
+    }
+}
+
+void IrBuilder::rename() {
+    std::vector<uint32_t> value(variables, IR_NONE);
+    std::vector<std::pair<uint32_t, uint32_t> > undo;     // variable, value before
+    std::vector<uint32_t> with(fn->insnCount(), IR_NONE);
+    uint32_t zero = IR_NONE;
+    struct Visit {
+        uint32_t block;
+        size_t mark;    // undo size on entry; IR_NONE: not entered yet
+    };
+    std::vector<Visit> stack;
+    Visit root = { 0, (size_t)IR_NONE };
+    stack.push_back(root);
+    while (!stack.empty()) {
+        Visit visit = stack.back();
+        stack.pop_back();
+        if (visit.mark != (size_t)IR_NONE) {
+            while (undo.size() > visit.mark) {
+                value[undo.back().first] = undo.back().second;
+                undo.pop_back();
+            }
+            continue;
+        }
+        uint32_t b = visit.block;
+        Visit leave = { b, undo.size() };
+        stack.push_back(leave);
+        for (uint32_t id = fn->blocks[b].first, next; id != IR_NONE; id = next) {
+            next = fn->insn(id).next;
+            IrInsn& i = fn->insn(id);
+            if (i.op == IR_PHI) {
+                undo.push_back(std::make_pair((uint32_t)i.imm, value[i.imm]));
+                value[i.imm] = id;
+                continue;
+            }
+            for (uint32_t k = 0; k < i.count; k++) {
+                if (i.operands[k] < with.size() && with[i.operands[k]] != IR_NONE) {
+                    i.operands[k] = with[i.operands[k]];
+                }
+            }
+            if (i.op == IR_GET) {
+                if (value[i.imm] == IR_NONE) {
+                    if (zero == IR_NONE) {
+                        zero = fn->constant(0);
+                    }
+                    value[i.imm] = zero;
+                }
+                with[id] = value[i.imm];
+                fn->remove(id);
+            } else if (i.op == IR_SET) {
+                undo.push_back(std::make_pair((uint32_t)i.imm, value[i.imm]));
+                value[i.imm] = i.operands[0];
+                fn->remove(id);
+            }
+        }
+        const IrBlock& block = fn->blocks[b];
+        for (uint32_t s = 0; s < block.succCount; s++) {
+            uint32_t j = fn->predIndex(block.succ[s], b);
+            for (uint32_t id = fn->blocks[block.succ[s]].first; id != IR_NONE && fn->insn(id).op == IR_PHI;
+                 id = fn->insn(id).next) {
+                IrInsn& phi = fn->insn(id);
+                if (value[phi.imm] == IR_NONE) {
+                    if (zero == IR_NONE) {
+                        zero = fn->constant(0);
+                    }
+                    value[phi.imm] = zero;
+                }
+                phi.operands[j] = value[phi.imm];
+            }
+        }
+        for (uint32_t c = dom.childEnd(b); c > dom.childBegin(b); c--) {
+            Visit child = { dom.children[c - 1], (size_t)IR_NONE };
+            stack.push_back(child);
+        }
+    }
+    for (uint32_t id = 0; id < fn->insnCount(); id++) {
+        if (fn->insn(id).op == IR_PHI) {
+            fn->insn(id).imm = 0;
+        }
+    }
+}
+
+bool IrBuilder::build(Ast& tree, const CallGraph& calls, IrProgram& program, std::string& err) {
+    ast = &tree;
+    graph = &calls;
+    failure = NULL;
+    nesting = 0;
+    program.clear();
+    program.main = calls.find(SYM_MAIN);
+    for (uint32_t f = 0; f < calls.size() && failure == NULL; f++) {
+        const AstNode& func = tree.node(calls.node(f));
+        fn = new IrFunction();
+        program.functions.push_back(fn);
+        fn->sym = func.a;
+        fn->params = calls.arity(f);
+        variables = 0;
+        loops.clear();
+        current = fn->newBlock();
+        names.open();
+        int32_t index = 0;
+        for (uint32_t p = func.b; p != AST_NONE; p = tree.node(p).next) {
+            uint32_t var = variables++;
+            names.declare(tree.node(p).a, var);
+            emit(IR_SET, (int32_t)var, emit(IR_PARAM, index++));
+        }
+        // The body's outermost block shares the parameters' scope.
+        statements(tree.node(func.c).a);
+        if (current != IR_NONE) {
+            emit(IR_RET, 0, emit(IR_CONST, 0));
+        }
+        names.close();
+        if (failure == NULL) {
+            pruneUnreachable();
+            placePhis();
+            rename();
+        }
+    }
+    if (failure == NULL && program.main == CallGraph::NO_FUNCTION) {
+        failure = "Missing main function";
+    }
+    if (failure != NULL) {
+        err = failure;
+        return false;
+    }
+    return true;
+}
+
+static const char* const irOpNames[IR_OP_COUNT] = {
+    "const", "param", "add", "sub", "mul", "div", "mod", "lt", "le", "gt", "ge", "eq", "ne", "neg", "not",
+    "call", "phi", "get", "set", "jmp", "br", "ret",
+};
+
+static bool fail(std::string& err, const std::string& what, uint32_t where) {
+    err = what + " at " + std::to_string(where);
+    return false;
+}
+
+bool verifyIr(const IrFunction& fn, std::string& err) {
+    if (fn.blocks.empty() || fn.blocks[0].removed || !fn.blocks[0].preds.empty()) {
+        return fail(err, "entry block missing or branched to", 0);
+    }
+    DominatorTree dom;
+    dom.build(fn);
+    std::vector<uint32_t> position(fn.insnCount(), IR_NONE);
+    for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+        const IrBlock& block = fn.blocks[b];
+        if (block.removed) {
+            continue;
+        }
+        if (!dom.reachable(b)) {
+            return fail(err, "unreachable block b", b);
+        }
+        if (block.last == IR_NONE || !irIsTerminator(fn.insn(block.last).op)) {
+            return fail(err, "no terminator in b", b);
+        }
+        const IrInsn& end = fn.insn(block.last);
+        uint32_t succs = end.op == IR_JMP ? 1 : end.op == IR_BR ? 2 : 0;
+        if (block.succCount != succs || (succs == 2 && block.succ[0] == block.succ[1])) {
+            return fail(err, "wrong successors for the terminator of b", b);
+        }
+        for (uint32_t s = 0; s < block.succCount; s++) {
+            const IrBlock& succ = fn.blocks[block.succ[s]];
+            if (succ.removed || std::count(succ.preds.begin(), succ.preds.end(), b) != 1) {
+                return fail(err, "edge missing from the predecessors of a successor of b", b);
+            }
+        }
+        for (size_t j = 0; j < block.preds.size(); j++) {
+            const IrBlock& pred = fn.blocks[block.preds[j]];
+            if (pred.removed || std::find(pred.succ, pred.succ + pred.succCount, b) == pred.succ + pred.succCount) {
+                return fail(err, "edge missing from the successors of a predecessor of b", b);
+            }
+        }
+        uint32_t n = 0;
+        bool phis = true;
+        for (uint32_t id = block.first, prev = IR_NONE; id != IR_NONE; prev = id, id = fn.insn(id).next) {
+            const IrInsn& i = fn.insn(id);
+            if (i.removed || i.block != b || i.prev != prev) {
+                return fail(err, "broken instruction list at v", id);
+            }
+            if (i.op == IR_GET || i.op == IR_SET) {
+                return fail(err, "variable left over at v", id);
+            }
+            if (i.op == IR_PHI && (!phis || i.count != block.preds.size())) {
+                return fail(err, "misplaced phi v", id);
+            }
+            phis = phis && i.op == IR_PHI;
+            if (irIsTerminator(i.op) != (id == block.last)) {
+                return fail(err, "terminator not at the end at v", id);
+            }
+            position[id] = n++;
+        }
+    }
+    for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+        const IrBlock& block = fn.blocks[b];
+        if (block.removed) {
+            continue;
+        }
+        for (uint32_t id = block.first; id != IR_NONE; id = fn.insn(id).next) {
+            const IrInsn& i = fn.insn(id);
+            for (uint32_t k = 0; k < i.count; k++) {
+                uint32_t v = i.operands[k];
+                if (v >= fn.insnCount() || fn.insn(v).removed || position[v] == IR_NONE) {
+                    return fail(err, "operand is not a value at v", id);
+                }
+                const IrInsn& def = fn.insn(v);
+                bool dominated;
+                if (i.op == IR_PHI) {
+                    dominated = dom.dominates(def.block, block.preds[k]);
+                } else if (def.block == b) {
+                    dominated = position[v] < position[id];
+                } else {
+                    dominated = dom.dominates(def.block, b);
+                }
+                if (!dominated || irIsTerminator(def.op)) {
+                    return fail(err, "use not dominated by its value at v", id);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void dumpIr(const IrProgram& program, SymbolTable& symbols, std::ostream& out) {
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        const IrFunction& fn = *program.functions[f];
+        size_t size;
+        const char* name = symbols.text(fn.sym, size);
+        out.write(name, size);
+        out << " (" << fn.params << " params)\n";
+        for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+            const IrBlock& block = fn.blocks[b];
+            if (block.removed) {
+                continue;
+            }
+            out << "  b" << b << ":";
+            if (!block.preds.empty()) {
+                out << "\t\t; preds";
+                for (size_t j = 0; j < block.preds.size(); j++) {
+                    out << " b" << block.preds[j];
+                }
+            }
+            out << "\n";
+            for (uint32_t id = block.first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                out << "    ";
+                if (!irIsTerminator(i.op)) {
+                    out << "v" << id << " = ";
+                }
+                out << irOpNames[i.op];
+                if (i.op == IR_CONST || i.op == IR_PARAM) {
+                    out << " " << i.imm;
+                } else if (i.op == IR_CALL) {
+                    name = symbols.text(program.functions[i.imm]->sym, size);
+                    out << " ";
+                    out.write(name, size);
+                }
+                for (uint32_t k = 0; k < i.count; k++) {
+                    out << (k == 0 ? " v" : ", v") << i.operands[k];
+                }
+                for (uint32_t s = 0; s < block.succCount && id == block.last; s++) {
+                    out << (s == 0 && i.count == 0 ? " b" : ", b") << block.succ[s];
+                }
+                out << "\n";
+            }
+        }
+    }
+}
@@ -0,0 +1,276 @@
+#ifndef IR_H
+#define IR_H
+
+#include "arena.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "callgraph.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// SSA form of accepted programs, between the syntax tree and bytecode. A
+// function is a graph of basic blocks; every value is the result of exactly
+// one instruction, and where control flow joins, phi instructions pick the
+// value that arrived along each edge.
+//
+// Instructions are numbered per function and stored in arena chunks, like
+// syntax tree nodes; they refer to their operands (other instructions) by
+// 32-bit number, and each block chains its instructions through prev and
+// next. Phis come first in a block and exactly one terminator (jmp, br or
+// ret) comes last. Removed instructions keep their number and are marked.
+enum IrOp {
+    IR_CONST,       // imm
+    IR_PARAM,       // parameter imm
+    IR_ADD,         // operands 0 and 1, with ToyC's semantics as in bytecode
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    IR_EQ,
+    IR_NE,
+    IR_NEG,         // operand 0
+    IR_NOT,
+    IR_CALL,        // function imm with the operands as arguments
+    IR_PHI,         // one operand per predecessor of the block, in order
+    IR_GET,         // variable imm; only while the builder runs
+    IR_SET,         // variable imm = operand 0; only while the builder runs
+    IR_JMP,         // to the block's successor
+    IR_BR,          // to the first successor if operand 0 is not 0, else the second
+    IR_RET,         // operand 0
+    IR_OP_COUNT
+};
+
+const uint32_t IR_NONE = 0xFFFFFFFFu;
+
+struct IrInsn {
+    uint16_t op;
+    uint16_t removed;
+    uint32_t block;
+    uint32_t prev, next;    // in the block, IR_NONE at either end
+    int32_t imm;
+    uint32_t count;         // of operands
+    uint32_t* operands;     // in the function's arena
+};
+
+struct IrBlock {
+    uint32_t first, last;   // instructions, IR_NONE if none
+    uint32_t succ[2];
+    uint32_t succCount;
+    std::vector<uint32_t> preds;    // in the order of phi operands
+    bool removed;
+};
+
+class IrFunction;
+
+bool irIsTerminator(uint32_t op);
+// Whether removing the instruction, if its value is unused, could change
+// what the program does: calls may never return, division may trap.
+bool irHasEffect(const IrFunction& fn, const IrInsn& insn);
+
+class IrFunction {
+private:
+    static const size_t CHUNK_INSNS = 256;
+
+    Arena arena;
+    std::vector<IrInsn*> chunks;
+    uint32_t insns;
+
+    IrFunction(const IrFunction&);
+    IrFunction& operator=(const IrFunction&);
+
+public:
+    uint32_t sym;
+    uint32_t params;
+    std::vector<IrBlock> blocks;    // 0 is the entry
+
+    IrFunction();
+
+    // Number of instructions ever added, removed ones included.
+    uint32_t insnCount() const { return insns; }
+    IrInsn& insn(uint32_t id) { return chunks[id / CHUNK_INSNS][id % CHUNK_INSNS]; }
+    const IrInsn& insn(uint32_t id) const { return chunks[id / CHUNK_INSNS][id % CHUNK_INSNS]; }
+    // Instructions and blocks in use.
+    size_t size() const;
+    size_t blockCount() const;
+
+    // A new instruction in no block, with count operands set to IR_NONE.
+    uint32_t add(IrOp op, int32_t imm, uint32_t count);
+    void append(uint32_t block, uint32_t id);
+    void prepend(uint32_t block, uint32_t id);
+    // Puts id into the entry block after its phis and parameters.
+    void addToEntry(uint32_t id);
+    void insertBefore(uint32_t before, uint32_t id);
+    // Takes id out of its block, to be put in another.
+    void detach(uint32_t id);
+    // Takes id out of its block and marks it removed.
+    void remove(uint32_t id);
+    void setOperands(uint32_t id, const uint32_t* operands, uint32_t count);
+    void eraseOperand(uint32_t id, uint32_t index);
+
+    uint32_t newBlock();
+    void addEdge(uint32_t from, uint32_t to);
+    // Drops the edge and the phi operands that came along it.
+    void removeEdge(uint32_t from, uint32_t to);
+    // Removes the block with its instructions and outgoing edges; it must
+    // have no predecessors left that stay.
+    void removeBlock(uint32_t block);
+    uint32_t predIndex(uint32_t block, uint32_t pred) const;
+
+    // Rewrites every operand through with (IR_NONE: keep), following
+    // chains, and removes the instructions that were replaced.
+    void replaceUses(const std::vector<uint32_t>& with);
+    // A new constant in the entry block, where it dominates every use.
+    uint32_t constant(int32_t value);
+};
+
+class IrProgram {
+private:
+    IrProgram(const IrProgram&);
+    IrProgram& operator=(const IrProgram&);
+
+public:
+    std::vector<IrFunction*> functions;     // by CallGraph index; owned
+    uint32_t main;
+    // By function: whether it may call itself, directly or through others.
+    // Passes only ever remove cycles, so a stale answer errs on the safe
+    // side; see findRecursive().
+    std::vector<bool> recursive;
+
+    IrProgram() : main(CallGraph::NO_FUNCTION) {}
+    ~IrProgram() { clear(); }
+    void clear();
+    size_t size() const;    // instructions in all functions
+    // Sets recursive from the calls left in the functions, like
+    // CallGraph::findRecursive().
+    void findRecursive();
+};
+
+// Immediate dominators (Cooper, Harvey and Kennedy) of the blocks reachable
+// from the entry, with the tree numbered so that dominance is a range test.
+class DominatorTree {
+private:
+    std::vector<uint32_t> rpoIndex;     // by block; IR_NONE if unreachable
+    std::vector<uint32_t> enter, leave; // preorder numbers in the tree
+    std::vector<uint32_t> childStart;
+
+public:
+    std::vector<uint32_t> order;        // reachable blocks, reverse postorder
+    std::vector<uint32_t> idom;         // by block; the entry is its own
+    std::vector<uint32_t> children;     // of block b: childStart[b] ..
+
+    void build(const IrFunction& fn);
+    bool reachable(uint32_t block) const { return rpoIndex[block] != IR_NONE; }
+    bool dominates(uint32_t a, uint32_t b) const { return enter[a] <= enter[b] && leave[b] <= leave[a]; }
+    uint32_t childBegin(uint32_t block) const { return childStart[block]; }
+    uint32_t childEnd(uint32_t block) const { return childStart[block + 1]; }
+    // Dominance frontiers, as lists by block.
+    void frontiers(const IrFunction& fn, std::vector<std::vector<uint32_t> >& df) const;
+};
+
+// Builds SSA form from the tree of a program that passed the scope and call
+// checks: variables become IR_GET and IR_SET while each function's graph is
+// built, then phis go at the iterated dominance frontiers of the blocks
+// that set each variable (Cytron et al.) and a walk of the dominator tree
+// renames every use to the value that reaches it. A variable read before
+// any assignment reaches it reads 0.
+class IrBuilder {
+private:
+    struct Loop {
+        uint32_t exit;
+        uint32_t header;
+    };
+
+    Ast* ast;
+    const CallGraph* graph;
+    IrFunction* fn;
+    DominatorTree dom;
+    ScopedSymbols names;
+    uint32_t variables;
+    uint32_t current;       // block being filled; IR_NONE where unreachable
+    std::vector<Loop> loops;
+    size_t nesting;
+    const char* failure;
+
+    uint32_t block();
+    uint32_t emit(IrOp op, int32_t imm, uint32_t a = IR_NONE, uint32_t b = IR_NONE);
+    void jump(uint32_t to);
+    bool enter();
+
+    void statement(uint32_t id);
+    void statements(uint32_t first);
+    uint32_t expression(uint32_t id);
+    void branch(uint32_t id, uint32_t yes, uint32_t no);
+
+    void pruneUnreachable();
+    void placePhis();
+    void rename();
+
+public:
+    IrBuilder();
+    bool build(Ast& tree, const CallGraph& calls, IrProgram& program, std::string& err);
+};
+
+// Checks the invariants above, the edges in both directions, and that every
+// value dominates its uses. False, with a message, if any is broken.
+bool verifyIr(const IrFunction& fn, std::string& err);
+
+// Writes each function's blocks and instructions.
+void dumpIr(const IrProgram& program, SymbolTable& symbols, std::ostream& out);
+
+// The optimizations, each run on one function at a time; true if it
+// changed anything.
+enum IrPass {
+    PASS_SIMPLIFY_CFG,  // folds constant branches, merges and skips blocks, drops unreachable ones
+    PASS_SCCP,          // sparse conditional constant propagation (Wegman and Zadeck)
+    PASS_GVN,           // dominator-scoped global value numbering
+    PASS_DCE,           // removes instructions whose values are unused and that have no effect
+    PASS_TAIL_RECURSION,    // turns self tail calls, and x + f(...) and x * f(...), into a loop
+    PASS_INLINE,        // copies small functions that do not recurse into their callers
+    IR_PASS_COUNT
+};
+
+const char* irPassName(IrPass pass);
+bool runIrPass(IrPass pass, IrProgram& program, IrFunction& fn);
+
+// Runs a pipeline of passes over every function, repeating it while it
+// still changes something (up to a limit), and keeps time per pass. Which
+// functions are recursive is worked out again before every round.
+class PassManager {
+private:
+    std::vector<IrPass> pipeline;
+    std::vector<double> ms;         // by pass
+    std::vector<uint64_t> runs;
+    std::vector<uint64_t> changes;
+    bool verifying;
+
+public:
+    static const int MAX_ROUNDS = 4;
+
+    PassManager();
+    void add(IrPass pass) { pipeline.push_back(pass); }
+    // tail-recursion, inline, simplify-cfg, sccp, simplify-cfg, gvn, dce.
+    void addStandard();
+    // Checks the function after every pass (see verifyIr()).
+    void verifyEach() { verifying = true; }
+    bool run(IrProgram& program, std::string& err);
+
+    double milliseconds(IrPass pass) const { return ms[pass]; }
+    uint64_t runCount(IrPass pass) const { return runs[pass]; }
+    uint64_t changeCount(IrPass pass) const { return changes[pass]; }
+};
+
+// Lowers SSA form to bytecode for the VM or the native backend: each value
+// gets a register of its own, constants are loaded where they are used,
+// and phis become copies on the edges into their block. Blocks are laid out
+// in reverse postorder, and a branch on a comparison becomes one compare
+// and jump. False, with a message, if a function does not fit bytecode's
+// 16-bit operands.
+bool lowerIr(const IrProgram& program, BytecodeProgram& out, std::string& err);
+
+#endif
@@ -0,0 +1,464 @@
+#include "ir.h"
+#include <algorithm>
+
+// Operands are 16 bits wide.
+static const uint32_t OPERAND_LIMIT = 0xFFFF;
+
+namespace {
+
+class Lowering {
+private:
+    struct Patch {
+        size_t at;          // jump to fill in
+        uint32_t block;     // target, or stub if stub is set
+        bool stub;
+    };
+    struct Stub {
+        uint32_t from, to;  // edge whose phi copies it holds
+    };
+
+    const IrFunction& fn;
+    BytecodeFunction& out;
+    DominatorTree dom;
+    std::vector<uint32_t> reg;      // by value
+    std::vector<uint32_t> uses;     // by value
+    std::vector<uint32_t> position; // of each value in its block
+    std::vector<std::vector<uint32_t> > liveOut;    // by block
+    std::vector<uint32_t> leader;   // by value: the value whose register it shares
+    uint32_t base;                  // first scratch register, above every value
+    std::vector<uint32_t> labels;   // by block
+    std::vector<Patch> patches;
+    std::vector<Stub> stubs;
+    const char* failure;
+
+    void emit(Opcode op, uint32_t a, uint32_t b, uint32_t c) {
+        if (out.code.size() >= OPERAND_LIMIT) {
+            failure = "Function too large to run";
+            return;
+        }
+        Insn insn = { (uint16_t)op, (uint16_t)a, (uint16_t)b, (uint16_t)c };
+        out.code.push_back(insn);
+    }
+
+    void jump(Opcode op, uint32_t a, uint32_t b, uint32_t target, bool stub) {
+        Patch p = { out.code.size(), target, stub };
+        patches.push_back(p);
+        emit(op, a, b, 0);
+    }
+
+    void constant(uint32_t r, int32_t value) {
+        emit(OP_LOADK, r, (uint32_t)value & 0xFFFF, (uint32_t)value >> 16);
+    }
+
+    // The register holding v; a constant is loaded into scratch first.
+    uint32_t operand(uint32_t v, uint32_t scratch) {
+        const IrInsn& i = fn.insn(v);
+        if (i.op == IR_CONST) {
+            constant(scratch, i.imm);
+            return scratch;
+        }
+        return reg[v];
+    }
+
+    // The phi copies of an edge, done in parallel: a copy goes once nothing
+    // still needs its destination, and a cycle is broken through scratch.
+    void copies(uint32_t from, uint32_t to) {
+        uint32_t j = fn.predIndex(to, from);
+        std::vector<std::pair<uint32_t, uint32_t> > moves;     // destination, source register
+        std::vector<std::pair<uint32_t, int32_t> > loads;
+        for (uint32_t id = fn.blocks[to].first; id != IR_NONE && fn.insn(id).op == IR_PHI; id = fn.insn(id).next) {
+            uint32_t v = fn.insn(id).operands[j];
+            if (fn.insn(v).op == IR_CONST) {
+                loads.push_back(std::make_pair(reg[id], fn.insn(v).imm));
+            } else if (reg[v] != reg[id]) {
+                moves.push_back(std::make_pair(reg[id], reg[v]));
+            }
+        }
+        while (!moves.empty()) {
+            size_t k = 0;
+            for (; k < moves.size(); k++) {
+                bool needed = false;
+                for (size_t m = 0; m < moves.size() && !needed; m++) {
+                    needed = m != k && moves[m].second == moves[k].first;
+                }
+                if (!needed) {
+                    break;
+                }
+            }
+            if (k == moves.size()) {
+                uint32_t r = moves[0].second;
+                emit(OP_MOVE, base, r, 0);
+                for (size_t m = 0; m < moves.size(); m++) {
+                    if (moves[m].second == r) {
+                        moves[m].second = base;
+                    }
+                }
+                continue;
+            }
+            emit(OP_MOVE, moves[k].first, moves[k].second, 0);
+            moves.erase(moves.begin() + k);
+        }
+        for (size_t k = 0; k < loads.size(); k++) {
+            constant(loads[k].first, loads[k].second);
+        }
+    }
+
+    static bool isValue(const IrInsn& i) {
+        return i.op != IR_CONST && !irIsTerminator(i.op);
+    }
+
+    // Values live at the end of each block, found by walking back from
+    // every use to the definition (each list sorted, since values are taken
+    // in order). A phi's operand is used at the end of the predecessor it
+    // comes from, not in the phi's block.
+    void liveness() {
+        liveOut.assign(fn.blocks.size(), std::vector<uint32_t>());
+        std::vector<uint32_t> start(fn.insnCount() + 1, 0);
+        std::vector<uint32_t> users;    // block where each use is live-out or live-in
+        std::vector<bool> atEnd;
+        for (int pass = 0; pass < 2; pass++) {
+            std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+            for (size_t k = 0; k < dom.order.size(); k++) {
+                const IrBlock& blk = fn.blocks[dom.order[k]];
+                for (uint32_t id = blk.first; id != IR_NONE; id = fn.insn(id).next) {
+                    const IrInsn& i = fn.insn(id);
+                    for (uint32_t o = 0; o < i.count; o++) {
+                        uint32_t v = i.operands[o];
+                        if (pass == 0) {
+                            start[v + 1]++;
+                        } else {
+                            bool phi = i.op == IR_PHI;
+                            users[fill[v]] = phi ? blk.preds[o] : dom.order[k];
+                            atEnd[fill[v]++] = phi;
+                        }
+                    }
+                }
+            }
+            if (pass == 0) {
+                for (size_t v = 0; v + 1 < start.size(); v++) {
+                    start[v + 1] += start[v];
+                }
+                users.resize(start.back());
+                atEnd.resize(start.back());
+            }
+        }
+        std::vector<uint32_t> inMark(fn.blocks.size(), IR_NONE);
+        std::vector<uint32_t> work;
+        for (uint32_t v = 0; v < fn.insnCount(); v++) {
+            if (fn.insn(v).removed || !isValue(fn.insn(v))) {
+                continue;
+            }
+            uint32_t d = fn.insn(v).block;
+            for (uint32_t u = start[v]; u < start[v + 1]; u++) {
+                uint32_t b = users[u];
+                if (atEnd[u]) {
+                    if (liveOut[b].empty() || liveOut[b].back() != v) {
+                        liveOut[b].push_back(v);
+                    }
+                }
+                if (b != d && inMark[b] != v) {
+                    inMark[b] = v;
+                    work.push_back(b);
+                }
+            }
+            while (!work.empty()) {
+                const IrBlock& blk = fn.blocks[work.back()];
+                work.pop_back();
+                for (size_t j = 0; j < blk.preds.size(); j++) {
+                    uint32_t p = blk.preds[j];
+                    if (liveOut[p].empty() || liveOut[p].back() != v) {
+                        liveOut[p].push_back(v);
+                    }
+                    if (p != d && inMark[p] != v) {
+                        inMark[p] = v;
+                        work.push_back(p);
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether x is still needed just after y is defined.
+    bool liveAfter(uint32_t x, uint32_t y) const {
+        uint32_t b = fn.insn(y).block;
+        if (std::binary_search(liveOut[b].begin(), liveOut[b].end(), x)) {
+            return true;
+        }
+        for (uint32_t id = fn.insn(y).next; id != IR_NONE; id = fn.insn(id).next) {
+            const IrInsn& i = fn.insn(id);
+            if (i.op != IR_PHI && std::find(i.operands, i.operands + i.count, x) != i.operands + i.count) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool defines(uint32_t x, uint32_t y) const {
+        uint32_t bx = fn.insn(x).block;
+        uint32_t by = fn.insn(y).block;
+        return bx == by ? position[x] < position[y] : dom.dominates(bx, by);
+    }
+
+    // In SSA form two values are live at once exactly when one is live
+    // where the other, which its definition dominates, is defined. Phis of
+    // one block are all written on the same edges, dead or not.
+    bool interfere(uint32_t x, uint32_t y) const {
+        const IrInsn& i = fn.insn(x);
+        const IrInsn& j = fn.insn(y);
+        if (i.op == IR_PHI && j.op == IR_PHI && i.block == j.block) {
+            return true;
+        }
+        if (defines(x, y)) {
+            return liveAfter(x, y);
+        }
+        if (defines(y, x)) {
+            return liveAfter(y, x);
+        }
+        return false;
+    }
+
+    // Gives each phi the register of the operands it can share one with, so
+    // that their copies disappear. A group may hold one parameter at most,
+    // since parameters come in registers of their own.
+    void coalesce() {
+        leader.resize(fn.insnCount());
+        std::vector<std::vector<uint32_t> > members(fn.insnCount());
+        for (uint32_t id = 0; id < fn.insnCount(); id++) {
+            leader[id] = id;
+            members[id].push_back(id);
+        }
+        for (size_t k = 0; k < dom.order.size(); k++) {
+            const IrBlock& blk = fn.blocks[dom.order[k]];
+            for (uint32_t p = blk.first; p != IR_NONE && fn.insn(p).op == IR_PHI; p = fn.insn(p).next) {
+                const IrInsn& phi = fn.insn(p);
+                for (uint32_t o = 0; o < phi.count; o++) {
+                    uint32_t a = leader[phi.operands[o]];
+                    uint32_t c = leader[p];
+                    if (a == c || !isValue(fn.insn(a))) {
+                        continue;
+                    }
+                    bool clash = false;
+                    bool params = false;
+                    for (size_t m = 0; m < members[a].size() && !clash; m++) {
+                        params = params || fn.insn(members[a][m]).op == IR_PARAM;
+                        for (size_t n = 0; n < members[c].size() && !clash; n++) {
+                            clash = interfere(members[a][m], members[c][n]) ||
+                                    (fn.insn(members[c][n]).op == IR_PARAM && params);
+                        }
+                    }
+                    if (clash) {
+                        continue;
+                    }
+                    if (fn.insn(a).op == IR_PARAM || (fn.insn(c).op != IR_PARAM && params)) {
+                        std::swap(a, c);
+                    }
+                    // c keeps its place as leader; a parameter leads its group.
+                    for (size_t m = 0; m < members[a].size(); m++) {
+                        leader[members[a][m]] = c;
+                        members[c].push_back(members[a][m]);
+                    }
+                    members[a].clear();
+                }
+            }
+        }
+    }
+
+    static bool hasPhis(const IrFunction& fn, uint32_t block) {
+        uint32_t first = fn.blocks[block].first;
+        return first != IR_NONE && fn.insn(first).op == IR_PHI;
+    }
+
+    static Opcode comparisonJump(uint32_t op, bool when) {
+        switch (op) {
+        case IR_LT: return when ? OP_JLT : OP_JGE;
+        case IR_LE: return when ? OP_JLE : OP_JGT;
+        case IR_GT: return when ? OP_JGT : OP_JLE;
+        case IR_GE: return when ? OP_JGE : OP_JLT;
+        case IR_EQ: return when ? OP_JEQ : OP_JNE;
+        default: return when ? OP_JNE : OP_JEQ;
+        }
+    }
+
+    // A comparison used only by the branch ending its block is not
+    // computed; the branch compares and jumps instead.
+    bool fused(uint32_t id) const {
+        const IrInsn& i = fn.insn(id);
+        if (i.op < IR_LT || i.op > IR_NE || uses[id] != 1) {
+            return false;
+        }
+        const IrInsn& end = fn.insn(fn.blocks[i.block].last);
+        return end.op == IR_BR && end.operands[0] == id;
+    }
+
+    // Jumps to target when the condition is when.
+    void branchOn(uint32_t cond, bool when, uint32_t target, bool stub) {
+        const IrInsn& c = fn.insn(cond);
+        if (fused(cond)) {
+            uint32_t l = operand(c.operands[0], base);
+            uint32_t r = operand(c.operands[1], base + 1);
+            jump(comparisonJump(c.op, when), l, r, target, stub);
+        } else {
+            jump(when ? OP_JNZ : OP_JZ, operand(cond, base), 0, target, stub);
+        }
+    }
+
+    void block(uint32_t b, uint32_t next) {
+        labels[b] = (uint32_t)out.code.size();
+        const IrBlock& blk = fn.blocks[b];
+        for (uint32_t id = blk.first; id != IR_NONE; id = fn.insn(id).next) {
+            const IrInsn& i = fn.insn(id);
+            switch (i.op) {
+            case IR_CONST:
+            case IR_PARAM:
+            case IR_PHI:
+                break;
+            case IR_NEG:
+                emit(OP_NEG, reg[id], operand(i.operands[0], base), 0);
+                break;
+            case IR_NOT:
+                emit(OP_NOT, reg[id], operand(i.operands[0], base), 0);
+                break;
+            case IR_CALL:
+                for (uint32_t k = 0; k < i.count; k++) {
+                    const IrInsn& arg = fn.insn(i.operands[k]);
+                    if (arg.op == IR_CONST) {
+                        constant(base + k, arg.imm);
+                    } else {
+                        emit(OP_MOVE, base + k, reg[i.operands[k]], 0);
+                    }
+                }
+                if ((uint32_t)i.imm > OPERAND_LIMIT) {
+                    failure = "Program too large to run";
+                }
+                emit(OP_CALL, reg[id], (uint32_t)i.imm, base);
+                break;
+            case IR_RET:
+                emit(OP_RET, operand(i.operands[0], base), 0, 0);
+                break;
+            case IR_JMP:
+                copies(b, blk.succ[0]);
+                if (blk.succ[0] != next) {
+                    jump(OP_JMP, 0, 0, blk.succ[0], false);
+                }
+                break;
+            case IR_BR: {
+                uint32_t yes = blk.succ[0];
+                uint32_t no = blk.succ[1];
+                if (yes == next && !hasPhis(fn, yes) && !hasPhis(fn, no)) {
+                    branchOn(i.operands[0], false, no, false);
+                    break;
+                }
+                if (hasPhis(fn, yes)) {
+                    Stub s = { b, yes };
+                    stubs.push_back(s);
+                    branchOn(i.operands[0], true, (uint32_t)stubs.size() - 1, true);
+                } else {
+                    branchOn(i.operands[0], true, yes, false);
+                }
+                copies(b, no);
+                if (no != next) {
+                    jump(OP_JMP, 0, 0, no, false);
+                }
+                break;
+            }
+            default:
+                if (!fused(id)) {
+                    uint32_t l = operand(i.operands[0], base);
+                    uint32_t r = operand(i.operands[1], base + 1);
+                    emit((Opcode)(OP_ADD + (i.op - IR_ADD)), reg[id], l, r);
+                }
+                break;
+            }
+        }
+    }
+
+public:
+    Lowering(const IrFunction& f, BytecodeFunction& o) : fn(f), out(o), base(0), failure(NULL) {}
+
+    const char* run() {
+        out.sym = fn.sym;
+        out.params = fn.params;
+        out.code.clear();
+        dom.build(fn);
+        reg.assign(fn.insnCount(), IR_NONE);
+        uses.assign(fn.insnCount(), 0);
+        position.assign(fn.insnCount(), 0);
+        uint32_t args = 2;
+        uint32_t least = 0;    // instructions of bytecode there will be at least
+        for (size_t k = 0; k < dom.order.size(); k++) {
+            const IrBlock& blk = fn.blocks[dom.order[k]];
+            uint32_t n = 0;
+            for (uint32_t id = blk.first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                position[id] = n++;
+                least += (i.op >= IR_ADD && i.op <= IR_CALL) || i.op == IR_RET;
+                if (i.op == IR_CALL) {
+                    args = std::max(args, i.count);
+                }
+                for (uint32_t o = 0; o < i.count; o++) {
+                    uses[i.operands[o]]++;
+                }
+            }
+        }
+        // Every operation and return takes an instruction (a comparison
+        // fused into a jump takes the jump's); give up before liveness.
+        if (least > OPERAND_LIMIT) {
+            return "Function too large to run";
+        }
+        liveness();
+        coalesce();
+        uint32_t next = fn.params;
+        for (size_t k = 0; k < dom.order.size(); k++) {
+            const IrBlock& blk = fn.blocks[dom.order[k]];
+            for (uint32_t id = blk.first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                if (!isValue(i)) {
+                    continue;
+                }
+                uint32_t l = leader[id];
+                if (reg[l] == IR_NONE) {
+                    reg[l] = fn.insn(l).op == IR_PARAM ? (uint32_t)fn.insn(l).imm : next++;
+                }
+                reg[id] = reg[l];
+            }
+        }
+        base = next;
+        if ((uint64_t)base + args > OPERAND_LIMIT) {
+            return "Function too large to run";
+        }
+        out.registers = base + args;
+        labels.assign(fn.blocks.size(), 0);
+        for (size_t k = 0; k < dom.order.size(); k++) {
+            block(dom.order[k], k + 1 < dom.order.size() ? dom.order[k + 1] : IR_NONE);
+        }
+        std::vector<uint32_t> stubLabels;
+        for (size_t s = 0; s < stubs.size(); s++) {
+            stubLabels.push_back((uint32_t)out.code.size());
+            copies(stubs[s].from, stubs[s].to);
+            jump(OP_JMP, 0, 0, stubs[s].to, false);
+        }
+        for (size_t p = 0; p < patches.size(); p++) {
+            if (patches[p].at < out.code.size()) {
+                out.code[patches[p].at].c = (uint16_t)(patches[p].stub ? stubLabels[patches[p].block] : labels[patches[p].block]);
+            }
+        }
+        return failure;
+    }
+};
+
+}
+
+bool lowerIr(const IrProgram& program, BytecodeProgram& out, std::string& err) {
+    out.functions.clear();
+    out.functions.resize(program.functions.size());
+    out.main = program.main;
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        Lowering lowering(*program.functions[f], out.functions[f]);
+        const char* failure = lowering.run();
+        if (failure != NULL) {
+            err = failure;
+            return false;
+        }
+    }
+    return true;
+}
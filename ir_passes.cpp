@@ -0,0 +1,1083 @@
+#include "ir.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+const int PassManager::MAX_ROUNDS;
+
+static const char* const passNames[IR_PASS_COUNT] = {
+    "simplify-cfg", "sccp", "gvn", "dce", "tail-recursion", "inline"
+};
+
+const char* irPassName(IrPass pass) {
+    return passNames[pass];
+}
+
+static bool isBinary(uint32_t op) {
+    return op >= IR_ADD && op <= IR_NE;
+}
+
+static bool isCommutative(uint32_t op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_EQ || op == IR_NE;
+}
+
+// ToyC's arithmetic on 32-bit values, as the VM does it. False for
+// division by zero, which is left to happen at run time.
+static bool fold(uint32_t op, uint32_t x, uint32_t y, uint32_t& out) {
+    switch (op) {
+    case IR_ADD: out = x + y; return true;
+    case IR_SUB: out = x - y; return true;
+    case IR_MUL: out = x * y; return true;
+    case IR_DIV:
+    case IR_MOD:
+        if (y == 0) {
+            return false;
+        }
+        if ((int32_t)y == -1) {
+            out = op == IR_DIV ? 0u - x : 0;
+        } else {
+            out = op == IR_DIV ? (uint32_t)((int32_t)x / (int32_t)y) : (uint32_t)((int32_t)x % (int32_t)y);
+        }
+        return true;
+    case IR_LT: out = (int32_t)x < (int32_t)y; return true;
+    case IR_LE: out = (int32_t)x <= (int32_t)y; return true;
+    case IR_GT: out = (int32_t)x > (int32_t)y; return true;
+    case IR_GE: out = (int32_t)x >= (int32_t)y; return true;
+    case IR_EQ: out = x == y; return true;
+    case IR_NE: out = x != y; return true;
+    case IR_NEG: out = 0u - x; return true;
+    case IR_NOT: out = x == 0; return true;
+    default: return false;
+    }
+}
+
+// Replaces a block's terminator with a jump to its only remaining
+// successor, dropping the edge to the other.
+static void jumpTo(IrFunction& fn, uint32_t b, uint32_t target) {
+    IrBlock& block = fn.blocks[b];
+    uint32_t other = block.succ[0] == target ? block.succ[1] : block.succ[0];
+    uint32_t jmp = fn.add(IR_JMP, 0, 0);
+    fn.insertBefore(block.last, jmp);
+    fn.remove(block.last);
+    fn.removeEdge(b, other);
+}
+
+static void markReachable(const IrFunction& fn, std::vector<bool>& seen) {
+    seen.assign(fn.blocks.size(), false);
+    std::vector<uint32_t> work(1, 0);
+    seen[0] = true;
+    while (!work.empty()) {
+        const IrBlock& b = fn.blocks[work.back()];
+        work.pop_back();
+        for (uint32_t s = 0; s < b.succCount; s++) {
+            if (!seen[b.succ[s]]) {
+                seen[b.succ[s]] = true;
+                work.push_back(b.succ[s]);
+            }
+        }
+    }
+}
+
+static void addPhiOperand(IrFunction& fn, uint32_t phi, uint32_t value) {
+    const IrInsn& i = fn.insn(phi);
+    std::vector<uint32_t> operands(i.operands, i.operands + i.count);
+    operands.push_back(value);
+    fn.setOperands(phi, &operands[0], (uint32_t)operands.size());
+}
+
+// Gives block to the successors of from, which is left with none.
+static void moveSuccessors(IrFunction& fn, uint32_t from, uint32_t to) {
+    IrBlock& source = fn.blocks[from];
+    IrBlock& target = fn.blocks[to];
+    for (uint32_t k = 0; k < source.succCount; k++) {
+        std::vector<uint32_t>& preds = fn.blocks[source.succ[k]].preds;
+        *std::find(preds.begin(), preds.end(), from) = to;
+        target.succ[k] = source.succ[k];
+        source.succ[k] = IR_NONE;
+    }
+    target.succCount = source.succCount;
+    source.succCount = 0;
+}
+
+static bool removeUnreachable(IrFunction& fn) {
+    std::vector<bool> seen;
+    markReachable(fn, seen);
+    bool changed = false;
+    for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+        if (!seen[b] && !fn.blocks[b].removed) {
+            fn.removeBlock(b);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Users of every value, in compressed sparse row form: the users of v are
+// users[start[v]] .. users[start[v + 1]].
+struct DefUse {
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> users;
+
+    void build(const IrFunction& fn) {
+        start.assign(fn.insnCount() + 1, 0);
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                for (uint32_t k = 0; k < i.count; k++) {
+                    start[i.operands[k] + 1]++;
+                }
+            }
+        }
+        for (size_t v = 0; v + 1 < start.size(); v++) {
+            start[v + 1] += start[v];
+        }
+        users.assign(start.back(), 0);
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                for (uint32_t k = 0; k < i.count; k++) {
+                    users[fill[i.operands[k]]++] = id;
+                }
+            }
+        }
+    }
+};
+
+// Sparse conditional constant propagation: values start unknown (TOP) and
+// only move down, to one constant and then to varying (BOTTOM), while
+// blocks are only visited once an edge into them is found executable.
+class Sccp {
+private:
+    enum { TOP, CONSTANT, BOTTOM };
+    struct Cell {
+        uint8_t state;
+        uint32_t value;
+    };
+
+    IrFunction& fn;
+    DefUse uses;
+    std::vector<Cell> cells;
+    std::vector<bool> executable;               // by block
+    std::vector<std::vector<bool> > edges;      // by block, by predecessor
+    std::vector<uint32_t> blockWork;
+    std::vector<uint32_t> valueWork;
+
+    void lower(uint32_t id, uint8_t state, uint32_t value) {
+        Cell& c = cells[id];
+        if (c.state == state && (state != CONSTANT || c.value == value)) {
+            return;
+        }
+        if (c.state == CONSTANT && state == CONSTANT) {
+            state = BOTTOM;
+        }
+        c.state = state;
+        c.value = value;
+        valueWork.push_back(id);
+    }
+
+    void markEdge(uint32_t from, uint32_t to) {
+        uint32_t j = fn.predIndex(to, from);
+        if (edges[to][j]) {
+            return;
+        }
+        edges[to][j] = true;
+        if (!executable[to]) {
+            executable[to] = true;
+            blockWork.push_back(to);
+            return;
+        }
+        for (uint32_t id = fn.blocks[to].first; id != IR_NONE && fn.insn(id).op == IR_PHI; id = fn.insn(id).next) {
+            visit(id);
+        }
+    }
+
+    void visit(uint32_t id) {
+        const IrInsn& i = fn.insn(id);
+        switch (i.op) {
+        case IR_CONST:
+            lower(id, CONSTANT, (uint32_t)i.imm);
+            break;
+        case IR_PARAM:
+        case IR_CALL:
+            lower(id, BOTTOM, 0);
+            break;
+        case IR_PHI: {
+            uint8_t state = TOP;
+            uint32_t value = 0;
+            for (uint32_t k = 0; k < i.count && state != BOTTOM; k++) {
+                const Cell& c = cells[i.operands[k]];
+                if (!edges[i.block][k] || c.state == TOP) {
+                    continue;
+                }
+                if (c.state == BOTTOM || (state == CONSTANT && c.value != value)) {
+                    state = BOTTOM;
+                } else {
+                    state = CONSTANT;
+                    value = c.value;
+                }
+            }
+            if (state != TOP) {
+                lower(id, state, value);
+            }
+            break;
+        }
+        case IR_JMP:
+            markEdge(i.block, fn.blocks[i.block].succ[0]);
+            break;
+        case IR_BR: {
+            const Cell& c = cells[i.operands[0]];
+            if (c.state == BOTTOM || c.state == CONSTANT) {
+                const IrBlock& b = fn.blocks[i.block];
+                if (c.state == BOTTOM || c.value != 0) {
+                    markEdge(i.block, b.succ[0]);
+                }
+                if (c.state == BOTTOM || c.value == 0) {
+                    markEdge(i.block, b.succ[1]);
+                }
+            }
+            break;
+        }
+        case IR_RET:
+            break;
+        default: {
+            const Cell& x = cells[i.operands[0]];
+            if (i.op == IR_NEG || i.op == IR_NOT) {
+                uint32_t out;
+                if (x.state == CONSTANT && fold(i.op, x.value, 0, out)) {
+                    lower(id, CONSTANT, out);
+                } else if (x.state == BOTTOM) {
+                    lower(id, BOTTOM, 0);
+                }
+                break;
+            }
+            const Cell& y = cells[i.operands[1]];
+            uint32_t out;
+            if (i.op == IR_MUL && ((x.state == CONSTANT && x.value == 0) || (y.state == CONSTANT && y.value == 0))) {
+                lower(id, CONSTANT, 0);
+            } else if (x.state == CONSTANT && y.state == CONSTANT) {
+                if (fold(i.op, x.value, y.value, out)) {
+                    lower(id, CONSTANT, out);
+                } else {
+                    lower(id, BOTTOM, 0);
+                }
+            } else if (x.state == BOTTOM || y.state == BOTTOM) {
+                lower(id, BOTTOM, 0);
+            }
+            break;
+        }
+        }
+    }
+
+public:
+    explicit Sccp(IrFunction& f) : fn(f) {}
+
+    bool run() {
+        uses.build(fn);
+        Cell top = { TOP, 0 };
+        cells.assign(fn.insnCount(), top);
+        executable.assign(fn.blocks.size(), false);
+        edges.resize(fn.blocks.size());
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            edges[b].assign(fn.blocks[b].preds.size(), false);
+        }
+        executable[0] = true;
+        blockWork.push_back(0);
+        while (!blockWork.empty() || !valueWork.empty()) {
+            if (!valueWork.empty()) {
+                uint32_t v = valueWork.back();
+                valueWork.pop_back();
+                for (uint32_t u = uses.start[v]; u < uses.start[v + 1]; u++) {
+                    if (executable[fn.insn(uses.users[u]).block]) {
+                        visit(uses.users[u]);
+                    }
+                }
+                continue;
+            }
+            uint32_t b = blockWork.back();
+            blockWork.pop_back();
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                visit(id);
+            }
+        }
+
+        bool changed = false;
+        std::vector<uint32_t> with(fn.insnCount(), IR_NONE);
+        std::map<uint32_t, uint32_t> constants;
+        std::vector<std::pair<uint32_t, uint32_t> > jumps;     // block, only target
+        for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+            if (!executable[b]) {
+                continue;
+            }
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                if (cells[id].state != CONSTANT || i.op == IR_CONST) {
+                    continue;
+                }
+                std::map<uint32_t, uint32_t>::iterator c = constants.find(cells[id].value);
+                if (c == constants.end()) {
+                    c = constants.insert(std::make_pair(cells[id].value, fn.constant((int32_t)cells[id].value))).first;
+                }
+                with[id] = c->second;
+                changed = true;
+            }
+            const IrBlock& block = fn.blocks[b];
+            if (block.succCount == 2) {
+                bool yes = edges[block.succ[0]][fn.predIndex(block.succ[0], b)];
+                bool no = edges[block.succ[1]][fn.predIndex(block.succ[1], b)];
+                if (yes != no) {
+                    jumps.push_back(std::make_pair(b, yes ? block.succ[0] : block.succ[1]));
+                }
+            }
+        }
+        // Edges are only dropped once no more of them will be looked up.
+        for (size_t j = 0; j < jumps.size(); j++) {
+            jumpTo(fn, jumps[j].first, jumps[j].second);
+            changed = true;
+        }
+        for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+            if (!executable[b] && !fn.blocks[b].removed) {
+                fn.removeBlock(b);
+                changed = true;
+            }
+        }
+        fn.replaceUses(with);
+        return changed;
+    }
+};
+
+// Marks everything that has an effect and everything it uses, and removes
+// the rest.
+static bool eliminateDeadCode(IrFunction& fn) {
+    std::vector<bool> live(fn.insnCount(), false);
+    std::vector<uint32_t> work;
+    for (size_t b = 0; b < fn.blocks.size(); b++) {
+        for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+            if (irHasEffect(fn, fn.insn(id))) {
+                live[id] = true;
+                work.push_back(id);
+            }
+        }
+    }
+    while (!work.empty()) {
+        const IrInsn& i = fn.insn(work.back());
+        work.pop_back();
+        for (uint32_t k = 0; k < i.count; k++) {
+            if (!live[i.operands[k]]) {
+                live[i.operands[k]] = true;
+                work.push_back(i.operands[k]);
+            }
+        }
+    }
+    bool changed = false;
+    for (size_t b = 0; b < fn.blocks.size(); b++) {
+        for (uint32_t id = fn.blocks[b].first, next; id != IR_NONE; id = next) {
+            next = fn.insn(id).next;
+            if (!live[id]) {
+                fn.remove(id);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Global value numbering over the dominator tree: an instruction computing
+// what one in a dominating block (or earlier in its own) already computed
+// is replaced by it. Calls are numbered too, since a ToyC function's result
+// depends only on its arguments. A scoped table is kept with an undo log,
+// as for variables in the builder.
+class Gvn {
+private:
+    IrFunction& fn;
+    DominatorTree dom;
+    std::unordered_multimap<uint64_t, uint32_t> table;
+    std::vector<std::pair<uint64_t, uint32_t> > undo;
+    std::vector<uint32_t> with;
+
+    uint32_t resolve(uint32_t v) const {
+        while (v < with.size() && with[v] != IR_NONE) {
+            v = with[v];
+        }
+        return v;
+    }
+
+    uint64_t hash(const IrInsn& i) const {
+        uint64_t h = (uint64_t)i.op * 0x9E3779B97F4A7C15ull ^ (uint32_t)i.imm;
+        if (i.op == IR_PHI) {
+            h ^= (uint64_t)i.block << 32;
+        }
+        for (uint32_t k = 0; k < i.count; k++) {
+            h = (h ^ i.operands[k]) * 0x100000001B3ull;
+        }
+        return h;
+    }
+
+    bool same(const IrInsn& a, const IrInsn& b) const {
+        if (a.op != b.op || a.imm != b.imm || a.count != b.count || (a.op == IR_PHI && a.block != b.block)) {
+            return false;
+        }
+        return std::equal(a.operands, a.operands + a.count, b.operands);
+    }
+
+    bool isConstant(uint32_t v, int32_t value) const {
+        return fn.insn(v).op == IR_CONST && fn.insn(v).imm == value;
+    }
+
+    // x + 0, x - 0, x * 1, x / 1 and phis that can only be one value.
+    uint32_t identity(uint32_t id) const {
+        const IrInsn& i = fn.insn(id);
+        if (i.op == IR_PHI) {
+            uint32_t only = IR_NONE;
+            for (uint32_t k = 0; k < i.count; k++) {
+                uint32_t v = i.operands[k];
+                if (v == id || v == only) {
+                    continue;
+                }
+                if (only != IR_NONE) {
+                    return IR_NONE;
+                }
+                only = v;
+            }
+            return only;
+        }
+        if (!isBinary(i.op)) {
+            return IR_NONE;
+        }
+        uint32_t x = i.operands[0];
+        uint32_t y = i.operands[1];
+        switch (i.op) {
+        case IR_ADD:
+            return isConstant(y, 0) ? x : isConstant(x, 0) ? y : IR_NONE;
+        case IR_SUB:
+            return isConstant(y, 0) ? x : IR_NONE;
+        case IR_MUL:
+            return isConstant(y, 1) ? x : isConstant(x, 1) ? y : IR_NONE;
+        case IR_DIV:
+            return isConstant(y, 1) ? x : IR_NONE;
+        default:
+            return IR_NONE;
+        }
+    }
+
+    bool number(uint32_t id) {
+        IrInsn& i = fn.insn(id);
+        for (uint32_t k = 0; k < i.count; k++) {
+            i.operands[k] = resolve(i.operands[k]);
+        }
+        if (irIsTerminator(i.op) || i.op == IR_PARAM) {
+            return false;
+        }
+        if (isCommutative(i.op) && i.operands[0] > i.operands[1]) {
+            std::swap(i.operands[0], i.operands[1]);
+        }
+        uint32_t simpler = identity(id);
+        if (simpler != IR_NONE) {
+            with[id] = simpler;
+            return true;
+        }
+        uint64_t h = hash(i);
+        typedef std::unordered_multimap<uint64_t, uint32_t>::iterator Iterator;
+        std::pair<Iterator, Iterator> range = table.equal_range(h);
+        for (Iterator it = range.first; it != range.second; ++it) {
+            if (same(fn.insn(it->second), i)) {
+                with[id] = it->second;
+                return true;
+            }
+        }
+        table.insert(std::make_pair(h, id));
+        undo.push_back(std::make_pair(h, id));
+        return false;
+    }
+
+public:
+    explicit Gvn(IrFunction& f) : fn(f) {}
+
+    bool run() {
+        dom.build(fn);
+        with.assign(fn.insnCount(), IR_NONE);
+        bool changed = false;
+        struct Visit {
+            uint32_t block;
+            size_t mark;    // undo size on entry; IR_NONE: not entered yet
+        };
+        std::vector<Visit> stack;
+        Visit root = { 0, (size_t)IR_NONE };
+        stack.push_back(root);
+        while (!stack.empty()) {
+            Visit visit = stack.back();
+            stack.pop_back();
+            if (visit.mark != (size_t)IR_NONE) {
+                while (undo.size() > visit.mark) {
+                    typedef std::unordered_multimap<uint64_t, uint32_t>::iterator Iterator;
+                    std::pair<Iterator, Iterator> range = table.equal_range(undo.back().first);
+                    for (Iterator it = range.first; it != range.second; ++it) {
+                        if (it->second == undo.back().second) {
+                            table.erase(it);
+                            break;
+                        }
+                    }
+                    undo.pop_back();
+                }
+                continue;
+            }
+            uint32_t b = visit.block;
+            Visit leave = { b, undo.size() };
+            stack.push_back(leave);
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                changed = number(id) || changed;
+            }
+            for (uint32_t c = dom.childEnd(b); c > dom.childBegin(b); c--) {
+                Visit child = { dom.children[c - 1], (size_t)IR_NONE };
+                stack.push_back(child);
+            }
+        }
+        fn.replaceUses(with);
+        return changed;
+    }
+};
+
+// Moves the instructions of s, except its phis, to the end of b.
+static void splice(IrFunction& fn, uint32_t b, uint32_t s) {
+    uint32_t first = fn.blocks[s].first;
+    while (first != IR_NONE && fn.insn(first).op == IR_PHI) {
+        first = fn.insn(first).next;
+    }
+    if (first == IR_NONE) {
+        return;
+    }
+    uint32_t last = fn.blocks[s].last;
+    for (uint32_t id = first; id != IR_NONE; id = fn.insn(id).next) {
+        fn.insn(id).block = b;
+    }
+    uint32_t before = fn.insn(first).prev;
+    if (before == IR_NONE) {
+        fn.blocks[s].first = IR_NONE;
+    } else {
+        fn.insn(before).next = IR_NONE;
+    }
+    fn.blocks[s].last = before;
+    IrBlock& block = fn.blocks[b];
+    fn.insn(first).prev = block.last;
+    if (block.last == IR_NONE) {
+        block.first = first;
+    } else {
+        fn.insn(block.last).next = first;
+    }
+    block.last = last;
+}
+
+// A block whose only predecessor jumps only to it is appended to that
+// predecessor; its phis then have one operand each and are replaced by it.
+static bool mergeBlocks(IrFunction& fn, std::vector<uint32_t>& with) {
+    bool changed = false;
+    for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+        while (!fn.blocks[b].removed && fn.blocks[b].succCount == 1) {
+            uint32_t s = fn.blocks[b].succ[0];
+            IrBlock& succ = fn.blocks[s];
+            if (s == b || s == 0 || succ.preds.size() != 1) {
+                break;
+            }
+            for (uint32_t id = succ.first; id != IR_NONE && fn.insn(id).op == IR_PHI; id = fn.insn(id).next) {
+                with[id] = fn.insn(id).operands[0];
+            }
+            fn.remove(fn.blocks[b].last);
+            fn.blocks[b].succCount = 0;
+            fn.blocks[b].succ[0] = IR_NONE;
+            splice(fn, b, s);
+            for (uint32_t k = 0; k < succ.succCount; k++) {
+                IrBlock& next = fn.blocks[succ.succ[k]];
+                *std::find(next.preds.begin(), next.preds.end(), s) = b;
+                fn.blocks[b].succ[k] = succ.succ[k];
+                succ.succ[k] = IR_NONE;
+            }
+            fn.blocks[b].succCount = succ.succCount;
+            succ.succCount = 0;
+            succ.preds.clear();
+            succ.removed = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Sends the predecessors of a block that holds nothing but a jump straight
+// to its target, unless that would give the target the same predecessor
+// twice.
+static bool skipEmptyBlocks(IrFunction& fn) {
+    bool changed = false;
+    for (uint32_t e = 1; e < fn.blocks.size(); e++) {
+        IrBlock& empty = fn.blocks[e];
+        if (empty.removed || empty.first != empty.last || empty.succCount != 1 || empty.succ[0] == e) {
+            continue;
+        }
+        uint32_t t = empty.succ[0];
+        uint32_t from = fn.predIndex(t, e);
+        for (size_t j = 0; j < empty.preds.size();) {
+            uint32_t p = empty.preds[j];
+            if (fn.predIndex(t, p) != IR_NONE) {
+                j++;
+                continue;
+            }
+            IrBlock& pred = fn.blocks[p];
+            *std::find(pred.succ, pred.succ + pred.succCount, e) = t;
+            empty.preds.erase(empty.preds.begin() + j);
+            fn.blocks[t].preds.push_back(p);
+            for (uint32_t id = fn.blocks[t].first; id != IR_NONE && fn.insn(id).op == IR_PHI; id = fn.insn(id).next) {
+                IrInsn& phi = fn.insn(id);
+                std::vector<uint32_t> operands(phi.operands, phi.operands + phi.count);
+                operands.push_back(operands[from]);
+                fn.setOperands(id, &operands[0], (uint32_t)operands.size());
+            }
+            changed = true;
+        }
+        if (empty.preds.empty()) {
+            fn.removeBlock(e);
+        }
+    }
+    return changed;
+}
+
+static bool simplifyCfg(IrFunction& fn) {
+    bool changed = false;
+    for (bool again = true; again;) {
+        again = false;
+        for (uint32_t b = 0; b < fn.blocks.size(); b++) {
+            IrBlock& block = fn.blocks[b];
+            if (block.removed || block.succCount != 2) {
+                continue;
+            }
+            IrInsn& br = fn.insn(block.last);
+            const IrInsn& cond = fn.insn(br.operands[0]);
+            if (cond.op == IR_CONST) {
+                jumpTo(fn, b, cond.imm != 0 ? block.succ[0] : block.succ[1]);
+                again = true;
+            } else if (cond.op == IR_NOT) {
+                br.operands[0] = cond.operands[0];
+                std::swap(block.succ[0], block.succ[1]);
+                again = true;
+            }
+        }
+        again = removeUnreachable(fn) || again;
+        std::vector<uint32_t> with(fn.insnCount(), IR_NONE);
+        again = mergeBlocks(fn, with) || again;
+        fn.replaceUses(with);
+        again = skipEmptyBlocks(fn) || again;
+        changed = changed || again;
+    }
+    return changed;
+}
+
+// Self calls whose result is returned as it is become jumps back to a loop
+// header just after the entry, with a phi per parameter for the arguments,
+// so that deep recursion runs in one frame. So do calls whose result is
+// added to (or multiplied by) a value worked out before them: the pending
+// sum (or product) is carried in one more phi, which every other return
+// then adds in. Only pure instructions may come between such a call and
+// its return, so nothing is done in a different order.
+class TailRecursion {
+private:
+    struct Site {
+        uint32_t ret;
+        uint32_t call;
+        uint32_t combine;   // the add or multiply; IR_NONE if none
+        uint32_t other;     // its other operand
+    };
+
+    IrFunction& fn;
+    uint32_t self;
+    std::vector<uint32_t> uses;
+    std::vector<Site> sites;
+    IrOp accumulate;        // IR_ADD or IR_MUL once a site needs it
+
+    bool selfCall(uint32_t id, uint32_t block) const {
+        const IrInsn& i = fn.insn(id);
+        return i.op == IR_CALL && (uint32_t)i.imm == self && i.block == block && uses[id] == 1;
+    }
+
+    void find(uint32_t ret) {
+        const IrInsn& r = fn.insn(ret);
+        const IrInsn& value = fn.insn(r.operands[0]);
+        Site site;
+        site.ret = ret;
+        site.call = r.operands[0];
+        site.combine = site.other = IR_NONE;
+        if (!selfCall(site.call, r.block)) {
+            if ((value.op != IR_ADD && value.op != IR_MUL) || value.block != r.block || uses[r.operands[0]] != 1) {
+                return;
+            }
+            if (accumulate != IR_OP_COUNT && value.op != accumulate) {
+                return;
+            }
+            site.combine = r.operands[0];
+            site.call = IR_NONE;
+            // Of two self calls, the later one is the tail call.
+            for (uint32_t id = fn.insn(ret).prev; id != IR_NONE; id = fn.insn(id).prev) {
+                if (id == value.operands[0] || id == value.operands[1]) {
+                    site.call = id;
+                    break;
+                }
+            }
+            site.other = value.operands[0] == site.call ? value.operands[1] : value.operands[0];
+            if (site.call == IR_NONE || site.other == site.call || !selfCall(site.call, r.block)) {
+                return;
+            }
+        }
+        for (uint32_t id = fn.insn(ret).prev; id != site.call; id = fn.insn(id).prev) {
+            if (id != site.combine && irHasEffect(fn, fn.insn(id))) {
+                return;
+            }
+        }
+        if (site.combine != IR_NONE) {
+            accumulate = (IrOp)value.op;
+        }
+        sites.push_back(site);
+    }
+
+    // Moves what the entry does into a new block after it, leaving the
+    // parameters and constants, and returns that block.
+    uint32_t splitEntry() {
+        uint32_t header = fn.newBlock();
+        for (uint32_t id = fn.blocks[0].first, next; id != IR_NONE; id = next) {
+            next = fn.insn(id).next;
+            if (fn.insn(id).op != IR_PARAM && fn.insn(id).op != IR_CONST) {
+                fn.detach(id);
+                fn.append(header, id);
+            }
+        }
+        moveSuccessors(fn, 0, header);
+        fn.append(0, fn.add(IR_JMP, 0, 0));
+        fn.addEdge(0, header);
+        return header;
+    }
+
+public:
+    TailRecursion(IrFunction& function, uint32_t index) : fn(function), self(index), accumulate(IR_OP_COUNT) {}
+
+    bool run() {
+        uses.assign(fn.insnCount(), 0);
+        std::vector<uint32_t> rets;
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                const IrInsn& i = fn.insn(id);
+                for (uint32_t k = 0; k < i.count; k++) {
+                    uses[i.operands[k]]++;
+                }
+                if (i.op == IR_RET) {
+                    rets.push_back(id);
+                }
+            }
+        }
+        for (size_t k = 0; k < rets.size(); k++) {
+            find(rets[k]);
+        }
+        if (sites.empty()) {
+            return false;
+        }
+
+        uint32_t header = splitEntry();
+        std::vector<uint32_t> phis(fn.params, IR_NONE);
+        std::vector<uint32_t> params(fn.params, IR_NONE);
+        for (uint32_t id = fn.blocks[0].first; id != IR_NONE; id = fn.insn(id).next) {
+            if (fn.insn(id).op == IR_PARAM) {
+                params[fn.insn(id).imm] = id;
+                phis[fn.insn(id).imm] = fn.add(IR_PHI, 0, 1);
+            }
+        }
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                IrInsn& i = fn.insn(id);
+                for (uint32_t k = 0; k < i.count; k++) {
+                    const IrInsn& v = fn.insn(i.operands[k]);
+                    if (v.op == IR_PARAM) {
+                        i.operands[k] = phis[v.imm];
+                    }
+                }
+            }
+        }
+        for (uint32_t p = 0; p < fn.params; p++) {
+            if (phis[p] != IR_NONE) {
+                fn.insn(phis[p]).operands[0] = params[p];
+                fn.prepend(header, phis[p]);
+            }
+        }
+        uint32_t acc = IR_NONE;
+        if (accumulate != IR_OP_COUNT) {
+            acc = fn.add(IR_PHI, 0, 1);
+            fn.insn(acc).operands[0] = fn.constant(accumulate == IR_ADD ? 0 : 1);
+            fn.prepend(header, acc);
+        }
+
+        for (size_t k = 0; k < sites.size(); k++) {
+            const Site& site = sites[k];
+            uint32_t b = fn.insn(site.ret).block;
+            uint32_t next = acc;
+            if (site.combine != IR_NONE) {
+                const IrInsn& other = fn.insn(site.other);
+                next = fn.add(accumulate, 0, 2);
+                fn.insn(next).operands[0] = acc;
+                fn.insn(next).operands[1] = other.op == IR_PARAM ? phis[other.imm] : site.other;
+                fn.insertBefore(site.ret, next);
+            }
+            const IrInsn& call = fn.insn(site.call);
+            std::vector<uint32_t> args(call.operands, call.operands + call.count);
+            fn.remove(site.ret);
+            if (site.combine != IR_NONE) {
+                fn.remove(site.combine);
+            }
+            fn.remove(site.call);
+            fn.append(b, fn.add(IR_JMP, 0, 0));
+            fn.addEdge(b, header);
+            for (uint32_t p = 0; p < fn.params; p++) {
+                if (phis[p] != IR_NONE) {
+                    addPhiOperand(fn, phis[p], args[p]);
+                }
+            }
+            if (acc != IR_NONE) {
+                addPhiOperand(fn, acc, next);
+            }
+        }
+
+        if (acc != IR_NONE) {
+            for (size_t k = 0; k < rets.size(); k++) {
+                IrInsn& ret = fn.insn(rets[k]);
+                if (ret.removed) {
+                    continue;
+                }
+                uint32_t result = fn.add(accumulate, 0, 2);
+                fn.insn(result).operands[0] = acc;
+                fn.insn(result).operands[1] = ret.operands[0];
+                fn.insertBefore(rets[k], result);
+                ret.operands[0] = result;
+            }
+        }
+        return true;
+    }
+};
+
+// Copies small callees that are not recursive into their callers: the
+// call's block is split after the call, the callee's blocks are cloned in
+// between with its parameters replaced by the arguments, and each return
+// jumps to the rest of the block, where a phi picks the result. Size is
+// counted in the instructions that become bytecode, less a little for
+// each constant argument, which the later passes are likely to fold.
+class Inliner {
+private:
+    static const uint32_t MAX_COST = 12;
+    static const uint32_t CONSTANT_BONUS = 2;
+    static const size_t MAX_CALLER = 2000;  // instructions
+
+    IrProgram& program;
+    IrFunction& fn;
+    std::vector<uint32_t> sizes;    // by function; IR_NONE until counted
+
+    uint32_t size(uint32_t f) {
+        if (sizes[f] == IR_NONE) {
+            const IrFunction& callee = *program.functions[f];
+            uint32_t n = 0;
+            for (size_t b = 0; b < callee.blocks.size(); b++) {
+                for (uint32_t id = callee.blocks[b].first; id != IR_NONE; id = callee.insn(id).next) {
+                    uint32_t op = callee.insn(id).op;
+                    n += op != IR_PARAM && op != IR_CONST && op != IR_JMP;
+                }
+            }
+            sizes[f] = n;
+        }
+        return sizes[f];
+    }
+
+    bool worthIt(uint32_t call) {
+        const IrInsn& i = fn.insn(call);
+        uint32_t f = (uint32_t)i.imm;
+        if (program.recursive[f] || program.functions[f] == &fn) {
+            return false;
+        }
+        uint32_t bonus = 0;
+        for (uint32_t k = 0; k < i.count; k++) {
+            bonus += fn.insn(i.operands[k]).op == IR_CONST ? CONSTANT_BONUS : 0;
+        }
+        return size(f) <= MAX_COST + bonus;
+    }
+
+    // Returns the value that replaces the call.
+    uint32_t inlineCall(uint32_t call) {
+        const IrFunction& callee = *program.functions[fn.insn(call).imm];
+        std::vector<uint32_t> args(fn.insn(call).operands, fn.insn(call).operands + fn.insn(call).count);
+        uint32_t b = fn.insn(call).block;
+        uint32_t rest = fn.newBlock();
+        for (uint32_t id = fn.insn(call).next, next; id != IR_NONE; id = next) {
+            next = fn.insn(id).next;
+            fn.detach(id);
+            fn.append(rest, id);
+        }
+        moveSuccessors(fn, b, rest);
+
+        std::vector<uint32_t> blockMap(callee.blocks.size(), IR_NONE);
+        for (uint32_t cb = 0; cb < callee.blocks.size(); cb++) {
+            if (!callee.blocks[cb].removed) {
+                blockMap[cb] = fn.newBlock();
+            }
+        }
+        std::vector<uint32_t> valueMap(callee.insnCount(), IR_NONE);
+        std::vector<uint32_t> results;
+        for (uint32_t cb = 0; cb < callee.blocks.size(); cb++) {
+            for (uint32_t id = callee.blocks[cb].first; id != IR_NONE; id = callee.insn(id).next) {
+                const IrInsn& i = callee.insn(id);
+                if (i.op == IR_PARAM) {
+                    valueMap[id] = args[i.imm];
+                } else if (i.op == IR_RET) {
+                    results.push_back(id);
+                    fn.append(blockMap[cb], fn.add(IR_JMP, 0, 0));
+                } else {
+                    valueMap[id] = fn.add((IrOp)i.op, i.imm, i.count);
+                    fn.append(blockMap[cb], valueMap[id]);
+                }
+            }
+        }
+        for (uint32_t cb = 0; cb < callee.blocks.size(); cb++) {
+            for (uint32_t id = callee.blocks[cb].first; id != IR_NONE; id = callee.insn(id).next) {
+                const IrInsn& i = callee.insn(id);
+                if (i.op == IR_PARAM || i.op == IR_RET) {
+                    continue;
+                }
+                IrInsn& copy = fn.insn(valueMap[id]);
+                for (uint32_t k = 0; k < i.count; k++) {
+                    copy.operands[k] = valueMap[i.operands[k]];
+                }
+            }
+        }
+        for (uint32_t cb = 0; cb < callee.blocks.size(); cb++) {
+            if (blockMap[cb] == IR_NONE) {
+                continue;
+            }
+            const IrBlock& from = callee.blocks[cb];
+            IrBlock& to = fn.blocks[blockMap[cb]];
+            for (uint32_t k = 0; k < from.succCount; k++) {
+                to.succ[k] = blockMap[from.succ[k]];
+            }
+            to.succCount = from.succCount;
+            for (size_t j = 0; j < from.preds.size(); j++) {
+                to.preds.push_back(blockMap[from.preds[j]]);
+            }
+        }
+        for (size_t k = 0; k < results.size(); k++) {
+            fn.addEdge(blockMap[callee.insn(results[k]).block], rest);
+        }
+        fn.append(b, fn.add(IR_JMP, 0, 0));
+        fn.addEdge(b, blockMap[0]);
+
+        if (results.empty()) {
+            return fn.constant(0);
+        }
+        if (results.size() == 1) {
+            return valueMap[callee.insn(results[0]).operands[0]];
+        }
+        uint32_t phi = fn.add(IR_PHI, 0, (uint32_t)results.size());
+        for (size_t k = 0; k < results.size(); k++) {
+            fn.insn(phi).operands[k] = valueMap[callee.insn(results[k]).operands[0]];
+        }
+        fn.prepend(rest, phi);
+        return phi;
+    }
+
+public:
+    Inliner(IrProgram& p, IrFunction& function) : program(p), fn(function), sizes(p.functions.size(), IR_NONE) {}
+
+    bool run() {
+        if (program.recursive.size() != program.functions.size()) {
+            program.findRecursive();
+        }
+        std::vector<uint32_t> calls;
+        for (size_t b = 0; b < fn.blocks.size(); b++) {
+            for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+                if (fn.insn(id).op == IR_CALL && worthIt(id)) {
+                    calls.push_back(id);
+                }
+            }
+        }
+        size_t grown = fn.size();
+        std::vector<std::pair<uint32_t, uint32_t> > replaced;
+        for (size_t k = 0; k < calls.size() && grown <= MAX_CALLER; k++) {
+            grown += size(fn.insn(calls[k]).imm);
+            replaced.push_back(std::make_pair(calls[k], inlineCall(calls[k])));
+        }
+        if (replaced.empty()) {
+            return false;
+        }
+        std::vector<uint32_t> with(fn.insnCount(), IR_NONE);
+        for (size_t k = 0; k < replaced.size(); k++) {
+            with[replaced[k].first] = replaced[k].second;
+        }
+        fn.replaceUses(with);
+        removeUnreachable(fn);
+        return true;
+    }
+};
+
+bool runIrPass(IrPass pass, IrProgram& program, IrFunction& fn) {
+    switch (pass) {
+    case PASS_SIMPLIFY_CFG:
+        return simplifyCfg(fn);
+    case PASS_SCCP: {
+        Sccp sccp(fn);
+        return sccp.run();
+    }
+    case PASS_GVN: {
+        Gvn gvn(fn);
+        return gvn.run();
+    }
+    case PASS_DCE:
+        return eliminateDeadCode(fn);
+    case PASS_TAIL_RECURSION: {
+        uint32_t index = (uint32_t)(std::find(program.functions.begin(), program.functions.end(), &fn) - program.functions.begin());
+        TailRecursion tail(fn, index);
+        return tail.run();
+    }
+    case PASS_INLINE: {
+        Inliner inliner(program, fn);
+        return inliner.run();
+    }
+    default:
+        return false;
+    }
+}
+
+PassManager::PassManager() : ms(IR_PASS_COUNT, 0), runs(IR_PASS_COUNT, 0), changes(IR_PASS_COUNT, 0), verifying(false) {}
+
+void PassManager::addStandard() {
+    add(PASS_TAIL_RECURSION);
+    add(PASS_INLINE);
+    add(PASS_SIMPLIFY_CFG);
+    add(PASS_SCCP);
+    add(PASS_SIMPLIFY_CFG);
+    add(PASS_GVN);
+    add(PASS_DCE);
+}
+
+bool PassManager::run(IrProgram& program, std::string& err) {
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        program.findRecursive();
+        bool changed = false;
+        for (size_t p = 0; p < pipeline.size(); p++) {
+            IrPass pass = pipeline[p];
+            for (size_t f = 0; f < program.functions.size(); f++) {
+                IrFunction& fn = *program.functions[f];
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                bool did = runIrPass(pass, program, fn);
+                ms[pass] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                runs[pass]++;
+                changes[pass] += did;
+                changed = changed || did;
+                if (verifying && !verifyIr(fn, err)) {
+                    err = std::string("after ") + irPassName(pass) + ": " + err;
+                    return false;
+                }
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    return true;
+}
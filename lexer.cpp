@@ -1,55 +1,210 @@
 #include "lexer.h"
+#include "scan.h"
 #include <cctype>
 #include <sstream>
 
-Lexer::Lexer(string s) {
-    input = s;
+namespace {
+
+struct Keyword {
+    const char* text;
+    int length;
+    TokenType type;
+};
+
+// Length plus first and last character separate all eight keywords; this
+// particular mix puts each one in its own slot of a 16-entry table.
+constexpr unsigned keywordHash(size_t length, char first, char last) {
+    return (unsigned)(length + (unsigned char)first + ((unsigned char)last << 3)) & 15;
+}
+
+constexpr Keyword keywordTable[16] = {
+    { "", 0, IDENTIFIER },
+    { "else", 4, ELSE },
+    { "", 0, IDENTIFIER },
+    { "continue", 8, CONTINUE },
+    { "while", 5, WHILE },
+    { "", 0, IDENTIFIER },
+    { "", 0, IDENTIFIER },
+    { "", 0, IDENTIFIER },
+    { "return", 6, RETURN },
+    { "", 0, IDENTIFIER },
+    { "void", 4, VOID },
+    { "if", 2, IF },
+    { "int", 3, INT },
+    { "", 0, IDENTIFIER },
+    { "", 0, IDENTIFIER },
+    { "break", 5, BREAK },
+};
+
+constexpr int textLength(const char* s) {
+    return *s ? 1 + textLength(s + 1) : 0;
+}
+
+constexpr bool slotMatches(const Keyword& k, unsigned slot) {
+    return k.length == 0 ||
+           (k.length == textLength(k.text) &&
+            keywordHash(k.length, k.text[0], k.text[k.length - 1]) == slot);
+}
+
+constexpr bool keywordTableValid(unsigned slot) {
+    return slot == 16 || (slotMatches(keywordTable[slot], slot) && keywordTableValid(slot + 1));
+}
+
+static_assert(keywordTableValid(0), "keywordTable is out of sync with keywordHash");
+
+}
+
+TokenType lookupKeyword(StrView id) {
+    if (id.size < 2 || id.size > 8) {
+        return IDENTIFIER;
+    }
+    const Keyword& k = keywordTable[keywordHash(id.size, id[0], id[id.size - 1])];
+    if (k.length == (int)id.size && memcmp(k.text, id.data, id.size) == 0) {
+        return k.type;
+    }
+    return IDENTIFIER;
+}
+
+Lexer::Lexer(string s, LexerEngine engine) : engine(engine), stream(NULL) {
+    owned.swap(s);
+    input = owned.data();
+    length = owned.length();
+    lines.reset(input, length);
+    pos = 0;
+    mark = 0;
+    tokenIndex = 0;
+    base = 0;
+    baseLine = 1;
+    baseLineStart = 0;
+    symbols = NULL;
+    openComment = false;
+}
+
+// Lexes data in place. The caller keeps the buffer alive for as long as the
+// lexer and the tokens it returned are in use.
+Lexer::Lexer(const char* data, size_t size, LexerEngine engine) : engine(engine), stream(NULL) {
+    input = data;
+    length = size;
+    lines.reset(input, length);
+    pos = 0;
+    mark = 0;
+    tokenIndex = 0;
+    base = 0;
+    baseLine = 1;
+    baseLineStart = 0;
+    symbols = NULL;
+    openComment = false;
+}
+
+void Lexer::reset(const char* data, size_t size) {
+    owned.clear();
+    stream = NULL;
+    input = data;
+    length = size;
+    lines.reset(input, length);
+    pos = 0;
+    mark = 0;
+    tokenIndex = 0;
+    base = 0;
+    baseLine = 1;
+    baseLineStart = 0;
+    openComment = false;
+    arena.reset();
+}
+
+// Lexes from a stream through a window of windowSize bytes, so memory use
+// does not depend on the length of the input. A token's text is only valid
+// until the next call to nextToken(). Like the stdin driver, a final line
+// without a newline is read as if it had one.
+Lexer::Lexer(istream& in, size_t windowSize, LexerEngine engine)
+    : engine(engine), stream(&in), window(windowSize > 0 ? windowSize : 1),
+      streamEnded(false), lastByte('\n') {
+    input = window.data();
+    length = 0;
     pos = 0;
+    mark = 0;
     tokenIndex = 0;
-    line = 1;
-    initKeywords();
+    base = 0;
+    baseLine = 1;
+    baseLineStart = 0;
+    symbols = NULL;
+    openComment = false;
 }
 
-void Lexer::initKeywords() {
-    keywordMap["int"] = INT;
-    keywordMap["void"] = VOID;
-    keywordMap["if"] = IF;
-    keywordMap["else"] = ELSE;
-    keywordMap["while"] = WHILE;
-    keywordMap["break"] = BREAK;
-    keywordMap["continue"] = CONTINUE;
-    keywordMap["return"] = RETURN;
+// Streaming mode only: slides everything from mark onwards to the front of
+// the window and reads more input behind it. Returns false once the stream
+// is exhausted. Offsets into the window (pos, mark) are adjusted; pointers
+// into it are not, so callers re-derive them after a refill.
+bool Lexer::refill() {
+    if (stream == NULL || streamEnded) {
+        return false;
+    }
+    size_t keep = length - mark;
+    if (mark > 0) {
+        // Carry the line position over the bytes being dropped.
+        const char* dropped = window.data();
+        int64_t n = countNewlines(dropped, dropped + mark);
+        if (n > 0) {
+            baseLine += n;
+            const char* last = dropped + mark - 1;
+            while (*last != '\n') {
+                last--;
+            }
+            baseLineStart = base + (last - dropped) + 1;
+        }
+        base += mark;
+        memmove(window.data(), window.data() + mark, keep);
+        pos -= mark;
+        mark = 0;
+    }
+    if (keep == window.size()) {
+        // A single token fills the whole window; only then does it grow.
+        window.resize(window.size() * 2);
+    }
+    stream->read(window.data() + keep, window.size() - keep);
+    size_t got = (size_t)stream->gcount();
+    if (got > 0) {
+        lastByte = window[keep + got - 1];
+    } else {
+        streamEnded = true;
+        if (lastByte != '\n') {
+            window[keep] = '\n';
+            lastByte = '\n';
+            got = 1;
+        }
+    }
+    input = window.data();
+    length = keep + got;
+    return got > 0;
 }
 
 char Lexer::getChar() {
-    if (pos >= (int)input.length()) {
+    if (pos >= length && !refill()) {
         return '\0';
     }
     return input[pos];
 }
 
 char Lexer::peek() {
-    if (pos + 1 >= (int)input.length()) {
-        return '\0';
+    while (pos + 1 >= length) {
+        if (!refill()) {
+            return '\0';
+        }
     }
     return input[pos + 1];
 }
 
 void Lexer::next() {
-    if (pos < (int)input.length()) {
-        if (input[pos] == '\n') {
-            line++;
-        }
+    if (pos < length || refill()) {
         pos++;
     }
 }
 
 void Lexer::skipSpace() {
-    while (pos < (int)input.length()) {
-        char c = getChar();
-        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') {
-            next();
-        } else {
+    for (;;) {
+        pos = scanSpace(input + pos, input + length) - input;
+        mark = pos;
+        if (pos < length || !refill()) {
             break;
         }
     }
@@ -60,121 +215,142 @@ void Lexer::skipComments() {
     char c2 = peek();
     
     if (c1 == '/' && c2 == '/') {
-        // Skip the two slashes
-        next();
-        next();
         // Skip until newline (LF) or end of input
         // Note: CR (0x0D) is not treated as newline here, it will be skipped by skipSpace()
-        while (pos < (int)input.length() && getChar() != '\n') {
-            next();
+        // The newline itself is left for skipSpace(), so the next token
+        // starts on the next line
+        pos += 2;
+        for (;;) {
+            pos = scanLineEnd(input + pos, input + length) - input;
+            mark = pos;
+            if (pos < length || !refill()) {
+                break;
+            }
         }
-        // Don't skip the newline here - let skipSpace() handle it in next iteration
-        // This ensures that if comment ends with newline, the next token starts on the next line
     } else if (c1 == '/' && c2 == '*') {
-        next();
-        next();
-        while (pos < (int)input.length()) {
-            if (getChar() == '*' && peek() == '/') {
-                next();
-                next();
+        pos += 2;
+        for (;;) {
+            const char* from = input + pos;
+            const char* end = input + length;
+            const char* to = scanCommentEnd(from, end);
+            if (to < end || (end - from >= 2 && end[-2] == '*' && end[-1] == '/')) {
+                pos = to - input;
+                break;
+            }
+            // Not closed in this window. A trailing '*' may be the first
+            // half of "*/", so keep it for the next round.
+            pos = length;
+            if (pos > 0 && end > from && end[-1] == '*') {
+                pos--;
+            }
+            mark = pos;
+            if (!refill()) {
+                pos = length;
+                openComment = true;
                 break;
             }
-            next();
         }
     }
 }
 
+// Text of the token being read, which starts at mark.
+StrView Lexer::slice() {
+    return StrView(input + mark, pos - mark);
+}
+
+// Copies text into the lexer's arena for the rare token that has to outlive
+// the buffer it was lexed from.
+StrView Lexer::own(StrView text) {
+    return StrView(arena.copy(text.data, text.size), text.size);
+}
+
 Token Lexer::readNumber() {
-    string num = "";
-    int startLine = line;
-    
-    if (pos >= (int)input.length() || getChar() < '0' || getChar() > '9') {
-        return Token(UNKNOWN, "", tokenIndex++, startLine);
+    if (getChar() < '0' || getChar() > '9') {
+        return Token(UNKNOWN, StrView(), tokenIndex++, markOffset());
     }
     
     char firstDigit = getChar();
-    num += firstDigit;
     next();
     
     if (firstDigit == '0') {
-        Token t(INTCONST, num, tokenIndex, startLine);
+        Token t(INTCONST, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     
-    while (pos < (int)input.length()) {
+    while (pos < length || refill()) {
         char c = getChar();
         if (c >= '0' && c <= '9') {
-            num += c;
             next();
         } else {
             break;
         }
     }
     
-    Token t(INTCONST, num, tokenIndex, startLine);
+    Token t(INTCONST, slice(), tokenIndex, markOffset());
     tokenIndex++;
     return t;
 }
 
 Token Lexer::readId() {
-    string id = "";
-    int startLine = line;
-    
-    while (pos < (int)input.length()) {
+    uint32_t hash = SYMBOL_HASH_SEED;
+    while (pos < length || refill()) {
         char c = getChar();
         if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || 
             (c >= '0' && c <= '9') || c == '_') {
-            id += c;
+            hash = symbolHashStep(hash, c);
             next();
         } else {
             break;
         }
     }
     
-    if (keywordMap.find(id) != keywordMap.end()) {
-        Token t(keywordMap[id], id, tokenIndex, startLine);
-        tokenIndex++;
-        return t;
+    return identifier(slice(), hash);
+}
+
+// Keyword or identifier token for id; hash is symbolHash(id).
+Token Lexer::identifier(StrView id, uint32_t hash) {
+    TokenType type = lookupKeyword(id);
+    uint32_t sym = NO_SYMBOL;
+    if (type == IDENTIFIER && symbols != NULL) {
+        sym = symbols->intern(id.data, id.size, hash);
     }
-    
-    Token t(IDENTIFIER, id, tokenIndex, startLine);
+    Token t(type, id, tokenIndex, markOffset(), sym);
     tokenIndex++;
     return t;
 }
 
 Token Lexer::readOp() {
     char c = getChar();
-    int startLine = line;
     Token t;
     
     if (c == '+') {
         next();
-        t = Token(PLUS, "+", tokenIndex, startLine);
+        t = Token(PLUS, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '-') {
         next();
-        t = Token(MINUS, "-", tokenIndex, startLine);
+        t = Token(MINUS, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '*') {
         next();
-        t = Token(MULTIPLY, "*", tokenIndex, startLine);
+        t = Token(MULTIPLY, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '/') {
         next();
-        t = Token(DIVIDE, "/", tokenIndex, startLine);
+        t = Token(DIVIDE, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '%') {
         next();
-        t = Token(MODULO, "%", tokenIndex, startLine);
+        t = Token(MODULO, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -182,11 +358,11 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '=') {
             next();
-            t = Token(EQUAL, "==", tokenIndex, startLine);
+            t = Token(EQUAL, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(ASSIGN, "=", tokenIndex, startLine);
+        t = Token(ASSIGN, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -194,11 +370,11 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '=') {
             next();
-            t = Token(NOT_EQUAL, "!=", tokenIndex, startLine);
+            t = Token(NOT_EQUAL, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(NOT, "!", tokenIndex, startLine);
+        t = Token(NOT, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -206,11 +382,11 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '=') {
             next();
-            t = Token(LESS_EQUAL, "<=", tokenIndex, startLine);
+            t = Token(LESS_EQUAL, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(LESS, "<", tokenIndex, startLine);
+        t = Token(LESS, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -218,11 +394,11 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '=') {
             next();
-            t = Token(GREATER_EQUAL, ">=", tokenIndex, startLine);
+            t = Token(GREATER_EQUAL, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(GREATER, ">", tokenIndex, startLine);
+        t = Token(GREATER, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -230,11 +406,11 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '&') {
             next();
-            t = Token(AND, "&&", tokenIndex, startLine);
+            t = Token(AND, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(UNKNOWN, "&", tokenIndex, startLine);
+        t = Token(UNKNOWN, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
@@ -242,64 +418,63 @@ Token Lexer::readOp() {
         next();
         if (getChar() == '|') {
             next();
-            t = Token(OR, "||", tokenIndex, startLine);
+            t = Token(OR, slice(), tokenIndex, markOffset());
             tokenIndex++;
             return t;
         }
-        t = Token(UNKNOWN, "|", tokenIndex, startLine);
+        t = Token(UNKNOWN, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '(') {
         next();
-        t = Token(LEFT_PAREN, "(", tokenIndex, startLine);
+        t = Token(LEFT_PAREN, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == ')') {
         next();
-        t = Token(RIGHT_PAREN, ")", tokenIndex, startLine);
+        t = Token(RIGHT_PAREN, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '{') {
         next();
-        t = Token(LEFT_BRACE, "{", tokenIndex, startLine);
+        t = Token(LEFT_BRACE, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == '}') {
         next();
-        t = Token(RIGHT_BRACE, "}", tokenIndex, startLine);
+        t = Token(RIGHT_BRACE, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == ';') {
         next();
-        t = Token(SEMICOLON, ";", tokenIndex, startLine);
+        t = Token(SEMICOLON, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     if (c == ',') {
         next();
-        t = Token(COMMA, ",", tokenIndex, startLine);
+        t = Token(COMMA, slice(), tokenIndex, markOffset());
         tokenIndex++;
         return t;
     }
     
     next();
-    string s = "";
-    s += c;
-    t = Token(UNKNOWN, s, tokenIndex, startLine);
+    t = Token(UNKNOWN, slice(), tokenIndex, markOffset());
     tokenIndex++;
     return t;
 }
 
 Token Lexer::nextToken() {
-    while (pos < (int)input.length()) {
+    mark = pos;
+    while (pos < length || refill()) {
         skipSpace();
         
-        if (pos >= (int)input.length()) {
+        if (pos >= length) {
             break;
         }
         
@@ -312,6 +487,10 @@ Token Lexer::nextToken() {
             continue;
         }
         
+        if (engine == LEX_TABLE) {
+            return readTable();
+        }
+        
         if (c >= '0' && c <= '9') {
             return readNumber();
         }
@@ -323,17 +502,55 @@ Token Lexer::nextToken() {
         return readOp();
     }
     
-    Token t(END_OF_FILE, "", tokenIndex, line);
+    Token t(END_OF_FILE, StrView(), tokenIndex, base + length);
     tokenIndex++;
     return t;
 }
 
+void Lexer::stop() {
+    pos = length;
+    streamEnded = true;
+}
+
+void Lexer::seek(size_t offset) {
+    pos = offset < length ? offset : length;
+    mark = pos;
+    openComment = false;
+}
+
+void Lexer::locate(uint64_t offset, int64_t& line, int64_t& column) {
+    if (stream == NULL) {
+        lines.locate(offset, line, column);
+        return;
+    }
+    if (offset < base) {
+        offset = base;
+    }
+    const char* p = input + (offset - base);
+    line = baseLine + countNewlines(input, p);
+    uint64_t lineStart = baseLineStart;
+    for (const char* q = p; q > input; q--) {
+        if (q[-1] == '\n') {
+            lineStart = base + (q - input);
+            break;
+        }
+    }
+    column = (int64_t)(offset - lineStart) + 1;
+}
+
 vector<Token> Lexer::getAllTokens() {
     vector<Token> result;
+    if (stream == NULL) {
+        result.reserve(length / 4 + 1);
+    }
     Token t;
     
     do {
         t = nextToken();
+        if (stream != NULL) {
+            // The window is reused, so keep a copy of the text.
+            t.value = own(t.value);
+        }
         result.push_back(t);
     } while (t.type != END_OF_FILE);
     
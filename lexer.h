@@ -3,8 +3,12 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <iostream>
+#include <cstring>
+#include <stdint.h>
+#include "arena.h"
+#include "line_index.h"
+#include "symbol_table.h"
 
 using namespace std;
 
@@ -20,25 +24,80 @@ enum TokenType {
     END_OF_FILE, UNKNOWN
 };
 
+// Non-owning view of token text. It points either into the source buffer the
+// lexer was given or into the lexer's arena, so copying a Token never touches
+// the heap.
+struct StrView {
+    const char* data;
+    size_t size;
+    
+    StrView() : data(""), size(0) {}
+    StrView(const char* d, size_t n) : data(d), size(n) {}
+    
+    string str() const { return string(data, size); }
+    bool empty() const { return size == 0; }
+    char operator[](size_t i) const { return data[i]; }
+    bool operator==(const StrView& o) const {
+        return size == o.size && memcmp(data, o.data, size) == 0;
+    }
+    bool operator!=(const StrView& o) const { return !(*this == o); }
+    bool operator==(const char* s) const {
+        return strncmp(data, s, size) == 0 && s[size] == '\0';
+    }
+    bool operator!=(const char* s) const { return !(*this == s); }
+    bool operator<(const StrView& o) const {
+        int c = memcmp(data, o.data, size < o.size ? size : o.size);
+        return c != 0 ? c < 0 : size < o.size;
+    }
+};
+
+inline ostream& operator<<(ostream& os, const StrView& v) {
+    return os.write(v.data, v.size);
+}
+
 struct Token {
     TokenType type;
-    string value;
-    int index;
-    int line;
+    StrView value;
+    int64_t index;
+    uint64_t offset;    // byte offset of the token in the whole input
+    uint32_t sym;       // interned id of an IDENTIFIER, or NO_SYMBOL
     
-    Token() : type(END_OF_FILE), value(""), index(0), line(1) {}
-    Token(TokenType t, const string& v, int idx, int l = 1) : type(t), value(v), index(idx), line(l) {}
+    Token() : type(END_OF_FILE), value(), index(0), offset(0), sym(NO_SYMBOL) {}
+    Token(TokenType t, StrView v, int64_t idx, uint64_t off = 0, uint32_t s = NO_SYMBOL)
+        : type(t), value(v), index(idx), offset(off), sym(s) {}
+};
+
+// Lexer implementations. Both produce exactly the same token stream.
+enum LexerEngine {
+    LEX_CLASSIC,    // hand-written character tests (readNumber/readId/readOp)
+    LEX_TABLE       // character-class table plus DFA transition table
 };
 
+// Keyword token type for id, or IDENTIFIER. Uses a compile-time perfect hash,
+// so there is no per-lexer table to build.
+TokenType lookupKeyword(StrView id);
+
 class Lexer {
 private:
-    string input;
-    int pos;
-    int tokenIndex;
-    int line;
-    map<string, TokenType> keywordMap;
+    string owned;
+    const char* input;
+    size_t length;
+    size_t pos;
+    size_t mark;
+    LexerEngine engine;
+    istream* stream;
+    vector<char> window;
+    bool streamEnded;
+    char lastByte;
+    bool openComment;
+    int64_t tokenIndex;
+    uint64_t base;              // input offset of input[0]; moves in stream mode
+    int64_t baseLine;           // line number at input[0]
+    uint64_t baseLineStart;     // input offset of the line containing input[0]
+    LineIndex lines;
+    SymbolTable* symbols;
+    Arena arena;
     
-    void initKeywords();
     char getChar();
     char peek();
     void next();
@@ -46,13 +105,43 @@ private:
     void skipComments();
     Token readNumber();
     Token readId();
+    Token identifier(StrView id, uint32_t hash);
     Token readOp();
+    Token readTable();
+    StrView slice();
+    uint64_t markOffset() const { return base + mark; }
+    bool refill();
     string typeToStr(TokenType t);
     
 public:
-    Lexer(string s);
+    Lexer(string s, LexerEngine engine = LEX_CLASSIC);
+    Lexer(const char* data, size_t size, LexerEngine engine = LEX_CLASSIC);
+    Lexer(istream& in, size_t windowSize, LexerEngine engine = LEX_CLASSIC);
+    // Starts over on another buffer, lexed in place, keeping the memory of
+    // earlier inputs.
+    void reset(const char* data, size_t size);
     Token nextToken();
     vector<Token> getAllTokens();
+    StrView own(StrView text);
+    // Interns every IDENTIFIER into table from now on, filling Token::sym.
+    // Without a table, sym stays NO_SYMBOL.
+    void setSymbols(SymbolTable* table) { symbols = table; }
+    // Ends the input here: every later nextToken() returns END_OF_FILE.
+    void stop();
+    // Lexes on from offset, as if a token had just ended there. In-place
+    // input only.
+    void seek(size_t offset);
+    // Locates offsets from line checkpoints; see LineIndex::useCheckpoints().
+    void useLineCheckpoints(const std::vector<uint64_t>& offsets, const std::vector<uint64_t>& linesBefore) {
+        lines.useCheckpoints(offsets, linesBefore);
+    }
+    // True if the input ended inside an unterminated /* comment.
+    bool endedInComment() const { return openComment; }
+    // 1-based line and column of a token offset. Lines are not tracked while
+    // lexing; they are worked out here, only when a caller asks. In stream
+    // mode the offset must still be inside the window, which holds for the
+    // most recently returned token.
+    void locate(uint64_t offset, int64_t& line, int64_t& column);
     void output();
 };
 
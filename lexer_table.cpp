@@ -0,0 +1,172 @@
+#include "lexer.h"
+
+// Table-driven engine for Lexer. A 256-entry table maps each byte to a
+// character class, and a transition table indexed by (state, class) drives
+// a DFA that recognises one token at a time. Whitespace and comments are
+// skipped by nextToken() before the DFA runs, exactly as for the classic
+// engine.
+
+namespace {
+
+enum CharClass {
+    CC_OTHER, CC_DIGIT, CC_ZERO, CC_ALPHA,
+    CC_PLUS, CC_MINUS, CC_STAR, CC_SLASH, CC_PERCENT,
+    CC_EQ, CC_BANG, CC_LT, CC_GT, CC_AMP, CC_PIPE,
+    CC_LPAREN, CC_RPAREN, CC_LBRACE, CC_RBRACE, CC_SEMI, CC_COMMA,
+    CC_COUNT
+};
+
+enum State {
+    S_START, S_IDENT, S_NUMBER, S_ZERO,
+    S_PLUS, S_MINUS, S_STAR, S_SLASH, S_PERCENT,
+    S_ASSIGN, S_EQUAL, S_NOT, S_NOT_EQUAL,
+    S_LESS, S_LESS_EQUAL, S_GREATER, S_GREATER_EQUAL,
+    S_AMP, S_AND, S_PIPE, S_OR,
+    S_LPAREN, S_RPAREN, S_LBRACE, S_RBRACE, S_SEMI, S_COMMA,
+    S_UNKNOWN,
+    S_COUNT,
+    S_STOP = 0xFF
+};
+
+struct LexTables {
+    unsigned char charClass[256];
+    unsigned char next[S_COUNT][CC_COUNT];
+    TokenType accept[S_COUNT];
+
+    void rule(State from, CharClass on, State to) {
+        next[from][on] = (unsigned char)to;
+    }
+
+    LexTables() {
+        for (int c = 0; c < 256; c++) {
+            charClass[c] = CC_OTHER;
+        }
+        for (int c = '1'; c <= '9'; c++) {
+            charClass[c] = CC_DIGIT;
+        }
+        charClass['0'] = CC_ZERO;
+        for (int c = 'a'; c <= 'z'; c++) {
+            charClass[c] = CC_ALPHA;
+        }
+        for (int c = 'A'; c <= 'Z'; c++) {
+            charClass[c] = CC_ALPHA;
+        }
+        charClass['_'] = CC_ALPHA;
+
+        struct Single { char c; CharClass cls; State state; TokenType type; };
+        static const Single singles[] = {
+            { '+', CC_PLUS, S_PLUS, PLUS },
+            { '-', CC_MINUS, S_MINUS, MINUS },
+            { '*', CC_STAR, S_STAR, MULTIPLY },
+            { '/', CC_SLASH, S_SLASH, DIVIDE },
+            { '%', CC_PERCENT, S_PERCENT, MODULO },
+            { '=', CC_EQ, S_ASSIGN, ASSIGN },
+            { '!', CC_BANG, S_NOT, NOT },
+            { '<', CC_LT, S_LESS, LESS },
+            { '>', CC_GT, S_GREATER, GREATER },
+            { '&', CC_AMP, S_AMP, UNKNOWN },
+            { '|', CC_PIPE, S_PIPE, UNKNOWN },
+            { '(', CC_LPAREN, S_LPAREN, LEFT_PAREN },
+            { ')', CC_RPAREN, S_RPAREN, RIGHT_PAREN },
+            { '{', CC_LBRACE, S_LBRACE, LEFT_BRACE },
+            { '}', CC_RBRACE, S_RBRACE, RIGHT_BRACE },
+            { ';', CC_SEMI, S_SEMI, SEMICOLON },
+            { ',', CC_COMMA, S_COMMA, COMMA },
+        };
+
+        for (int s = 0; s < S_COUNT; s++) {
+            for (int c = 0; c < CC_COUNT; c++) {
+                next[s][c] = S_STOP;
+            }
+            accept[s] = UNKNOWN;
+        }
+
+        // Any byte that starts no token is a one-character UNKNOWN token.
+        for (int c = 0; c < CC_COUNT; c++) {
+            next[S_START][c] = S_UNKNOWN;
+        }
+        for (size_t i = 0; i < sizeof(singles) / sizeof(singles[0]); i++) {
+            charClass[(unsigned char)singles[i].c] = (unsigned char)singles[i].cls;
+            rule(S_START, singles[i].cls, singles[i].state);
+            accept[singles[i].state] = singles[i].type;
+        }
+
+        // Identifiers: a letter or '_', then letters, digits and '_'.
+        rule(S_START, CC_ALPHA, S_IDENT);
+        rule(S_IDENT, CC_ALPHA, S_IDENT);
+        rule(S_IDENT, CC_DIGIT, S_IDENT);
+        rule(S_IDENT, CC_ZERO, S_IDENT);
+        accept[S_IDENT] = IDENTIFIER;
+
+        // Integers: a lone '0', or a non-zero digit followed by digits.
+        rule(S_START, CC_ZERO, S_ZERO);
+        rule(S_START, CC_DIGIT, S_NUMBER);
+        rule(S_NUMBER, CC_DIGIT, S_NUMBER);
+        rule(S_NUMBER, CC_ZERO, S_NUMBER);
+        accept[S_ZERO] = INTCONST;
+        accept[S_NUMBER] = INTCONST;
+
+        // Two-character operators.
+        rule(S_ASSIGN, CC_EQ, S_EQUAL);
+        rule(S_NOT, CC_EQ, S_NOT_EQUAL);
+        rule(S_LESS, CC_EQ, S_LESS_EQUAL);
+        rule(S_GREATER, CC_EQ, S_GREATER_EQUAL);
+        rule(S_AMP, CC_AMP, S_AND);
+        rule(S_PIPE, CC_PIPE, S_OR);
+        accept[S_EQUAL] = EQUAL;
+        accept[S_NOT_EQUAL] = NOT_EQUAL;
+        accept[S_LESS_EQUAL] = LESS_EQUAL;
+        accept[S_GREATER_EQUAL] = GREATER_EQUAL;
+        accept[S_AND] = AND;
+        accept[S_OR] = OR;
+    }
+};
+
+const LexTables tables;
+
+}
+
+Token Lexer::readTable() {
+    unsigned state = S_START;
+    bool stopped = false;
+    
+    // The outer loop only repeats when a streaming window runs out
+    // mid-token; the DFA state carries over into the refilled window.
+    while (!stopped) {
+        const unsigned char* p = (const unsigned char*)input + pos;
+        const unsigned char* end = (const unsigned char*)input + length;
+        while (p < end) {
+            unsigned to = tables.next[state][tables.charClass[*p]];
+            if (to == S_STOP) {
+                stopped = true;
+                break;
+            }
+            p++;
+            if (to == state) {
+                // Self-loop (identifier or number body): spin on one table
+                // row so each step doesn't wait on the previous transition.
+                const unsigned char* row = tables.next[state];
+                while (p < end && row[tables.charClass[*p]] == state) {
+                    p++;
+                }
+                continue;
+            }
+            state = to;
+        }
+        pos = (const char*)p - input;
+        if (!stopped && !refill()) {
+            break;
+        }
+    }
+    
+    StrView text = slice();
+    TokenType type = tables.accept[state];
+    if (type == IDENTIFIER) {
+        // The spin loop above has no room for hashing; the text is still in
+        // cache, so hash it here, and only if it will be interned.
+        return identifier(text, symbols != NULL ? symbolHash(text.data, text.size) : 0);
+    }
+    Token t(type, text, tokenIndex, markOffset());
+    tokenIndex++;
+    return t;
+}
@@ -0,0 +1,71 @@
+#include "line_index.h"
+#include "scan.h"
+#include <algorithm>
+
+LineIndex::LineIndex() : data(0), size(0), built(false), checkpoints(NULL), checkpointLines(NULL), lastOffset(0),
+    lastLine(0), lastLineStart(0) {}
+
+void LineIndex::reset(const char* d, size_t n) {
+    data = d;
+    size = n;
+    built = false;
+    newlines.clear();
+    checkpoints = NULL;
+    checkpointLines = NULL;
+}
+
+void LineIndex::useCheckpoints(const std::vector<uint64_t>& offsets, const std::vector<uint64_t>& linesBefore) {
+    checkpoints = &offsets;
+    checkpointLines = &linesBefore;
+    lastOffset = 0;
+    lastLine = 0;
+    lastLineStart = 0;
+}
+
+void LineIndex::build() {
+    const char* end = data + size;
+    newlines.reserve(countNewlines(data, end));
+    for (const char* p = scanLineEnd(data, end); p < end; p = scanLineEnd(p + 1, end)) {
+        newlines.push_back(p - data);
+    }
+    built = true;
+}
+
+void LineIndex::locate(uint64_t offset, int64_t& line, int64_t& column) {
+    if (checkpoints != NULL) {
+        size_t i = std::upper_bound(checkpoints->begin(), checkpoints->end(), offset) - checkpoints->begin() - 1;
+        uint64_t from = (*checkpoints)[i];
+        int64_t before = (*checkpointLines)[i];
+        uint64_t lineStart = from;
+        bool knownStart = false;
+        if (lastOffset >= from && lastOffset <= offset) {
+            from = lastOffset;
+            before = lastLine;
+            lineStart = lastLineStart;
+            knownStart = true;
+        }
+        int64_t more = countNewlines(data + from, data + offset);
+        if (more > 0 || !knownStart) {
+            lineStart = offset;
+            while (lineStart > 0 && data[lineStart - 1] != '\n') {
+                lineStart--;
+            }
+        }
+        lastOffset = offset;
+        lastLine = before + more;
+        lastLineStart = lineStart;
+        line = lastLine + 1;
+        column = (int64_t)(offset - lineStart) + 1;
+        return;
+    }
+    if (!built) {
+        build();
+    }
+    // Newlines strictly before offset end the lines above it.
+    std::vector<uint64_t>::const_iterator it =
+        std::lower_bound(newlines.begin(), newlines.end(), offset);
+    int64_t before = it - newlines.begin();
+    uint64_t lineStart = before > 0 ? newlines[before - 1] + 1 : 0;
+    line = before + 1;
+    column = (int64_t)(offset - lineStart) + 1;
+}
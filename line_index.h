@@ -0,0 +1,37 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Maps byte offsets in a buffer to 1-based line and column numbers. The
+// table of newline offsets is only built on the first lookup, so inputs
+// that never need a position (the common, error-free case) pay nothing.
+class LineIndex {
+private:
+    const char* data;
+    size_t size;
+    bool built;
+    std::vector<uint64_t> newlines;
+    const std::vector<uint64_t>* checkpoints;       // NULL: index every newline
+    const std::vector<uint64_t>* checkpointLines;
+    uint64_t lastOffset;                            // the last lookup, to count on from
+    int64_t lastLine;
+    uint64_t lastLineStart;
+
+    void build();
+
+public:
+    LineIndex();
+    void reset(const char* data, size_t size);
+    // Locates from checkpoints instead of a table of every newline:
+    // linesBefore[i] newlines come before offsets[i], which ascend from 0.
+    // A lookup counts newlines on from the checkpoint or lookup before it,
+    // so a buffer that is mostly unchanged need not be scanned again. The
+    // tables must outlive the lookups; reset() drops them.
+    void useCheckpoints(const std::vector<uint64_t>& offsets, const std::vector<uint64_t>& linesBefore);
+    void locate(uint64_t offset, int64_t& line, int64_t& column);
+};
+
+#endif
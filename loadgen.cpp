@@ -0,0 +1,240 @@
+#include "batch.h"
+#include "server.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+// Load generator for parser_server: every client sends a request, waits
+// for the answer and sends the next, and the time from send to answer is
+// recorded. With --exec the same requests go instead to a new parser
+// process each, which is what the server replaces.
+
+static int usage() {
+    std::cerr << "usage: parser_loadgen (--socket=PATH | --exec=PARSER) [--clients=N] [--requests=N] [path...]" << std::endl
+              << "--clients concurrent clients (default 8), each sending --requests requests (default 1000);" << std::endl
+              << "requests cycle through the files given, and every *.c file below each directory" << std::endl
+              << "given, or use a small built-in program;" << std::endl
+              << "--exec runs PARSER once per request, source on stdin, instead of using a server." << std::endl;
+    return 2;
+}
+
+static bool parseCount(const char* text, size_t& value) {
+    char* end;
+    value = strtoul(text, &end, 10);
+    return *end == '\0' && value != 0;
+}
+
+static bool readWhole(const std::string& path, std::string& text) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) {
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Runs the parser on source in a new process and collects what it prints.
+static bool runProcess(const std::string& parser, const std::string& source, std::string& answer) {
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) != 0) {
+        return false;
+    }
+    if (pipe2(out, O_CLOEXEC) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    char* argv[] = { (char*)parser.c_str(), NULL };
+    pid_t pid;
+    int spawned = posix_spawn(&pid, parser.c_str(), &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+    // The parser reads all of its input before it prints anything.
+    for (size_t done = 0; spawned == 0 && done < source.size();) {
+        ssize_t n = write(in[1], source.data() + done, source.size() - done);
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    close(in[1]);
+    answer.clear();
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(out[0], buf, sizeof(buf))) > 0) {
+        answer.append(buf, (size_t)n);
+    }
+    close(out[0]);
+    int status;
+    return spawned == 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status);
+}
+
+struct Client {
+    std::vector<uint64_t> latencies;    // nanoseconds
+    size_t failures;
+
+    Client() : failures(0) {}
+};
+
+static double percentile(const std::vector<uint64_t>& sorted, double p) {
+    size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[i] / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    std::string socketPath, parserPath;
+    size_t clients = 8, requests = 1000;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0 && argv[i][9] != '\0') {
+            socketPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--exec=", 7) == 0 && argv[i][7] != '\0') {
+            parserPath = argv[i] + 7;
+        } else if (strncmp(argv[i], "--clients=", 10) == 0) {
+            if (!parseCount(argv[i] + 10, clients)) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--requests=", 11) == 0) {
+            if (!parseCount(argv[i] + 11, requests)) {
+                return usage();
+            }
+        } else if (argv[i][0] != '-') {
+            std::string err;
+            if (!collectSources(argv[i], files, err)) {
+                std::cerr << "parser_loadgen: " << err << std::endl;
+                return 2;
+            }
+        } else {
+            return usage();
+        }
+    }
+    if (socketPath.empty() == parserPath.empty()) {
+        return usage();
+    }
+
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::string text;
+        if (!readWhole(files[i], text)) {
+            std::cerr << "parser_loadgen: cannot read " << files[i] << std::endl;
+            return 2;
+        }
+        sources.push_back(text);
+    }
+    if (sources.empty()) {
+        sources.push_back("int f(int n) {\n    if (n < 2) {\n        return n;\n    }\n"
+                          "    return f(n - 1) + f(n - 2);\n}\n\nint main() {\n    return f(10);\n}\n");
+    }
+
+    std::vector<Client> results(clients);
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < clients; c++) {
+        threads.push_back(std::thread([&, c]() {
+            Client& me = results[c];
+            me.latencies.reserve(requests);
+            int fd = -1;
+            if (!socketPath.empty()) {
+                std::string err;
+                fd = connectServer(socketPath, err);
+                if (fd < 0) {
+                    std::cerr << "parser_loadgen: " << err << std::endl;
+                    me.failures = requests;
+                    return;
+                }
+            }
+            std::string answer;
+            for (size_t r = 0; r < requests; r++) {
+                const std::string& source = sources[(c + r * clients) % sources.size()];
+                std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+                bool ok;
+                if (fd >= 0) {
+                    ok = sendFrame(fd, source.data(), source.size()) && receiveFrame(fd, answer);
+                } else {
+                    ok = runProcess(parserPath, source, answer);
+                }
+                std::chrono::steady_clock::time_point got = std::chrono::steady_clock::now();
+                if (!ok || (answer.compare(0, 6, "accept") != 0 && answer.compare(0, 6, "reject") != 0)) {
+                    me.failures++;
+                    if (fd >= 0 && !ok) {
+                        me.failures += requests - r - 1;
+                        break;
+                    }
+                    continue;
+                }
+                me.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(got - sent).count());
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }));
+    }
+    for (size_t c = 0; c < threads.size(); c++) {
+        threads[c].join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint64_t> all;
+    size_t failures = 0;
+    for (size_t c = 0; c < results.size(); c++) {
+        all.insert(all.end(), results[c].latencies.begin(), results[c].latencies.end());
+        failures += results[c].failures;
+    }
+    printf("%zu requests from %zu clients in %.3f s: %.0f requests/s, %zu failed\n",
+           all.size() + failures, clients, seconds, seconds > 0 ? all.size() / seconds : 0.0, failures);
+    if (all.empty()) {
+        return 1;
+    }
+    std::sort(all.begin(), all.end());
+    printf("latency (us): min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           all[0] / 1000.0, percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99),
+           percentile(all, 0.999), all[all.size() - 1] / 1000.0);
+
+    // Power-of-two buckets: each row counts the latencies below its bound
+    // and not below the previous row's.
+    std::vector<size_t> buckets;
+    for (size_t i = 0; i < all.size(); i++) {
+        size_t b = 0;
+        while ((uint64_t)1000 << b <= all[i]) {
+            b++;
+        }
+        if (b >= buckets.size()) {
+            buckets.resize(b + 1);
+        }
+        buckets[b]++;
+    }
+    size_t widest = *std::max_element(buckets.begin(), buckets.end());
+    size_t below = 0;
+    size_t first = 0;
+    while (buckets[first] == 0) {
+        first++;
+    }
+    for (size_t b = first; b < buckets.size(); b++) {
+        below += buckets[b];
+        printf("< %8llu us %9zu %6.2f%% %s\n", (unsigned long long)1 << b, buckets[b], 100.0 * below / all.size(),
+               std::string((buckets[b] * 50 + widest - 1) / widest, '#').c_str());
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,20 +1,298 @@
+#include "ir.h"
+#include "native.h"
 #include "parser.h"
+#include "source.h"
+#include "thread_pool.h"
+#include "verdict_cache.h"
+#include "vm.h"
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
 
-int main() {
-    std::string input;
-    std::string line;
+struct Options {
+    LexerEngine engine;
+    bool columns;
+    bool prelex;
+    bool dumpTree;
+    size_t maxDepth;    // 0: recursive parser
+    size_t maxErrors;   // 0: no limit
+    bool failFast;
+    bool semantic;
+    bool dumpCalls;
+    bool execute;
+    bool native;        // run as machine code
+    bool assembly;
+    bool optimize;      // lower through SSA form and its passes
+    bool dumpIr;
+    int threads;
+    VerdictCache* cache;    // NULL: no cache
+
+    Options() : engine(LEX_CLASSIC), columns(false), prelex(false), dumpTree(false), maxDepth(0),
+                maxErrors(0), failFast(false), semantic(false), dumpCalls(false), execute(false), native(false),
+                assembly(false), optimize(false), dumpIr(false), threads(1), cache(NULL) {}
+};
+
+// Prints the verdict and, if asked for and the program was accepted, its
+// syntax tree, call graph, SSA form and assembly. With a key, records the verdict in the cache.
+// Returns the exit status: main's value if the program was run.
+static int run(Parser& parser, const Options& opt, const Hash128* key = NULL) {
+    if (opt.maxDepth != 0) {
+        parser.useExplicitStack(opt.maxDepth);
+    }
+    parser.setMaxErrors(opt.maxErrors);
+    if (opt.failFast) {
+        parser.failFast();
+    }
+    bool lowering = opt.execute || opt.assembly || opt.dumpIr;
+    if (opt.semantic || lowering) {
+        parser.checkScopes();
+    }
+    if (opt.semantic || opt.dumpCalls || lowering) {
+        parser.checkCalls();
+    }
+    Ast tree;
+    bool ok = parser.parse(opt.dumpTree || lowering ? &tree : NULL);
+    // The assembly owns standard output, so it can be redirected to a file.
+    parser.printErrors(opt.columns, opt.assembly ? std::cerr : std::cout);
+    if (ok && opt.dumpTree) {
+        dumpAst(tree, parser.symbolTable(), std::cout);
+    }
+    if (ok && opt.dumpCalls) {
+        dumpCallGraph(parser.callGraph(), parser.symbolTable(), std::cout);
+    }
+    if (key != NULL) {
+        opt.cache->store(*key, parser.errorList(), opt.maxErrors, opt.failFast);
+    }
+    if (!ok || !lowering) {
+        return 0;
+    }
+    BytecodeProgram program;
+    BytecodeCompiler compiler;
+    NativeCompiler native;
+    std::string err;
+    int32_t result = 0;
+    bool done;
+    if (opt.optimize || opt.dumpIr) {
+        IrProgram ir;
+        IrBuilder builder;
+        done = builder.build(tree, parser.callGraph(), ir, err);
+        if (done && opt.optimize) {
+            PassManager passes;
+            passes.addStandard();
+            done = passes.run(ir, err);
+        }
+        if (done && opt.dumpIr) {
+            dumpIr(ir, parser.symbolTable(), std::cout);
+        }
+        if (done && (opt.execute || opt.assembly)) {
+            done = lowerIr(ir, program, err);
+        }
+    } else {
+        done = compiler.compile(tree, parser.callGraph(), program, err);
+    }
+    if (done && opt.assembly) {
+        done = native.writeAssembly(program, parser.symbolTable(), std::cout, err);
+    }
+    std::cout.flush();
+    if (done && opt.execute && opt.native) {
+        NativeCode code;
+        done = native.compile(program, code, err) && code.run(result, err);
+    } else if (done && opt.execute) {
+        Vm vm;
+        done = vm.run(program, result, err);
+    }
+    if (!done) {
+        std::cerr << "parser: " << err << std::endl;
+        return 2;
+    }
+    return result;
+}
+
+static int parseInPlace(const char* data, size_t size, const Options& opt) {
+    // A cached verdict has no tree to go with it.
+    Hash128 key = { 0, 0 };
+    if (opt.cache != NULL) {
+        key = opt.cache->key(data, size, opt.maxDepth);
+        std::vector<ErrorInfo> errors;
+        if (!opt.dumpTree && opt.cache->lookup(key, opt.maxErrors, opt.failFast, errors)) {
+            printVerdict(errors, opt.failFast, opt.columns);
+            return 0;
+        }
+    }
+    const Hash128* store = opt.cache != NULL ? &key : NULL;
+    if (opt.prelex) {
+        TokenBuffer tokens;
+        tokens.lex(data, size, opt.engine);
+        Parser parser(tokens);
+        ThreadPool pool(opt.threads);
+        if (opt.threads > 1) {
+            parser.useThreads(pool);
+        }
+        return run(parser, opt, store);
+    }
+    Parser parser(data, size, opt.engine);
+    return run(parser, opt, store);
+}
+
+static int usage() {
+    std::cerr << "usage: parser [--lexer=classic|table] [--stream] [--token-buffer] [--columns] [--ast]" << std::endl
+              << "              [--iterative] [--max-depth=N] [--max-errors=N] [--fail-fast]" << std::endl
+              << "              [--semantic] [--call-graph] [--run] [--native] [--asm] [--optimize] [--ir]" << std::endl
+              << "              [--threads=N] [--cache=PATH] [--cache-size=MB] [file]" << std::endl
+              << "reads the program from file (memory-mapped) or from stdin;" << std::endl
+              << "--stream lexes stdin through a fixed-size window instead of reading it all;" << std::endl
+              << "--token-buffer lexes the whole input before parsing;" << std::endl
+              << "--columns prints rejected positions as line:column;" << std::endl
+              << "--ast prints the syntax tree of an accepted program;" << std::endl
+              << "--iterative parses on a heap stack instead of recursing, rejecting" << std::endl
+              << "nesting deeper than --max-depth frames (default " << Parser::DEFAULT_MAX_DEPTH << ");" << std::endl
+              << "--max-errors stops after rejecting N lines;" << std::endl
+              << "--fail-fast stops at the first error and prints only the verdict;" << std::endl
+              << "--semantic also rejects variables used undeclared or declared twice in a block," << std::endl
+              << "calls to undefined functions and calls with the wrong number of arguments;" << std::endl
+              << "--call-graph checks calls and prints what each function of an accepted program" << std::endl
+              << "calls, marking recursive functions and those main never reaches;" << std::endl
+              << "--run checks an accepted program like --semantic, then runs it on the bytecode" << std::endl
+              << "interpreter and exits with the value main returns;" << std::endl
+              << "--native runs it like --run, but as x86-64 machine code;" << std::endl
+              << "--asm checks an accepted program like --semantic and prints it as x86-64" << std::endl
+              << "assembly for the GNU assembler, with the entry point toyc_run and the verdict" << std::endl
+              << "on standard error;" << std::endl
+              << "--optimize makes --run, --native and --asm go through SSA form, with constant" << std::endl
+              << "propagation, value numbering, dead code and branch removal, inlining of small" << std::endl
+              << "functions, and loops in place of tail recursion;" << std::endl
+              << "--ir checks an accepted program like --semantic and prints its SSA form" << std::endl
+              << "(after the passes with --optimize);" << std::endl
+              << "--threads parses function definitions on N threads (implies --token-buffer);" << std::endl
+              << "--cache answers a program seen before from a file of verdicts at PATH, which" << std::endl
+              << "holds about --cache-size MB (default " << (VerdictCache::DEFAULT_SIZE >> 20) << ");" << std::endl
+              << "--stream and --semantic (or --call-graph, --run, --native, --asm, --ir) go with" << std::endl
+              << "neither --cache nor each other." << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    const char* path = NULL;
+    bool streaming = false;
+    const char* cachePath = NULL;
+    size_t cacheSize = VerdictCache::DEFAULT_SIZE >> 20;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lexer=table") == 0) {
+            opt.engine = LEX_TABLE;
+        } else if (strcmp(argv[i], "--lexer=classic") == 0) {
+            opt.engine = LEX_CLASSIC;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streaming = true;
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            opt.columns = true;
+        } else if (strcmp(argv[i], "--token-buffer") == 0) {
+            opt.prelex = true;
+        } else if (strcmp(argv[i], "--ast") == 0) {
+            opt.dumpTree = true;
+        } else if (strcmp(argv[i], "--iterative") == 0) {
+            if (opt.maxDepth == 0) {
+                opt.maxDepth = Parser::DEFAULT_MAX_DEPTH;
+            }
+        } else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+            char* end;
+            opt.maxDepth = strtoul(argv[i] + 12, &end, 10);
+            if (*end != '\0' || opt.maxDepth == 0) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            char* end;
+            opt.maxErrors = strtoul(argv[i] + 13, &end, 10);
+            if (*end != '\0' || opt.maxErrors == 0) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            char* end;
+            opt.threads = (int)strtol(argv[i] + 10, &end, 10);
+            if (*end != '\0' || opt.threads < 1) {
+                return usage();
+            }
+            opt.prelex = true;
+        } else if (strcmp(argv[i], "--fail-fast") == 0) {
+            opt.failFast = true;
+        } else if (strcmp(argv[i], "--semantic") == 0) {
+            opt.semantic = true;
+        } else if (strcmp(argv[i], "--call-graph") == 0) {
+            opt.dumpCalls = true;
+        } else if (strcmp(argv[i], "--run") == 0) {
+            opt.execute = true;
+        } else if (strcmp(argv[i], "--native") == 0) {
+            opt.execute = true;
+            opt.native = true;
+        } else if (strcmp(argv[i], "--asm") == 0) {
+            opt.assembly = true;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            opt.optimize = true;
+        } else if (strcmp(argv[i], "--ir") == 0) {
+            opt.dumpIr = true;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8] != '\0') {
+            cachePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            char* end;
+            cacheSize = strtoul(argv[i] + 13, &end, 10);
+            if (*end != '\0' || cacheSize == 0) {
+                return usage();
+            }
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    bool checking = opt.semantic || opt.dumpCalls || opt.execute || opt.assembly || opt.dumpIr;
+    if (streaming && (path != NULL || opt.prelex || cachePath != NULL || checking)) {
+        return usage();
+    }
+    if (checking && cachePath != NULL) {
+        return usage();
+    }
+    VerdictCache cache;
+    if (cachePath != NULL) {
+        std::string err;
+        if (!cache.open(cachePath, cacheSize << 20, err)) {
+            std::cerr << "parser: " << err << std::endl;
+            return 2;
+        }
+        opt.cache = &cache;
+    }
     
-    while (std::getline(std::cin, line)) {
-        input += line + "\n";
+    if (streaming) {
+        std::ios::sync_with_stdio(false);
+        Parser parser(std::cin, 1 << 20, opt.engine);
+        return run(parser, opt);
     }
     
-    Parser parser(input);
-    parser.parse();
-    parser.printErrors();
+    // Input is treated line by line, so text after the last newline counts
+    // as a complete line. A mapped file that already ends in a newline (or
+    // is empty) is parsed in place; anything else needs the newline added.
+    std::string input;
+    SourceFile file;
+    if (path != NULL) {
+        std::string err;
+        if (!file.open(path, err)) {
+            std::cerr << "parser: " << err << std::endl;
+            return 2;
+        }
+        if (file.size() == 0 || file.data()[file.size() - 1] == '\n') {
+            return parseInPlace(file.data(), file.size(), opt);
+        }
+        input.assign(file.data(), file.size());
+        file.close();
+    } else {
+        std::stringstream ss;
+        ss << std::cin.rdbuf();
+        input = ss.str();
+    }
+    if (!input.empty() && input[input.size() - 1] != '\n') {
+        input += '\n';
+    }
     
-    return 0;
+    return parseInPlace(input.data(), input.size(), opt);
 }
-
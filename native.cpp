@@ -0,0 +1,818 @@
+#include "native.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define NATIVE_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool nativeSupported() {
+#ifdef NATIVE_SUPPORTED
+    return true;
+#else
+    return false;
+#endif
+}
+
+const size_t NativeCode::DEFAULT_STACK;
+
+namespace {
+
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15, REGISTERS
+};
+
+enum Cond {
+    CC_B = 2, CC_E = 4, CC_NE = 5, CC_L = 12, CC_GE = 13, CC_LE = 14, CC_G = 15, ALWAYS = -1
+};
+
+// The two quadwords of the data page, for getting out of a failed run.
+enum Data {
+    SAVED_RSP, STACK_LIMIT
+};
+
+enum Alu {
+    ALU_MOV, ALU_ADD, ALU_SUB, ALU_XOR, ALU_CMP, ALU_TEST
+};
+
+struct AluOp {
+    const char* name;
+    uint8_t store;      // r/m = r/m op reg
+    uint8_t load;       // reg = reg op r/m
+};
+
+const AluOp aluOps[] = {
+    { "mov", 0x89, 0x8B }, { "add", 0x01, 0x03 }, { "sub", 0x29, 0x2B },
+    { "xor", 0x31, 0x33 }, { "cmp", 0x39, 0x3B }, { "test", 0x85, 0x85 },
+};
+
+const char* const names64[REGISTERS] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+const char* const names32[REGISTERS] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+const char* const condNames[16] = {
+    "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g",
+};
+
+const char* const dataNames[] = { "toyc_saved_rsp", "toyc_stack_limit" };
+
+const int arguments[] = { RDI, RSI, RDX, RCX, R8, R9 };
+const uint32_t REGISTER_ARGUMENTS = 6;
+
+// Caller-saved registers first, so that leaf functions need not save any.
+// rax, rcx and rdx are left over for scratch, and the argument registers
+// for calls.
+const int allocatable[] = { R10, R11, RBX, R12, R13, R14, R15 };
+
+const uint64_t FAILED_DIVISION = 1;
+const uint64_t FAILED_STACK = 2;
+
+// A 32-bit (or, for the frame and stack pointers, 64-bit) operand: a
+// register, or memory at disp(%rbp).
+struct Loc {
+    int reg;
+    int32_t disp;
+
+    bool inMemory() const { return reg < 0; }
+    bool operator==(const Loc& o) const { return reg == o.reg && (reg >= 0 || disp == o.disp); }
+    bool operator!=(const Loc& o) const { return !(*this == o); }
+};
+
+Loc regLoc(int reg) {
+    Loc l = { reg, 0 };
+    return l;
+}
+
+Loc frameLoc(int32_t disp) {
+    Loc l = { -1, disp };
+    return l;
+}
+
+std::string operand(const Loc& l, bool wide) {
+    if (!l.inMemory()) {
+        return std::string("%") + (wide ? names64 : names32)[l.reg];
+    }
+    return std::to_string(l.disp) + "(%rbp)";
+}
+
+} // namespace
+
+// Encodes instructions into a byte buffer and, given a stream, also writes
+// them out in AT&T syntax. Jumps and calls always take 32-bit
+// displacements, patched once every label is placed.
+class X86Emitter {
+private:
+    struct Fixup {
+        size_t at;
+        uint32_t target;    // label, or Data
+        bool data;
+    };
+
+    std::vector<Fixup> fixups;
+    uint32_t locals;
+
+    void byte(uint8_t b) { code.push_back(b); }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            byte((uint8_t)(v >> (8 * i)));
+        }
+    }
+
+    void rex(bool wide, int reg, int rm) {
+        uint8_t r = (uint8_t)(0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | (rm >= 0 && (rm & 8) ? 1 : 0));
+        if (r != 0x40) {
+            byte(r);
+        }
+    }
+
+    // [REX] opcode ModRM [disp]; opcodes above 0xFF take a 0x0F escape.
+    void encode(bool wide, int op, int reg, const Loc& rm) {
+        rex(wide, reg, rm.reg);
+        if (op > 0xFF) {
+            byte(0x0F);
+        }
+        byte((uint8_t)op);
+        if (!rm.inMemory()) {
+            byte((uint8_t)(0xC0 | (reg & 7) << 3 | (rm.reg & 7)));
+        } else if (rm.disp >= -128 && rm.disp <= 127) {
+            byte((uint8_t)(0x45 | (reg & 7) << 3));
+            byte((uint8_t)rm.disp);
+        } else {
+            byte((uint8_t)(0x85 | (reg & 7) << 3));
+            imm32((uint32_t)rm.disp);
+        }
+    }
+
+    void line(const std::string& s) {
+        *text << "\t" << s << "\n";
+    }
+
+public:
+    std::vector<uint8_t> code;
+    std::ostream* text;
+    std::vector<size_t> labels;     // offsets
+    std::vector<std::string> labelNames;
+
+    explicit X86Emitter(std::ostream* text) : locals(0), text(text) {}
+
+    uint32_t label(const std::string& name) {
+        labels.push_back(0);
+        labelNames.push_back(name);
+        return (uint32_t)labels.size() - 1;
+    }
+
+    uint32_t label() {
+        return label(text != NULL ? ".L" + std::to_string(locals++) : std::string());
+    }
+
+    void bind(uint32_t l) {
+        labels[l] = code.size();
+        if (text != NULL) {
+            *text << labelNames[l] << ":\n";
+        }
+    }
+
+    void directive(const std::string& s) {
+        if (text != NULL) {
+            line(s);
+        }
+    }
+
+    void align() {
+        while (code.size() % 16 != 0) {
+            byte(0x90);
+        }
+        directive(".p2align 4");
+    }
+
+    // dst op= src; at most one of them in memory.
+    void alu(Alu op, const Loc& dst, const Loc& src, bool wide = false) {
+        if (!dst.inMemory()) {
+            encode(wide, aluOps[op].load, dst.reg, src);
+        } else {
+            encode(wide, aluOps[op].store, src.reg, dst);
+        }
+        if (text != NULL) {
+            line(std::string(aluOps[op].name) + (wide ? "q\t" : "l\t") + operand(src, wide) + ", " +
+                 operand(dst, wide));
+        }
+    }
+
+    // ext is the ModRM reg field that picks the operation: 0 add, 5 sub,
+    // 7 cmp.
+    void aluImm(int ext, const Loc& dst, int32_t imm, bool wide = false) {
+        static const char* const names[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+        if (imm >= -128 && imm <= 127) {
+            encode(wide, 0x83, ext, dst);
+            byte((uint8_t)imm);
+        } else {
+            encode(wide, 0x81, ext, dst);
+            imm32((uint32_t)imm);
+        }
+        if (text != NULL) {
+            line(std::string(names[ext]) + (wide ? "q\t$" : "l\t$") + std::to_string(imm) + ", " +
+                 operand(dst, wide));
+        }
+    }
+
+    void movImm(const Loc& dst, int32_t imm) {
+        if (!dst.inMemory()) {
+            rex(false, 0, dst.reg);
+            byte((uint8_t)(0xB8 | (dst.reg & 7)));
+        } else {
+            encode(false, 0xC7, 0, dst);
+        }
+        imm32((uint32_t)imm);
+        if (text != NULL) {
+            line("movl\t$" + std::to_string(imm) + ", " + operand(dst, false));
+        }
+    }
+
+    void imul(int dst, const Loc& src) {
+        encode(false, 0x0FAF, dst, src);
+        if (text != NULL) {
+            line("imull\t" + operand(src, false) + ", " + operand(regLoc(dst), false));
+        }
+    }
+
+    // ext 3 neg, 7 idiv.
+    void unary(int ext, const Loc& l) {
+        encode(false, 0xF7, ext, l);
+        if (text != NULL) {
+            line(std::string(ext == 3 ? "negl\t" : "idivl\t") + operand(l, false));
+        }
+    }
+
+    void cdq() {
+        byte(0x99);
+        directive("cltd");
+    }
+
+    // eax = the condition, 0 or 1.
+    void setcc(Cond cc) {
+        byte(0x0F);
+        byte((uint8_t)(0x90 | cc));
+        byte(0xC0);
+        byte(0x0F);
+        byte(0xB6);
+        byte(0xC0);
+        if (text != NULL) {
+            line(std::string("set") + condNames[cc] + "\t%al");
+            line("movzbl\t%al, %eax");
+        }
+    }
+
+    void jump(Cond cc, uint32_t target) {
+        if (cc == ALWAYS) {
+            byte(0xE9);
+        } else {
+            byte(0x0F);
+            byte((uint8_t)(0x80 | cc));
+        }
+        Fixup f = { code.size(), target, false };
+        fixups.push_back(f);
+        imm32(0);
+        if (text != NULL) {
+            line(std::string(cc == ALWAYS ? "jmp" : std::string("j") + condNames[cc]) + "\t" + labelNames[target]);
+        }
+    }
+
+    void call(uint32_t target) {
+        byte(0xE8);
+        Fixup f = { code.size(), target, false };
+        fixups.push_back(f);
+        imm32(0);
+        if (text != NULL) {
+            line("call\t" + labelNames[target]);
+        }
+    }
+
+    void push(const Loc& l) {
+        if (l.inMemory()) {
+            encode(false, 0xFF, 6, l);
+        } else {
+            rex(false, 0, l.reg);
+            byte((uint8_t)(0x50 | (l.reg & 7)));
+        }
+        if (text != NULL) {
+            line("pushq\t" + operand(l, true));
+        }
+    }
+
+    void pop(int reg) {
+        rex(false, 0, reg);
+        byte((uint8_t)(0x58 | (reg & 7)));
+        if (text != NULL) {
+            line(std::string("popq\t%") + names64[reg]);
+        }
+    }
+
+    // 64-bit mov (0x89: data = reg, 0x8B: reg = data) or cmp (0x3B: reg
+    // against data) with a quadword of the data page.
+    void data(int op, int reg, Data d) {
+        rex(true, reg, -1);
+        byte((uint8_t)op);
+        byte((uint8_t)(0x05 | (reg & 7) << 3));
+        Fixup f = { code.size(), (uint32_t)d, true };
+        fixups.push_back(f);
+        imm32(0);
+        if (text != NULL) {
+            std::string mem = std::string(dataNames[d]) + "(%rip)";
+            std::string r = std::string("%") + names64[reg];
+            if (op == 0x89) {
+                line("movq\t" + r + ", " + mem);
+            } else {
+                line(std::string(op == 0x8B ? "movq\t" : "cmpq\t") + mem + ", " + r);
+            }
+        }
+    }
+
+    void shl64(int reg, int bits) {
+        encode(true, 0xC1, 4, regLoc(reg));
+        byte((uint8_t)bits);
+        if (text != NULL) {
+            line("shlq\t$" + std::to_string(bits) + ", %" + names64[reg]);
+        }
+    }
+
+    void leave() {
+        byte(0xC9);
+        directive("leave");
+    }
+
+    void ret() {
+        byte(0xC3);
+        directive("ret");
+    }
+
+    // Patches jumps and data references, the data page starting at offset
+    // dataStart of the code.
+    void resolve(size_t dataStart) {
+        for (size_t i = 0; i < fixups.size(); i++) {
+            const Fixup& f = fixups[i];
+            size_t to = f.data ? dataStart + 8 * f.target : labels[f.target];
+            uint32_t rel = (uint32_t)((int64_t)to - (int64_t)(f.at + 4));
+            for (int b = 0; b < 4; b++) {
+                code[f.at + b] = (uint8_t)(rel >> (8 * b));
+            }
+        }
+    }
+};
+
+namespace {
+
+void load(X86Emitter& out, int reg, const Loc& src) {
+    if (src.reg != reg) {
+        out.alu(ALU_MOV, regLoc(reg), src);
+    }
+}
+
+void move(X86Emitter& out, const Loc& dst, const Loc& src) {
+    if (dst == src) {
+        return;
+    }
+    if (dst.inMemory() && src.inMemory()) {
+        load(out, RAX, src);
+        out.alu(ALU_MOV, dst, regLoc(RAX));
+        return;
+    }
+    out.alu(ALU_MOV, dst, src);
+}
+
+// Sets the flags as for x - y.
+void compare(X86Emitter& out, const Loc& x, const Loc& y) {
+    if (x.inMemory() && y.inMemory()) {
+        load(out, RAX, x);
+        out.alu(ALU_CMP, regLoc(RAX), y);
+        return;
+    }
+    out.alu(ALU_CMP, x, y);
+}
+
+void testZero(X86Emitter& out, const Loc& x) {
+    if (x.inMemory()) {
+        out.aluImm(7, x, 0);
+    } else {
+        out.alu(ALU_TEST, x, x);
+    }
+}
+
+Cond conditionOf(uint16_t op) {
+    switch (op) {
+    case OP_LT:
+    case OP_JLT:
+        return CC_L;
+    case OP_LE:
+    case OP_JLE:
+        return CC_LE;
+    case OP_GT:
+    case OP_JGT:
+        return CC_G;
+    case OP_GE:
+    case OP_JGE:
+        return CC_GE;
+    case OP_EQ:
+    case OP_JEQ:
+        return CC_E;
+    default:
+        return CC_NE;
+    }
+}
+
+} // namespace
+
+NativeCode::NativeCode() : memory(NULL), mappedSize(0), entry(0), margin(0), stackSize(DEFAULT_STACK) {}
+
+NativeCode::~NativeCode() {
+    release();
+}
+
+void NativeCode::release() {
+#ifdef NATIVE_SUPPORTED
+    if (memory != NULL) {
+        munmap(memory, mappedSize);
+    }
+#endif
+    memory = NULL;
+    mappedSize = 0;
+}
+
+bool NativeCode::run(int32_t& result, std::string& err) const {
+#ifdef NATIVE_SUPPORTED
+    if (memory == NULL) {
+        err = "No native code loaded";
+        return false;
+    }
+    void* stack = mmap(NULL, stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+        err = "Cannot map a stack for native code";
+        return false;
+    }
+    typedef uint64_t (*Entry)(void* stackTop, void* stackLimit);
+    Entry run = reinterpret_cast<Entry>(memory + entry);
+    uint8_t* bottom = static_cast<uint8_t*>(stack);
+    uint64_t r = run(bottom + stackSize, bottom + margin);
+    munmap(stack, stackSize);
+    switch (r >> 32) {
+    case 0:
+        result = (int32_t)(uint32_t)r;
+        return true;
+    case FAILED_DIVISION:
+        err = "Division by zero";
+        return false;
+    default:
+        err = "Stack overflow";
+        return false;
+    }
+#else
+    (void)result;
+    err = "Native code needs x86-64 Linux";
+    return false;
+#endif
+}
+
+NativeCompiler::NativeCompiler() : program(NULL), entry(0), divisionByZero(0), overflow(0), margin(0) {}
+
+void NativeCompiler::function(X86Emitter& out, uint32_t f) {
+    const BytecodeFunction& fn = program->functions[f];
+    std::vector<bool> preserved(REGISTERS, false);
+    preserved[RBX] = preserved[RBP] = preserved[R12] = preserved[R13] = preserved[R14] = preserved[R15] = true;
+    std::vector<int> registers(allocatable, allocatable + sizeof(allocatable) / sizeof(allocatable[0]));
+    scan.allocate(*program, fn, registers, preserved, alloc);
+
+    // Frame, below the saved rbp: the preserved registers used, then the
+    // spill slots, padded to keep calls 16-byte aligned.
+    std::vector<int> saved;
+    for (size_t r = 0; r < registers.size(); r++) {
+        if (alloc.used[registers[r]] && preserved[registers[r]]) {
+            saved.push_back(registers[r]);
+        }
+    }
+    int32_t frame = (int32_t)(8 * alloc.slots + 8 * ((saved.size() + alloc.slots) % 2));
+    std::vector<Loc> locs(fn.registers);
+    for (uint32_t v = 0; v < fn.registers; v++) {
+        locs[v] = alloc.reg[v] != Allocation::NO_REGISTER
+                      ? regLoc(alloc.reg[v])
+                      : frameLoc(-8 * (int32_t)(saved.size() + alloc.slot[v] + 1));
+    }
+    std::vector<uint32_t> targets(fn.code.size(), 0);
+    size_t outgoing = 0;
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const Insn& insn = fn.code[i];
+        if (insn.op >= OP_JMP && insn.op <= OP_JNE && targets[insn.c] == 0) {
+            targets[insn.c] = out.label() + 1;
+        }
+        if (insn.op == OP_CALL && program->functions[insn.b].params > REGISTER_ARGUMENTS) {
+            size_t stacked = program->functions[insn.b].params - REGISTER_ARGUMENTS;
+            outgoing = std::max(outgoing, 8 * (stacked + stacked % 2));
+        }
+    }
+    // Return address, rbp, the frame, stacked arguments and the return
+    // address of a call.
+    margin = std::max(margin, 16 + 8 * saved.size() + frame + outgoing + 8);
+    uint32_t epilogue = out.label();
+    const Loc unused = regLoc(RAX);
+
+    out.align();
+    out.bind(functionLabels[f]);
+    out.data(0x3B, RSP, STACK_LIMIT);
+    out.jump(CC_B, overflow);
+    out.push(regLoc(RBP));
+    out.alu(ALU_MOV, regLoc(RBP), regLoc(RSP), true);
+    for (size_t i = 0; i < saved.size(); i++) {
+        out.push(regLoc(saved[i]));
+    }
+    if (frame != 0) {
+        out.aluImm(5, regLoc(RSP), frame, true);
+    }
+    for (uint32_t p = 0; p < fn.params; p++) {
+        if (!alloc.mentioned[p]) {
+            continue;
+        }
+        if (p < REGISTER_ARGUMENTS) {
+            move(out, locs[p], regLoc(arguments[p]));
+        } else {
+            move(out, locs[p], frameLoc((int32_t)(16 + 8 * (p - REGISTER_ARGUMENTS))));
+        }
+    }
+
+    for (size_t i = 0; i < fn.code.size(); i++) {
+        const Insn& insn = fn.code[i];
+        if (targets[i] != 0) {
+            out.bind(targets[i] - 1);
+        }
+        // Operands that are not registers (constants, targets, functions)
+        // get a location they never use.
+        const Loc& a = insn.a < fn.registers ? locs[insn.a] : unused;
+        const Loc& b = insn.b < fn.registers ? locs[insn.b] : unused;
+        const Loc& c = insn.c < fn.registers ? locs[insn.c] : unused;
+        switch (insn.op) {
+        case OP_MOVE:
+            move(out, a, b);
+            break;
+        case OP_LOADK:
+            if (!a.inMemory() && insn.constant() == 0) {
+                out.alu(ALU_XOR, a, a);
+            } else {
+                out.movImm(a, insn.constant());
+            }
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL: {
+            // Work in a's register unless a is in memory, or is c and the
+            // operation does not commute.
+            bool commutes = insn.op != OP_SUB;
+            Loc acc = a;
+            if (a.inMemory() || (a == c && a != b && !commutes)) {
+                acc = regLoc(RAX);
+            }
+            Loc other = c;
+            if (acc == c && acc != b) {
+                other = b;
+            } else {
+                move(out, acc, b);
+            }
+            if (insn.op == OP_MUL) {
+                out.imul(acc.reg, other);
+            } else {
+                out.alu(insn.op == OP_ADD ? ALU_ADD : ALU_SUB, acc, other);
+            }
+            move(out, a, acc);
+            break;
+        }
+        case OP_DIV:
+        case OP_MOD: {
+            // idiv faults on INT_MIN / -1, which wraps to INT_MIN (with
+            // remainder 0) in ToyC, so -1 takes a path of its own.
+            uint32_t minusOne = out.label();
+            uint32_t done = out.label();
+            load(out, RCX, c);
+            out.alu(ALU_TEST, regLoc(RCX), regLoc(RCX));
+            out.jump(CC_E, divisionByZero);
+            out.aluImm(7, regLoc(RCX), -1);
+            out.jump(CC_E, minusOne);
+            load(out, RAX, b);
+            out.cdq();
+            out.unary(7, regLoc(RCX));
+            move(out, a, regLoc(insn.op == OP_DIV ? RAX : RDX));
+            out.jump(ALWAYS, done);
+            out.bind(minusOne);
+            if (insn.op == OP_DIV) {
+                load(out, RAX, b);
+                out.unary(3, regLoc(RAX));
+                move(out, a, regLoc(RAX));
+            } else {
+                out.movImm(a, 0);
+            }
+            out.bind(done);
+            break;
+        }
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+        case OP_EQ:
+        case OP_NE:
+            compare(out, b, c);
+            out.setcc(conditionOf(insn.op));
+            move(out, a, regLoc(RAX));
+            break;
+        case OP_NEG:
+            if (a.inMemory()) {
+                load(out, RAX, b);
+                out.unary(3, regLoc(RAX));
+                move(out, a, regLoc(RAX));
+            } else {
+                move(out, a, b);
+                out.unary(3, a);
+            }
+            break;
+        case OP_NOT:
+            testZero(out, b);
+            out.setcc(CC_E);
+            move(out, a, regLoc(RAX));
+            break;
+        case OP_JMP:
+            out.jump(ALWAYS, targets[insn.c] - 1);
+            break;
+        case OP_JZ:
+        case OP_JNZ:
+            testZero(out, a);
+            out.jump(insn.op == OP_JZ ? CC_E : CC_NE, targets[insn.c] - 1);
+            break;
+        case OP_CALL: {
+            uint32_t n = program->functions[insn.b].params;
+            uint32_t stacked = n > REGISTER_ARGUMENTS ? n - REGISTER_ARGUMENTS : 0;
+            if (stacked % 2 != 0) {
+                out.aluImm(5, regLoc(RSP), 8, true);
+            }
+            for (uint32_t k = n; k > REGISTER_ARGUMENTS; k--) {
+                out.push(locs[insn.c + k - 1]);
+            }
+            for (uint32_t k = 0; k < n && k < REGISTER_ARGUMENTS; k++) {
+                load(out, arguments[k], locs[insn.c + k]);
+            }
+            out.call(functionLabels[insn.b]);
+            if (stacked != 0) {
+                out.aluImm(0, regLoc(RSP), (int32_t)(8 * (stacked + stacked % 2)), true);
+            }
+            move(out, a, regLoc(RAX));
+            break;
+        }
+        case OP_RET:
+            load(out, RAX, a);
+            if (i + 1 != fn.code.size()) {
+                out.jump(ALWAYS, epilogue);
+            }
+            break;
+        default:
+            compare(out, a, b);
+            out.jump(conditionOf(insn.op), targets[insn.c] - 1);
+            break;
+        }
+    }
+
+    out.bind(epilogue);
+    for (size_t i = 0; i < saved.size(); i++) {
+        out.alu(ALU_MOV, regLoc(saved[i]), frameLoc(-8 * (int32_t)(i + 1)), true);
+    }
+    out.leave();
+    out.ret();
+}
+
+bool NativeCompiler::generate(X86Emitter& out, SymbolTable* symbols, std::string& err) {
+    static const int calleeSaved[] = { RBP, RBX, R12, R13, R14, R15 };
+    const size_t saves = sizeof(calleeSaved) / sizeof(calleeSaved[0]);
+    margin = 0;
+    functionLabels.clear();
+    for (size_t f = 0; f < program->functions.size(); f++) {
+        std::string name;
+        if (symbols != NULL) {
+            size_t size;
+            const char* text = symbols->text(program->functions[f].sym, size);
+            name = "toyc_" + std::string(text, size);
+        }
+        functionLabels.push_back(out.label(name));
+    }
+    entry = out.label("toyc_run");
+    uint32_t exit = out.label();
+    divisionByZero = out.label();
+    overflow = out.label();
+
+    // The entry point saves what System V says it must, switches to the
+    // given stack and calls main, with any parameters it has set to 0 as
+    // the VM does. A failure anywhere below jumps to a stub that puts the
+    // saved stack pointer back and returns the error code.
+    out.directive(".text");
+    out.directive(".globl\ttoyc_run");
+    out.directive(".type\ttoyc_run, @function");
+    out.align();
+    out.bind(entry);
+    for (size_t i = 0; i < saves; i++) {
+        out.push(regLoc(calleeSaved[i]));
+    }
+    out.aluImm(5, regLoc(RSP), 8, true);
+    out.data(0x89, RSP, SAVED_RSP);
+    out.data(0x89, RSI, STACK_LIMIT);
+    out.alu(ALU_MOV, regLoc(RSP), regLoc(RDI), true);
+    uint32_t params = program->functions[program->main].params;
+    out.alu(ALU_XOR, regLoc(RAX), regLoc(RAX));
+    if (params > REGISTER_ARGUMENTS && (params - REGISTER_ARGUMENTS) % 2 != 0) {
+        out.aluImm(5, regLoc(RSP), 8, true);
+    }
+    for (uint32_t k = params; k > REGISTER_ARGUMENTS; k--) {
+        out.push(regLoc(RAX));
+    }
+    for (uint32_t k = 0; k < params && k < REGISTER_ARGUMENTS; k++) {
+        out.alu(ALU_MOV, regLoc(arguments[k]), regLoc(RAX));
+    }
+    out.call(functionLabels[program->main]);
+    out.alu(ALU_MOV, regLoc(RAX), regLoc(RAX));
+    out.data(0x8B, RSP, SAVED_RSP);
+    out.bind(exit);
+    out.aluImm(0, regLoc(RSP), 8, true);
+    for (size_t i = saves; i > 0; i--) {
+        out.pop(calleeSaved[i - 1]);
+    }
+    out.ret();
+    const uint32_t stubs[] = { divisionByZero, overflow };
+    const uint64_t codes[] = { FAILED_DIVISION, FAILED_STACK };
+    for (size_t i = 0; i < 2; i++) {
+        out.bind(stubs[i]);
+        out.data(0x8B, RSP, SAVED_RSP);
+        out.movImm(regLoc(RAX), (int32_t)codes[i]);
+        out.shl64(RAX, 32);
+        out.jump(ALWAYS, exit);
+    }
+
+    for (uint32_t f = 0; f < program->functions.size(); f++) {
+        function(out, f);
+    }
+    margin += 64;
+    if (out.code.size() > 0x7FFFFFFF) {
+        err = "Program too large for native code";
+        return false;
+    }
+    out.directive(".bss");
+    out.directive(".p2align 3");
+    for (size_t d = 0; d < 2; d++) {
+        if (out.text != NULL) {
+            *out.text << dataNames[d] << ":\n";
+        }
+        out.directive(".zero\t8");
+    }
+    out.directive(".section\t.note.GNU-stack,\"\",@progbits");
+    return true;
+}
+
+bool NativeCompiler::compile(const BytecodeProgram& prog, NativeCode& code, std::string& err) {
+#ifdef NATIVE_SUPPORTED
+    program = &prog;
+    X86Emitter out(NULL);
+    if (!generate(out, NULL, err)) {
+        return false;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t codeSize = (out.code.size() + page - 1) / page * page;
+    out.resolve(codeSize);
+    void* p = mmap(NULL, codeSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        err = "Cannot map memory for native code";
+        return false;
+    }
+    memcpy(p, &out.code[0], out.code.size());
+    if (mprotect(p, codeSize, PROT_READ | PROT_EXEC) != 0) {
+        munmap(p, codeSize + page);
+        err = "Cannot make native code executable";
+        return false;
+    }
+    code.release();
+    code.memory = static_cast<uint8_t*>(p);
+    code.mappedSize = codeSize + page;
+    code.entry = out.labels[entry];
+    code.margin = margin;
+    return true;
+#else
+    (void)prog;
+    (void)code;
+    err = "Native code needs x86-64 Linux";
+    return false;
+#endif
+}
+
+bool NativeCompiler::writeAssembly(const BytecodeProgram& prog, SymbolTable& symbols, std::ostream& out,
+                                   std::string& err) {
+    program = &prog;
+    X86Emitter emitter(&out);
+    return generate(emitter, &symbols, err);
+}
@@ -0,0 +1,88 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "bytecode.h"
+#include "regalloc.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Whether this build can run native code (x86-64 Linux). Assembly can be
+// written anywhere.
+bool nativeSupported();
+
+// Machine code for a whole program, in pages that are executable but not
+// writable, with one writable page after them for the stack bounds. It
+// runs on a stack of its own, so that deep recursion in the program fails
+// with a stack overflow instead of crashing the process.
+class NativeCode {
+private:
+    uint8_t* memory;
+    size_t mappedSize;
+    size_t entry;           // offset of toyc_run
+    size_t margin;          // bytes the deepest frame needs below the limit
+    size_t stackSize;
+
+    NativeCode(const NativeCode&);
+    NativeCode& operator=(const NativeCode&);
+
+    friend class NativeCompiler;
+
+public:
+    static const size_t DEFAULT_STACK = (size_t)1 << 28;
+
+    NativeCode();
+    ~NativeCode();
+    void release();
+    bool isLoaded() const { return memory != NULL; }
+    // Calls that would take the stack past this many bytes fail with a
+    // stack overflow.
+    void setStackSize(size_t bytes) { stackSize = bytes; }
+
+    // Runs main and sets result to what it returns. False, with the same
+    // messages as Vm::run(), on division by zero or stack overflow.
+    bool run(int32_t& result, std::string& err) const;
+};
+
+class X86Emitter;
+
+// Translates bytecode to x86-64, one machine instruction sequence per
+// bytecode instruction, with the registers of each function given machine
+// registers by linear scan (see LinearScan) and the rest kept in its frame.
+// Functions follow the System V calling convention: the first six
+// arguments go in rdi, rsi, rdx, rcx, r8 and r9, the others on the stack,
+// the result comes back in eax, and rbx, rbp and r12-r15 survive calls.
+// Every function checks the stack bound on entry, and division checks for
+// zero, both jumping out through toyc_run with an error code.
+//
+// The same code can be loaded into memory and run, or written out as GNU
+// assembler (AT&T syntax) with each function as toyc_<name> and the entry
+// point
+//
+//     uint64_t toyc_run(void* stackTop, void* stackLimit);
+//
+// which calls main on the stack below stackTop and returns its value in
+// the low 32 bits, with 1 (division by zero) or 2 (stack overflow) in the
+// high ones if it failed.
+class NativeCompiler {
+private:
+    const BytecodeProgram* program;
+    LinearScan scan;
+    Allocation alloc;
+    std::vector<uint32_t> functionLabels;
+    uint32_t entry;
+    uint32_t divisionByZero;
+    uint32_t overflow;
+    size_t margin;
+
+    bool generate(X86Emitter& out, SymbolTable* symbols, std::string& err);
+    void function(X86Emitter& out, uint32_t f);
+
+public:
+    NativeCompiler();
+    bool compile(const BytecodeProgram& program, NativeCode& code, std::string& err);
+    bool writeAssembly(const BytecodeProgram& program, SymbolTable& symbols, std::ostream& out, std::string& err);
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "parallel_lexer.h"
+#include "scan.h"
+
+// Chunks always end just after a '\n', so no token and no line comment
+// crosses a chunk boundary; only a block comment can. Every chunk is lexed
+// in parallel on the guess that it starts in code. A sequential pass then
+// walks the chunks in order and re-lexes, from the end of the comment, any
+// chunk whose predecessor actually ended inside a block comment; that only
+// happens when a comment straddles a cut, so the fix-up is rare and cheap.
+// Finally token indexes are rebased from a prefix sum.
+
+namespace {
+
+struct Chunk {
+    size_t begin;
+    size_t end;
+    bool startsInComment;
+    bool endsInComment;
+    vector<Token> tokens;       // chunk-relative index, absolute offset
+    int64_t firstIndex;
+    
+    Chunk(size_t b, size_t e)
+        : begin(b), end(e), startsInComment(false), endsInComment(false),
+          firstIndex(0) {}
+};
+
+void lexChunk(const char* data, Chunk& c, bool inComment, LexerEngine engine) {
+    const char* p = data + c.begin;
+    const char* end = data + c.end;
+    c.startsInComment = inComment;
+    if (inComment) {
+        const char* q = scanCommentEnd(p, end);
+        if (q == end && !(end - p >= 2 && end[-2] == '*' && end[-1] == '/')) {
+            // The whole chunk is comment.
+            c.tokens.clear();
+            c.endsInComment = true;
+            return;
+        }
+        p = q;
+    }
+    Lexer lexer(p, end - p, engine);
+    // Generous guess (one token per four bytes) so the vector rarely grows.
+    c.tokens.clear();
+    c.tokens.reserve((end - p) / 4 + 1);
+    Token t;
+    do {
+        t = lexer.nextToken();
+        c.tokens.push_back(t);
+    } while (t.type != END_OF_FILE);
+    c.tokens.pop_back();
+    uint64_t offset = p - data;
+    for (size_t k = 0; k < c.tokens.size(); k++) {
+        c.tokens[k].offset += offset;
+    }
+    c.endsInComment = lexer.endedInComment();
+}
+
+}
+
+vector<Token> lexParallel(const char* data, size_t size, ThreadPool& pool,
+                          size_t chunkBytes, LexerEngine engine) {
+    if (chunkBytes == 0) {
+        chunkBytes = size / (pool.size() * 4) + 1;
+        if (chunkBytes < 64 * 1024) {
+            chunkBytes = 64 * 1024;
+        }
+    }
+    
+    vector<Chunk> chunks;
+    size_t begin = 0;
+    while (begin < size) {
+        size_t end = begin + chunkBytes < size ? begin + chunkBytes : size;
+        end = scanLineEnd(data + end, data + size) - data;
+        end = end < size ? end + 1 : size;
+        chunks.push_back(Chunk(begin, end));
+        begin = end;
+    }
+    
+    pool.run(chunks.size(), [&](size_t i) {
+        lexChunk(data, chunks[i], false, engine);
+    });
+    
+    bool inComment = false;
+    int64_t index = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        Chunk& c = chunks[i];
+        if (c.startsInComment != inComment) {
+            lexChunk(data, c, inComment, engine);
+        }
+        inComment = c.endsInComment;
+        c.firstIndex = index;
+        index += c.tokens.size();
+    }
+    
+    vector<Token> result(index + 1);
+    pool.run(chunks.size(), [&](size_t i) {
+        const Chunk& c = chunks[i];
+        Token* out = &result[c.firstIndex];
+        for (size_t k = 0; k < c.tokens.size(); k++) {
+            out[k] = c.tokens[k];
+            out[k].index += c.firstIndex;
+        }
+    });
+    result[index] = Token(END_OF_FILE, StrView(), index, size);
+    return result;
+}
@@ -0,0 +1,15 @@
+#ifndef PARALLEL_LEXER_H
+#define PARALLEL_LEXER_H
+
+#include "lexer.h"
+#include "thread_pool.h"
+
+// Lexes data on the pool's threads and returns exactly what
+// Lexer(data, size, engine).getAllTokens() would, including the trailing
+// END_OF_FILE token. The input is cut into chunks of about chunkBytes at
+// line ends (0 picks a size from the pool width). Token text points into
+// data.
+vector<Token> lexParallel(const char* data, size_t size, ThreadPool& pool,
+                          size_t chunkBytes = 0, LexerEngine engine = LEX_CLASSIC);
+
+#endif
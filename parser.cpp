@@ -1,38 +1,85 @@
 #include "parser.h"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
-Parser::Parser(const std::string& input) : lexer(input), hasMain(false) {
-    current = lexer.nextToken();
-    if (current.type == UNKNOWN) {
-        error("Lexical error");
-    }
+Parser::Parser(const std::string& input, LexerEngine engine, SymbolTable* symbols)
+    : lexer(input, engine), buffered(false), hasMain(false), ast(NULL), maxErrors(0), verdictOnly(false), stopped(false), maxDepth(0), tooDeep(false), pool(NULL), checkingScopes(false), checkingCalls(false), pieceTokens(0), definitions(NULL), resumeAt(NULL), resumeEnd(NULL), framesEnd(NULL) {
+    start(symbols);
 }
 
-void Parser::advance() {
-    current = lexer.nextToken();
+// Parses data in place without copying it; the buffer must outlive the parser.
+Parser::Parser(const char* data, size_t size, LexerEngine engine, SymbolTable* symbols)
+    : lexer(data, size, engine), buffered(false), hasMain(false), ast(NULL), maxErrors(0), verdictOnly(false), stopped(false), maxDepth(0), tooDeep(false), pool(NULL), checkingScopes(false), checkingCalls(false), pieceTokens(0), definitions(NULL), resumeAt(NULL), resumeEnd(NULL), framesEnd(NULL) {
+    start(symbols);
 }
 
-bool Parser::match(TokenType type) {
-    if (check(type)) {
-        advance();
-        return true;
-    }
-    return false;
+// Parses a stream of any length in bounded memory; see Lexer(istream&, ...).
+Parser::Parser(std::istream& in, size_t windowSize, LexerEngine engine, SymbolTable* symbols)
+    : lexer(in, windowSize, engine), buffered(false), hasMain(false), ast(NULL), maxErrors(0), verdictOnly(false), stopped(false), maxDepth(0), tooDeep(false), pool(NULL), checkingScopes(false), checkingCalls(false), pieceTokens(0), definitions(NULL), resumeAt(NULL), resumeEnd(NULL), framesEnd(NULL) {
+    start(symbols);
+}
+
+// The lexer is kept only to turn offsets into line numbers for errors.
+Parser::Parser(const TokenBuffer& tokens, SymbolTable* symbols)
+    : lexer(tokens.data(), tokens.dataSize()), cursor(tokens), buffered(true), hasMain(false), ast(NULL), maxErrors(0), verdictOnly(false), stopped(false), maxDepth(0), tooDeep(false), pool(NULL), checkingScopes(false), checkingCalls(false), pieceTokens(0), definitions(NULL), resumeAt(NULL), resumeEnd(NULL), framesEnd(NULL) {
+    start(symbols);
+}
+
+void Parser::start(SymbolTable* shared) {
+    symbols = shared != NULL ? shared : &ownSymbols;
+    lexer.setSymbols(symbols);
+    current = buffered ? cursor.token() : lexer.nextToken();
 }
 
-bool Parser::check(TokenType type) {
-    return current.type == type;
+// Tokens from a TokenBuffer carry no symbol; intern those on demand.
+uint32_t Parser::symbolOf(const Token& t) {
+    if (t.sym != NO_SYMBOL) {
+        return t.sym;
+    }
+    return symbols->intern(t.value.data, t.value.size);
 }
 
 void Parser::error(const std::string& msg) {
-    int line = current.line;
-    for (const auto& err : errors) {
-        if (err.line == line) {
-            return;
-        }
+    errorAt(current.offset, msg);
+}
+
+// Keeps the first error on each line. The parse is cut short, by making
+// the rest of the input look empty, once enough lines are rejected.
+void Parser::errorAt(uint64_t offset, const std::string& msg) {
+    if (stopped) {
+        return;
+    }
+    if (verdictOnly) {
+        errors.push_back(ErrorInfo(0, 0, msg));
+        stop();
+        return;
+    }
+    int64_t line, column;
+    lexer.locate(offset, line, column);
+    if ((size_t)line >= errorLines.size()) {
+        errorLines.resize(std::max((size_t)line + 1, errorLines.size() * 2));
+    } else if (errorLines[line]) {
+        return;
+    }
+    errorLines[line] = true;
+    errors.push_back(ErrorInfo(line, column, msg));
+    if (errors.size() == maxErrors) {
+        stop();
+    }
+}
+
+// Every grammar function already gives up at END_OF_FILE, so jumping there
+// unwinds the parse without a check on the token path.
+void Parser::stop() {
+    stopped = true;
+    if (buffered) {
+        cursor.stop();
+        current = cursor.token();
+    } else {
+        lexer.stop();
+        current = lexer.nextToken();
     }
-    errors.push_back(ErrorInfo(line, msg));
 }
 
 void Parser::errorExpected(const std::string& expected) {
@@ -40,18 +87,50 @@ void Parser::errorExpected(const std::string& expected) {
     error(msg);
 }
 
+template <bool BUILD>
 void Parser::parseCompUnit() {
     if (check(END_OF_FILE)) {
         error("Empty program");
         return;
     }
     
+    AstList functions;
+    if (pool != NULL && buffered) {
+        parsePieces<BUILD>(functions);
+    } else {
+        parseFunctions<BUILD>(functions);
+    }
+    if (tooDeep) {
+        return;
+    }
+    if (BUILD) {
+        ast->functions = functions.first;
+    }
+    
+    if (!hasMain) {
+        error("Missing main function");
+    }
+}
+
+// Function definitions from the current token on, skipping to the next
+// int or void after one that has errors.
+template <bool BUILD>
+void Parser::parseFunctions(AstList& functions) {
     while (!check(END_OF_FILE)) {
+        while (resumeAt != resumeEnd && *resumeAt < current.offset) {
+            resumeAt++;
+        }
+        if (resumeAt != resumeEnd && *resumeAt == current.offset) {
+            return;
+        }
         int errorCountBefore = errors.size();
-        int tokenIndexBefore = current.index;
-        parseFuncDef();
+        int64_t tokenIndexBefore = current.index;
+        functions.append(ast, maxDepth != 0 ? parseFuncDefStack<BUILD>() : parseFuncDef<BUILD>());
+        if (tooDeep) {
+            return;
+        }
         int errorCountAfter = errors.size();
-        int tokenIndexAfter = current.index;
+        int64_t tokenIndexAfter = current.index;
         
         if (errorCountAfter > errorCountBefore) {
             if (tokenIndexBefore == tokenIndexAfter) {
@@ -71,35 +150,49 @@ void Parser::parseCompUnit() {
             break;
         }
     }
+}
+
+// Records a function definition; offset locates a duplicate.
+void Parser::defineFunction(uint32_t sym, uint64_t offset) {
+    if (sym == SYM_MAIN) {
+        hasMain = true;
+    }
     
-    if (!hasMain) {
-        error("Missing main function");
+    if (sym < definedFunctions.size() && definedFunctions[sym]) {
+        errorAt(offset, "Duplicate function name");
+    } else {
+        if (sym >= definedFunctions.size()) {
+            definedFunctions.resize(sym + 1);
+        }
+        definedFunctions[sym] = true;
     }
 }
 
-void Parser::parseFuncDef() {
+// A function definition up to its body. Returns false if the definition
+// ends there.
+template <bool BUILD>
+bool Parser::parseFuncHead(FuncHead& head) {
     if (!check(INT) && !check(VOID)) {
         errorExpected("int or void");
-        return;
+        return false;
     }
+    head.returnType = current.type;
+    head.offset = current.offset;
     advance();
     
     if (!check(IDENTIFIER)) {
         errorExpected("function name");
-        return;
+        return false;
     }
     
-    std::string funcName = current.value;
+    head.sym = symbolOf(current);
     advance();
     
-    if (funcName == "main") {
-        hasMain = true;
-    }
-    
-    if (functionNames.find(funcName) != functionNames.end()) {
-        error("Duplicate function name");
+    if (definitions != NULL) {
+        // A piece of a parallel parse; duplicates are found in the merge.
+        definitions->push_back(Definition(head.sym, current.offset));
     } else {
-        functionNames.insert(funcName);
+        defineFunction(head.sym, current.offset);
     }
     
     if (!match(LEFT_PAREN)) {
@@ -107,12 +200,13 @@ void Parser::parseFuncDef() {
         if (check(RIGHT_PAREN)) {
             advance();
         }
-        return;
+        return false;
     }
     
+    AstList params;
     if (check(INT)) {
         int paramErrorBefore = errors.size();
-        parseParam();
+        params.append(ast, parseParam<BUILD>());
         if (errors.size() > paramErrorBefore) {
             // If first parameter has error, skip to closing paren without parsing more parameters
             while (!check(RIGHT_PAREN) && !check(END_OF_FILE) && !check(LEFT_BRACE)) {
@@ -124,7 +218,7 @@ void Parser::parseFuncDef() {
                     break;
                 }
                 int paramErrorBefore2 = errors.size();
-                parseParam();
+                params.append(ast, parseParam<BUILD>());
                 // If a parameter after comma has error, stop parsing more parameters
                 if (errors.size() > paramErrorBefore2) {
                     break;
@@ -140,35 +234,81 @@ void Parser::parseFuncDef() {
         }
     }
     
+    head.params = params.first;
+    
     if (!match(RIGHT_PAREN)) {
         errorExpected(")");
-        return;
+        return false;
     }
-    
-    parseBlock();
+    return true;
 }
 
-void Parser::parseParam() {
+template <bool BUILD>
+uint32_t Parser::parseFuncDef() {
+    FuncHead head;
+    if (!parseFuncHead<BUILD>(head)) {
+        return AST_NONE;
+    }
+    uint32_t body = parseBlock<BUILD>();
+    return node<BUILD>(AST_FUNC, head.sym, head.params, body, head.returnType, head.offset);
+}
+
+template <bool BUILD>
+uint32_t Parser::parseParam() {
     if (!match(INT)) {
         errorExpected("int");
-        return;
+        return AST_NONE;
     }
     
+    uint32_t sym = nameSym<BUILD>();
+    uint64_t offset = current.offset;
     if (!match(IDENTIFIER)) {
         errorExpected("parameter name");
-        return;
+        return AST_NONE;
     }
+    return node<BUILD>(AST_PARAM, sym, AST_NONE, AST_NONE, 0, offset);
 }
 
-void Parser::parseStmt() {
+// Argument list of a call whose '(' has been consumed, up to and including
+// the ')'.
+template <bool BUILD>
+uint32_t Parser::parseArgs() {
+    AstList args;
+    if (!check(RIGHT_PAREN)) {
+        if (check(COMMA)) {
+            error("Missing argument");
+        } else {
+            args.append(ast, parseExpr<BUILD>());
+            while (match(COMMA)) {
+                if (check(RIGHT_PAREN) || check(SEMICOLON) || 
+                    check(END_OF_FILE)) {
+                    error("Missing argument");
+                    break;
+                }
+                args.append(ast, parseExpr<BUILD>());
+            }
+        }
+    }
+    if (!match(RIGHT_PAREN)) {
+        errorExpected(")");
+    }
+    return args.first;
+}
+
+template <bool BUILD>
+uint32_t Parser::parseStmt() {
+    uint64_t offset = current.offset;
     if (check(LEFT_BRACE)) {
-        parseBlock();
+        return parseBlock<BUILD>();
     } else if (match(SEMICOLON)) {
-        return;
+        return AST_NONE;
     } else if (check(INT)) {
         advance(); // Consume 'int' keyword
+        AstList vars;
         do {
             // Parse variable name (identifier required)
+            uint32_t sym = nameSym<BUILD>();
+            uint64_t varOffset = current.offset;
             if (!match(IDENTIFIER)) {
                 errorExpected("variable name");
                 // Skip until comma, semicolon, or end of file
@@ -183,6 +323,7 @@ void Parser::parseStmt() {
             }
             
             // Optional assignment: parse expr only if '=' exists
+            uint32_t init = AST_NONE;
             if (match(ASSIGN)) {
                 // Check if expression is missing
                 if (check(SEMICOLON) || check(COMMA) || check(END_OF_FILE) || 
@@ -198,8 +339,9 @@ void Parser::parseStmt() {
                         break;
                     }
                 }
-                parseExpr();
+                init = parseExpr<BUILD>();
             }
+            vars.append(ast, node<BUILD>(AST_VAR, sym, init, AST_NONE, 0, varOffset));
             
             if (!check(COMMA)) {
                 break; // No more variables
@@ -217,38 +359,25 @@ void Parser::parseStmt() {
         if (!match(SEMICOLON)) {
             errorExpected(";");
         }
+        return node<BUILD>(AST_DECL, vars.first, AST_NONE, AST_NONE, 0, offset);
     } else if (check(IDENTIFIER)) {
-        Token idToken = current;
+        uint32_t sym = nameSym<BUILD>();
         advance();
         if (check(ASSIGN)) {
             advance();
-            parseExpr();
+            uint32_t value = parseExpr<BUILD>();
             if (!match(SEMICOLON)) {
                 errorExpected(";");
             }
+            return node<BUILD>(AST_ASSIGN, sym, value, AST_NONE, 0, offset);
         } else if (check(LEFT_PAREN)) {
             advance();
-            if (!check(RIGHT_PAREN)) {
-                if (check(COMMA)) {
-                    error("Missing argument");
-                } else {
-                    parseExpr();
-                    while (match(COMMA)) {
-                        if (check(RIGHT_PAREN) || check(SEMICOLON) || 
-                            check(END_OF_FILE)) {
-                            error("Missing argument");
-                            break;
-                        }
-                        parseExpr();
-                    }
-                }
-            }
-            if (!match(RIGHT_PAREN)) {
-                errorExpected(")");
-            }
+            uint32_t args = parseArgs<BUILD>();
             if (!match(SEMICOLON)) {
                 errorExpected(";");
             }
+            uint32_t call = node<BUILD>(AST_CALL, sym, args, AST_NONE, 0, offset);
+            return node<BUILD>(AST_EXPR_STMT, call, AST_NONE, AST_NONE, 0, offset);
         } else {
             error("Invalid statement");
         }
@@ -256,66 +385,77 @@ void Parser::parseStmt() {
         advance();
         if (!match(LEFT_PAREN)) {
             errorExpected("(");
-            return;
+            return AST_NONE;
         }
-        parseExpr();
+        uint32_t cond = parseExpr<BUILD>();
         if (!match(RIGHT_PAREN)) {
             errorExpected(")");
-            return;
+            return AST_NONE;
         }
-        parseStmt();
+        uint32_t then = parseStmt<BUILD>();
+        uint32_t otherwise = AST_NONE;
         if (match(ELSE)) {
-            parseStmt();
+            otherwise = parseStmt<BUILD>();
         }
+        return node<BUILD>(AST_IF, cond, then, otherwise, 0, offset);
     } else if (check(WHILE)) {
         advance();
         if (!match(LEFT_PAREN)) {
             errorExpected("(");
-            return;
+            return AST_NONE;
         }
-        parseExpr();
+        uint32_t cond = parseExpr<BUILD>();
         if (!match(RIGHT_PAREN)) {
             errorExpected(")");
-            return;
+            return AST_NONE;
         }
-        parseStmt();
+        uint32_t body = parseStmt<BUILD>();
+        return node<BUILD>(AST_WHILE, cond, body, AST_NONE, 0, offset);
     } else if (check(BREAK)) {
         advance();
         if (!match(SEMICOLON)) {
             errorExpected(";");
         }
+        return node<BUILD>(AST_BREAK, AST_NONE, AST_NONE, AST_NONE, 0, offset);
     } else if (check(CONTINUE)) {
         advance();
         if (!match(SEMICOLON)) {
             errorExpected(";");
         }
+        return node<BUILD>(AST_CONTINUE, AST_NONE, AST_NONE, AST_NONE, 0, offset);
     } else if (check(RETURN)) {
         advance();
-        parseExpr();
+        uint32_t value = parseExpr<BUILD>();
         if (!match(SEMICOLON)) {
             errorExpected(";");
         }
+        return node<BUILD>(AST_RETURN, value, AST_NONE, AST_NONE, 0, offset);
     } else if (check(ELSE)) {
         // Skip else that appears without a matching if (error recovery)
         advance();
     } else {
-        parseExpr();
+        uint32_t expr = parseExpr<BUILD>();
         if (!match(SEMICOLON)) {
             errorExpected(";");
         }
+        return node<BUILD>(AST_EXPR_STMT, expr, AST_NONE, AST_NONE, 0, offset);
     }
+    return AST_NONE;
 }
 
-void Parser::parseBlock() {
+template <bool BUILD>
+uint32_t Parser::parseBlock() {
+    uint64_t offset = current.offset;
     if (!match(LEFT_BRACE)) {
         errorExpected("{");
-        return;
+        return AST_NONE;
     }
     
+    AstList stmts;
     while (!check(RIGHT_BRACE) && !check(END_OF_FILE)) {
-        int beforeIndex = current.index;
-        parseStmt();
-        int afterIndex = current.index;
+        int64_t beforeIndex = current.index;
+        stmts.append(ast, parseStmt<BUILD>());
+        int64_t afterIndex = current.index;
         
         if (beforeIndex == afterIndex && !check(RIGHT_BRACE) && !check(END_OF_FILE)) {
             advance();
@@ -329,128 +469,215 @@ void Parser::parseBlock() {
     if (!match(RIGHT_BRACE)) {
         errorExpected("}");
     }
+    return node<BUILD>(AST_BLOCK, stmts.first, AST_NONE, AST_NONE, 0, offset);
 }
 
-void Parser::parseExpr() {
-    parseLOrExpr();
-}
+// Binding power of each binary operator, indexed by TokenType; 0 for
+// tokens that are not one. Higher binds tighter, and every level is
+// left-associative. Operators from ADDITIVE_POWER up report a missing
+// right operand.
+const unsigned char Parser::bindingPower[UNKNOWN + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0,     // INT .. RETURN
+    0, 0,                       // IDENTIFIER, INTCONST
+    4, 4, 5, 5, 5,              // PLUS, MINUS, MULTIPLY, DIVIDE, MODULO
+    0, 3, 3,                    // ASSIGN, EQUAL, NOT_EQUAL
+    3, 3, 3, 3,                 // LESS, LESS_EQUAL, GREATER, GREATER_EQUAL
+    2, 1, 0,                    // AND, OR, NOT
+    0, 0, 0, 0,                 // LEFT_PAREN .. RIGHT_BRACE
+    0, 0,                       // SEMICOLON, COMMA
+    0, 0                        // END_OF_FILE, UNKNOWN
+};
 
-void Parser::parseLOrExpr() {
-    parseLAndExpr();
-    while (match(OR)) {
-        parseLAndExpr();
+// Value of the current INTCONST, modulo 2^32.
+uint32_t Parser::numberValue() {
+    uint32_t value = 0;
+    for (size_t i = 0; i < current.value.size; i++) {
+        value = value * 10 + (current.value[i] - '0');
     }
+    return value;
 }
 
-void Parser::parseLAndExpr() {
-    parseRelExpr();
-    while (match(AND)) {
-        parseRelExpr();
-    }
+template <bool BUILD>
+uint32_t Parser::parseExpr() {
+    return parseBinary<BUILD>(1);
 }
 
-void Parser::parseRelExpr() {
-    parseAddExpr();
-    while (check(LESS) || check(GREATER) || check(LESS_EQUAL) || 
-           check(GREATER_EQUAL) || check(EQUAL) || check(NOT_EQUAL)) {
-        advance();
-        parseAddExpr();
-    }
-}
-
-void Parser::parseAddExpr() {
-    parseMulExpr();
-    while (check(PLUS) || check(MINUS)) {
-        advance();
-        if (check(SEMICOLON) || check(RIGHT_PAREN) || check(RIGHT_BRACE) || 
-            check(COMMA) || check(END_OF_FILE)) {
-            error("Missing operand");
-            return;
+// Precedence climbing: parses a unary operand, then folds in every
+// following operator that binds at least as tightly as minPower.
+template <bool BUILD>
+uint32_t Parser::parseBinary(int minPower) {
+    uint32_t left = parseUnaryExpr<BUILD>();
+    for (;;) {
+        TokenType op = current.type;
+        int power = bindingPower[op];
+        if (power == 0 || power < minPower) {
+            return left;
         }
-        parseMulExpr();
-    }
-}
-
-void Parser::parseMulExpr() {
-    parseUnaryExpr();
-    while (check(MULTIPLY) || check(DIVIDE) || check(MODULO)) {
+        uint64_t offset = current.offset;
         advance();
-        if (check(SEMICOLON) || check(RIGHT_PAREN) || check(RIGHT_BRACE) || 
-            check(COMMA) || check(END_OF_FILE)) {
+        if (power >= ADDITIVE_POWER && atOperandEnd()) {
             error("Missing operand");
-            return;
+            return left;
         }
-        parseUnaryExpr();
+        uint32_t right = parseBinary<BUILD>(power + 1);
+        left = node<BUILD>(AST_BINARY, left, right, AST_NONE, op, offset);
     }
 }
 
-void Parser::parseUnaryExpr() {
+template <bool BUILD>
+uint32_t Parser::parseUnaryExpr() {
     if (check(PLUS) || check(MINUS) || check(NOT)) {
+        TokenType op = current.type;
+        uint64_t offset = current.offset;
         advance();
-        if (check(SEMICOLON) || check(RIGHT_PAREN) || check(RIGHT_BRACE) || 
-            check(COMMA) || check(END_OF_FILE)) {
+        if (atOperandEnd()) {
             error("Missing operand");
-            return;
+            return AST_NONE;
         }
-        parseUnaryExpr();
+        uint32_t operand = parseUnaryExpr<BUILD>();
+        return node<BUILD>(AST_UNARY, operand, AST_NONE, AST_NONE, op, offset);
     } else {
-        parsePrimaryExpr();
+        return parsePrimaryExpr<BUILD>();
     }
 }
 
-void Parser::parsePrimaryExpr() {
+template <bool BUILD>
+uint32_t Parser::parsePrimaryExpr() {
+    uint64_t offset = current.offset;
     if (check(IDENTIFIER)) {
-        Token idToken = current;
+        uint32_t sym = nameSym<BUILD>();
         advance();
         if (check(LEFT_PAREN)) {
             advance();
-            if (!check(RIGHT_PAREN)) {
-                if (check(COMMA)) {
-                    error("Missing argument");
-                } else {
-                    parseExpr();
-                    while (match(COMMA)) {
-                        if (check(RIGHT_PAREN) || check(SEMICOLON) || 
-                            check(END_OF_FILE)) {
-                            error("Missing argument");
-                            break;
-                        }
-                        parseExpr();
-                    }
-                }
-            }
-            if (!match(RIGHT_PAREN)) {
-                errorExpected(")");
-            }
+            uint32_t args = parseArgs<BUILD>();
+            return node<BUILD>(AST_CALL, sym, args, AST_NONE, 0, offset);
         }
-    } else if (match(INTCONST)) {
-        return;
+        return node<BUILD>(AST_NAME, sym, AST_NONE, AST_NONE, 0, offset);
+    } else if (check(INTCONST)) {
+        uint32_t value = BUILD ? numberValue() : 0;
+        advance();
+        return node<BUILD>(AST_NUMBER, value, AST_NONE, AST_NONE, 0, offset);
     } else if (match(LEFT_PAREN)) {
-        parseExpr();
+        uint32_t expr = parseExpr<BUILD>();
         if (!match(RIGHT_PAREN)) {
             errorExpected(")");
         }
+        return expr;
     } else {
         errorExpected("expression");
     }
+    return AST_NONE;
+}
+
+// parser_stack.cpp shares the function prologue, and parser_parallel.cpp
+// the sequential parse.
+template bool Parser::parseFuncHead<true>(FuncHead& head);
+template bool Parser::parseFuncHead<false>(FuncHead& head);
+template uint32_t Parser::parseFuncDef<true>();
+template uint32_t Parser::parseFuncDef<false>();
+template void Parser::parseFunctions<true>(AstList& functions);
+template void Parser::parseFunctions<false>(AstList& functions);
+
+void Parser::useExplicitStack(size_t depth) {
+    maxDepth = depth;
+}
+
+void Parser::reset(const char* data, size_t size) {
+    lexer.reset(data, size);
+    buffered = false;
+    errors.clear();
+    errorLines.clear();
+    hasMain = false;
+    definedFunctions.clear();
+    stopped = false;
+    tooDeep = false;
+    if (symbols == &ownSymbols) {
+        ownSymbols.clear();
+    }
+    start(symbols);
 }
 
-bool Parser::parse() {
-    parseCompUnit();
+void Parser::useThreads(ThreadPool& threads, size_t tokens) {
+    pool = &threads;
+    pieceTokens = tokens;
+}
+
+void Parser::setMaxErrors(size_t n) {
+    maxErrors = n;
+}
+
+void Parser::failFast() {
+    verdictOnly = true;
+}
+
+void Parser::checkScopes() {
+    checkingScopes = true;
+}
+
+void Parser::checkCalls() {
+    checkingCalls = true;
+}
+
+static bool bySourceOrder(const SemanticError& x, const SemanticError& y) {
+    return x.offset < y.offset;
+}
+
+bool Parser::parse(Ast* tree) {
+    Ast own;
+    bool checking = checkingScopes || checkingCalls;
+    if (tree == NULL && checking) {
+        tree = &own;
+    }
+    ast = tree;
+    if (current.type == UNKNOWN) {
+        error("Lexical error");
+    }
+    if (tree != NULL) {
+        parseCompUnit<true>();
+    } else {
+        parseCompUnit<false>();
+    }
+    if (checking && errors.empty() && tree->isFull()) {
+        // The checks, and whatever runs the program, need all of the tree.
+        error("Program too large");
+    } else if (checking && errors.empty()) {
+        semanticErrors.clear();
+        if (checkingScopes) {
+            scopes.check(*tree, semanticErrors);
+        }
+        if (checkingCalls) {
+            size_t scopeErrors = semanticErrors.size();
+            calls.build(*tree, semanticErrors);
+            std::inplace_merge(semanticErrors.begin(), semanticErrors.begin() + scopeErrors,
+                               semanticErrors.end(), bySourceOrder);
+        }
+        for (size_t i = 0; i < semanticErrors.size() && !stopped; i++) {
+            errorAt(semanticErrors[i].offset, semanticErrors[i].message);
+        }
+    }
+    ast = NULL;
     return errors.empty();
 }
 
-void Parser::printErrors() {
+void Parser::printErrors(bool columns, std::ostream& out) {
+    printVerdict(errors, verdictOnly, columns, out);
+}
+
+void printVerdict(const std::vector<ErrorInfo>& errors, bool verdictOnly, bool columns, std::ostream& out) {
     if (errors.empty()) {
-        std::cout << "accept" << std::endl;
+        out << "accept" << std::endl;
     } else {
-        std::cout << "reject" << std::endl;
-        std::set<int> seenLines;
+        out << "reject" << std::endl;
+        if (verdictOnly) {
+            return;
+        }
         for (const auto& err : errors) {
-            if (seenLines.find(err.line) == seenLines.end()) {
-                std::cout << err.line << std::endl;
-                seenLines.insert(err.line);
+            out << err.line;
+            if (columns) {
+                out << ":" << err.column;
             }
+            // No flush per line: garbage input can reject millions of them.
+            out << '\n';
         }
     }
 }
@@ -2,50 +2,221 @@
 #define PARSER_H
 
 #include "lexer.h"
+#include "token_buffer.h"
+#include "ast.h"
+#include "callgraph.h"
 #include <vector>
 #include <string>
-#include <set>
+
+class ThreadPool;
 
 struct ErrorInfo {
-    int line;
+    int64_t line;
+    int64_t column;
     std::string message;
     
-    ErrorInfo(int l, const std::string& m) : line(l), message(m) {}
+    ErrorInfo(int64_t l, int64_t c, const std::string& m) : line(l), column(c), message(m) {}
 };
 
 class Parser {
 private:
     Lexer lexer;
+    TokenCursor cursor;
+    bool buffered;
     Token current;
-    std::vector<ErrorInfo> errors;
+    std::vector<ErrorInfo> errors;          // at most one per line
     bool hasMain;
-    std::set<std::string> functionNames;
+    SymbolTable ownSymbols;
+    SymbolTable* symbols;
+    std::vector<bool> definedFunctions;     // indexed by symbol id
+    Ast* ast;                               // NULL: recognize only
+    std::vector<bool> errorLines;           // indexed by line
+    size_t maxErrors;                       // 0: no limit
+    bool verdictOnly;                       // stop at the first error, unlocated
+    bool stopped;                           // input cut off after an error
+    size_t maxDepth;                        // 0: recursive parser
+    bool tooDeep;                           // parse abandoned at maxDepth
+    ThreadPool* pool;                       // NULL: one thread
+    bool checkingScopes;
+    ScopeChecker scopes;
+    bool checkingCalls;
+    CallGraph calls;
+    std::vector<SemanticError> semanticErrors;
+    size_t pieceTokens;                     // 0: sized from the pool
+    
+    // A function defined by name sym; a duplicate is reported at offset.
+    struct Definition {
+        uint32_t sym;
+        uint64_t offset;
+        
+        Definition(uint32_t s, uint64_t o) : sym(s), offset(o) {}
+    };
+    std::vector<Definition>* definitions;   // non-NULL: a piece of a parallel parse
+    struct Piece;
+    // Offsets of function starts, ascending, at which parseFunctions() hands
+    // back to an incremental parse (incremental.cpp).
+    const uint64_t* resumeAt;
+    const uint64_t* resumeEnd;
+    friend class IncrementalParser;
+    
+    struct FuncHead {
+        TokenType returnType;
+        uint32_t sym;
+        uint32_t params;
+        uint64_t offset;
+    };
     
-    void advance();
-    bool match(TokenType type);
-    bool check(TokenType type);
+    // One activation of a grammar function in the explicit-stack parser:
+    // the step of the function to resume at, and the locals it keeps across
+    // the calls it makes.
+    struct Frame {
+        uint8_t step;
+        uint8_t op;
+        uint8_t minPower;
+        uint32_t sym;
+        uint32_t left;
+        uint32_t then;
+        AstList list;
+        uint64_t offset;
+        uint64_t innerOffset;
+        int64_t mark;
+    };
+    std::vector<Frame> frames;              // frames[0] is a sentinel
+    Frame* framesEnd;
+    
+    static const int ADDITIVE_POWER = 4;
+    static const unsigned char bindingPower[UNKNOWN + 1];
+    
+    void start(SymbolTable* shared);
+    uint32_t symbolOf(const Token& t);
+    // Symbol of the current IDENTIFIER, needed only when building a tree.
+    template <bool BUILD>
+    uint32_t nameSym() { return BUILD ? symbolOf(current) : NO_SYMBOL; }
+    template <bool BUILD>
+    uint32_t node(AstKind kind, uint32_t a, uint32_t b, uint32_t c, uint32_t op, uint64_t offset) {
+        return BUILD ? ast->add(kind, a, b, c, op, offset) : AST_NONE;
+    }
+    // Token helpers are inline so that both parsers (parser.cpp and
+    // parser_stack.cpp) get them without a call.
+    void advance() {
+        if (buffered) {
+            cursor.next();
+            current = cursor.token();
+        } else {
+            current = lexer.nextToken();
+        }
+    }
+    bool match(TokenType type) {
+        if (check(type)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+    bool check(TokenType type) { return current.type == type; }
     void error(const std::string& msg);
+    void errorAt(uint64_t offset, const std::string& msg);
+    void stop();
     void errorExpected(const std::string& expected);
+    // Tokens that cannot start an operand, after which an operator is left
+    // without one.
+    bool atOperandEnd() {
+        return check(SEMICOLON) || check(RIGHT_PAREN) || check(RIGHT_BRACE) ||
+               check(COMMA) || check(END_OF_FILE);
+    }
+    uint32_t numberValue();
     
-    void parseCompUnit();
-    void parseFuncDef();
-    void parseParam();
-    void parseStmt();
-    void parseBlock();
-    void parseExpr();
-    void parseLOrExpr();
-    void parseLAndExpr();
-    void parseRelExpr();
-    void parseAddExpr();
-    void parseMulExpr();
-    void parseUnaryExpr();
-    void parsePrimaryExpr();
+    // The grammar is compiled twice: with BUILD the functions also build the
+    // tree and return the id of the node they built (AST_NONE after an
+    // error leaves nothing sensible to build); without it they only
+    // recognize, at no cost for the tree code.
+    template <bool BUILD> void parseCompUnit();
+    template <bool BUILD> void parseFunctions(AstList& functions);
+    void defineFunction(uint32_t sym, uint64_t offset);
+    template <bool BUILD> bool parseFuncHead(FuncHead& head);
+    template <bool BUILD> uint32_t parseFuncDef();
+    template <bool BUILD> uint32_t parseParam();
+    template <bool BUILD> uint32_t parseArgs();
+    template <bool BUILD> uint32_t parseStmt();
+    template <bool BUILD> uint32_t parseBlock();
+    template <bool BUILD> uint32_t parseExpr();
+    template <bool BUILD> uint32_t parseBinary(int minPower);
+    template <bool BUILD> uint32_t parseUnaryExpr();
+    template <bool BUILD> uint32_t parsePrimaryExpr();
+    // parseFuncDef run as a loop over a heap-allocated stack of frames
+    // (parser_stack.cpp), for input nested too deeply to recurse on.
+    template <bool BUILD> uint32_t parseFuncDefStack();
+    Frame* pushFrame(Frame* top, uint8_t step, int minPower = 0);
+    bool growFrames();
+    template <bool BUILD> Frame* startExpr(Frame* top, int minPower, uint32_t& ret);
+    // parseFunctions split at function boundaries across the pool
+    // (parser_parallel.cpp).
+    template <bool BUILD> void parsePieces(AstList& functions);
     
 public:
-    Parser(const std::string& input);
-    bool parse();
-    void printErrors();
+    // Each parser interns identifiers into a table of its own unless given
+    // a shared one, which lets many files store common names only once.
+    Parser(const std::string& input, LexerEngine engine = LEX_CLASSIC,
+           SymbolTable* symbols = NULL);
+    Parser(const char* data, size_t size, LexerEngine engine = LEX_CLASSIC,
+           SymbolTable* symbols = NULL);
+    Parser(std::istream& in, size_t windowSize, LexerEngine engine = LEX_CLASSIC,
+           SymbolTable* symbols = NULL);
+    // Walks tokens lexed ahead of time; the buffer and its source must
+    // outlive the parser.
+    Parser(const TokenBuffer& tokens, SymbolTable* symbols = NULL);
+    // Parses without recursing on the native stack, so that no input can
+    // overflow it. Nesting deeper than maxDepth grammar frames (a few per
+    // level of parentheses or blocks) is rejected with "Nesting too deep".
+    // Call before parse().
+    static const size_t DEFAULT_MAX_DEPTH = 1000000;
+    void useExplicitStack(size_t maxDepth = DEFAULT_MAX_DEPTH);
+    // Starts over on another buffer, parsed in place, keeping the options
+    // set on this parser and the memory of earlier parses, so one parser
+    // can serve many inputs. The buffer must outlive the parse.
+    void reset(const char* data, size_t size);
+    // Parses the function definitions of the program on the pool's
+    // threads, pieceTokens tokens or so at a time (0 picks a size from the
+    // pool width), with the same result as parsing on one. Only a parser
+    // over a TokenBuffer can split its input; others ignore this. The pool
+    // must outlive parse().
+    void useThreads(ThreadPool& pool, size_t pieceTokens = 0);
+    // Stops parsing once errors are reported on maxErrors lines; 0 (the
+    // default) parses to the end. Call before parse().
+    void setMaxErrors(size_t maxErrors);
+    // Stops at the first error without working out where it is, for
+    // callers that only want the verdict: printErrors() prints no lines.
+    // Call before parse().
+    void failFast();
+    // Also checks the variables of an accepted program (ScopeChecker) and
+    // reports what it finds like any other error. The check needs a tree,
+    // which parse() builds for itself if it is given none; a program too
+    // large for the tree is rejected at its end. Call before parse(); not
+    // for a parser reading a stream.
+    void checkScopes();
+    // Also resolves the calls of an accepted program against its functions
+    // (CallGraph), rejecting calls to undefined functions and calls with the
+    // wrong number of arguments. Same conditions as checkScopes().
+    void checkCalls();
+    // With a tree, also builds the syntax tree of the program into it. The
+    // tree is only complete when the parse succeeds.
+    bool parse(Ast* tree = NULL);
+    // Names in the tree are ids in this table.
+    SymbolTable& symbolTable() { return *symbols; }
+    // With checkCalls(), the call graph of the last program parsed without
+    // syntax errors; its node ids are those of the tree parse() was given.
+    const CallGraph& callGraph() const { return calls; }
+    // With columns, each rejected line is printed as line:column.
+    void printErrors(bool columns = false, std::ostream& out = std::cout);
+    // The errors behind the verdict, one per rejected line. Under
+    // failFast() they have no line or column.
+    const std::vector<ErrorInfo>& errorList() const { return errors; }
 };
 
+// What printErrors() prints for a parse that left errors in its
+// errorList(), for callers that kept the list but not the parser.
+void printVerdict(const std::vector<ErrorInfo>& errors, bool verdictOnly, bool columns,
+                  std::ostream& out = std::cout);
+
 #endif
 
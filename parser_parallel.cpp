@@ -0,0 +1,106 @@
+#include "parser.h"
+#include "thread_pool.h"
+
+// Parallel parsing of function definitions. The program is cut into pieces
+// where one well-formed function ends and the next begins, and every piece
+// is parsed by a parser of its own, with its own symbol table and tree, on
+// the guess that it is a run of well-formed functions. The merge
+// then walks the pieces in order, interning each one's names, checking its
+// definitions for duplicates and appending its tree: what the sequential
+// parser does, in the same order. From the first piece with an error (or
+// where the guess was wrong) the rest is parsed sequentially; the
+// sequential parser would have reached the start of that piece in the same
+// state.
+
+struct Parser::Piece {
+    size_t begin;
+    size_t end;
+    bool ok;
+    SymbolTable symbols;
+    Ast tree;
+    std::vector<Definition> definitions;
+};
+
+template <bool BUILD>
+void Parser::parsePieces(AstList& functions) {
+    const TokenBuffer& tokens = cursor.buffer();
+    size_t start = cursor.position();
+    size_t last = tokens.size() - 1;    // END_OF_FILE
+    size_t target = pieceTokens;
+    if (target == 0) {
+        target = (last - start) / (pool->size() * 4) + 1;
+        if (target < 16 * 1024) {
+            target = 16 * 1024;
+        }
+    }
+    
+    // Inside a function "} int name (" cannot parse, so it is taken to be a
+    // function boundary without tracking braces from the start; a wrong
+    // guess only costs a piece that fails.
+    std::vector<size_t> cuts(1, start);
+    for (size_t i = start + target; i + 3 < last; i++) {
+        if (tokens.type(i) == RIGHT_BRACE && (tokens.type(i + 1) == INT || tokens.type(i + 1) == VOID) &&
+            tokens.type(i + 2) == IDENTIFIER && tokens.type(i + 3) == LEFT_PAREN) {
+            cuts.push_back(i + 1);
+            i += target;
+        }
+    }
+    if (cuts.size() == 1) {
+        parseFunctions<BUILD>(functions);
+        return;
+    }
+    cuts.push_back(last);
+    
+    std::vector<Piece> pieces(cuts.size() - 1);
+    pool->run(pieces.size(), [&](size_t k) {
+        Piece& piece = pieces[k];
+        piece.begin = cuts[k];
+        piece.end = cuts[k + 1];
+        Parser part(tokens, &piece.symbols);
+        part.cursor.seek(piece.begin);
+        part.current = part.cursor.token();
+        part.ast = BUILD ? &piece.tree : NULL;
+        part.verdictOnly = true;
+        part.maxDepth = maxDepth;
+        part.definitions = &piece.definitions;
+        AstList list;
+        while (part.errors.empty() && part.cursor.position() < piece.end) {
+            list.append(part.ast, maxDepth != 0 ? part.parseFuncDefStack<BUILD>() : part.parseFuncDef<BUILD>());
+        }
+        piece.tree.functions = list.first;
+        piece.ok = part.errors.empty() && part.cursor.position() == piece.end;
+    });
+    
+    for (size_t k = 0; k < pieces.size(); k++) {
+        Piece& piece = pieces[k];
+        if (!piece.ok) {
+            cursor.seek(piece.begin);
+            current = cursor.token();
+            parseFunctions<BUILD>(functions);
+            return;
+        }
+        std::vector<uint32_t> symbolMap(piece.symbols.size());
+        for (uint32_t id = 0; id < symbolMap.size(); id++) {
+            size_t size;
+            const char* text = piece.symbols.text(id, size);
+            symbolMap[id] = symbols->intern(text, size);
+        }
+        for (size_t d = 0; d < piece.definitions.size(); d++) {
+            defineFunction(symbolMap[piece.definitions[d].sym], piece.definitions[d].offset);
+        }
+        if (BUILD) {
+            uint32_t first = ast->append(piece.tree, symbolMap);
+            for (uint32_t id = first; id != AST_NONE; id = ast->node(id).next) {
+                functions.append(ast, id);
+            }
+        }
+        if (stopped) {
+            return;
+        }
+    }
+    cursor.stop();
+    current = cursor.token();
+}
+
+template void Parser::parsePieces<true>(AstList& functions);
+template void Parser::parsePieces<false>(AstList& functions);
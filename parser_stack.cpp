@@ -0,0 +1,519 @@
+#include "parser.h"
+#include <algorithm>
+
+// The explicit-stack parser. Each grammar function of parser.cpp becomes a
+// run of steps; a frame on `frames` records the step its function resumes
+// at and the locals it keeps across calls. A call sets the caller's resume
+// step and pushes the callee; a return leaves its result in `ret` and pops.
+// Steps follow the recursive functions line for line, so both parsers
+// report the same errors and build the same tree. Locals that only go into
+// tree nodes (offsets, names) are kept only when building one; unlike the
+// recursive parser's, the stores to a frame cannot be optimized away.
+
+namespace {
+
+enum Step {
+    FINISHED,
+    // parseBlock
+    BLOCK,
+    BLOCK_STMT_DONE,
+    BLOCK_LOOP,
+    BLOCK_END,
+    // parseStmt
+    STMT,
+    STMT_DECL_VAR,
+    STMT_DECL_INIT_DONE,
+    STMT_DECL_END,
+    STMT_ASSIGN_DONE,
+    STMT_CALL_DONE,
+    STMT_IF_COND_DONE,
+    STMT_IF_THEN_DONE,
+    STMT_IF_ELSE_DONE,
+    STMT_WHILE_COND_DONE,
+    STMT_WHILE_BODY_DONE,
+    STMT_RETURN_DONE,
+    STMT_EXPR_DONE,
+    // parseArgs
+    ARGS,
+    ARGS_EXPR_DONE,
+    ARGS_END,
+    // parseBinary
+    BINARY,
+    BINARY_CALL_DONE,
+    BINARY_PAREN_DONE,
+    BINARY_RIGHT_DONE,
+    BINARY_LOOP,
+    // parseUnaryExpr
+    UNARY_OPERAND_DONE,
+    UNARY,
+    // parsePrimaryExpr
+    PRIMARY,
+    PRIMARY_CALL_DONE,
+    PRIMARY_PAREN_DONE
+};
+
+}
+
+// Pushes a frame starting at step above top and returns it. At maxDepth
+// frames it reports the nesting as too deep instead and returns the bottom
+// frame, whose FINISHED step ends the parse. Steps initialize the locals
+// they use.
+inline Parser::Frame* Parser::pushFrame(Frame* top, uint8_t step, int minPower) {
+    if (top + 1 == framesEnd) {
+        size_t used = top - frames.data() + 1;
+        if (!growFrames()) {
+            return &frames[0];
+        }
+        top = &frames[used - 1];
+    }
+    top++;
+    top->step = step;
+    top->minPower = minPower;
+    return top;
+}
+
+// The stack grows by doubling and is kept for the next function. Its first
+// frame is a sentinel below the frames in use.
+bool Parser::growFrames() {
+    if (frames.size() > maxDepth) {
+        error("Nesting too deep");
+        tooDeep = true;
+        return false;
+    }
+    frames.resize(std::min(std::max(frames.size() * 2, (size_t)64), maxDepth + 1));
+    frames[0].step = FINISHED;
+    framesEnd = frames.data() + frames.size();
+    return true;
+}
+
+// Starts an expression whose operators bind at least minPower; the caller
+// has set the step to resume at. Returns the new top frame: top itself if
+// the expression was a lone name or number, by far the most common kind,
+// which is then parsed in place into ret. Anything else pushes the frames
+// that will leave the expression in ret, starting with one per opening
+// parenthesis.
+template <bool BUILD>
+inline Parser::Frame* Parser::startExpr(Frame* top, int minPower, uint32_t& ret) {
+    while (check(LEFT_PAREN)) {
+        advance();
+        top = pushFrame(top, BINARY_PAREN_DONE, minPower);
+        if (tooDeep) {
+            return top;
+        }
+        minPower = 1;
+    }
+    uint64_t offset = current.offset;
+    if (check(INTCONST)) {
+        uint32_t value = BUILD ? numberValue() : 0;
+        advance();
+        ret = node<BUILD>(AST_NUMBER, value, AST_NONE, AST_NONE, 0, offset);
+    } else if (check(IDENTIFIER)) {
+        uint32_t sym = nameSym<BUILD>();
+        advance();
+        if (check(LEFT_PAREN)) {
+            advance();
+            top = pushFrame(top, BINARY_CALL_DONE, minPower);
+            if (tooDeep) {
+                return top;
+            }
+            top->sym = sym;
+            top->offset = offset;
+            return pushFrame(top, ARGS);
+        }
+        ret = node<BUILD>(AST_NAME, sym, AST_NONE, AST_NONE, 0, offset);
+    } else {
+        return pushFrame(top, BINARY, minPower);
+    }
+    if (bindingPower[current.type] >= minPower) {
+        return pushFrame(top, BINARY_LOOP, minPower);
+    }
+    return top;
+}
+
+template <bool BUILD>
+uint32_t Parser::parseFuncDefStack() {
+    FuncHead head;
+    if (!parseFuncHead<BUILD>(head)) {
+        return AST_NONE;
+    }
+
+    uint32_t ret = AST_NONE;
+    if (frames.empty()) {
+        growFrames();
+    }
+    Frame* top = pushFrame(&frames[0], BLOCK);
+    for (;;) {
+        Frame& f = *top;
+        switch (f.step) {
+        case FINISHED:
+            break;
+
+        case BLOCK:
+            if (BUILD) {
+                f.offset = current.offset;
+            }
+            if (!match(LEFT_BRACE)) {
+                errorExpected("{");
+                ret = AST_NONE;
+                top--;
+                continue;
+            }
+            f.list = AstList();
+            f.step = BLOCK_LOOP;
+            continue;
+        case BLOCK_STMT_DONE:
+            f.list.append(ast, ret);
+            if (f.mark == current.index && !check(RIGHT_BRACE) && !check(END_OF_FILE)) {
+                advance();
+            }
+            // fall through
+        case BLOCK_LOOP:
+            if (!check(RIGHT_BRACE) && !check(END_OF_FILE)) {
+                f.mark = current.index;
+                f.step = BLOCK_STMT_DONE;
+                top = pushFrame(top, STMT);
+                continue;
+            }
+            // fall through
+        case BLOCK_END:
+            if (!match(RIGHT_BRACE)) {
+                errorExpected("}");
+            }
+            ret = node<BUILD>(AST_BLOCK, f.list.first, AST_NONE, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+
+        case STMT:
+            if (BUILD) {
+                f.offset = current.offset;
+            }
+            if (check(LEFT_BRACE)) {
+                f.step = BLOCK;
+                continue;
+            } else if (match(SEMICOLON)) {
+                ret = AST_NONE;
+            } else if (check(INT)) {
+                advance();
+                f.list = AstList();
+                f.step = STMT_DECL_VAR;
+                continue;
+            } else if (check(IDENTIFIER)) {
+                if (BUILD) {
+                    f.sym = nameSym<BUILD>();
+                }
+                advance();
+                if (check(ASSIGN)) {
+                    advance();
+                    f.step = STMT_ASSIGN_DONE;
+                    top = startExpr<BUILD>(top, 1, ret);
+                    continue;
+                } else if (check(LEFT_PAREN)) {
+                    advance();
+                    f.step = STMT_CALL_DONE;
+                    top = pushFrame(top, ARGS);
+                    continue;
+                }
+                error("Invalid statement");
+                ret = AST_NONE;
+            } else if (check(IF) || check(WHILE)) {
+                bool isIf = check(IF);
+                advance();
+                if (!match(LEFT_PAREN)) {
+                    errorExpected("(");
+                    ret = AST_NONE;
+                } else {
+                    f.step = isIf ? STMT_IF_COND_DONE : STMT_WHILE_COND_DONE;
+                    top = startExpr<BUILD>(top, 1, ret);
+                    continue;
+                }
+            } else if (check(BREAK) || check(CONTINUE)) {
+                AstKind kind = check(BREAK) ? AST_BREAK : AST_CONTINUE;
+                advance();
+                if (!match(SEMICOLON)) {
+                    errorExpected(";");
+                }
+                ret = node<BUILD>(kind, AST_NONE, AST_NONE, AST_NONE, 0, f.offset);
+            } else if (check(RETURN)) {
+                advance();
+                f.step = STMT_RETURN_DONE;
+                top = startExpr<BUILD>(top, 1, ret);
+                continue;
+            } else if (check(ELSE)) {
+                advance();
+                ret = AST_NONE;
+            } else {
+                f.step = STMT_EXPR_DONE;
+                top = startExpr<BUILD>(top, 1, ret);
+                continue;
+            }
+            top--;
+            continue;
+        case STMT_DECL_VAR:
+            if (BUILD) {
+                f.sym = nameSym<BUILD>();
+                f.innerOffset = current.offset;
+            }
+            if (!match(IDENTIFIER)) {
+                errorExpected("variable name");
+                while (!check(COMMA) && !check(SEMICOLON) && !check(END_OF_FILE)) {
+                    advance();
+                }
+                f.step = match(COMMA) ? STMT_DECL_VAR : STMT_DECL_END;
+                continue;
+            }
+            ret = AST_NONE;
+            if (match(ASSIGN)) {
+                if (check(SEMICOLON) || check(COMMA) || check(END_OF_FILE) ||
+                    check(RIGHT_BRACE) || check(RIGHT_PAREN)) {
+                    error("Missing expression after '='");
+                    while (!check(COMMA) && !check(SEMICOLON) && !check(END_OF_FILE)) {
+                        advance();
+                    }
+                    f.step = match(COMMA) ? STMT_DECL_VAR : STMT_DECL_END;
+                    continue;
+                }
+                f.step = STMT_DECL_INIT_DONE;
+                Frame* next = startExpr<BUILD>(top, 1, ret);
+                if (next != top) {
+                    top = next;
+                    continue;
+                }
+            }
+            // fall through
+        case STMT_DECL_INIT_DONE:
+            f.list.append(ast, node<BUILD>(AST_VAR, f.sym, ret, AST_NONE, 0, f.innerOffset));
+            if (check(COMMA)) {
+                advance();
+                if (check(SEMICOLON) || check(END_OF_FILE)) {
+                    error("Missing variable name after ','");
+                } else {
+                    f.step = STMT_DECL_VAR;
+                    continue;
+                }
+            }
+            // fall through
+        case STMT_DECL_END:
+            if (!match(SEMICOLON)) {
+                errorExpected(";");
+            }
+            ret = node<BUILD>(AST_DECL, f.list.first, AST_NONE, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_ASSIGN_DONE:
+            if (!match(SEMICOLON)) {
+                errorExpected(";");
+            }
+            ret = node<BUILD>(AST_ASSIGN, f.sym, ret, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_CALL_DONE:
+            if (!match(SEMICOLON)) {
+                errorExpected(";");
+            }
+            ret = node<BUILD>(AST_CALL, f.sym, ret, AST_NONE, 0, f.offset);
+            ret = node<BUILD>(AST_EXPR_STMT, ret, AST_NONE, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_IF_COND_DONE:
+        case STMT_WHILE_COND_DONE:
+            if (!match(RIGHT_PAREN)) {
+                errorExpected(")");
+                ret = AST_NONE;
+                top--;
+                continue;
+            }
+            f.left = ret;
+            f.step = f.step == STMT_IF_COND_DONE ? STMT_IF_THEN_DONE : STMT_WHILE_BODY_DONE;
+            top = pushFrame(top, STMT);
+            continue;
+        case STMT_IF_THEN_DONE:
+            f.then = ret;
+            if (match(ELSE)) {
+                f.step = STMT_IF_ELSE_DONE;
+                top = pushFrame(top, STMT);
+                continue;
+            }
+            ret = node<BUILD>(AST_IF, f.left, f.then, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_IF_ELSE_DONE:
+            ret = node<BUILD>(AST_IF, f.left, f.then, ret, 0, f.offset);
+            top--;
+            continue;
+        case STMT_WHILE_BODY_DONE:
+            ret = node<BUILD>(AST_WHILE, f.left, ret, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_RETURN_DONE:
+            if (!match(SEMICOLON)) {
+                errorExpected(";");
+            }
+            ret = node<BUILD>(AST_RETURN, ret, AST_NONE, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case STMT_EXPR_DONE:
+            if (!match(SEMICOLON)) {
+                errorExpected(";");
+            }
+            ret = node<BUILD>(AST_EXPR_STMT, ret, AST_NONE, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+
+        case ARGS:
+            f.list = AstList();
+            f.step = ARGS_END;
+            if (!check(RIGHT_PAREN)) {
+                if (check(COMMA)) {
+                    error("Missing argument");
+                } else {
+                    f.step = ARGS_EXPR_DONE;
+                    top = startExpr<BUILD>(top, 1, ret);
+                }
+            }
+            continue;
+        case ARGS_EXPR_DONE:
+            f.list.append(ast, ret);
+            f.step = ARGS_END;
+            if (match(COMMA)) {
+                if (check(RIGHT_PAREN) || check(SEMICOLON) || check(END_OF_FILE)) {
+                    error("Missing argument");
+                } else {
+                    f.step = ARGS_EXPR_DONE;
+                    top = startExpr<BUILD>(top, 1, ret);
+                }
+            }
+            continue;
+        case ARGS_END:
+            if (!match(RIGHT_PAREN)) {
+                errorExpected(")");
+            }
+            ret = f.list.first;
+            top--;
+            continue;
+
+        case BINARY:
+            f.step = BINARY_LOOP;
+            top = pushFrame(top, UNARY);
+            continue;
+        case BINARY_CALL_DONE:
+            ret = node<BUILD>(AST_CALL, f.sym, ret, AST_NONE, 0, f.offset);
+            f.step = BINARY_LOOP;
+            continue;
+        case BINARY_PAREN_DONE:
+            if (!match(RIGHT_PAREN)) {
+                errorExpected(")");
+            }
+            f.step = BINARY_LOOP;
+            continue;
+        case BINARY_RIGHT_DONE:
+            ret = node<BUILD>(AST_BINARY, f.left, ret, AST_NONE, f.op, f.innerOffset);
+            // fall through
+        case BINARY_LOOP:
+            // ret holds the left operand; it and the operator only go to
+            // the frame if the right operand needs frames of its own.
+            for (;;) {
+                TokenType op = current.type;
+                int power = bindingPower[op];
+                if (power == 0 || power < f.minPower) {
+                    top--;
+                    break;
+                }
+                uint64_t offset = current.offset;
+                advance();
+                if (power >= ADDITIVE_POWER && atOperandEnd()) {
+                    error("Missing operand");
+                    top--;
+                    break;
+                }
+                uint32_t left = ret;
+                size_t self = top - frames.data();
+                Frame* next = startExpr<BUILD>(top, power + 1, ret);
+                if (next != top) {
+                    top = next;
+                    Frame& g = frames[self];
+                    g.step = BINARY_RIGHT_DONE;
+                    g.op = op;
+                    if (BUILD) {
+                        g.left = left;
+                        g.innerOffset = offset;
+                    }
+                    break;
+                }
+                ret = node<BUILD>(AST_BINARY, left, ret, AST_NONE, op, offset);
+            }
+            continue;
+
+        case UNARY_OPERAND_DONE:
+            ret = node<BUILD>(AST_UNARY, ret, AST_NONE, AST_NONE, f.op, f.offset);
+            top--;
+            continue;
+        case UNARY:
+            if (check(PLUS) || check(MINUS) || check(NOT)) {
+                f.op = current.type;
+                if (BUILD) {
+                    f.offset = current.offset;
+                }
+                advance();
+                if (atOperandEnd()) {
+                    error("Missing operand");
+                    ret = AST_NONE;
+                    top--;
+                    continue;
+                }
+                f.step = UNARY_OPERAND_DONE;
+                top = pushFrame(top, UNARY);
+                continue;
+            }
+            // fall through
+        case PRIMARY:
+            if (BUILD) {
+                f.offset = current.offset;
+            }
+            if (check(IDENTIFIER)) {
+                if (BUILD) {
+                    f.sym = nameSym<BUILD>();
+                }
+                advance();
+                if (check(LEFT_PAREN)) {
+                    advance();
+                    f.step = PRIMARY_CALL_DONE;
+                    top = pushFrame(top, ARGS);
+                    continue;
+                }
+                ret = node<BUILD>(AST_NAME, f.sym, AST_NONE, AST_NONE, 0, f.offset);
+            } else if (check(INTCONST)) {
+                uint32_t value = BUILD ? numberValue() : 0;
+                advance();
+                ret = node<BUILD>(AST_NUMBER, value, AST_NONE, AST_NONE, 0, f.offset);
+            } else if (match(LEFT_PAREN)) {
+                f.step = PRIMARY_PAREN_DONE;
+                top = startExpr<BUILD>(top, 1, ret);
+                continue;
+            } else {
+                errorExpected("expression");
+                ret = AST_NONE;
+            }
+            top--;
+            continue;
+        case PRIMARY_CALL_DONE:
+            ret = node<BUILD>(AST_CALL, f.sym, ret, AST_NONE, 0, f.offset);
+            top--;
+            continue;
+        case PRIMARY_PAREN_DONE:
+            if (!match(RIGHT_PAREN)) {
+                errorExpected(")");
+            }
+            top--;
+            continue;
+        }
+        break;
+    }
+
+    if (tooDeep) {
+        return AST_NONE;
+    }
+    return node<BUILD>(AST_FUNC, head.sym, head.params, ret, head.returnType, head.offset);
+}
+
+template uint32_t Parser::parseFuncDefStack<true>();
+template uint32_t Parser::parseFuncDefStack<false>();
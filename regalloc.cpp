@@ -0,0 +1,160 @@
+#include "regalloc.h"
+#include <algorithm>
+
+const int Allocation::NO_REGISTER;
+
+void LinearScan::mention(uint32_t vreg, uint32_t pos) {
+    Interval& i = intervals[vreg];
+    i.start = std::min(i.start, pos);
+    i.end = std::max(i.end, pos);
+}
+
+static bool byStart(const std::pair<uint32_t, uint32_t>& x, const std::pair<uint32_t, uint32_t>& y) {
+    return x.first < y.first;
+}
+
+void LinearScan::allocate(const BytecodeProgram& program, const BytecodeFunction& fn,
+                          const std::vector<int>& registers, const std::vector<bool>& preserved, Allocation& out) {
+    static const uint32_t UNUSED = 0xFFFFFFFFu;
+    intervals.assign(fn.registers, Interval());
+    for (uint32_t v = 0; v < fn.registers; v++) {
+        intervals[v].start = UNUSED;
+        intervals[v].end = 0;
+        intervals[v].vreg = v;
+        intervals[v].acrossCall = false;
+    }
+    // Parameters arrive at 0, before the first instruction (at 1), so that
+    // they are live on entry to a loop that starts there.
+    for (uint32_t p = 0; p < fn.params; p++) {
+        mention(p, 0);
+    }
+    calls.clear();
+    std::vector<std::pair<uint32_t, uint32_t> > loops;     // target, back jump
+    for (uint32_t pos = 1; pos <= fn.code.size(); pos++) {
+        const Insn& insn = fn.code[pos - 1];
+        switch (insn.op) {
+        case OP_LOADK:
+            mention(insn.a, pos);
+            break;
+        case OP_MOVE:
+        case OP_NEG:
+        case OP_NOT:
+            mention(insn.a, pos);
+            mention(insn.b, pos);
+            break;
+        case OP_JMP:
+            break;
+        case OP_JZ:
+        case OP_JNZ:
+        case OP_RET:
+            mention(insn.a, pos);
+            break;
+        case OP_CALL:
+            mention(insn.a, pos);
+            for (uint32_t i = 0; i < program.functions[insn.b].params; i++) {
+                mention(insn.c + i, pos);
+            }
+            calls.push_back(pos);
+            break;
+        default:
+            mention(insn.a, pos);
+            mention(insn.b, pos);
+            if (insn.op < OP_JLT) {
+                mention(insn.c, pos);
+            }
+            break;
+        }
+        if (insn.op >= OP_JMP && insn.op <= OP_JNE && insn.c < pos) {
+            loops.push_back(std::make_pair((uint32_t)insn.c + 1, pos));
+        }
+    }
+
+    // A value live on entry to a loop, or out of it, is live all through
+    // it. Widening for one loop can make an interval reach another, so
+    // repeat until nothing changes.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t l = 0; l < loops.size(); l++) {
+            uint32_t head = loops[l].first, tail = loops[l].second;
+            for (size_t v = 0; v < intervals.size(); v++) {
+                Interval& i = intervals[v];
+                if (i.start == UNUSED || i.end < head || i.start > tail) {
+                    continue;
+                }
+                if ((i.start < head || i.end > tail) && (i.start > head || i.end < tail)) {
+                    i.start = std::min(i.start, head);
+                    i.end = std::max(i.end, tail);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    out.reg.assign(fn.registers, Allocation::NO_REGISTER);
+    out.slot.assign(fn.registers, 0);
+    out.slots = 0;
+    out.used.assign(preserved.size(), false);
+    out.mentioned.assign(fn.registers, false);
+    std::vector<std::pair<uint32_t, uint32_t> > order;     // start, vreg
+    for (uint32_t v = 0; v < fn.registers; v++) {
+        Interval& i = intervals[v];
+        if (i.start == UNUSED) {
+            continue;
+        }
+        out.mentioned[v] = true;
+        std::vector<uint32_t>::iterator call = std::upper_bound(calls.begin(), calls.end(), i.start);
+        i.acrossCall = call != calls.end() && *call < i.end;
+        order.push_back(std::make_pair(i.start, v));
+    }
+    std::stable_sort(order.begin(), order.end(), byStart);
+
+    std::vector<bool> taken(preserved.size(), false);
+    active.clear();
+    for (size_t k = 0; k < order.size(); k++) {
+        Interval& current = intervals[order[k].second];
+        // Intervals that ended before this one starts give back their
+        // registers; active is sorted by end.
+        size_t expired = 0;
+        while (expired < active.size() && intervals[active[expired]].end < current.start) {
+            taken[out.reg[intervals[active[expired]].vreg]] = false;
+            expired++;
+        }
+        active.erase(active.begin(), active.begin() + expired);
+
+        int chosen = Allocation::NO_REGISTER;
+        for (size_t r = 0; r < registers.size() && chosen == Allocation::NO_REGISTER; r++) {
+            if (!taken[registers[r]] && (preserved[registers[r]] || !current.acrossCall)) {
+                chosen = registers[r];
+            }
+        }
+        if (chosen == Allocation::NO_REGISTER) {
+            // Spill whichever of this and the active intervals it could
+            // take a register from ends last.
+            size_t victim = active.size();
+            for (size_t a = active.size(); a > 0; a--) {
+                const Interval& other = intervals[active[a - 1]];
+                if (other.end > current.end && (preserved[out.reg[other.vreg]] || !current.acrossCall)) {
+                    victim = a - 1;
+                    break;
+                }
+            }
+            if (victim == active.size()) {
+                out.slot[current.vreg] = out.slots++;
+                continue;
+            }
+            Interval& other = intervals[active[victim]];
+            chosen = out.reg[other.vreg];
+            out.reg[other.vreg] = Allocation::NO_REGISTER;
+            out.slot[other.vreg] = out.slots++;
+            active.erase(active.begin() + victim);
+        }
+        out.reg[current.vreg] = chosen;
+        out.used[chosen] = true;
+        taken[chosen] = true;
+        size_t at = active.size();
+        while (at > 0 && intervals[active[at - 1]].end > current.end) {
+            at--;
+        }
+        active.insert(active.begin() + at, order[k].second);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "bytecode.h"
+#include <stdint.h>
+#include <vector>
+
+// Where each bytecode register of a function lives in machine code: a
+// machine register, or a spill slot in the frame. Bytecode registers the
+// code never mentions get neither.
+struct Allocation {
+    static const int NO_REGISTER = -1;
+
+    std::vector<int> reg;           // machine register, or NO_REGISTER
+    std::vector<uint32_t> slot;     // spill slot when reg is NO_REGISTER
+    uint32_t slots;
+    std::vector<bool> used;         // by machine register
+    std::vector<bool> mentioned;    // by bytecode register
+};
+
+// Linear-scan register allocation (Poletto and Sarkar) over the bytecode
+// registers of one function: a variable or temporary is live from the
+// first instruction that mentions it to the last, widened to cover any
+// loop it is live across, and the intervals are handed machine registers
+// in order of their start, the one ending last being spilled when none is
+// free. Intervals that span a call only get registers the calling
+// convention preserves.
+class LinearScan {
+private:
+    struct Interval {
+        uint32_t start, end;
+        uint32_t vreg;
+        bool acrossCall;
+    };
+
+    std::vector<Interval> intervals;
+    std::vector<uint32_t> calls;    // positions
+    std::vector<size_t> active;     // indexes into intervals, by end
+
+    void mention(uint32_t vreg, uint32_t pos);
+
+public:
+    // Computes the allocation of fn, whose calls go to functions of
+    // program, with registers handed out in the order given; preserved[r]
+    // tells whether machine register r survives a call.
+    void allocate(const BytecodeProgram& program, const BytecodeFunction& fn, const std::vector<int>& registers,
+                  const std::vector<bool>& preserved, Allocation& out);
+};
+
+#endif
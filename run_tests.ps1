@@ -1,14 +1,21 @@
 $ErrorActionPreference = "Stop"
 
+# The parser maps files and code with POSIX calls (mmap, flock), so this
+# script needs PowerShell 7 on Linux; on Windows, use WSL.
+if ($env:OS -eq "Windows_NT") {
+    Write-Host "run_tests.ps1 needs a POSIX system; run it under WSL." -ForegroundColor Red
+    exit 1
+}
+
 # 编译
 Write-Host "Compiling..." -ForegroundColor Cyan
-g++ -std=c++11 -o parser_v3.exe lexer.cpp parser.cpp main.cpp
+g++ -std=c++11 -pthread -o parser_v3 arena.cpp ast.cpp lexer.cpp lexer_table.cpp line_index.cpp scan.cpp source.cpp symbol_table.cpp token_buffer.cpp parser.cpp parser_stack.cpp parser_parallel.cpp thread_pool.cpp verdict_cache.cpp semantic.cpp callgraph.cpp bytecode.cpp vm.cpp native.cpp regalloc.cpp ir.cpp ir_lower.cpp ir_passes.cpp main.cpp
 if ($LASTEXITCODE -ne 0) {
     Write-Host "Compilation failed!" -ForegroundColor Red
     exit 1
 }
 
-$testDir = "parser_testcases\functional"
+$testDir = Join-Path "parser_testcases" "functional"
 $testFiles = Get-ChildItem -Path $testDir -Filter "*.c" | Sort-Object Name
 
 $total = 0
@@ -28,7 +35,7 @@ foreach ($testFile in $testFiles) {
     
     # 运行测试
     $input = Get-Content $testFile.FullName -Raw -Encoding UTF8
-    $actual = $input | .\parser_v3.exe
+    $actual = $input | ./parser_v3
     
     # 读取期望输出
     $expected = Get-Content $expectedFile -Raw
@@ -0,0 +1,274 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline bool isSpace(char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+// ---- scalar ----
+
+static const char* spaceScalar(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char* lineEndScalar(const char* p, const char* end) {
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+static const char* commentEndScalar(const char* p, const char* end) {
+    while (p < end) {
+        if (*p == '*' && p + 1 < end && p[1] == '/') {
+            return p + 2;
+        }
+        p++;
+    }
+    return end;
+}
+
+static int64_t newlinesScalar(const char* p, const char* end) {
+    int64_t n = 0;
+    for (; p < end; p++) {
+        n += *p == '\n';
+    }
+    return n;
+}
+
+#ifdef SCAN_X86
+
+// ---- SSE2 ----
+
+__attribute__((target("sse2")))
+static inline unsigned spaceMask16(__m128i v) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(ctl, sp));
+}
+
+__attribute__((target("sse2")))
+static const char* spaceSSE2(const char* p, const char* end) {
+    // Most runs between tokens are a single space; don't pay for a vector
+    // load to find that out.
+    if (p < end && !isSpace(*p)) {
+        return p;
+    }
+    if (p + 1 < end && *p == ' ' && !isSpace(p[1])) {
+        return p + 1;
+    }
+    while (end - p >= 16) {
+        unsigned stop = ~spaceMask16(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 16;
+    }
+    return spaceScalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* lineEndSSE2(const char* p, const char* end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+        p += 16;
+    }
+    return lineEndScalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char* commentEndSSE2(const char* p, const char* end) {
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+    // Compare each byte with its successor, so keep one byte of lookahead.
+    while (end - p >= 17) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i w = _mm_loadu_si128((const __m128i*)(p + 1));
+        unsigned hit = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(w, slash)));
+        if (hit) {
+            return p + __builtin_ctz(hit) + 2;
+        }
+        p += 16;
+    }
+    return commentEndScalar(p, end);
+}
+
+__attribute__((target("sse2,popcnt")))
+static int64_t newlinesSSE2(const char* p, const char* end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    int64_t n = 0;
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        n += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        p += 16;
+    }
+    return n + newlinesScalar(p, end);
+}
+
+// ---- AVX2 ----
+
+__attribute__((target("avx2")))
+static inline unsigned spaceMask32(__m256i v) {
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('\r' - '\t')), t);
+    __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctl, sp));
+}
+
+__attribute__((target("avx2")))
+static const char* spaceAVX2(const char* p, const char* end) {
+    if (p < end && !isSpace(*p)) {
+        return p;
+    }
+    if (p + 1 < end && *p == ' ' && !isSpace(p[1])) {
+        return p + 1;
+    }
+    while (end - p >= 32) {
+        unsigned stop = ~spaceMask32(_mm256_loadu_si256((const __m256i*)p));
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+        p += 32;
+    }
+    return spaceSSE2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* lineEndAVX2(const char* p, const char* end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+        p += 32;
+    }
+    return lineEndSSE2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* commentEndAVX2(const char* p, const char* end) {
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i slash = _mm256_set1_epi8('/');
+    while (end - p >= 33) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i w = _mm256_loadu_si256((const __m256i*)(p + 1));
+        unsigned hit = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(v, star), _mm256_cmpeq_epi8(w, slash)));
+        if (hit) {
+            return p + __builtin_ctz(hit) + 2;
+        }
+        p += 32;
+    }
+    return commentEndSSE2(p, end);
+}
+
+__attribute__((target("avx2,popcnt")))
+static int64_t newlinesAVX2(const char* p, const char* end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    int64_t n = 0;
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        n += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        p += 32;
+    }
+    return n + newlinesSSE2(p, end);
+}
+
+#endif
+
+// ---- dispatch ----
+
+struct ScanTable {
+    ScanKernel kernel;
+    const char* (*space)(const char*, const char*);
+    const char* (*lineEnd)(const char*, const char*);
+    const char* (*commentEnd)(const char*, const char*);
+    int64_t (*newlines)(const char*, const char*);
+};
+
+static const ScanTable scanTables[] = {
+    { SCAN_SCALAR, spaceScalar, lineEndScalar, commentEndScalar, newlinesScalar },
+#ifdef SCAN_X86
+    { SCAN_SSE2, spaceSSE2, lineEndSSE2, commentEndSSE2, newlinesSSE2 },
+    { SCAN_AVX2, spaceAVX2, lineEndAVX2, commentEndAVX2, newlinesAVX2 },
+#endif
+};
+
+bool scanKernelSupported(ScanKernel k) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (k == SCAN_SSE2) {
+        return __builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt");
+    }
+    if (k == SCAN_AVX2) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+#endif
+    return k == SCAN_SCALAR;
+}
+
+static const ScanTable* detectKernel() {
+    const ScanTable* best = &scanTables[0];
+    for (size_t i = 1; i < sizeof(scanTables) / sizeof(scanTables[0]); i++) {
+        if (scanKernelSupported(scanTables[i].kernel)) {
+            best = &scanTables[i];
+        }
+    }
+    return best;
+}
+
+// Starts out scalar so lexing during static initialisation is still safe.
+static const ScanTable* active = &scanTables[0];
+static const bool detected = (active = detectKernel()) != 0;
+
+const char* scanSpace(const char* p, const char* end) {
+    return active->space(p, end);
+}
+
+const char* scanLineEnd(const char* p, const char* end) {
+    return active->lineEnd(p, end);
+}
+
+const char* scanCommentEnd(const char* p, const char* end) {
+    return active->commentEnd(p, end);
+}
+
+int64_t countNewlines(const char* p, const char* end) {
+    return active->newlines(p, end);
+}
+
+ScanKernel scanKernel() {
+    return active->kernel;
+}
+
+bool setScanKernel(ScanKernel k) {
+    for (size_t i = 0; i < sizeof(scanTables) / sizeof(scanTables[0]); i++) {
+        if (scanTables[i].kernel == k && scanKernelSupported(k)) {
+            active = &scanTables[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* scanKernelName(ScanKernel k) {
+    if (k == SCAN_SSE2) return "sse2";
+    if (k == SCAN_AVX2) return "avx2";
+    return "scalar";
+}
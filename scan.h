@@ -0,0 +1,34 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+
+// Bulk scanning kernels for the lexer's hot loops. Each kernel exists in a
+// scalar form and, on x86, SSE2 and AVX2 forms; the widest one the CPU
+// supports is picked at startup. All forms return identical results.
+
+enum ScanKernel {
+    SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2
+};
+
+// Returns the first byte in [p, end) that is not whitespace.
+const char* scanSpace(const char* p, const char* end);
+
+// Returns the first '\n' in [p, end), or end.
+const char* scanLineEnd(const char* p, const char* end);
+
+// Returns the byte just past the first "*/" in [p, end), or end if the
+// comment is unterminated.
+const char* scanCommentEnd(const char* p, const char* end);
+
+// Number of '\n' bytes in [p, end).
+int64_t countNewlines(const char* p, const char* end);
+
+ScanKernel scanKernel();
+bool scanKernelSupported(ScanKernel k);
+// Forces a kernel (for testing and benchmarking); returns false if the CPU
+// cannot run it, in which case the active kernel is unchanged.
+bool setScanKernel(ScanKernel k);
+const char* scanKernelName(ScanKernel k);
+
+#endif
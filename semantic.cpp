@@ -0,0 +1,174 @@
+#include "semantic.h"
+#include <algorithm>
+
+void ScopedSymbols::close() {
+    size_t begin = scopes.back();
+    scopes.pop_back();
+    while (log.size() > begin) {
+        bindings[log.back().sym] = log.back().replaced;
+        log.pop_back();
+    }
+}
+
+bool ScopedSymbols::declare(uint32_t sym, uint32_t value) {
+    if (sym >= bindings.size()) {
+        Binding none = { 0, 0 };
+        bindings.resize(std::max((size_t)sym + 1, bindings.size() * 2), none);
+    }
+    Binding& b = bindings[sym];
+    if (b.depth == scopes.size()) {
+        return false;
+    }
+    Undo undo = { sym, b };
+    log.push_back(undo);
+    b.depth = (uint32_t)scopes.size();
+    b.value = value;
+    return true;
+}
+
+// Mark the start and end of a scope, of a loop body, and the end of an
+// initializer on the work stack; no node has these ids.
+static const uint32_t CLOSE_SCOPE = AST_NONE - 1;
+static const uint32_t OPEN_SCOPE = AST_NONE - 2;
+static const uint32_t ENTER_LOOP = AST_NONE - 3;
+static const uint32_t LEAVE_LOOP = AST_NONE - 4;
+static const uint32_t END_INIT = AST_NONE - 5;
+
+// Pushes a list so that its first element is popped first.
+void ScopeChecker::pushList(Ast& ast, uint32_t first) {
+    size_t n = 0;
+    for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+        n++;
+    }
+    work.resize(work.size() + n);
+    size_t i = work.size();
+    for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+        work[--i] = id;
+    }
+}
+
+// Pushes the body of an if, else or while, which is a scope of its own
+// even without braces, as in C.
+void ScopeChecker::pushScoped(uint32_t id) {
+    if (id == AST_NONE) {
+        return;
+    }
+    if (Ast::kind(id) == AST_BLOCK) {
+        work.push_back(id);
+        return;
+    }
+    work.push_back(CLOSE_SCOPE);
+    work.push_back(id);
+    work.push_back(OPEN_SCOPE);
+}
+
+void ScopeChecker::check(Ast& ast, std::vector<SemanticError>& errors) {
+    uint32_t value;
+    for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+        const AstNode& func = ast.node(f);
+        symbols.open();
+        for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+            if (!symbols.declare(ast.node(p).a, p)) {
+                errors.push_back(SemanticError(ast.node(p).offset, "Redeclared variable"));
+            }
+        }
+        work.clear();
+        size_t loops = 0;
+        // Initializers hold no declarations, so at most one is open.
+        uint32_t initializing = AST_NONE;
+        if (func.c != AST_NONE) {
+            pushList(ast, ast.node(func.c).a);
+        }
+        while (!work.empty()) {
+            uint32_t id = work.back();
+            work.pop_back();
+            if (id == CLOSE_SCOPE) {
+                symbols.close();
+                continue;
+            }
+            if (id == OPEN_SCOPE) {
+                symbols.open();
+                continue;
+            }
+            if (id == ENTER_LOOP) {
+                loops++;
+                continue;
+            }
+            if (id == LEAVE_LOOP) {
+                loops--;
+                continue;
+            }
+            if (id == END_INIT) {
+                initializing = AST_NONE;
+                continue;
+            }
+            const AstNode& n = ast.node(id);
+            switch (Ast::kind(id)) {
+            case AST_BLOCK:
+                symbols.open();
+                work.push_back(CLOSE_SCOPE);
+                pushList(ast, n.a);
+                break;
+            case AST_DECL:
+                pushList(ast, n.a);
+                break;
+            case AST_VAR:
+                if (!symbols.declare(n.a, id)) {
+                    errors.push_back(SemanticError(n.offset, "Redeclared variable"));
+                }
+                if (n.b != AST_NONE) {
+                    initializing = id;
+                    work.push_back(END_INIT);
+                    work.push_back(n.b);
+                }
+                break;
+            case AST_ASSIGN:
+                if (!symbols.find(n.a, value)) {
+                    errors.push_back(SemanticError(n.offset, "Undeclared variable"));
+                }
+                push(n.b);
+                break;
+            case AST_NAME:
+                if (!symbols.find(n.a, value)) {
+                    errors.push_back(SemanticError(n.offset, "Undeclared variable"));
+                } else if (value == initializing) {
+                    errors.push_back(SemanticError(n.offset, "Variable used in its own initializer"));
+                }
+                break;
+            case AST_IF:
+                pushScoped(n.c);
+                pushScoped(n.b);
+                push(n.a);
+                break;
+            case AST_WHILE:
+                work.push_back(LEAVE_LOOP);
+                pushScoped(n.b);
+                work.push_back(ENTER_LOOP);
+                push(n.a);
+                break;
+            case AST_BREAK:
+            case AST_CONTINUE:
+                if (loops == 0) {
+                    errors.push_back(SemanticError(n.offset, Ast::kind(id) == AST_BREAK ? "Break outside loop"
+                                                                                       : "Continue outside loop"));
+                }
+                break;
+            case AST_BINARY:
+                push(n.b);
+                push(n.a);
+                break;
+            case AST_RETURN:
+            case AST_EXPR_STMT:
+            case AST_UNARY:
+                push(n.a);
+                break;
+            case AST_CALL:
+                pushList(ast, n.b);
+                break;
+            default:
+                break;
+            }
+        }
+        symbols.close();
+    }
+}
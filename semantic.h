@@ -0,0 +1,80 @@
+#ifndef SEMANTIC_H
+#define SEMANTIC_H
+
+#include "ast.h"
+#include <stdint.h>
+#include <vector>
+
+// Names in scope at one point of a walk over a function, by symbol id. Ids
+// are dense, so the table is a flat array indexed by id rather than a hash
+// map: the name was hashed once already, when it was interned, and a
+// lookup is a single load. Every declaration saves the binding it replaces
+// in an undo log, and closing a scope pops the log back to where the scope
+// began, so opening and closing a scope are O(1) amortized and nothing is
+// allocated once the arrays have grown to fit the program.
+class ScopedSymbols {
+private:
+    struct Binding {
+        uint32_t depth;     // of the scope that declares it; 0: not in scope
+        uint32_t value;
+    };
+    struct Undo {
+        uint32_t sym;
+        Binding replaced;
+    };
+
+    std::vector<Binding> bindings;  // indexed by symbol id
+    std::vector<Undo> log;
+    std::vector<size_t> scopes;     // log size where each open scope began
+
+public:
+    void open() { scopes.push_back(log.size()); }
+    void close();
+    // Binds sym to value in the innermost open scope. False, binding
+    // nothing, if that scope already declares sym.
+    bool declare(uint32_t sym, uint32_t value);
+    // What sym is bound to where it is visible.
+    bool find(uint32_t sym, uint32_t& value) const {
+        if (sym >= bindings.size() || bindings[sym].depth == 0) {
+            return false;
+        }
+        value = bindings[sym].value;
+        return true;
+    }
+    size_t depth() const { return scopes.size(); }
+};
+
+// An error found in a tree, at a source offset.
+struct SemanticError {
+    uint64_t offset;
+    const char* message;
+
+    SemanticError(uint64_t o, const char* m) : offset(o), message(m) {}
+};
+
+// Checks the variables of an accepted program: every name used must be
+// declared before it, in its block or one around it, and no block may
+// declare a name twice. As in C, a function's parameters and the outermost
+// block of its body are one scope, and the body of an if, else or while is
+// one even without braces. A variable is in scope from its own initializer
+// on, but may not be used there, and a break or continue must be inside a
+// loop. The walk keeps its own stack, so it takes nesting of any depth, and
+// errors come out in source order.
+class ScopeChecker {
+private:
+    ScopedSymbols symbols;
+    std::vector<uint32_t> work;
+
+    void push(uint32_t id) {
+        if (id != AST_NONE) {
+            work.push_back(id);
+        }
+    }
+    void pushList(Ast& ast, uint32_t first);
+    void pushScoped(uint32_t id);
+
+public:
+    void check(Ast& ast, std::vector<SemanticError>& errors);
+};
+
+#endif
@@ -0,0 +1,427 @@
+#include "server.h"
+#include "parser.h"
+#include "verdict_cache.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+namespace {
+
+const size_t FRAME_HEADER = 4;
+
+uint32_t frameLength(const char* p) {
+    const unsigned char* b = (const unsigned char*)p;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+void appendFrameHeader(std::string& out, size_t size) {
+    char header[FRAME_HEADER] = {
+        (char)size, (char)(size >> 8), (char)(size >> 16), (char)(size >> 24),
+    };
+    out.append(header, FRAME_HEADER);
+}
+
+// Turns requests into answers with one parser, set up once with the
+// server's options and reused for every request.
+class Handler {
+private:
+    const ServerOptions& opt;
+    Parser parser;
+    std::string copy;
+    std::vector<ErrorInfo> cached;
+    std::ostringstream text;
+
+    const std::vector<ErrorInfo>& parse(const char* source, size_t size) {
+        parser.reset(source, size);
+        parser.parse();
+        return parser.errorList();
+    }
+
+public:
+    explicit Handler(const ServerOptions& o) : opt(o), parser("", 0) {
+        parser.setMaxErrors(opt.maxErrors);
+        if (opt.failFast) {
+            parser.failFast();
+        }
+        if (opt.maxDepth != 0) {
+            parser.useExplicitStack(opt.maxDepth);
+        }
+        // Warm up, so that the first request does not pay for the
+        // parser's first allocations.
+        static const char warmUp[] = "int main() {\n    return 0;\n}\n";
+        parse(warmUp, sizeof(warmUp) - 1);
+    }
+
+    // Appends the answer frame for source to out.
+    void handle(const char* source, size_t size, std::string& out) {
+        // Input is read line by line, so a final line needs its newline.
+        if (size > 0 && source[size - 1] != '\n') {
+            copy.assign(source, size);
+            copy += '\n';
+            source = copy.data();
+            size = copy.size();
+        }
+        const std::vector<ErrorInfo>* errors = &cached;
+        if (opt.cache == NULL) {
+            errors = &parse(source, size);
+        } else {
+            Hash128 key = opt.cache->key(source, size, opt.maxDepth);
+            if (!opt.cache->lookup(key, opt.maxErrors, opt.failFast, cached)) {
+                errors = &parse(source, size);
+                opt.cache->store(key, *errors, opt.maxErrors, opt.failFast);
+            }
+        }
+        text.str(std::string());
+        printVerdict(*errors, opt.failFast, opt.columns, text);
+        const std::string& answer = text.str();
+        appendFrameHeader(out, answer.size());
+        out += answer;
+    }
+};
+
+// Answers every complete request at the front of in, appending to out,
+// and drops them from in. False if a request is longer than allowed.
+bool handleRequests(Handler& handler, std::string& in, std::string& out, size_t maxRequest) {
+    size_t pos = 0;
+    while (in.size() - pos >= FRAME_HEADER) {
+        size_t size = frameLength(in.data() + pos);
+        if (size > maxRequest) {
+            return false;
+        }
+        if (in.size() - pos - FRAME_HEADER < size) {
+            break;
+        }
+        handler.handle(in.data() + pos + FRAME_HEADER, size, out);
+        pos += FRAME_HEADER + size;
+    }
+    in.erase(0, pos);
+    return true;
+}
+
+struct Connection {
+    int fd;
+    std::string in;
+    std::string out;
+    size_t written;
+    bool writing;       // waiting for the socket to take more output
+    bool ended;         // the client has sent everything it will
+};
+
+// Outstanding answers past this stop a connection's reading until the
+// client catches up.
+const size_t OUTPUT_LIMIT = 4 << 20;
+
+// epoll_event.data.ptr of the listening socket and the stop event; every
+// other event carries its Connection.
+char listenTag;
+char stopTag;
+
+// Whether to take more input: not once the client has ended, since its end
+// of input would otherwise wake the loop over and over, and not while its
+// answers are over the limit.
+bool reading(const Connection* c) {
+    return !c->ended && c->out.size() - c->written < OUTPUT_LIMIT;
+}
+
+void watch(int epoll, Connection* c) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (c->writing ? EPOLLOUT : 0) | (reading(c) ? EPOLLIN : 0);
+    ev.data.ptr = c;
+    epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Writes as much pending output as the socket takes. False if the
+// connection failed.
+bool flush(Connection* c) {
+    while (c->written < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + c->written, c->out.size() - c->written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->written += (size_t)n;
+    }
+    c->out.clear();
+    c->written = 0;
+    return true;
+}
+
+// Reads what has arrived, answers the complete requests and sends what it
+// can. False once the connection is done with.
+bool service(Connection* c, Handler& handler, size_t maxRequest, char* buffer, size_t bufferSize) {
+    while (reading(c)) {
+        ssize_t n = recv(c->fd, buffer, bufferSize, 0);
+        if (n > 0) {
+            c->in.append(buffer, (size_t)n);
+            if ((size_t)n < bufferSize) {
+                break;
+            }
+        } else if (n == 0) {
+            c->ended = true;
+            break;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            return false;
+        }
+    }
+    if (!handleRequests(handler, c->in, c->out, maxRequest) || !flush(c)) {
+        return false;
+    }
+    c->writing = c->written < c->out.size();
+    return !(c->ended && !c->writing);
+}
+
+}
+
+ParseServer::ParseServer(const ServerOptions& o) : opt(o), listenFd(-1), stopFd(-1) {
+    if (opt.threads < 1) {
+        opt.threads = 1;
+    }
+}
+
+ParseServer::~ParseServer() {
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(path.c_str());
+    }
+    if (stopFd >= 0) {
+        close(stopFd);
+    }
+}
+
+bool ParseServer::listen(const std::string& socketPath, std::string& err) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        err = socketPath + ": path too long for a socket";
+        return false;
+    }
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        err = std::string("socket: ") + strerror(errno);
+        return false;
+    }
+    unlink(socketPath.c_str());
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        err = socketPath + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stopFd < 0) {
+        err = std::string("eventfd: ") + strerror(errno);
+        close(fd);
+        unlink(socketPath.c_str());
+        return false;
+    }
+    listenFd = fd;
+    path = socketPath;
+    return true;
+}
+
+void ParseServer::stop() {
+    uint64_t one = 1;
+    ssize_t n = write(stopFd, &one, sizeof(one));
+    (void)n;
+}
+
+void ParseServer::serve() {
+    std::vector<std::thread> threads;
+    for (int i = 1; i < opt.threads; i++) {
+        threads.push_back(std::thread(&ParseServer::loop, this));
+    }
+    loop();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+}
+
+// Every loop watches the listening socket; EPOLLEXCLUSIVE wakes just one
+// of them per connection instead of all. The stop event is never read, so
+// it stays ready and ends every loop.
+void ParseServer::loop() {
+    Handler handler(opt);
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listenTag;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listenFd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stopTag;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, stopFd, &ev);
+
+    std::vector<Connection*> connections;
+    std::vector<char> buffer(64 * 1024);
+    struct epoll_event events[64];
+    bool stopping = false;
+    while (!stopping) {
+        int ready = epoll_wait(epoll, events, 64, -1);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &stopTag) {
+                stopping = true;
+            } else if (tag == &listenTag) {
+                for (;;) {
+                    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        break;
+                    }
+                    Connection* c = new Connection();
+                    c->fd = fd;
+                    c->written = 0;
+                    c->writing = false;
+                    c->ended = false;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+                    connections.push_back(c);
+                }
+            } else {
+                Connection* c = (Connection*)tag;
+                if (service(c, handler, opt.maxRequest, &buffer[0], buffer.size())) {
+                    watch(epoll, c);
+                } else {
+                    close(c->fd);
+                    c->fd = -1;
+                }
+            }
+        }
+        // Closed connections are freed after the batch of events, which
+        // may still refer to them.
+        size_t kept = 0;
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (connections[i]->fd >= 0) {
+                connections[kept++] = connections[i];
+            } else {
+                delete connections[i];
+            }
+        }
+        connections.resize(kept);
+    }
+    for (size_t i = 0; i < connections.size(); i++) {
+        close(connections[i]->fd);
+        delete connections[i];
+    }
+    close(epoll);
+}
+
+bool serveStream(int in, int out, const ServerOptions& opt) {
+    Handler handler(opt);
+    std::string pending;
+    std::string answers;
+    std::vector<char> buffer(64 * 1024);
+    for (;;) {
+        ssize_t n = read(in, &buffer[0], buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return pending.empty();
+        }
+        pending.append(&buffer[0], (size_t)n);
+        if (!handleRequests(handler, pending, answers, opt.maxRequest)) {
+            return false;
+        }
+        for (size_t done = 0; done < answers.size();) {
+            ssize_t w = write(out, answers.data() + done, answers.size() - done);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                return false;
+            }
+            done += (size_t)w;
+        }
+        answers.clear();
+    }
+}
+
+int connectServer(const std::string& socketPath, std::string& err) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        err = socketPath + ": path too long for a socket";
+        return -1;
+    }
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        err = std::string("socket: ") + strerror(errno);
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        err = socketPath + ": " + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendFrame(int fd, const char* data, size_t size) {
+    std::string frame;
+    frame.reserve(FRAME_HEADER + size);
+    appendFrameHeader(frame, size);
+    frame.append(data, size);
+    for (size_t done = 0; done < frame.size();) {
+        ssize_t n = send(fd, frame.data() + done, frame.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, char* p, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool receiveFrame(int fd, std::string& payload) {
+    char header[FRAME_HEADER];
+    if (!receiveAll(fd, header, FRAME_HEADER)) {
+        return false;
+    }
+    payload.resize(frameLength(header));
+    return payload.empty() || receiveAll(fd, &payload[0], payload.size());
+}
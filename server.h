@@ -0,0 +1,70 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class VerdictCache;
+
+// Long-running parse service. A request is a program, sent as a frame: its
+// length as 4 bytes, least significant first, then that many bytes of
+// source. The answer to each request is a frame holding exactly what
+// printErrors() prints for the program. A client may send any number of
+// requests on one connection, without waiting for the answers, which come
+// back in the order of the requests.
+
+struct ServerOptions {
+    int threads;
+    bool columns;
+    size_t maxErrors;       // 0: no limit
+    bool failFast;
+    size_t maxDepth;        // 0: recursive parser
+    size_t maxRequest;      // longer requests close the connection
+    VerdictCache* cache;    // NULL: parse every request
+
+    ServerOptions() : threads(1), columns(false), maxErrors(0), failFast(false), maxDepth(0),
+                      maxRequest(64 << 20), cache(NULL) {}
+};
+
+// Serves a Unix domain socket with one epoll loop per thread. Every loop
+// accepts from the shared listening socket and parses the requests of its
+// own connections, on a Parser it set up before the first one arrived.
+class ParseServer {
+private:
+    ServerOptions opt;
+    int listenFd;
+    int stopFd;
+    std::string path;
+
+    void loop();
+
+    ParseServer(const ParseServer&);
+    ParseServer& operator=(const ParseServer&);
+
+public:
+    explicit ParseServer(const ServerOptions& opt);
+    ~ParseServer();
+
+    // Listens on path, replacing a socket left there by an earlier run.
+    // False, with err set, on failure.
+    bool listen(const std::string& path, std::string& err);
+    // Serves until stop(): opt.threads - 1 loops on new threads and one on
+    // the caller.
+    void serve();
+    // Ends serve(). Safe from any thread and from a signal handler.
+    void stop();
+};
+
+// Answers frames from in until it ends, on the calling thread: the same
+// service over a pipe, e.g. stdin and stdout. False on a read or write
+// error or a malformed frame.
+bool serveStream(int in, int out, const ServerOptions& opt);
+
+// Blocking client side of the protocol. connectServer returns a socket, or
+// -1 with err set.
+int connectServer(const std::string& path, std::string& err);
+bool sendFrame(int fd, const char* data, size_t size);
+bool receiveFrame(int fd, std::string& payload);
+
+#endif
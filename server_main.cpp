@@ -0,0 +1,122 @@
+#include "parser.h"
+#include "server.h"
+#include "verdict_cache.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+static ParseServer* running = NULL;
+
+static void onSignal(int) {
+    if (running != NULL) {
+        running->stop();
+    }
+}
+
+static int usage() {
+    std::cerr << "usage: parser_server [--threads=N] [--columns] [--max-errors=N] [--fail-fast]" << std::endl
+              << "                     [--iterative] [--max-depth=N] [--max-request=BYTES]" << std::endl
+              << "                     [--cache=PATH] [--cache-size=MB] (--socket=PATH | --stdio)" << std::endl
+              << "answers parse requests until SIGINT or SIGTERM. A request is a 4-byte little-endian" << std::endl
+              << "length and that many bytes of source; its answer, framed the same way, is what" << std::endl
+              << "the parser prints for the source." << std::endl
+              << "--socket listens on a Unix domain socket, --stdio reads stdin and writes stdout;" << std::endl
+              << "--threads (sockets only) defaults to one event loop per hardware thread;" << std::endl
+              << "--max-request drops connections that send longer requests (default 64 MB);" << std::endl
+              << "--cache and --cache-size are parser_batch's;" << std::endl
+              << "the other options are the parser's." << std::endl;
+    return 2;
+}
+
+static bool parseCount(const char* text, size_t& value) {
+    char* end;
+    value = strtoul(text, &end, 10);
+    return *end == '\0' && value != 0;
+}
+
+int main(int argc, char** argv) {
+    ServerOptions opt;
+    opt.threads = std::thread::hardware_concurrency();
+    if (opt.threads < 1) {
+        opt.threads = 1;
+    }
+    std::string socketPath;
+    bool stdio = false;
+    std::string cachePath;
+    size_t cacheSize = VerdictCache::DEFAULT_SIZE >> 20;
+    for (int i = 1; i < argc; i++) {
+        size_t n;
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            if (!parseCount(argv[i] + 10, n)) {
+                return usage();
+            }
+            opt.threads = (int)n;
+        } else if (strcmp(argv[i], "--columns") == 0) {
+            opt.columns = true;
+        } else if (strncmp(argv[i], "--max-errors=", 13) == 0) {
+            if (!parseCount(argv[i] + 13, opt.maxErrors)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--fail-fast") == 0) {
+            opt.failFast = true;
+        } else if (strcmp(argv[i], "--iterative") == 0) {
+            if (opt.maxDepth == 0) {
+                opt.maxDepth = Parser::DEFAULT_MAX_DEPTH;
+            }
+        } else if (strncmp(argv[i], "--max-depth=", 12) == 0) {
+            if (!parseCount(argv[i] + 12, opt.maxDepth)) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--max-request=", 14) == 0) {
+            if (!parseCount(argv[i] + 14, opt.maxRequest)) {
+                return usage();
+            }
+        } else if (strncmp(argv[i], "--socket=", 9) == 0 && argv[i][9] != '\0') {
+            socketPath = argv[i] + 9;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8] != '\0') {
+            cachePath = argv[i] + 8;
+        } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+            if (!parseCount(argv[i] + 13, cacheSize)) {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--stdio") == 0) {
+            stdio = true;
+        } else {
+            return usage();
+        }
+    }
+    if (stdio == !socketPath.empty()) {
+        return usage();
+    }
+
+    VerdictCache cache;
+    if (!cachePath.empty()) {
+        std::string err;
+        if (!cache.open(cachePath, cacheSize << 20, err)) {
+            std::cerr << "parser_server: " << err << std::endl;
+            return 1;
+        }
+        opt.cache = &cache;
+    }
+
+    if (stdio) {
+        return serveStream(STDIN_FILENO, STDOUT_FILENO, opt) ? 0 : 1;
+    }
+    ParseServer server(opt);
+    std::string err;
+    if (!server.listen(socketPath, err)) {
+        std::cerr << "parser_server: " << err << std::endl;
+        return 1;
+    }
+    running = &server;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    server.serve();
+    running = NULL;
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "source.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::SourceFile() : mapped(0), length(0) {}
+
+SourceFile::~SourceFile() {
+    close();
+}
+
+bool SourceFile::open(const std::string& path, std::string& err) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        err = path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        err = path + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        err = path + ": not a regular file";
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)st.st_size;
+    if (length == 0) {
+        // mmap rejects empty mappings; an empty file is just an empty view.
+        ::close(fd);
+        return true;
+    }
+    void* p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        err = path + ": " + strerror(errno);
+        length = 0;
+        return false;
+    }
+    // The lexer makes one forward pass, so let the kernel read ahead
+    // aggressively and drop pages behind us.
+    madvise(p, length, MADV_SEQUENTIAL);
+    mapped = (const char*)p;
+    return true;
+}
+
+void SourceFile::close() {
+    if (mapped) {
+        munmap((void*)mapped, length);
+    }
+    mapped = 0;
+    length = 0;
+}
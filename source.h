@@ -0,0 +1,30 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <string>
+#include <stddef.h>
+
+// Read-only memory mapping of a source file. The contents are paged in by
+// the kernel on demand and never copied, so a file of any size costs
+// address space rather than heap.
+class SourceFile {
+private:
+    const char* mapped;
+    size_t length;
+
+    SourceFile(const SourceFile&);
+    SourceFile& operator=(const SourceFile&);
+
+public:
+    SourceFile();
+    ~SourceFile();
+
+    // Maps path; on failure returns false and describes the problem in err.
+    bool open(const std::string& path, std::string& err);
+    void close();
+
+    const char* data() const { return mapped ? mapped : ""; }
+    size_t size() const { return length; }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "symbol_table.h"
+#include <algorithm>
+
+SymbolTable::SymbolTable(bool locking) : arena(4096), locking(locking) {
+    Slot empty = { 0, NO_SYMBOL };
+    slots.assign(64, empty);
+    insert("main", 4, symbolHash("main", 4));
+}
+
+uint32_t SymbolTable::intern(const char* text, size_t size, uint32_t hash) {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (locking) {
+        guard.lock();
+    }
+    return insert(text, size, hash);
+}
+
+uint32_t SymbolTable::insert(const char* text, size_t size, uint32_t hash) {
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot& s = slots[i];
+        if (s.id == NO_SYMBOL) {
+            s.hash = hash;
+            s.id = (uint32_t)names.size();
+            Name name = { arena.copy(text, size), size };
+            names.push_back(name);
+            // Keep the load factor at or below one half.
+            if (names.size() * 2 > slots.size()) {
+                grow();
+            }
+            return (uint32_t)names.size() - 1;
+        }
+        if (s.hash == hash && names[s.id].size == size &&
+            memcmp(names[s.id].text, text, size) == 0) {
+            return s.id;
+        }
+    }
+}
+
+void SymbolTable::grow() {
+    Slot empty = { 0, NO_SYMBOL };
+    std::vector<Slot> old(slots.size() * 2, empty);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (size_t k = 0; k < old.size(); k++) {
+        if (old[k].id == NO_SYMBOL) {
+            continue;
+        }
+        size_t i = old[k].hash & mask;
+        while (slots[i].id != NO_SYMBOL) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = old[k];
+    }
+}
+
+uint32_t SymbolTable::find(const char* text, size_t size) {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (locking) {
+        guard.lock();
+    }
+    uint32_t hash = symbolHash(text, size);
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i].id != NO_SYMBOL; i = (i + 1) & mask) {
+        const Slot& s = slots[i];
+        if (s.hash == hash && names[s.id].size == size &&
+            memcmp(names[s.id].text, text, size) == 0) {
+            return s.id;
+        }
+    }
+    return NO_SYMBOL;
+}
+
+void SymbolTable::clear() {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (locking) {
+        guard.lock();
+    }
+    Slot empty = { 0, NO_SYMBOL };
+    if (slots.size() <= 64 * 1024) {
+        std::fill(slots.begin(), slots.end(), empty);
+    } else {
+        // Don't make every later use pay to wipe a table sized for one
+        // huge input.
+        std::vector<Slot>(64, empty).swap(slots);
+    }
+    names.clear();
+    arena.reset();
+    insert("main", 4, symbolHash("main", 4));
+}
+
+size_t SymbolTable::size() {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (locking) {
+        guard.lock();
+    }
+    return names.size();
+}
+
+const char* SymbolTable::text(uint32_t id, size_t& size) {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (locking) {
+        guard.lock();
+    }
+    size = names[id].size;
+    return names[id].text;
+}
@@ -0,0 +1,76 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include "arena.h"
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Identifier interning. Every distinct name gets a dense 32-bit id, in
+// order of first appearance, so later passes compare and index by integer
+// instead of by string. "main" is interned first and always has id
+// SYM_MAIN.
+
+const uint32_t NO_SYMBOL = 0xFFFFFFFFu;
+const uint32_t SYM_MAIN = 0;
+
+// FNV-1a, one byte at a time, so the lexer can hash an identifier while it
+// scans it.
+const uint32_t SYMBOL_HASH_SEED = 2166136261u;
+
+inline uint32_t symbolHashStep(uint32_t h, char c) {
+    return (h ^ (unsigned char)c) * 16777619u;
+}
+
+inline uint32_t symbolHash(const char* s, size_t n) {
+    uint32_t h = SYMBOL_HASH_SEED;
+    for (size_t i = 0; i < n; i++) {
+        h = symbolHashStep(h, s[i]);
+    }
+    return h;
+}
+
+class SymbolTable {
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;    // NO_SYMBOL when the slot is empty
+    };
+    struct Name {
+        const char* text;
+        size_t size;
+    };
+
+    std::vector<Slot> slots;    // open addressing, linear probing
+    std::vector<Name> names;    // indexed by id; text lives in the arena
+    Arena arena;
+    bool locking;
+    std::mutex lock;
+
+    uint32_t insert(const char* text, size_t size, uint32_t hash);
+    void grow();
+
+    SymbolTable(const SymbolTable&);
+    SymbolTable& operator=(const SymbolTable&);
+
+public:
+    // A table shared by parsers on several threads needs locking; one
+    // owned by a single parser does not.
+    explicit SymbolTable(bool locking = false);
+
+    // Id of text, adding it if new. hash must be symbolHash(text, size).
+    uint32_t intern(const char* text, size_t size, uint32_t hash);
+    uint32_t intern(const char* text, size_t size) {
+        return intern(text, size, symbolHash(text, size));
+    }
+    // Id of text, or NO_SYMBOL if it was never interned.
+    uint32_t find(const char* text, size_t size);
+    // Forgets every name but "main", keeping the memory for the next use.
+    void clear();
+
+    size_t size();
+    const char* text(uint32_t id, size_t& size);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Building a tree must not change what the parser reports, an accepted
+// program's tree must reach every node that was allocated, and a small
+// program covering every node kind must come out as expected.
+
+static int failures = 0;
+
+static string parseOutput(Parser& parser, Ast* tree) {
+    stringstream out;
+    streambuf* saved = cout.rdbuf(out.rdbuf());
+    parser.parse(tree);
+    parser.printErrors(true);
+    cout.rdbuf(saved);
+    return out.str();
+}
+
+static size_t reachable(Ast& ast, uint32_t id);
+
+static size_t reachableList(Ast& ast, uint32_t first) {
+    size_t n = 0;
+    for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+        n += reachable(ast, id);
+    }
+    return n;
+}
+
+static size_t reachable(Ast& ast, uint32_t id) {
+    if (id == AST_NONE) {
+        return 0;
+    }
+    const AstNode& n = ast.node(id);
+    switch (Ast::kind(id)) {
+    case AST_FUNC:
+        return 1 + reachableList(ast, n.b) + reachable(ast, n.c);
+    case AST_BLOCK:
+    case AST_DECL:
+        return 1 + reachableList(ast, n.a);
+    case AST_VAR:
+    case AST_ASSIGN:
+        return 1 + reachable(ast, n.b);
+    case AST_IF:
+        return 1 + reachable(ast, n.a) + reachable(ast, n.b) + reachable(ast, n.c);
+    case AST_WHILE:
+    case AST_BINARY:
+        return 1 + reachable(ast, n.a) + reachable(ast, n.b);
+    case AST_RETURN:
+    case AST_EXPR_STMT:
+    case AST_UNARY:
+        return 1 + reachable(ast, n.a);
+    case AST_CALL:
+        return 1 + reachableList(ast, n.b);
+    default:
+        return 1;
+    }
+}
+
+static void check(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    Parser plain(src.data(), src.size());
+    Parser building(src.data(), src.size());
+    Ast tree;
+    string expected = parseOutput(plain, NULL);
+    if (parseOutput(building, &tree) != expected) {
+        printf("FAIL %s: errors differ with a tree\n", name.c_str());
+        failures++;
+    }
+    if (expected == "accept\n" && reachableList(tree, tree.functions) != tree.nodeCount()) {
+        printf("FAIL %s: %d nodes allocated, %d reachable\n", name.c_str(),
+               (int)tree.nodeCount(), (int)reachableList(tree, tree.functions));
+        failures++;
+    }
+}
+
+static void checkDump() {
+    string src =
+        "void f(int a, int b) { ; }\n"
+        "int main() {\n"
+        "    int x = 1 + 2 * 3, y, z = -(x) % 4;\n"
+        "    while (x < 10 || !y && z != 0) { x = x + 1; if (x == 5) break; else continue; }\n"
+        "    f(x, g(y));\n"
+        "    x = x - y - z < 1 == 2 || y && !z * 3;\n"
+        "    return (1 - 2) - 3 >= 4;\n"
+        "}\n";
+    string expected =
+        "(func void f (a b) (block))\n"
+        "(func int main () (block"
+        " (int (x (+ 1 (* 2 3))) y (z (% (- x) 4)))"
+        " (while (|| (< x 10) (&& (! y) (!= z 0)))"
+        " (block (= x (+ x 1)) (if (== x 5) (break) (continue))))"
+        " (expr (call f (x (call g (y)))))"
+        " (= x (|| (== (< (- (- x y) z) 1) 2) (&& y (* (! z) 3))))"
+        " (return (>= (- (- 1 2) 3) 4))))\n";
+    Ast tree;
+    for (int round = 0; round < 2; round++) {
+        // The second round reuses the cleared tree.
+        tree.clear();
+        Parser parser(src);
+        parser.parse(&tree);
+        stringstream out;
+        dumpAst(tree, parser.symbolTable(), out);
+        if (out.str() != expected) {
+            printf("FAIL dump, round %d:\n%s", round, out.str().c_str());
+            failures++;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    checkDump();
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+    }
+    printf("%d files, 1000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include "batch.h"
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Batch results must be what the single-file parser prints, in input order
+// or as a permutation of it, and a parser reset between inputs must behave
+// like a new one.
+
+static int failures = 0;
+
+static string singleOutput(string src, const BatchOptions& opt) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    Parser parser(src.data(), src.size());
+    parser.setMaxErrors(opt.maxErrors);
+    if (opt.failFast) {
+        parser.failFast();
+    }
+    stringstream out;
+    parser.parse();
+    parser.printErrors(opt.columns, out);
+    return out.str();
+}
+
+static vector<string> records(const string& out, const string& start) {
+    vector<string> result;
+    size_t p = 0;
+    while (p < out.size()) {
+        size_t next = out.find("\n" + start, p);
+        next = next == string::npos ? out.size() : next + 1;
+        result.push_back(out.substr(p, next - p));
+        p = next;
+    }
+    return result;
+}
+
+static void checkBatch(const vector<string>& files, const BatchOptions& opt) {
+    string expected;
+    for (size_t i = 0; i < files.size(); i++) {
+        expected += "==> " + files[i] + " <==\n" + singleOutput(readFile(files[i]), opt);
+    }
+    stringstream out;
+    BatchSummary s = runBatch(files, opt, out);
+    if (s.files != files.size() || s.accepted + s.rejected != files.size() || s.unreadable != 0) {
+        printf("FAIL %d threads: summary counts %zu files\n", opt.threads, s.files);
+        failures++;
+    }
+    if (opt.ordered && out.str() != expected) {
+        printf("FAIL %d threads: ordered output differs\n", opt.threads);
+        failures++;
+    }
+    if (!opt.ordered) {
+        vector<string> got = records(out.str(), "==> ");
+        vector<string> want = records(expected, "==> ");
+        sort(got.begin(), got.end());
+        sort(want.begin(), want.end());
+        if (got != want) {
+            printf("FAIL %d threads: unordered output is not a permutation\n", opt.threads);
+            failures++;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    string err;
+    if (!collectSources(dir, files, err) || files.empty()) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+
+    // Many files, so that threads run out of their own and steal.
+    vector<string> many;
+    for (int r = 0; r < 25; r++) {
+        many.insert(many.end(), files.begin(), files.end());
+    }
+    int threadCounts[] = { 1, 4 };
+    for (int t = 0; t < 2; t++) {
+        BatchOptions opt;
+        opt.threads = threadCounts[t];
+        checkBatch(many, opt);
+        opt.ordered = false;
+        checkBatch(many, opt);
+        opt.ordered = true;
+        opt.columns = true;
+        opt.maxErrors = 1;
+        checkBatch(many, opt);
+        opt.failFast = true;
+        checkBatch(many, opt);
+    }
+
+    // JSON lines: one object per file, in order, with the same verdicts.
+    BatchOptions json;
+    json.threads = 4;
+    json.jsonLines = true;
+    vector<string> withMissing = files;
+    withMissing.push_back(dir + "/no_such_file.c");
+    stringstream out;
+    BatchSummary s = runBatch(withMissing, json, out);
+    vector<string> lines = records(out.str(), "{");
+    if (lines.size() != withMissing.size() || s.unreadable != 1) {
+        printf("FAIL jsonl: %zu lines, %zu unreadable\n", lines.size(), s.unreadable);
+        failures++;
+    } else {
+        for (size_t i = 0; i < lines.size(); i++) {
+            string verdict = "error";
+            if (i < files.size()) {
+                verdict = singleOutput(readFile(files[i]), json) == "accept\n" ? "accept" : "reject";
+            }
+            string start = "{\"file\":\"" + withMissing[i] + "\"";
+            if (lines[i].compare(0, start.size(), start) != 0 ||
+                lines[i].find("\"verdict\":\"" + verdict + "\"") == string::npos) {
+                printf("FAIL jsonl: %s", lines[i].c_str());
+                failures++;
+            }
+        }
+    }
+
+    // Links to files are collected, links to directories are not, so a
+    // link back up ends.
+    char tree[64];
+    snprintf(tree, sizeof(tree), "/tmp/toyc_test_batch.%d", (int)getpid());
+    string top = tree;
+    mkdir(top.c_str(), 0755);
+    mkdir((top + "/sub").c_str(), 0755);
+    std::ofstream((top + "/sub/a.c").c_str()) << "int main() {\n    return 0;\n}\n";
+    int linked = symlink((top + "/sub/a.c").c_str(), (top + "/b.c").c_str()) +
+                 symlink(top.c_str(), (top + "/sub/loop").c_str());
+    vector<string> found;
+    if (linked != 0 || !collectSources(top, found, err) || found.size() != 2 || found[0] != top + "/b.c" ||
+        found[1] != top + "/sub/a.c") {
+        printf("FAIL collecting through symbolic links: %zu files\n", found.size());
+        failures++;
+    }
+    unlink((top + "/sub/loop").c_str());
+    unlink((top + "/b.c").c_str());
+    unlink((top + "/sub/a.c").c_str());
+    rmdir((top + "/sub").c_str());
+    rmdir(top.c_str());
+
+    // One parser reset from input to input, as each batch thread does.
+    Parser reused("", 0);
+    BatchOptions plain;
+    for (unsigned seed = 0; seed < 500; seed++) {
+        string src = seed < files.size() ? readFile(files[seed]) : randomSource(seed);
+        if (!src.empty() && src[src.size() - 1] != '\n') {
+            src += '\n';
+        }
+        reused.reset(src.data(), src.size());
+        reused.parse();
+        stringstream got;
+        reused.printErrors(false, got);
+        if (got.str() != singleOutput(src, plain)) {
+            printf("FAIL reset parser differs on input %u\n", seed);
+            failures++;
+        }
+    }
+
+    printf("%d files, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
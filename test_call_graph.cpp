@@ -0,0 +1,416 @@
+#include "parser.h"
+#include "thread_pool.h"
+#include "test_util.h"
+#include <cstdio>
+#include <map>
+
+// The call graph must resolve exactly the calls a plain map from names to
+// functions resolves, report the same undefined and mismatched calls under
+// every parser and limit, and agree with a naive search on which functions
+// are recursive and which main reaches.
+
+static int failures = 0;
+
+struct RefCall {
+    uint32_t callee;    // sym
+    uint32_t arguments;
+    uint64_t offset;
+    bool defined;
+};
+
+struct RefFunction {
+    uint32_t sym;
+    uint32_t arity;
+    std::vector<RefCall> calls;
+    std::vector<size_t> callees;    // of the defined calls, by index
+};
+
+// The obvious implementation: a recursive walk collecting calls (each after
+// the calls in its arguments, as the tree numbers them), resolved
+// through a std::map, and a depth-first search from every function.
+class Reference {
+private:
+    Ast& ast;
+
+    void walk(uint32_t id, RefFunction& f) {
+        if (id == AST_NONE) {
+            return;
+        }
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK:
+        case AST_DECL:
+            for (uint32_t s = n.a; s != AST_NONE; s = ast.node(s).next) {
+                walk(s, f);
+            }
+            break;
+        case AST_CALL: {
+            RefCall call = { (uint32_t)n.a, 0, n.offset, false };
+            for (uint32_t arg = n.b; arg != AST_NONE; arg = ast.node(arg).next) {
+                call.arguments++;
+            }
+            for (uint32_t arg = n.b; arg != AST_NONE; arg = ast.node(arg).next) {
+                walk(arg, f);
+            }
+            f.calls.push_back(call);
+            break;
+        }
+        case AST_VAR:
+        case AST_ASSIGN:
+            walk(n.b, f);
+            break;
+        case AST_NAME:
+        case AST_NUMBER:
+            break;
+        default:
+            walk(n.a, f);
+            walk(n.b, f);
+            walk(n.c, f);
+            break;
+        }
+    }
+
+    bool reaches(size_t from, size_t to, std::vector<bool>& seen) {
+        for (size_t k = 0; k < functions[from].callees.size(); k++) {
+            size_t g = functions[from].callees[k];
+            if (g == to) {
+                return true;
+            }
+            if (!seen[g]) {
+                seen[g] = true;
+                if (reaches(g, to, seen)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+public:
+    std::vector<RefFunction> functions;
+    std::vector<uint64_t> errors;
+    std::vector<bool> recursive;
+    std::vector<bool> reached;
+
+    explicit Reference(Ast& tree) : ast(tree) {
+        std::map<uint32_t, size_t> byName;
+        for (uint32_t id = ast.functions; id != AST_NONE; id = ast.node(id).next) {
+            const AstNode& func = ast.node(id);
+            RefFunction f;
+            f.sym = func.a;
+            f.arity = 0;
+            for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+                f.arity++;
+            }
+            walk(func.c, f);
+            byName[f.sym] = functions.size();
+            functions.push_back(f);
+        }
+        for (size_t i = 0; i < functions.size(); i++) {
+            RefFunction& f = functions[i];
+            for (size_t k = 0; k < f.calls.size(); k++) {
+                std::map<uint32_t, size_t>::iterator callee = byName.find(f.calls[k].callee);
+                if (callee == byName.end()) {
+                    errors.push_back(f.calls[k].offset);
+                    continue;
+                }
+                f.calls[k].defined = true;
+                if (functions[callee->second].arity != f.calls[k].arguments) {
+                    errors.push_back(f.calls[k].offset);
+                }
+                f.callees.push_back(callee->second);
+            }
+        }
+        std::sort(errors.begin(), errors.end());
+        for (size_t i = 0; i < functions.size(); i++) {
+            std::vector<bool> seen(functions.size(), false);
+            recursive.push_back(reaches(i, i, seen));
+        }
+        reached.assign(functions.size(), false);
+        if (byName.count(SYM_MAIN)) {
+            size_t main = byName[SYM_MAIN];
+            std::vector<bool> seen(functions.size(), false);
+            for (size_t i = 0; i < functions.size(); i++) {
+                seen.assign(functions.size(), false);
+                reached[i] = i == main || reaches(main, i, seen);
+            }
+        }
+    }
+};
+
+// What the parser should print with no limits: the reference's errors,
+// one per line.
+static string expectedOutput(const string& src) {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    if (!parser.parse(&tree)) {
+        stringstream out;
+        parser.printErrors(true, out);
+        return out.str();
+    }
+    Reference ref(tree);
+    if (ref.errors.empty()) {
+        return "accept\n";
+    }
+    stringstream out;
+    out << "reject\n";
+    int64_t lastLine = 0;
+    for (size_t i = 0; i < ref.errors.size(); i++) {
+        uint64_t offset = ref.errors[i];
+        int64_t line = 1 + std::count(src.begin(), src.begin() + offset, '\n');
+        size_t lineStart = offset == 0 ? string::npos : src.rfind('\n', offset - 1);
+        lineStart = lineStart == string::npos ? 0 : lineStart + 1;
+        if (line != lastLine) {
+            out << line << ":" << offset - lineStart + 1 << "\n";
+        }
+        lastLine = line;
+    }
+    return out.str();
+}
+
+// Compares the graph with the reference, by names and offsets since the
+// two trees number their symbols and nodes independently.
+static bool sameGraph(const CallGraph& graph, Ast& tree, SymbolTable& symbols, const Reference& ref,
+                      SymbolTable& refSymbols) {
+    if (graph.size() != ref.functions.size()) {
+        return false;
+    }
+    std::vector<bool> recursive, reached(graph.size(), false);
+    graph.findRecursive(recursive);
+    if (graph.find(SYM_MAIN) != CallGraph::NO_FUNCTION) {
+        graph.findReachable(graph.find(SYM_MAIN), reached);
+    }
+    size_t size, refSize;
+    for (uint32_t f = 0; f < graph.size(); f++) {
+        const RefFunction& r = ref.functions[f];
+        const char* name = symbols.text(graph.name(f), size);
+        const char* refName = refSymbols.text(r.sym, refSize);
+        if (string(name, size) != string(refName, refSize) || graph.arity(f) != r.arity ||
+            graph.find(graph.name(f)) != f || Ast::kind(graph.node(f)) != AST_FUNC ||
+            recursive[f] != ref.recursive[f] || reached[f] != ref.reached[f]) {
+            return false;
+        }
+        if (graph.siteBegin(f + 1) - graph.siteBegin(f) != r.callees.size()) {
+            return false;
+        }
+        size_t k = 0;
+        for (size_t c = 0; c < r.calls.size(); c++) {
+            if (!r.calls[c].defined) {
+                continue;
+            }
+            const char* callee = refSymbols.text(r.calls[c].callee, refSize);
+            uint32_t site = graph.siteBegin(f) + (uint32_t)k;
+            const char* got = symbols.text(graph.name(graph.callee(site)), size);
+            if (string(got, size) != string(callee, refSize) || graph.callee(site) != r.callees[k] ||
+                tree.node(graph.callNode(site)).offset != r.calls[c].offset) {
+                return false;
+            }
+            k++;
+        }
+    }
+    return true;
+}
+
+struct Setup {
+    int parser;     // 0: recursive, 1: explicit stack, 2: token buffer on threads
+    size_t maxErrors;
+    bool failFast;
+};
+
+static Ast empty;
+
+static void check(const string& name, string src, ThreadPool& pool) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    string expected = expectedOutput(src);
+    Parser refParser(src.data(), src.size());
+    Ast refTree;
+    bool parsed = refParser.parse(&refTree);
+    Reference ref(parsed ? refTree : empty);
+
+    static const Setup setups[] = {
+        { 0, 0, false }, { 1, 0, false }, { 2, 0, false }, { 0, 2, false }, { 0, 0, true }, { 2, 1, false },
+    };
+    for (size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++) {
+        const Setup& setup = setups[s];
+        TokenBuffer tokens;
+        tokens.lex(src.data(), src.size());
+        Parser inPlace(src.data(), src.size());
+        Parser buffered(tokens);
+        Parser& parser = setup.parser == 2 ? buffered : inPlace;
+        if (setup.parser == 1) {
+            parser.useExplicitStack();
+        } else if (setup.parser == 2) {
+            parser.useThreads(pool, 5);
+        }
+        parser.setMaxErrors(setup.maxErrors);
+        if (setup.failFast) {
+            parser.failFast();
+        }
+        parser.checkCalls();
+        Ast tree;
+        parser.parse(&tree);
+        stringstream out;
+        parser.printErrors(true, out);
+
+        string want = expected;
+        if (expected == "accept\n" || setup.failFast) {
+            want = expected.substr(0, expected.find('\n') + 1);
+        } else if (setup.maxErrors != 0) {
+            size_t end = 0;
+            for (size_t i = 0; i <= setup.maxErrors && end != string::npos; i++) {
+                end = expected.find('\n', end + (i > 0));
+            }
+            want = end == string::npos ? expected : expected.substr(0, end + 1);
+        }
+        if (out.str() != want) {
+            printf("FAIL %s (setup #%d): got\n%sexpected\n%s", name.c_str(), (int)s, out.str().c_str(),
+                   want.c_str());
+            failures++;
+        }
+        if (parsed && !sameGraph(parser.callGraph(), tree, parser.symbolTable(), ref, refParser.symbolTable())) {
+            printf("FAIL %s (setup #%d): call graph differs\n", name.c_str(), (int)s);
+            failures++;
+        }
+    }
+}
+
+// Checks the verdict and the printed graph of one small program.
+static void expect(const string& src, const string& verdict, const string& graph, ThreadPool& pool) {
+    Parser parser(src.data(), src.size());
+    parser.checkCalls();
+    bool ok = parser.parse();
+    stringstream out;
+    parser.printErrors(true, out);
+    if (ok) {
+        dumpCallGraph(parser.callGraph(), parser.symbolTable(), out);
+    }
+    if (out.str() != verdict + graph) {
+        printf("FAIL %sgot\n%sexpected\n%s%s", src.c_str(), out.str().c_str(), verdict.c_str(), graph.c_str());
+        failures++;
+    }
+    check(src, src, pool);
+}
+
+// Functions over a few names, calling defined and undefined ones with
+// about the right number of arguments.
+static string randomProgram(unsigned seed) {
+    static const char* names[] = { "a", "b", "c", "d", "e", "f", "g", "h" };
+    srand(seed);
+    int functions = 1 + rand() % 6;
+    int arity[8];
+    for (int i = 0; i < 8; i++) {
+        arity[i] = rand() % 4;
+    }
+    string s;
+    for (int f = 0; f < functions; f++) {
+        bool isMain = f == functions - 1 && rand() % 8 != 0;
+        s += isMain ? "int main(" : string("int ") + names[f] + "(";
+        for (int p = 0; p < (isMain ? 0 : arity[f]); p++) {
+            s += p > 0 ? ", int x" : "int x";
+            s += (char)('0' + p);
+        }
+        s += ") {\n";
+        int statements = rand() % 6;
+        for (int i = 0; i < statements; i++) {
+            string call;
+            int nesting = 1 + rand() % 2;
+            for (int level = 0; level < nesting; level++) {
+                int callee = rand() % 8;
+                int arguments = rand() % 5 == 0 ? rand() % 4 : arity[callee];
+                string inner = call;
+                call = string(names[callee]) + "(";
+                for (int k = 0; k < arguments; k++) {
+                    call += k > 0 ? ", " : "";
+                    call += k == 0 && !inner.empty() ? inner : "1";
+                }
+                call += ")";
+            }
+            switch (rand() % 4) {
+            case 0:
+                s += call + ";\n";
+                break;
+            case 1:
+                s += "int v" + std::to_string(i) + " = " + call + " + 1;\n";
+                break;
+            case 2:
+                s += "if (" + call + ") { " + call + "; }\n";
+                break;
+            default:
+                s += "return " + call + ";\n";
+                break;
+            }
+        }
+        s += "return 0;\n}\n";
+    }
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    ThreadPool pool(4);
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]), pool);
+    }
+    expect(readFile(dir + "/f09_recursion.c"), "accept\n", "fact: fact [recursive]\nmain: fact\n", pool);
+
+    expect("int main() {\n    return f(1);\n}\nint f(int a) {\n    return a;\n}\n", "accept\n",
+           "main: f\nf:\n", pool);
+    expect("int main() {\n    return g(1);\n}\n", "reject\n2:12\n", "", pool);
+    expect("int f(int a, int b) {\n    return a;\n}\nint main() {\n    f(1);\n    return f(1, 2, 3);\n}\n",
+           "reject\n5:5\n6:12\n", "", pool);
+    expect("void f() {\n}\nint main() {\n    f(f());\n    return 0;\n}\n", "reject\n4:5\n", "", pool);
+    expect("int even(int n) {\n    if (n == 0) return 1;\n    return odd(n - 1);\n}\n"
+           "int odd(int n) {\n    if (n == 0) return 0;\n    return even(n - 1);\n}\n"
+           "int dead() {\n    return dead() + even(2);\n}\n"
+           "int main() {\n    return odd(3) + odd(5);\n}\n",
+           "accept\n", "even: odd [recursive]\nodd: even [recursive]\ndead: dead even [recursive] [unreachable]\n"
+           "main: odd\n", pool);
+
+    for (unsigned seed = 0; seed < 500; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomProgram(seed), pool);
+    }
+
+    // A cycle through far more functions than a recursive search could
+    // follow, and the same chain cut open.
+    size_t n = 100000;
+    for (int closed = 0; closed < 2; closed++) {
+        string chain;
+        for (size_t i = 0; i < n; i++) {
+            size_t next = i + 1 < n ? i + 1 : 0;
+            chain += "int f" + std::to_string(i) + "() { return " +
+                     (i + 1 < n || closed ? "f" + std::to_string(next) + "()" : string("0")) + "; }\n";
+        }
+        chain += "int main() { return f0(); }\n";
+        Parser parser(chain.data(), chain.size());
+        parser.checkCalls();
+        if (!parser.parse()) {
+            printf("FAIL chain of %zu functions rejected\n", n);
+            failures++;
+            continue;
+        }
+        const CallGraph& graph = parser.callGraph();
+        std::vector<bool> recursive, reached;
+        graph.findRecursive(recursive);
+        graph.findReachable(graph.find(SYM_MAIN), reached);
+        size_t recursiveCount = std::count(recursive.begin(), recursive.end(), true);
+        size_t reachedCount = std::count(reached.begin(), reached.end(), true);
+        if (graph.size() != n + 1 || graph.siteCount() != n + closed || recursiveCount != (closed ? n : 0) ||
+            reachedCount != n + 1) {
+            printf("FAIL chain of %zu functions (closed %d): %zu recursive, %zu reached\n", n, closed,
+                   recursiveCount, reachedCount);
+            failures++;
+        }
+    }
+
+    printf("%d files, 500 random programs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
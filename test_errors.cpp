@@ -0,0 +1,128 @@
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Every way of feeding the parser reports each rejected line once, in
+// order; --max-errors=N output is the first N lines of the full output, and
+// fail-fast output is the bare verdict.
+
+static int failures = 0;
+
+enum Mode { IN_PLACE, TOKEN_BUFFER, STREAM, STACK, MODES };
+
+static const char* modeNames[] = { "in place", "token buffer", "stream", "explicit stack" };
+
+static string parseOutput(const string& src, Mode mode, size_t maxErrors, bool failFast) {
+    stringstream out;
+    streambuf* saved = cout.rdbuf(out.rdbuf());
+    TokenBuffer tokens;
+    stringstream in(src);
+    Parser* parser;
+    if (mode == TOKEN_BUFFER) {
+        tokens.lex(src.data(), src.size());
+        parser = new Parser(tokens);
+    } else if (mode == STREAM) {
+        parser = new Parser(in, 64);
+    } else {
+        parser = new Parser(src.data(), src.size());
+    }
+    if (mode == STACK) {
+        parser->useExplicitStack();
+    }
+    parser->setMaxErrors(maxErrors);
+    if (failFast) {
+        parser->failFast();
+    }
+    parser->parse();
+    parser->printErrors(true);
+    delete parser;
+    cout.rdbuf(saved);
+    return out.str();
+}
+
+// The first n lines of the full output, verdict included.
+static string firstLines(const string& out, size_t n) {
+    size_t end = 0;
+    for (size_t i = 0; i <= n && end < out.size(); i++) {
+        end = out.find('\n', end) + 1;
+    }
+    return out.substr(0, end);
+}
+
+static void check(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    string full = parseOutput(src, IN_PLACE, 0, false);
+    bool accepted = full == "accept\n";
+    if (!accepted) {
+        int64_t last = 0;
+        for (size_t p = full.find('\n') + 1; p < full.size(); p = full.find('\n', p) + 1) {
+            int64_t line = atoll(full.c_str() + p);
+            if (line <= last) {
+                printf("FAIL %s: line %lld reported out of order or twice\n", name.c_str(), (long long)line);
+                failures++;
+            }
+            last = line;
+        }
+    }
+    for (int mode = 0; mode < MODES; mode++) {
+        Mode m = (Mode)mode;
+        if (m != IN_PLACE && parseOutput(src, m, 0, false) != full) {
+            printf("FAIL %s: %s output differs\n", name.c_str(), modeNames[m]);
+            failures++;
+        }
+        for (size_t n = 1; n <= 4; n++) {
+            if (parseOutput(src, m, n, false) != firstLines(full, n)) {
+                printf("FAIL %s: %s with %d errors is not a prefix\n", name.c_str(), modeNames[m], (int)n);
+                failures++;
+            }
+        }
+        if (parseOutput(src, m, 0, true) != (accepted ? "accept\n" : "reject\n")) {
+            printf("FAIL %s: %s fail-fast verdict differs\n", name.c_str(), modeNames[m]);
+            failures++;
+        }
+    }
+}
+
+// main() with random statements, most of them broken, one per line.
+static string garbageProgram(unsigned seed) {
+    static const char* pieces[] = {
+        "x", "1", "+", "*", "(", ")", "=", ";", ",", "f(", "{", "}", "if (", "else",
+        "while (", "return", "int", "break;", "!",
+    };
+    srand(seed);
+    string s = "int main() {\n";
+    int lines = rand() % 30;
+    for (int i = 0; i < lines; i++) {
+        s += "    ";
+        int n = rand() % 6;
+        for (int j = 0; j < n; j++) {
+            s += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+            s += ' ';
+        }
+        s += rand() % 3 ? "x = 1;\n" : "\n";
+    }
+    return s + "}\n";
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 500; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+        check(name.str() + " (garbage)", garbageProgram(seed));
+    }
+
+    printf("%d files, 1000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
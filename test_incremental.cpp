@@ -0,0 +1,151 @@
+#include "incremental.h"
+#include "test_util.h"
+#include <cstdio>
+
+// After every edit, an incremental parse must report exactly what a fresh
+// parse of the edited text does, under every limit; and an edit inside one
+// function of a valid program must not re-lex the rest.
+
+static int failures = 0;
+
+struct Setup {
+    size_t maxErrors;
+    bool failFast;
+    size_t maxDepth;
+};
+
+static const Setup setups[] = { { 0, false, 0 }, { 2, false, 0 }, { 0, true, 0 }, { 0, false, 20 } };
+static const size_t SETUPS = sizeof(setups) / sizeof(setups[0]);
+
+static string freshOutput(string src, const Setup& setup) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    Parser parser(src.data(), src.size());
+    parser.setMaxErrors(setup.maxErrors);
+    if (setup.failFast) {
+        parser.failFast();
+    }
+    if (setup.maxDepth != 0) {
+        parser.useExplicitStack(setup.maxDepth);
+    }
+    parser.parse();
+    stringstream out;
+    parser.printErrors(true, out);
+    return out.str();
+}
+
+static string incrementalOutput(IncrementalParser& parser) {
+    stringstream out;
+    parser.printErrors(true, out);
+    return out.str();
+}
+
+// Edits that open and close functions, blocks and comments, join and split
+// tokens and lines, and break statements.
+static void randomEdit(const string& text, size_t& offset, size_t& removed, string& inserted) {
+    static const char* pieces[] = {
+        " ", "\n", "x", "1", ";", "{", "}", "(", ")", "/*", "*/", "//", "=", "*", "/", "@", "int", "void",
+        "}\nint f() { return 0; }\n", "int main() {\n", "\nint main() { return 0; }\n",
+        "void g(int a) { while (a) { a = a - 1; } }\n", "x = ;", "return (1 + 2);",
+    };
+    offset = text.empty() ? 0 : rand() % (text.size() + 1);
+    removed = 0;
+    inserted.clear();
+    if (rand() % 3 != 0) {
+        inserted = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    if (inserted.empty() || rand() % 4 == 0) {
+        removed = rand() % (rand() % 8 == 0 ? 200 : 6);
+    }
+}
+
+static void check(const string& name, const string& src, unsigned seed, int edits) {
+    for (size_t s = 0; s < SETUPS; s++) {
+        IncrementalParser parser(src);
+        parser.setMaxErrors(setups[s].maxErrors);
+        if (setups[s].failFast) {
+            parser.failFast();
+        }
+        if (setups[s].maxDepth != 0) {
+            parser.useExplicitStack(setups[s].maxDepth);
+        }
+        parser.parse();
+        string text = src;
+        srand(seed);
+        for (int e = 0; e <= edits; e++) {
+            if (e > 0) {
+                size_t offset, removed;
+                string inserted;
+                randomEdit(text, offset, removed, inserted);
+                removed = std::min(removed, text.size() - offset);
+                text.replace(offset, removed, inserted);
+                parser.edit(offset, removed, inserted);
+            }
+            if (parser.text() != text) {
+                printf("FAIL %s: text differs after %d edits (setup #%d)\n", name.c_str(), e, (int)s);
+                failures++;
+                break;
+            }
+            if (incrementalOutput(parser) != freshOutput(text, setups[s])) {
+                printf("FAIL %s: errors differ after %d edits (setup #%d)\n", name.c_str(), e, (int)s);
+                failures++;
+                break;
+            }
+        }
+    }
+}
+
+// A valid program of many functions; a one-character edit in the middle
+// re-lexes about one function.
+static void checkLocality() {
+    string src;
+    for (int i = 0; i < 1000; i++) {
+        stringstream f;
+        f << "int f" << i << "(int n) {\n    while (n > 0) { n = n - 1; }\n    return n;\n}\n";
+        src += f.str();
+    }
+    src += "int main() {\n    return f0(1);\n}\n";
+    IncrementalParser parser(src);
+    parser.parse();
+    size_t middle = src.find("int f500(");
+    size_t semicolon = src.find(';', middle);
+    bool accepted = parser.edit(middle, 0, " ");
+    bool rejected = !parser.edit(semicolon + 1, 1, "");
+    bool restored = parser.edit(semicolon + 1, 0, ";") && parser.edit(middle, 1, "");
+    if (!accepted || !rejected || !restored || parser.text() != src) {
+        printf("FAIL locality: wrong verdicts\n");
+        failures++;
+    }
+    if (parser.relexedBytes() > 200 || parser.segmentCount() != 1001) {
+        printf("FAIL locality: %zu bytes re-lexed, %zu segments\n", parser.relexedBytes(),
+               parser.segmentCount());
+        failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    string all;
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        check(files[i], src, (unsigned)i, 40);
+        all += src + "\n";
+    }
+    check("all files", all, 0, 300);
+    check("empty", "", 0, 40);
+    for (unsigned seed = 0; seed < 200; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed), seed, 20);
+    }
+    checkLocality();
+
+    printf("%d files, 200 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
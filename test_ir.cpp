@@ -0,0 +1,416 @@
+#include "parser.h"
+#include "ir.h"
+#include "native.h"
+#include "vm.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Programs lowered through SSA form must give what the bytecode compiler's
+// code gives, error for error, with and without the passes, on the VM and
+// as native code; the passes must keep the form valid after each of them,
+// and must actually fold, merge and remove what they are for.
+
+static int failures = 0;
+
+static string interpreted(const BytecodeProgram& program) {
+    Vm vm;
+    int32_t result;
+    string err;
+    if (!vm.run(program, result, err)) {
+        return "error: " + err;
+    }
+    return std::to_string(result);
+}
+
+static string native(const BytecodeProgram& program) {
+    NativeCompiler compiler;
+    NativeCode code;
+    int32_t result;
+    string err;
+    if (!compiler.compile(program, code, err) || !code.run(result, err)) {
+        return "error: " + err;
+    }
+    return std::to_string(result);
+}
+
+static bool parseChecked(const string& name, Parser& parser, Ast& tree, bool scopes = true) {
+    if (scopes) {
+        parser.checkScopes();
+    }
+    parser.checkCalls();
+    if (!parser.parse(&tree)) {
+        printf("FAIL %s rejected\n", name.c_str());
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+// Builds src's SSA form, optimized if asked; false, counted as a failure,
+// if anything goes wrong on the way.
+static bool build(const string& name, Parser& parser, Ast& tree, IrProgram& ir, bool optimize) {
+    IrBuilder builder;
+    string err;
+    if (!builder.build(tree, parser.callGraph(), ir, err)) {
+        printf("FAIL %s not built: %s\n", name.c_str(), err.c_str());
+        failures++;
+        return false;
+    }
+    for (size_t f = 0; f < ir.functions.size(); f++) {
+        if (!verifyIr(*ir.functions[f], err)) {
+            printf("FAIL %s built invalid: %s\n", name.c_str(), err.c_str());
+            dumpIr(ir, parser.symbolTable(), std::cout);
+            failures++;
+            return false;
+        }
+    }
+    if (optimize) {
+        PassManager passes;
+        passes.addStandard();
+        passes.verifyEach();
+        if (!passes.run(ir, err)) {
+            printf("FAIL %s optimized invalid: %s\n", name.c_str(), err.c_str());
+            dumpIr(ir, parser.symbolTable(), std::cout);
+            failures++;
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t count(const IrFunction& fn, IrOp op) {
+    size_t n = 0;
+    for (size_t b = 0; b < fn.blocks.size(); b++) {
+        for (uint32_t id = fn.blocks[b].first; id != IR_NONE; id = fn.insn(id).next) {
+            n += fn.insn(id).op == op;
+        }
+    }
+    return n;
+}
+
+// Runs src through the bytecode compiler and through SSA form both ways;
+// expected is what it should give, or empty to take the compiler's word.
+// Without scopes, src skips the scope check.
+static void check(const string& name, const string& src, const string& expected = "", bool scopes = true) {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    if (!parseChecked(name, parser, tree, scopes)) {
+        return;
+    }
+    BytecodeCompiler compiler;
+    BytecodeProgram direct;
+    string err;
+    if (!compiler.compile(tree, parser.callGraph(), direct, err)) {
+        printf("FAIL %s not compiled: %s\n", name.c_str(), err.c_str());
+        failures++;
+        return;
+    }
+    string want = interpreted(direct);
+    if (!expected.empty() && want != expected) {
+        printf("FAIL %s interpreted: got %s, expected %s\n", name.c_str(), want.c_str(), expected.c_str());
+        failures++;
+    }
+    for (int optimize = 0; optimize < 2; optimize++) {
+        IrProgram ir;
+        BytecodeProgram program;
+        if (!build(name, parser, tree, ir, optimize != 0)) {
+            continue;
+        }
+        if (!lowerIr(ir, program, err)) {
+            printf("FAIL %s not lowered: %s\n", name.c_str(), err.c_str());
+            failures++;
+            continue;
+        }
+        string got = interpreted(program);
+        string machine = nativeSupported() ? native(program) : got;
+        if (got != want || machine != want) {
+            printf("FAIL %s%s: got %s (native %s), expected %s\n", name.c_str(), optimize ? " optimized" : "",
+                   got.c_str(), machine.c_str(), want.c_str());
+            dumpIr(ir, parser.symbolTable(), std::cout);
+            dumpBytecode(program, parser.symbolTable(), std::cout);
+            failures++;
+        }
+    }
+}
+
+// The optimized form of function f of src, for checks on its shape.
+static bool optimized(const string& name, const string& src, size_t f, IrProgram& ir) {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    if (!parseChecked(name, parser, tree) || !build(name, parser, tree, ir, true)) {
+        return false;
+    }
+    if (f >= ir.functions.size()) {
+        printf("FAIL %s has no function %zu\n", name.c_str(), f);
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+static void expect(const string& name, bool ok) {
+    if (!ok) {
+        printf("FAIL %s\n", name.c_str());
+        failures++;
+    }
+}
+
+static bool callsAllowed;
+
+// An expression over the variables v0 .. v{vars - 1}, heavy on constants
+// and repeated subexpressions, with division by zero now and then.
+static string randomExpr(int vars, int depth) {
+    static const char* ops[] = { "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+    if (depth == 0 || rand() % 3 == 0) {
+        if (vars > 0 && rand() % 3 != 0) {
+            return "v" + std::to_string(rand() % vars);
+        }
+        return std::to_string(rand() % 7 == 0 ? 2147483647 : rand() % 4 - (rand() % 5 == 0 ? 2 : 0));
+    }
+    switch (rand() % 7) {
+    case 0:
+        return string(rand() % 2 ? "-" : "!") + "(" + randomExpr(vars, depth - 1) + ")";
+    case 1:
+        if (!callsAllowed) {
+            return randomExpr(vars, depth - 1);
+        }
+        if (rand() % 2) {
+            return "g(" + randomExpr(vars, depth - 1) + ")";
+        }
+        {
+            string call = "f(";
+            for (int i = 0; i < 4; i++) {
+                call += (i > 0 ? ", " : "") + randomExpr(vars, i == 0 ? depth - 1 : 0);
+            }
+            return call + ")";
+        }
+    case 2: {
+        string e = randomExpr(vars, depth - 1);
+        return "(" + e + " " + ops[rand() % 13] + " " + e + ")";
+    }
+    default:
+        return "(" + randomExpr(vars, depth - 1) + " " + ops[rand() % 13] + " " + randomExpr(vars, depth - 1) + ")";
+    }
+}
+
+// Assignments in branches and bounded loops, so that values meet at phis,
+// some conditions are constant and some code is dead.
+static string randomBody(int& vars, int depth, int loops) {
+    string s;
+    int statements = 2 + rand() % 6;
+    for (int i = 0; i < statements; i++) {
+        switch (rand() % 9) {
+        case 0:
+        case 1:
+        case 2:
+            s += "int v" + std::to_string(vars) + " = " + randomExpr(vars, 3) + ";\n";
+            vars++;
+            break;
+        case 3:
+            if (vars > 0) {
+                s += "v" + std::to_string(rand() % vars) + " = " + randomExpr(vars, 3) + ";\n";
+            }
+            break;
+        case 4:
+            if (depth > 0) {
+                int inner = vars;
+                s += "if (" + randomExpr(vars, 2) + ") {\n" + randomBody(inner, depth - 1, loops) + "}";
+                if (rand() % 2) {
+                    inner = vars;
+                    s += " else {\n" + randomBody(inner, depth - 1, loops) + "}";
+                }
+                s += "\n";
+            }
+            break;
+        case 5:
+            if (depth > 0) {
+                string counter = "i" + std::to_string(depth) + "_" + std::to_string(i);
+                string n = std::to_string(rand() % 5);
+                int inner = vars;
+                s += "int " + counter + " = 0;\nwhile (" + counter + " < " + n + ") {\n" + counter + " = " + counter +
+                     " + 1;\n" + randomBody(inner, depth - 1, loops + 1) + "}\n";
+            }
+            break;
+        case 6:
+            if (loops > 0) {
+                s += string("if (") + randomExpr(vars, 1) + ") " + (rand() % 2 ? "break;\n" : "continue;\n");
+            }
+            break;
+        case 7:
+            s += "{\nint v" + std::to_string(vars) + " = " + randomExpr(vars, 2) + ";\n}\n";
+            break;
+        default:
+            s += "if (" + randomExpr(vars, 2) + ") return " + randomExpr(vars, 2) + ";\n";
+            break;
+        }
+    }
+    return s;
+}
+
+// A recursive function that ends in a tail call, a sum or product with one,
+// or calls it cannot loop on; n goes down by one or two each time.
+static string randomRecursion() {
+    int vars = 2;
+    string call = "h(n - 1, " + randomExpr(vars, 1) + ", " + randomExpr(vars, 1) + ")";
+    string s = "int h(int n, int v0, int v1) {\nif (n <= 0) return " + randomExpr(vars, 2) + ";\n";
+    if (rand() % 2) {
+        s += "if (" + randomExpr(vars, 1) + ") return " + randomExpr(vars, 1) + " + " + call + ";\n";
+    }
+    s += randomBody(vars, 1, 0);
+    string e = randomExpr(vars, 1);
+    switch (rand() % 5) {
+    case 0:
+        return s + "return " + call + ";\n}\n";
+    case 1:
+        return s + "return " + e + " + " + call + ";\n}\n";
+    case 2:
+        return s + "return " + call + " * " + e + ";\n}\n";
+    case 3:
+        return s + "return " + call + " + h(n - 2, v1, " + e + ");\n}\n";
+    default:
+        return s + "return f(" + e + ", v0, v1, 1) - " + call + ";\n}\n";
+    }
+}
+
+static string randomProgram(unsigned seed) {
+    srand(seed);
+    int vars = 4;
+    callsAllowed = false;
+    string s = "int f(int v0, int v1, int v2, int v3) {\n" + randomBody(vars, 2, 0) + "return v0 - v3 + v2;\n}\n";
+    s += randomRecursion();
+    vars = 1;
+    callsAllowed = true;
+    s += "int g(int v0) {\n    if (v0 < 0) return v0;\n    int v1 = 5;\n"
+         "    return v1 + f(v0, v1, 2, v0 * v1) + h(v0 % 8, v0, v1);\n}\n";
+    vars = 0;
+    s += "int main() {\n" + randomBody(vars, 3, 0) + "return " + randomExpr(vars, 2) + ";\n}\n";
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    int run = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        Parser parser(src.data(), src.size());
+        if (!parser.parse()) {
+            continue;
+        }
+        run++;
+        check(files[i], src);
+    }
+    // f19 mended, as in the native backend's test.
+    string many = readFile(dir + "/f19_many_arguments.c");
+    size_t at = many.find("sum16(,");
+    if (at != string::npos) {
+        many.replace(at, 7, "sum16(int a1,");
+    }
+    at = many.find("= (v1, 2");
+    if (at != string::npos) {
+        many.insert(at + 2, "sum8");
+    }
+    check("f19_many_arguments.c mended", many);
+
+    check("INT_MIN / -1 folded", "int main() {\n    int m = -2147483647 - 1;\n    int d = -1;\n"
+          "    return (m / d == m) + (m % d == 0) * 2 + (7 / d == -7) * 4 + (-7 % 2 == -1) * 8;\n}\n", "15");
+    check("division by zero kept", "int main() {\n    int z = 0;\n    int t = 1 / z;\n    return 3;\n}\n",
+          "error: Division by zero");
+    check("zero times a trap", "int main() {\n    int z = 0;\n    return 0 * (1 % z);\n}\n", "error: Division by zero");
+    check("short circuit", "int main() {\n    int z = 0;\n    return (z && 1 / z) + (1 || 1 / z);\n}\n", "1");
+    check("fall off the end", "int f() {\n    int x = 1;\n}\nint main() {\n    return f() + 7;\n}\n", "7");
+    check("main with parameters", "int main(int a, int b) {\n    return a + b + 1;\n}\n", "1");
+    check("read before set", "int main() {\n    int i = 0;\n    int s;\n    while (i < 3) {\n        int t;\n"
+          "        s = s + t + i;\n        t = 5;\n        i = i + 1;\n    }\n    return s;\n}\n", "3");
+    check("shadowing initializers", "int main() {\n    int x = 70;\n    int s = 0;\n    {\n        int y = x + 1;\n"
+          "        int x = y * 2;\n        s = x;\n    }\n    if (s) int y = s + x;\n    return s + x;\n}\n", "212");
+    check("own initializer unchecked", "int main() {\n    int x = 70;\n    { int x = x + 1; return x; }\n}\n", "71",
+          false);
+    check("swap in a loop", "int main() {\n    int a = 1;\n    int b = 2;\n    int i = 0;\n    while (i < 5) {\n"
+          "        int t = a;\n        a = b;\n        b = t;\n        i = i + 1;\n    }\n    return a * 10 + b;\n}\n",
+          "21");
+    check("nested breaks", "int main() {\n    int n = 0;\n    int i = 0;\n    while (1) {\n        int j = 0;\n"
+          "        while (1) {\n            if (j == i) break;\n            j = j + 1;\n            n = n + j;\n"
+          "        }\n        if (i == 6) break;\n        i = i + 1;\n        if (i % 2) continue;\n"
+          "        n = n * 2;\n    }\n    return n;\n}\n");
+
+    string recursive = "int fib(int n) {\n    if (n <= 1) return n;\n    return fib(n - 1) + fib(n - 2);\n}\n"
+                       "int gcd(int a, int b) {\n    if (b == 0) return a;\n    return gcd(b, a % b);\n}\n"
+                       "int fact(int n) {\n    if (n <= 1) return 1;\n    return n * fact(n - 1);\n}\n"
+                       "int p(int n, int x) {\n    if (n == 0) return x;\n    if (n % 3 == 0) return p(n - 1, x + 1);\n"
+                       "    return n * p(n - 1, x);\n}\n";
+    check("tail calls", recursive + "int main() {\n    return fib(15) + gcd(1071, 462) * 1000 + fact(10) + p(7, 2);\n}\n");
+    check("mutual recursion", "int even(int n) {\n    if (n == 0) return 1;\n    return odd(n - 1);\n}\n"
+          "int odd(int n) {\n    if (n == 0) return 0;\n    return even(n - 1);\n}\n"
+          "int main() {\n    return even(10) * 10 + odd(7);\n}\n", "11");
+    check("trap at the bottom of tail calls", "int f(int n, int d) {\n    if (n == 0) return 10 / d;\n"
+          "    return 1 + f(n - 1, d - 1);\n}\nint main() {\n    return f(3, 3);\n}\n", "error: Division by zero");
+    // After tail-recursion the loop starts at the first instruction, with the
+    // parameters live into it.
+    check("loop at the first instruction", "int h(int n, int v0, int v1) {\n    if (n <= 0) return v0 - v1;\n"
+          "    if (v1) {\n        v1 = v1 / v1 / (v1 > 0) / v1;\n    }\n    int v2 = -v0 / (v1 <= v1);\n"
+          "    return h(n - 1, 3 < v1, v0);\n}\nint main() {\n    int s = 0;\n    int i = 0;\n"
+          "    while (i < 8) {\n        s = s + h(i, i, 5);\n        i = i + 1;\n    }\n    return s;\n}\n", "-6");
+    check("inlined trap", "int half(int x, int y) {\n    return x / y;\n}\nint main() {\n    int s = 0;\n"
+          "    int i = 3;\n    while (i >= 0) {\n        s = s + half(12, i);\n        i = i - 1;\n    }\n"
+          "    return s;\n}\n", "error: Division by zero");
+
+    IrProgram ir;
+    if (optimized("tail recursion", recursive + "int main() {\n    return fib(5);\n}\n", 0, ir)) {
+        expect("fibonacci keeps one of its calls", count(*ir.functions[0], IR_CALL) == 1);
+        expect("gcd becomes a loop", count(*ir.functions[1], IR_CALL) == 0);
+        expect("factorial becomes a loop", count(*ir.functions[2], IR_CALL) == 0);
+        expect("both kinds of tail call in one function become a loop", count(*ir.functions[3], IR_CALL) == 0);
+    }
+    // Far deeper than the stack allows for the calls, but not for the loop.
+    if (optimized("deep tail recursion", "int count(int n, int s) {\n    if (n == 0) return s;\n"
+                  "    return count(n - 1, s + 2);\n}\nint main() {\n    return count(20000000, 1);\n}\n", 0, ir)) {
+        BytecodeProgram program;
+        string err;
+        expect("deep tail recursion runs in one frame", lowerIr(ir, program, err) && interpreted(program) == "40000001" &&
+               (!nativeSupported() || native(program) == "40000001"));
+    }
+    if (optimized("inlining", "int sq(int x) {\n    return x * x;\n}\n"
+                  "int odd(int n) {\n    if (n == 0) return 0;\n    return even(n - 1);\n}\n"
+                  "int even(int n) {\n    if (n == 0) return 1;\n    return odd(n - 1);\n}\n"
+                  "int main() {\n    int i = 0;\n    int s = 0;\n    while (i < 10) {\n"
+                  "        s = s + sq(i) + even(i);\n        i = i + 1;\n    }\n    return s;\n}\n", 3, ir)) {
+        expect("a small function is inlined and mutually recursive ones are not",
+               count(*ir.functions[3], IR_CALL) == 1 && count(*ir.functions[3], IR_MUL) == 1);
+    }
+    if (optimized("folding", "int main() {\n    int x = 6;\n    int y = x * 7;\n    if (y == 42) return y - 2;\n"
+                  "    while (x > 100) x = x - 1;\n    return 0;\n}\n", 0, ir)) {
+        const IrFunction& fn = *ir.functions[0];
+        expect("folding leaves one block returning a constant", fn.blockCount() == 1 && fn.size() == 2);
+    }
+    if (optimized("value numbering", "int f(int a, int b) {\n    int x = a * b;\n    if (a) x = x + b * a;\n"
+                  "    return x + a * b;\n}\nint main() {\n    return f(2, 3);\n}\n", 0, ir)) {
+        expect("value numbering leaves one multiplication", count(*ir.functions[0], IR_MUL) == 1);
+    }
+    if (optimized("dead code", "int f(int a) {\n    int unused = a * 3 + 1;\n    int i = 0;\n"
+                  "    while (i < a) {\n        unused = unused + i;\n        i = i + 1;\n    }\n    return a;\n}\n"
+                  "int main() {\n    return f(1);\n}\n", 0, ir)) {
+        const IrFunction& fn = *ir.functions[0];
+        expect("dead code leaves the loop and nothing of unused",
+               count(fn, IR_MUL) == 0 && count(fn, IR_PHI) == 1 && count(fn, IR_ADD) == 1);
+    }
+    if (optimized("trapping division", "int f(int a) {\n    int t = a / 0;\n    int u = a / 2;\n    return 1;\n}\n"
+                  "int main() {\n    return f(1);\n}\n", 0, ir)) {
+        expect("only the division that may trap is kept", count(*ir.functions[0], IR_DIV) == 1);
+    }
+    if (optimized("branch on not", "int f(int a) {\n    if (!a) return 1;\n    return 2;\n}\n"
+                  "int main() {\n    return f(1);\n}\n", 0, ir)) {
+        expect("a branch on a negation branches on its operand", count(*ir.functions[0], IR_NOT) == 0);
+    }
+
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        check("random#" + std::to_string(seed), randomProgram(seed));
+    }
+
+    printf("%d files run, 1000 random programs, %d failures\n", run, failures);
+    return failures == 0 ? 0 : 1;
+}
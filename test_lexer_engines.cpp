@@ -0,0 +1,50 @@
+#include "lexer.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Differential test: the table-driven engine must produce exactly the same
+// tokens (type, text, index and offset) as the classic engine.
+
+static int failures = 0;
+
+static void check(const string& name, const string& src) {
+    Lexer classic(src, LEX_CLASSIC);
+    Lexer table(src, LEX_TABLE);
+    vector<Token> expected = classic.getAllTokens();
+    vector<Token> actual = table.getAllTokens();
+    if (!sameTokens(expected, actual)) {
+        printf("FAIL %s: table engine differs from classic\n", name.c_str());
+        failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 2000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+    }
+    // Every single byte and every byte pair, including NUL and non-ASCII.
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            string s;
+            s += (char)a;
+            s += (char)b;
+            check("pair", s);
+        }
+    }
+
+    printf("%d files, 2000 random inputs, 65536 byte pairs, %d failures\n",
+           (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,326 @@
+#include "parser.h"
+#include "native.h"
+#include "vm.h"
+#include "test_util.h"
+#include <cstdio>
+#include <map>
+
+// Native code must give what the bytecode interpreter gives, error for
+// error, on every accepted test case, on programs that need more registers
+// than there are or more arguments than go in registers, and on random
+// programs; deep recursion must fail with a stack overflow, not a crash.
+
+static int failures = 0;
+
+static string interpreted(const BytecodeProgram& program) {
+    Vm vm;
+    int32_t result;
+    string err;
+    if (!vm.run(program, result, err)) {
+        return "error: " + err;
+    }
+    return std::to_string(result);
+}
+
+static string native(const BytecodeProgram& program, size_t stack = NativeCode::DEFAULT_STACK) {
+    NativeCompiler compiler;
+    NativeCode code;
+    code.setStackSize(stack);
+    int32_t result;
+    string err;
+    if (!compiler.compile(program, code, err) || !code.run(result, err)) {
+        return "error: " + err;
+    }
+    return std::to_string(result);
+}
+
+static bool lower(const string& name, const string& src, Parser& parser, Ast& tree, BytecodeProgram& program) {
+    parser.checkScopes();
+    parser.checkCalls();
+    if (!parser.parse(&tree)) {
+        printf("FAIL %s rejected\n", name.c_str());
+        failures++;
+        return false;
+    }
+    BytecodeCompiler compiler;
+    string err;
+    if (!compiler.compile(tree, parser.callGraph(), program, err)) {
+        printf("FAIL %s not lowered: %s\n", name.c_str(), err.c_str());
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+// Runs src both ways; expected is what it should give, or empty to take
+// the interpreter's word for it.
+static void check(const string& name, const string& src, const string& expected = "") {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    BytecodeProgram program;
+    if (!lower(name, src, parser, tree, program)) {
+        return;
+    }
+    string want = interpreted(program);
+    if (!expected.empty() && want != expected) {
+        printf("FAIL %s interpreted: got %s, expected %s\n", name.c_str(), want.c_str(), expected.c_str());
+        failures++;
+    }
+    string got = native(program);
+    if (got != want) {
+        printf("FAIL %s: got %s, expected %s\n", name.c_str(), got.c_str(), want.c_str());
+        dumpBytecode(program, parser.symbolTable(), std::cout);
+        NativeCompiler compiler;
+        string err;
+        compiler.writeAssembly(program, parser.symbolTable(), std::cout, err);
+        failures++;
+    }
+}
+
+// n parameters p0 .. p{n-1}, weighted so that a swapped or dropped
+// argument changes the result.
+static string weighted(const string& name, int n) {
+    string s = "int " + name + "(";
+    string sum = "0";
+    for (int i = 0; i < n; i++) {
+        s += (i > 0 ? ", int p" : "int p") + std::to_string(i);
+        sum = "(" + sum + ") * 3 + p" + std::to_string(i);
+    }
+    return s + ") {\n    return " + sum + ";\n}\n";
+}
+
+static bool callsAllowed;
+
+// An expression over the variables v0 .. v{vars - 1}, with division by
+// zero now and then.
+static string randomExpr(int vars, int depth) {
+    static const char* ops[] = { "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+    if (depth == 0 || rand() % 3 == 0) {
+        if (vars > 0 && rand() % 4 != 0) {
+            return "v" + std::to_string(rand() % vars);
+        }
+        return std::to_string(rand() % 7 == 0 ? 2147483647 : rand() % 10 - (rand() % 5 == 0 ? 11 : 0));
+    }
+    switch (rand() % 6) {
+    case 0:
+        return string(rand() % 2 ? "-" : "!") + "(" + randomExpr(vars, depth - 1) + ")";
+    case 1:
+        if (!callsAllowed) {
+            return randomExpr(vars, depth - 1);
+        }
+        if (rand() % 2) {
+            return "g(" + randomExpr(vars, depth - 1) + ")";
+        }
+        {
+            string call = "f(";
+            for (int i = 0; i < 8; i++) {
+                call += (i > 0 ? ", " : "") + randomExpr(vars, i == 0 ? depth - 1 : 0);
+            }
+            return call + ")";
+        }
+    default:
+        return "(" + randomExpr(vars, depth - 1) + " " + ops[rand() % 13] + " " + randomExpr(vars, depth - 1) + ")";
+    }
+}
+
+// Many variables live at once, assigned and tested inside bounded loops.
+static string randomBody(int& vars, int depth, int loops) {
+    string s;
+    int statements = 2 + rand() % 6;
+    for (int i = 0; i < statements; i++) {
+        switch (rand() % 8) {
+        case 0:
+        case 1:
+        case 2:
+            s += "int v" + std::to_string(vars) + " = " + randomExpr(vars, 3) + ";\n";
+            vars++;
+            break;
+        case 3:
+            if (vars > 0) {
+                s += "v" + std::to_string(rand() % vars) + " = " + randomExpr(vars, 3) + ";\n";
+            }
+            break;
+        case 4:
+            if (depth > 0) {
+                int inner = vars;
+                s += "if (" + randomExpr(vars, 2) + ") {\n" + randomBody(inner, depth - 1, loops) + "} else {\n";
+                inner = vars;
+                s += randomBody(inner, depth - 1, loops) + "}\n";
+            }
+            break;
+        case 5:
+            if (depth > 0) {
+                string counter = "i" + std::to_string(depth) + "_" + std::to_string(i);
+                string n = std::to_string(rand() % 5);
+                string tests[] = {
+                    counter + " < " + n, n + " > " + counter, counter + " != " + n, n + " - 1 >= " + counter,
+                };
+                int inner = vars;
+                s += "int " + counter + " = 0;\nwhile (" + tests[rand() % 4] + ") {\n" + counter + " = " + counter +
+                     " + 1;\n" + randomBody(inner, depth - 1, loops + 1) + "}\n";
+            }
+            break;
+        case 6:
+            if (loops > 0) {
+                s += string("if (") + randomExpr(vars, 1) + ") " + (rand() % 2 ? "break;\n" : "continue;\n");
+            }
+            break;
+        default:
+            s += "if (" + randomExpr(vars, 2) + ") return " + randomExpr(vars, 2) + ";\n";
+            break;
+        }
+    }
+    return s;
+}
+
+// f takes more arguments than go in registers; g calls f, so values live
+// across calls in both g and main.
+static string randomProgram(unsigned seed) {
+    srand(seed);
+    int vars = 8;
+    callsAllowed = false;
+    string s = "int f(int v0, int v1, int v2, int v3, int v4, int v5, int v6, int v7) {\n" +
+               randomBody(vars, 2, 0) + "return v0 - v7 + v5;\n}\n";
+    vars = 1;
+    callsAllowed = true;
+    s += "int g(int v0) {\n    if (v0 < 0) return v0;\n    int v1 = 5;\n    return v1 + f(v0, v1, 2, 3, v0 * v1, 5, 6, 7);\n}\n";
+    vars = 0;
+    s += "int main() {\n" + randomBody(vars, 3, 0) + "return " + randomExpr(vars, 2) + ";\n}\n";
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    if (!nativeSupported()) {
+        BytecodeProgram program;
+        NativeCompiler compiler;
+        NativeCode code;
+        string err;
+        if (compiler.compile(program, code, err)) {
+            printf("FAIL compiled natively on an unsupported platform\n");
+            return 1;
+        }
+        printf("native code not supported here: %s\n", err.c_str());
+        return 0;
+    }
+
+    int run = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        Parser parser(src.data(), src.size());
+        if (!parser.parse()) {
+            continue;
+        }
+        run++;
+        check(files[i], src);
+    }
+    // f19 is rejected for two typos; mended, it passes up to 64 arguments,
+    // most of them on the stack. A C compiler makes it exit with 16.
+    string many = readFile(dir + "/f19_many_arguments.c");
+    size_t at = many.find("sum16(,");
+    if (at != string::npos) {
+        many.replace(at, 7, "sum16(int a1,");
+    }
+    at = many.find("= (v1, 2");
+    if (at != string::npos) {
+        many.insert(at + 2, "sum8");
+    }
+    Parser mended(many.data(), many.size());
+    if (mended.parse()) {
+        check("f19_many_arguments.c mended", many);
+        Parser again(many.data(), many.size());
+        Ast tree;
+        BytecodeProgram program;
+        if (lower("f19 mended", many, again, tree, program) && (atoi(native(program).c_str()) & 0xFF) != 16) {
+            printf("FAIL f19 mended: exit code %d, expected 16\n", atoi(native(program).c_str()) & 0xFF);
+            failures++;
+        }
+    } else {
+        printf("FAIL f19_many_arguments.c does not parse when mended\n");
+        failures++;
+    }
+
+    check("wraparound", "int main() {\n    int x = 2147483647;\n    return x + 1 == -2147483647 - 1;\n}\n", "1");
+    check("INT_MIN / -1", "int main() {\n    int m = -2147483647 - 1;\n    int d = -1;\n"
+          "    return (m / d == m) + (m % d == 0) * 2 + (7 / d == -7) * 4 + (-7 % 2 == -1) * 8;\n}\n", "15");
+    check("division by zero", "int main() {\n    int z = 0;\n    return 1 / z;\n}\n", "error: Division by zero");
+    check("modulo by zero deep down", "int f(int n, int z) {\n    if (n == 0) return 5 % z;\n"
+          "    return f(n - 1, z) + 1;\n}\nint main() {\n    return f(1000, 0);\n}\n", "error: Division by zero");
+    check("short circuit", "int main() {\n    int z = 0;\n    return (z && 1 / z) + (1 || 1 / z);\n}\n", "1");
+    check("fall off the end", "int f() {\n    int x = 1;\n}\nint main() {\n    return f() + 7;\n}\n", "7");
+    check("subtract from itself", "int main() {\n    int x = 9;\n    int y = 4;\n    y = x - y;\n    x = y - x;\n"
+          "    x = x - x + x * x;\n    return x * 100 + y;\n}\n", "1605");
+    // Nothing passes main arguments; its parameters start at 0, as on the VM.
+    check("main with parameters", "int main(int a, int b) {\n    return a + b + 1;\n}\n", "1");
+    check("main with stacked parameters", "int main(int a, int b, int c, int d, int e, int f, int g, int h, int i) {\n"
+          "    return a + b + c + d + e + f + g + h + i + 2;\n}\n", "2");
+    check("arguments in order", weighted("f", 3) + "int main() {\n    return f(1, f(0, 0, 2), 3);\n}\n", "18");
+    check("seven arguments", weighted("f", 7) + "int main() {\n    return f(1, 2, 3, 4, 5, 6, 7);\n}\n", "1636");
+    check("eight arguments", weighted("f", 8) +
+          "int main() {\n    int x = 8;\n    return f(1, 2, 3, 4, 5, 6, 7, x) - f(0, 0, 0, 0, 0, 0, 0, 1);\n}\n",
+          "4915");
+    check("arguments that are calls", weighted("f", 9) + weighted("g", 2) +
+          "int main() {\n    return f(g(1, 2), 1, g(3, 4), 1, 1, 1, g(5, 6), 1, g(7, 8));\n}\n");
+
+    // More values live across calls than there are preserved registers.
+    string pressure = "int id(int x) {\n    return x;\n}\nint main() {\n";
+    string sum = "0";
+    for (int i = 0; i < 24; i++) {
+        pressure += "    int v" + std::to_string(i) + " = id(" + std::to_string(i * 7 + 1) + ");\n";
+        sum = "(" + sum + ") * 3 + v" + std::to_string(i);
+    }
+    check("register pressure", pressure + "    return " + sum + ";\n}\n");
+    check("loop-carried spills", "int main() {\n    int a = 1;\n    int b = 2;\n    int c = 3;\n    int d = 4;\n"
+          "    int e = 5;\n    int f = 6;\n    int g = 7;\n    int h = 8;\n    int i = 0;\n    while (i < 50) {\n"
+          "        int t = a;\n        a = b;\n        b = c;\n        c = d;\n        d = e;\n        e = f;\n"
+          "        f = g;\n        g = h;\n        h = t + i;\n        i = i + 1;\n    }\n"
+          "    return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;\n}\n");
+
+    // Deep recursion runs on a stack of its own, and past its end fails.
+    string deep = "int down(int n) {\n    if (n == 0) return 0;\n    return down(n - 1) + 1;\n}\n"
+                  "int main() {\n    return down(1000000);\n}\n";
+    Parser parser(deep.data(), deep.size());
+    Ast tree;
+    BytecodeProgram program;
+    if (lower("deep", deep, parser, tree, program)) {
+        if (native(program) != "1000000") {
+            printf("FAIL deep recursion: %s\n", native(program).c_str());
+            failures++;
+        }
+        if (native(program, 1 << 20) != "error: Stack overflow") {
+            printf("FAIL deep recursion past the stack limit\n");
+            failures++;
+        }
+        // The code survives a failed run.
+        NativeCompiler compiler;
+        NativeCode code;
+        string err;
+        int32_t result = 0;
+        code.setStackSize(1 << 16);
+        bool ok = compiler.compile(program, code, err) && !code.run(result, err);
+        code.setStackSize(NativeCode::DEFAULT_STACK);
+        if (!ok || !code.run(result, err) || result != 1000000) {
+            printf("FAIL rerun after a stack overflow: %s\n", err.c_str());
+            failures++;
+        }
+        stringstream assembly;
+        if (!compiler.writeAssembly(program, parser.symbolTable(), assembly, err) ||
+            assembly.str().find("toyc_down:") == string::npos || assembly.str().find("toyc_run:") == string::npos ||
+            assembly.str().find("\tcall\ttoyc_down\n") == string::npos) {
+            printf("FAIL assembly:\n%s\n", assembly.str().c_str());
+            failures++;
+        }
+    }
+
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        check("random#" + std::to_string(seed), randomProgram(seed));
+    }
+
+    printf("%d files run, 1000 random programs, %d failures\n", run, failures);
+    return failures == 0 ? 0 : 1;
+}
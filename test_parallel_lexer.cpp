@@ -0,0 +1,47 @@
+#include "parallel_lexer.h"
+#include "test_util.h"
+#include <cstdio>
+
+// The parallel lexer must return exactly Lexer::getAllTokens(). Tiny chunk
+// sizes put a chunk boundary after nearly every line, including inside
+// block comments.
+
+static int failures = 0;
+
+static void check(ThreadPool& pool, const string& name, const string& src) {
+    static const size_t chunkSizes[] = { 1, 2, 7, 64, 1000, 0 };
+    LexerEngine engines[] = { LEX_CLASSIC, LEX_TABLE };
+    for (int e = 0; e < 2; e++) {
+        Lexer lexer(src.data(), src.size(), engines[e]);
+        vector<Token> expected = lexer.getAllTokens();
+        for (size_t c = 0; c < sizeof(chunkSizes) / sizeof(chunkSizes[0]); c++) {
+            vector<Token> actual = lexParallel(src.data(), src.size(), pool, chunkSizes[c], engines[e]);
+            if (!sameTokens(expected, actual)) {
+                printf("FAIL %s: chunk size %d, engine %d\n", name.c_str(), (int)chunkSizes[c], e);
+                failures++;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    ThreadPool pool(4);
+    for (size_t i = 0; i < files.size(); i++) {
+        check(pool, files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(pool, name.str(), randomSource(seed));
+    }
+    check(pool, "empty", "");
+    check(pool, "unterminated", "int x; /* never closed\n\n int y;\n");
+    printf("%d files, 1000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "parser.h"
+#include "thread_pool.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Parsing function definitions on several threads must give exactly the
+// sequential result: the same diagnostics, the same tree and the same
+// symbol ids, whatever the size of the pieces and wherever errors are.
+
+static int failures = 0;
+
+struct Setup {
+    size_t pieceTokens;     // 0: sequential
+    size_t maxErrors;
+    bool failFast;
+    size_t maxDepth;
+};
+
+static string parseOutput(const TokenBuffer& tokens, ThreadPool& pool, const Setup& setup, bool build) {
+    Parser parser(tokens);
+    if (setup.pieceTokens != 0) {
+        parser.useThreads(pool, setup.pieceTokens);
+    }
+    parser.setMaxErrors(setup.maxErrors);
+    if (setup.failFast) {
+        parser.failFast();
+    }
+    if (setup.maxDepth != 0) {
+        parser.useExplicitStack(setup.maxDepth);
+    }
+    Ast tree;
+    stringstream out;
+    streambuf* saved = cout.rdbuf(out.rdbuf());
+    bool ok = parser.parse(build ? &tree : NULL);
+    parser.printErrors(true);
+    cout.rdbuf(saved);
+    if (ok && build) {
+        dumpAst(tree, parser.symbolTable(), out);
+        // Node and symbol numbering too, not just the shape.
+        out << "\n" << tree.functions << " " << tree.nodeCount();
+        SymbolTable& symbols = parser.symbolTable();
+        for (uint32_t id = 0; id < symbols.size(); id++) {
+            size_t size;
+            const char* text = symbols.text(id, size);
+            out << " " << string(text, size);
+        }
+    }
+    return out.str();
+}
+
+static void check(const string& name, ThreadPool& pool, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    TokenBuffer tokens;
+    tokens.lex(src.data(), src.size());
+    static const size_t pieceSizes[] = { 1, 7, 40 };
+    static const Setup limits[] = {
+        { 0, 0, false, 0 }, { 0, 2, false, 0 }, { 0, 0, true, 0 }, { 0, 0, false, 20 },
+    };
+    for (int build = 0; build < 2; build++) {
+        for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+            Setup setup = limits[l];
+            string expected = parseOutput(tokens, pool, setup, build);
+            for (size_t p = 0; p < sizeof(pieceSizes) / sizeof(pieceSizes[0]); p++) {
+                setup.pieceTokens = pieceSizes[p];
+                if (parseOutput(tokens, pool, setup, build) != expected) {
+                    printf("FAIL %s: %d-token pieces differ (limits #%d%s)\n", name.c_str(),
+                           (int)setup.pieceTokens, (int)l, build ? ", building a tree" : "");
+                    failures++;
+                }
+            }
+        }
+    }
+}
+
+// Several functions, each possibly damaged, named from a small set so that
+// duplicates and a missing main come up.
+static string randomFunctions(unsigned seed) {
+    static const char* names[] = { "main", "f", "g", "h" };
+    static const char* statements[] = {
+        "int x = 1;", "x = f(x, 2) + 3;", "if (x < 2) { return 1; } else { x = 0; }",
+        "while (x) { x = x - 1; break; }", "{ { ; } }", "return x * (x + 1);", "g();",
+    };
+    static const char* damage[] = { "{", "}", "(", ";", "int", "void f()", "x = ;", "}}" };
+    srand(seed);
+    string s;
+    int functions = 1 + rand() % 8;
+    for (int i = 0; i < functions; i++) {
+        s += rand() % 4 ? "int " : "void ";
+        s += names[rand() % 4];
+        s += "(int x) {\n";
+        int n = rand() % 5;
+        for (int j = 0; j < n; j++) {
+            s += "    ";
+            s += rand() % 12 ? statements[rand() % 7] : damage[rand() % 8];
+            s += "\n";
+        }
+        s += "}\n";
+    }
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    ThreadPool pool(4);
+    string all;
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        check(files[i], pool, src);
+        all += src + "\n";
+    }
+    // Every file at once: many functions, duplicate names, several mains.
+    check("all files", pool, all);
+    for (unsigned seed = 0; seed < 500; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), pool, randomFunctions(seed));
+        check(name.str() + " (source)", pool, randomSource(seed));
+    }
+
+    printf("%d files, 1000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+
+// The explicit-stack parser must report exactly what the recursive one does
+// and build the same tree, and must turn nesting far deeper than the native
+// stack allows into either an accept or a "too deep" reject, never a crash.
+
+static int failures = 0;
+
+static string parseOutput(const string& src, size_t maxDepth, bool build) {
+    Parser parser(src.data(), src.size());
+    if (maxDepth != 0) {
+        parser.useExplicitStack(maxDepth);
+    }
+    Ast tree;
+    stringstream out;
+    streambuf* saved = cout.rdbuf(out.rdbuf());
+    bool ok = parser.parse(build ? &tree : NULL);
+    parser.printErrors(true);
+    cout.rdbuf(saved);
+    if (ok && build) {
+        dumpAst(tree, parser.symbolTable(), out);
+    }
+    return out.str();
+}
+
+static void check(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    for (int build = 0; build < 2; build++) {
+        if (parseOutput(src, Parser::DEFAULT_MAX_DEPTH, build) != parseOutput(src, 0, build)) {
+            printf("FAIL %s: parsers differ%s\n", name.c_str(), build ? " building a tree" : "");
+            failures++;
+        }
+    }
+}
+
+// Random statements and expressions from grammar fragments, well-formed or
+// not, to reach every step of the machine and its error paths.
+static string randomProgram(unsigned seed) {
+    static const char* pieces[] = {
+        "a", "b", "1", "(", ")", "+", "-", "*", "%", "<", "==", "&&", "||", "!",
+        "f(", "f(a,", ",", ";", "\n", "{", "}", "x =", "int", "int y", "= 2",
+        "if (", "while (", "else", "break;", "continue;", "return", "void g()",
+        "int main() {",
+    };
+    srand(seed);
+    string s = rand() % 5 ? "int f(int a) { return a; }\nint main() {\n" : "";
+    int n = rand() % 60;
+    for (int i = 0; i < n; i++) {
+        s += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+        s += ' ';
+    }
+    return s + "\n}\n";
+}
+
+static string repeat(const string& s, int n) {
+    string out;
+    for (int i = 0; i < n; i++) {
+        out += s;
+    }
+    return out;
+}
+
+// Deep nesting parses, tree and all, under the default limit, the tree
+// can be written out, and it is rejected on its first line past a small
+// limit.
+static void checkDeep(const string& name, const string& src) {
+    Parser parser(src.data(), src.size());
+    parser.useExplicitStack();
+    Ast tree;
+    if (!parser.parse(&tree)) {
+        printf("FAIL %s: not accepted\n", name.c_str());
+        failures++;
+    } else {
+        stringstream out;
+        dumpAst(tree, parser.symbolTable(), out);
+        string dump = out.str();
+        if (dump.compare(0, 15, "(func int main ") != 0 ||
+            std::count(dump.begin(), dump.end(), '(') != std::count(dump.begin(), dump.end(), ')')) {
+            printf("FAIL %s: tree written as %.60s...\n", name.c_str(), dump.c_str());
+            failures++;
+        }
+    }
+    string limited = parseOutput(src, 1000, false);
+    if (limited.compare(0, 9, "reject\n2:") != 0 || limited.find('\n', 9) + 1 != limited.size()) {
+        printf("FAIL %s: limited to 1000 frames gives %s\n", name.c_str(), limited.c_str());
+        failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        check(files[i], src);
+        // However small the limit, a parse ends in a verdict.
+        for (size_t depth = 1; depth <= 16; depth++) {
+            string out = parseOutput(src, depth, true);
+            if (out != parseOutput(src, 0, true) && out.compare(0, 7, "reject\n") != 0) {
+                printf("FAIL %s: limited to %d frames\n", files[i].c_str(), (int)depth);
+                failures++;
+            }
+        }
+    }
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+        check(name.str() + " (program)", randomProgram(seed));
+    }
+
+    const int n = 200000;
+    checkDeep("parentheses", "int main() {\n    return " + repeat("(", n) + "1" + repeat(")", n) + ";\n}\n");
+    checkDeep("blocks", "int main() {\n" + repeat("{", n) + "\n" + repeat("}", n) + "\n}\n");
+    checkDeep("sums in parentheses", "int main() {\n    return " + repeat("(", n) + "1" + repeat(" + 1)", n) + ";\n}\n");
+    checkDeep("unary", "int main() {\n    return " + repeat("-", n) + "1;\n}\n");
+    checkDeep("if", "int main() {\n" + repeat("if (1) ", n) + ";\n}\n");
+    checkDeep("calls", "int main() {\n    return " + repeat("f(", n) + repeat(")", n) + ";\n}\n");
+
+    printf("%d files, 2000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
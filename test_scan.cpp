@@ -0,0 +1,49 @@
+#include "lexer.h"
+#include "scan.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Lexes every functional test case and a batch of random inputs with each
+// scan kernel the CPU supports and checks the token streams are identical.
+
+static int failures = 0;
+
+static void check(const string& name, const string& src) {
+    ScanKernel saved = scanKernel();
+    setScanKernel(SCAN_SCALAR);
+    Lexer scalar(src);
+    vector<Token> expected = scalar.getAllTokens();
+    ScanKernel kernels[] = { SCAN_SSE2, SCAN_AVX2 };
+    for (int i = 0; i < 2; i++) {
+        if (!setScanKernel(kernels[i])) {
+            continue;
+        }
+        Lexer lexer(src);
+        if (!sameTokens(expected, lexer.getAllTokens())) {
+            printf("FAIL %s: %s differs from scalar\n", name.c_str(), scanKernelName(kernels[i]));
+            failures++;
+        }
+    }
+    setScanKernel(saved);
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 2000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+    }
+
+    printf("%d files, 2000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
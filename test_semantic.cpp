@@ -0,0 +1,348 @@
+#include "parser.h"
+#include "thread_pool.h"
+#include "test_util.h"
+#include <cstdio>
+#include <map>
+
+// The scope check must find exactly the undeclared and redeclared
+// variables, the variables used in their own initializers, and the break
+// and continue outside loops, a plain stack of maps finds, report them like syntax errors
+// under every limit and parser, and cope with nesting of any depth.
+
+static int failures = 0;
+
+// The obvious implementation: one map per open scope from a name to the
+// node that declares it, searched innermost first. Returns the offsets of the errors in source order.
+class Reference {
+private:
+    Ast& ast;
+    std::vector<std::map<uint32_t, uint32_t> > scopes;
+    int loops;
+    uint32_t initializing;
+
+    // The node that declares a visible name, or AST_NONE.
+    uint32_t declaration(uint32_t sym) {
+        for (size_t i = scopes.size(); i > 0; i--) {
+            if (scopes[i - 1].count(sym)) {
+                return scopes[i - 1][sym];
+            }
+        }
+        return AST_NONE;
+    }
+    void declare(uint32_t id) {
+        const AstNode& n = ast.node(id);
+        if (scopes.back().count(n.a)) {
+            errors.push_back(n.offset);
+        } else {
+            scopes.back()[n.a] = id;
+        }
+    }
+    void list(uint32_t first) {
+        for (uint32_t id = first; id != AST_NONE; id = ast.node(id).next) {
+            walk(id);
+        }
+    }
+    void scoped(uint32_t id) {
+        scopes.push_back(std::map<uint32_t, uint32_t>());
+        walk(id);
+        scopes.pop_back();
+    }
+    void walk(uint32_t id) {
+        if (id == AST_NONE) {
+            return;
+        }
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK:
+            scopes.push_back(std::map<uint32_t, uint32_t>());
+            list(n.a);
+            scopes.pop_back();
+            break;
+        case AST_DECL:
+            list(n.a);
+            break;
+        case AST_VAR:
+            declare(id);
+            initializing = id;
+            walk(n.b);
+            initializing = AST_NONE;
+            break;
+        case AST_ASSIGN:
+        case AST_NAME:
+            if (declaration(n.a) == AST_NONE) {
+                errors.push_back(n.offset);
+            } else if (Ast::kind(id) == AST_NAME && declaration(n.a) == initializing) {
+                errors.push_back(n.offset);
+            }
+            if (Ast::kind(id) == AST_ASSIGN) {
+                walk(n.b);
+            }
+            break;
+        case AST_CALL:
+            list(n.b);
+            break;
+        case AST_IF:
+            walk(n.a);
+            scoped(n.b);
+            scoped(n.c);
+            break;
+        case AST_WHILE:
+            walk(n.a);
+            loops++;
+            scoped(n.b);
+            loops--;
+            break;
+        case AST_BREAK:
+        case AST_CONTINUE:
+            if (loops == 0) {
+                errors.push_back(n.offset);
+            }
+            break;
+        case AST_NUMBER:
+            break;
+        default:
+            walk(n.a);
+            walk(n.b);
+            walk(n.c);
+            break;
+        }
+    }
+
+public:
+    std::vector<uint64_t> errors;
+
+    explicit Reference(Ast& tree) : ast(tree), loops(0), initializing(AST_NONE) {
+        for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+            const AstNode& func = ast.node(f);
+            scopes.push_back(std::map<uint32_t, uint32_t>());
+            for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+                declare(p);
+            }
+            if (func.c != AST_NONE) {
+                list(ast.node(func.c).a);
+            }
+            scopes.pop_back();
+        }
+    }
+};
+
+// What the parser should print with no limits: the reference's errors,
+// one per line.
+static string expectedOutput(const string& src) {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    if (!parser.parse(&tree)) {
+        stringstream out;
+        parser.printErrors(true, out);
+        return out.str();
+    }
+    Reference ref(tree);
+    if (ref.errors.empty()) {
+        return "accept\n";
+    }
+    stringstream out;
+    out << "reject\n";
+    int64_t lastLine = 0;
+    for (size_t i = 0; i < ref.errors.size(); i++) {
+        uint64_t offset = ref.errors[i];
+        int64_t line = 1 + std::count(src.begin(), src.begin() + offset, '\n');
+        size_t lineStart = offset == 0 ? string::npos : src.rfind('\n', offset - 1);
+        lineStart = lineStart == string::npos ? 0 : lineStart + 1;
+        if (line != lastLine) {
+            out << line << ":" << offset - lineStart + 1 << "\n";
+        }
+        lastLine = line;
+    }
+    return out.str();
+}
+
+struct Setup {
+    int parser;     // 0: recursive, 1: explicit stack, 2: token buffer on threads
+    size_t maxErrors;
+    bool failFast;
+};
+
+static string checkedOutput(const string& src, const Setup& setup, ThreadPool& pool) {
+    TokenBuffer tokens;
+    tokens.lex(src.data(), src.size());
+    Parser inPlace(src.data(), src.size());
+    Parser buffered(tokens);
+    Parser& parser = setup.parser == 2 ? buffered : inPlace;
+    if (setup.parser == 1) {
+        parser.useExplicitStack();
+    } else if (setup.parser == 2) {
+        parser.useThreads(pool, 5);
+    }
+    parser.setMaxErrors(setup.maxErrors);
+    if (setup.failFast) {
+        parser.failFast();
+    }
+    parser.checkScopes();
+    parser.parse();
+    stringstream out;
+    parser.printErrors(true, out);
+    return out.str();
+}
+
+// The first lines of the output a parse without limits gives.
+static string limited(const string& full, const Setup& setup) {
+    if (full == "accept\n" || setup.failFast) {
+        return full.substr(0, full.find('\n') + 1);
+    }
+    if (setup.maxErrors == 0) {
+        return full;
+    }
+    size_t end = 0;
+    for (size_t i = 0; i <= setup.maxErrors && end != string::npos; i++) {
+        end = full.find('\n', end + (i > 0));
+    }
+    return end == string::npos ? full : full.substr(0, end + 1);
+}
+
+static void check(const string& name, string src, ThreadPool& pool) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    string expected = expectedOutput(src);
+    static const Setup setups[] = {
+        { 0, 0, false }, { 1, 0, false }, { 2, 0, false }, { 0, 2, false }, { 0, 0, true }, { 2, 1, false },
+    };
+    for (size_t s = 0; s < sizeof(setups) / sizeof(setups[0]); s++) {
+        string got = checkedOutput(src, setups[s], pool);
+        if (got != limited(expected, setups[s])) {
+            printf("FAIL %s (setup #%d): got\n%sexpected\n%s", name.c_str(), (int)s, got.c_str(),
+                   limited(expected, setups[s]).c_str());
+            failures++;
+        }
+    }
+}
+
+// Checks the output of one small program against what it should be.
+static void expect(const string& src, const string& expected, ThreadPool& pool) {
+    Setup setup = { 0, 0, false };
+    string got = checkedOutput(src, setup, pool);
+    if (got != expected) {
+        printf("FAIL %sgot\n%sexpected\n%s", src.c_str(), got.c_str(), expected.c_str());
+        failures++;
+    }
+    check(src, src, pool);
+}
+
+// Functions of nested statements over a few names, declared or not.
+static string randomProgram(unsigned seed) {
+    static const char* names[] = { "a", "b", "c", "d" };
+    srand(seed);
+    string s;
+    int functions = 1 + rand() % 3;
+    for (int f = 0; f < functions; f++) {
+        s += f == functions - 1 ? "int main(" : (f == 0 ? "int f(" : "int g(");
+        int params = f == functions - 1 ? 0 : rand() % 3;
+        for (int p = 0; p < params; p++) {
+            s += p > 0 ? ", int " : "int ";
+            s += names[rand() % 4];
+        }
+        s += ") {\n";
+        int depth = 1;
+        int statements = rand() % 30;
+        for (int i = 0; i < statements; i++) {
+            string name = names[rand() % 4];
+            string other = names[rand() % 4];
+            switch (rand() % 8) {
+            case 0:
+            case 1:
+                s += "int " + name + (rand() % 2 ? " = " + other + " + 1" : "") + ";\n";
+                break;
+            case 2:
+                s += name + " = " + other + " * 2;\n";
+                break;
+            case 3:
+                s += "{\n";
+                depth++;
+                break;
+            case 4:
+                if (depth > 1) {
+                    s += "}\n";
+                    depth--;
+                }
+                break;
+            case 5:
+                s += "if (" + name + " < 3) " + other + " = 1; else { int " + other + " = " + name + "; }\n";
+                break;
+            case 6:
+                s += "while (" + name + ") { " + other + " = f(" + name + ", " + other + "); break; }\n";
+                if (rand() % 4 == 0) {
+                    s += rand() % 2 ? "break;\n" : "continue;\n";
+                }
+                break;
+            default:
+                s += "return " + name + ";\n";
+                break;
+            }
+        }
+        for (; depth > 0; depth--) {
+            s += "}\n";
+        }
+    }
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    ThreadPool pool(4);
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]), pool);
+    }
+    string shadow = readFile(dir + "/f07_scope_shadow.c");
+    expect(shadow, "accept\n", pool);
+
+    expect("int main() {\n    return x;\n}\n", "reject\n2:12\n", pool);
+    expect("int main() {\n    x = 1;\n    int x;\n    return x;\n}\n", "reject\n2:5\n", pool);
+    expect("int main() {\n    int x = 1;\n    int y, x;\n    return 0;\n}\n", "reject\n3:12\n", pool);
+    // A variable is in scope in its own initializer, but may not be read there.
+    expect("int main() {\n    int x = 1;\n    { int x = x + 1; }\n    return x;\n}\n", "reject\n3:15\n", pool);
+    expect("int main() {\n    int x = 1, y = x;\n    int z = f(z, y);\n    return z;\n}\n", "reject\n3:15\n", pool);
+    expect("int main() {\n    { int y = 1; }\n    return y;\n}\n", "reject\n3:12\n", pool);
+    expect("int main() {\n    { int y = 1; }\n    { int y = 2; }\n    return 0;\n}\n", "accept\n", pool);
+    expect("int f(int a, int a) {\n    return a;\n}\nint main() {\n    return f(1, 2);\n}\n",
+           "reject\n1:18\n", pool);
+    expect("int f(int a) {\n    int a = 2;\n    return a;\n}\nint main() {\n    return f(1);\n}\n",
+           "reject\n2:9\n", pool);
+    expect("int main() {\n    while (n) { n = n - 1; }\n    if (m) return k; else return 0;\n}\n",
+           "reject\n2:12\n3:9\n", pool);
+    // The body of an if or while is a scope even without braces.
+    expect("int main() {\n    if (0) int x = 5;\n    return x;\n}\n", "reject\n3:12\n", pool);
+    expect("int main() {\n    int x = 1;\n    if (x) int x = 2; else int x = 3;\n    while (0) int x;\n"
+           "    return x;\n}\n", "accept\n", pool);
+    expect("int main() {\n    int x = 1;\n    if (x) break;\n    while (x) {\n        if (x) continue;\n"
+           "        x = 0;\n    }\n    continue;\n}\n", "reject\n3:12\n8:5\n", pool);
+    // Variables are not functions: calling an undeclared name is fine here.
+    expect("int main() {\n    int f = 1;\n    return g(f);\n}\n", "accept\n", pool);
+
+    for (unsigned seed = 0; seed < 500; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomProgram(seed), pool);
+    }
+
+    // Nesting far deeper than a recursive walk could take.
+    size_t depth = 200000;
+    string deep = "int main() {\n    int x = 1;\n" + string(depth, '{') + "x = y;" + string(depth, '}') + "\n}\n";
+    Parser parser(deep.data(), deep.size());
+    parser.useExplicitStack(4 * depth);
+    parser.checkScopes();
+    stringstream out;
+    parser.parse();
+    parser.printErrors(true, out);
+    if (out.str() != "reject\n3:" + std::to_string(depth + 5) + "\n") {
+        printf("FAIL %zu nested blocks: %s", depth, out.str().c_str());
+        failures++;
+    }
+
+    printf("%d files, 500 random programs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+#include "parser.h"
+#include "server.h"
+#include "test_util.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The server's answer to a request must be what the parser prints for the
+// source, however the request is split across writes, however many are
+// sent before the first answer is read and however many clients there are.
+
+static std::atomic<int> failures(0);
+
+static string expectedAnswer(string src, bool columns) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    Parser parser(src.data(), src.size());
+    stringstream out;
+    parser.parse();
+    parser.printErrors(columns, out);
+    return out.str();
+}
+
+static string frame(const string& src) {
+    string f;
+    for (int i = 0; i < 4; i++) {
+        f += (char)(src.size() >> (8 * i));
+    }
+    return f + src;
+}
+
+static void checkAnswer(const string& what, int fd, const string& src) {
+    string answer;
+    if (!receiveFrame(fd, answer)) {
+        printf("FAIL %s: no answer\n", what.c_str());
+        failures++;
+    } else if (answer != expectedAnswer(src, true)) {
+        printf("FAIL %s: answer differs\n", what.c_str());
+        failures++;
+    }
+}
+
+// CPU time of the whole process, server threads included.
+static double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static bool writeAll(int fd, const string& data) {
+    for (size_t done = 0; done < data.size();) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> names;
+    if (!listTestCases(dir, names)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    vector<string> sources;
+    for (size_t i = 0; i < names.size(); i++) {
+        sources.push_back(readFile(dir + "/" + names[i]));
+    }
+    for (unsigned seed = 0; seed < 200; seed++) {
+        sources.push_back(randomSource(seed));
+    }
+    sources.push_back("");
+
+    ServerOptions opt;
+    opt.threads = 3;
+    opt.columns = true;
+    opt.maxRequest = 1 << 20;
+    ParseServer server(opt);
+    char socketPath[64];
+    snprintf(socketPath, sizeof(socketPath), "/tmp/toyc_test_server.%d", (int)getpid());
+    string err;
+    if (!server.listen(socketPath, err)) {
+        printf("cannot listen: %s\n", err.c_str());
+        return 1;
+    }
+    std::thread serving(&ParseServer::serve, &server);
+
+    // One request at a time.
+    int fd = connectServer(socketPath, err);
+    for (size_t i = 0; i < sources.size() && fd >= 0; i++) {
+        sendFrame(fd, sources[i].data(), sources[i].size());
+        checkAnswer("request " + std::to_string(i), fd, sources[i]);
+    }
+
+    // Everything at once, then the answers in order. Writing and reading
+    // on separate threads, since neither side may take all of it unread.
+    string all;
+    for (size_t i = 0; i < sources.size(); i++) {
+        all += frame(sources[i]);
+    }
+    std::thread writer([&]() { writeAll(fd, all); });
+    for (size_t i = 0; i < sources.size(); i++) {
+        checkAnswer("pipelined request " + std::to_string(i), fd, sources[i]);
+    }
+    writer.join();
+
+    // A byte at a time.
+    string split = frame(sources[0]);
+    for (size_t i = 0; i < split.size(); i++) {
+        writeAll(fd, split.substr(i, 1));
+    }
+    checkAnswer("request in single bytes", fd, sources[0]);
+    close(fd);
+
+    // Many clients at once.
+    vector<std::thread> clients;
+    for (int c = 0; c < 8; c++) {
+        clients.push_back(std::thread([&, c]() {
+            string e;
+            int cfd = connectServer(socketPath, e);
+            for (size_t i = c; i < sources.size(); i += 3) {
+                sendFrame(cfd, sources[i].data(), sources[i].size());
+                checkAnswer("client " + std::to_string(c), cfd, sources[i]);
+            }
+            close(cfd);
+        }));
+    }
+    for (size_t c = 0; c < clients.size(); c++) {
+        clients[c].join();
+    }
+
+    // A request over the limit ends its connection, not the server.
+    fd = connectServer(socketPath, err);
+    writeAll(fd, string("\xff\xff\xff\x7f", 4));
+    string answer;
+    if (receiveFrame(fd, answer)) {
+        printf("FAIL oversized request was answered\n");
+        failures++;
+    }
+    close(fd);
+    fd = connectServer(socketPath, err);
+    sendFrame(fd, sources[0].data(), sources[0].size());
+    checkAnswer("request after an oversized one", fd, sources[0]);
+
+    // A client that stops sending while its answers are still queued, and
+    // reads them only later, leaves the server idle meanwhile.
+    string errors;
+    for (int i = 0; i < 20000; i++) {
+        errors += "int 1;\n";
+    }
+    int halfClosed = connectServer(socketPath, err);
+    for (int i = 0; i < 8; i++) {
+        sendFrame(halfClosed, errors.data(), errors.size());
+    }
+    shutdown(halfClosed, SHUT_WR);
+    usleep(200000);
+    double before = cpuSeconds();
+    usleep(500000);
+    double spent = cpuSeconds() - before;
+    if (spent > 0.25) {
+        printf("FAIL server took %.2f s of CPU waiting on a half-closed client\n", spent);
+        failures++;
+    }
+    for (int i = 0; i < 8; i++) {
+        checkAnswer("answer to a half-closed client", halfClosed, errors);
+    }
+    close(halfClosed);
+
+    // A client that keeps sending but reads slowly is held back once its
+    // answers pile up, rather than buffered without bound.
+    int greedy = connectServer(socketPath, err);
+    std::atomic<bool> sending(true);
+    std::atomic<size_t> sent(0);
+    string request = frame(errors);
+    std::thread flood([&]() {
+        while (sending) {
+            ssize_t n = send(greedy, request.data(), request.size(), MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += (size_t)n;
+        }
+    });
+    size_t received = 0;
+    char chunk[16384];
+    for (int i = 0; i < 1000; i++) {
+        ssize_t n = recv(greedy, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            break;
+        }
+        received += (size_t)n;
+        usleep(1000);
+    }
+    size_t held = sent - received;
+    sending = false;
+    shutdown(greedy, SHUT_RDWR);
+    flood.join();
+    close(greedy);
+    if (held > (8u << 20)) {
+        printf("FAIL server took %zu bytes more than it answered from a slow reader\n", held);
+        failures++;
+    }
+
+    server.stop();
+    serving.join();
+    close(fd);
+
+    // The same protocol over a pipe.
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    fwrite(all.data(), 1, all.size(), in);
+    fflush(in);
+    rewind(in);
+    if (!serveStream(fileno(in), fileno(out), opt)) {
+        printf("FAIL stream service\n");
+        failures++;
+    }
+    fflush(out);
+    string expected;
+    for (size_t i = 0; i < sources.size(); i++) {
+        expected += frame(expectedAnswer(sources[i], true));
+    }
+    rewind(out);
+    string got;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), out)) > 0) {
+        got.append(buf, n);
+    }
+    if (got != expected) {
+        printf("FAIL stream answers differ\n");
+        failures++;
+    }
+    fclose(in);
+    fclose(out);
+
+    printf("%d requests, %d failures\n", (int)sources.size(), (int)failures);
+    return failures == 0 ? 0 : 1;
+}
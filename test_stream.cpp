@@ -0,0 +1,170 @@
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+#include <sys/resource.h>
+
+// Streaming lexer tests.
+//
+// 1. Lexing through windows of many small sizes gives exactly the tokens
+//    of the in-memory lexer, so tokens and comments that straddle a refill
+//    are handled, and every token is located at the same line and column
+//    as in memory (and as a plain count of the source bytes says).
+// 2. A synthetic program of several gigabytes (1 by default, pass the
+//    size as the second argument, e.g. 10) is parsed under an address
+//    space limit far below its size, and peak RSS stays flat.
+
+static int failures = 0;
+
+static void naiveLocate(const string& src, uint64_t offset, int64_t& line, int64_t& column) {
+    line = 1;
+    column = 1;
+    for (uint64_t i = 0; i < offset; i++) {
+        if (src[i] == '\n') {
+            line++;
+            column = 1;
+        } else {
+            column++;
+        }
+    }
+}
+
+static void checkWindows(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    static const size_t windows[] = { 1, 2, 3, 5, 8, 16, 17, 31, 64, 1000 };
+    LexerEngine engines[] = { LEX_CLASSIC, LEX_TABLE };
+    for (int e = 0; e < 2; e++) {
+        Lexer whole(src, engines[e]);
+        vector<Token> expected = whole.getAllTokens();
+        vector<int64_t> lines, columns;
+        for (size_t i = 0; i < expected.size(); i++) {
+            int64_t line, column, naiveLine, naiveColumn;
+            whole.locate(expected[i].offset, line, column);
+            naiveLocate(src, expected[i].offset, naiveLine, naiveColumn);
+            if (line != naiveLine || column != naiveColumn) {
+                printf("FAIL %s: token %d at %d:%d, expected %d:%d\n", name.c_str(), (int)i,
+                       (int)line, (int)column, (int)naiveLine, (int)naiveColumn);
+                failures++;
+            }
+            lines.push_back(line);
+            columns.push_back(column);
+        }
+        for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+            istringstream in(src);
+            Lexer streamed(in, windows[w], engines[e]);
+            vector<Token> tokens;
+            bool located = true;
+            Token t;
+            do {
+                t = streamed.nextToken();
+                int64_t line, column;
+                streamed.locate(t.offset, line, column);
+                size_t i = tokens.size();
+                if (i >= lines.size() || line != lines[i] || column != columns[i]) {
+                    located = false;
+                }
+                t.value = streamed.own(t.value);
+                tokens.push_back(t);
+            } while (t.type != END_OF_FILE);
+            if (!sameTokens(expected, tokens) || !located) {
+                printf("FAIL %s: window %d, engine %d\n", name.c_str(), (int)windows[w], e);
+                failures++;
+            }
+        }
+    }
+}
+
+// Produces "int main() {", then the same block over and over, then the
+// closing "return 0; }", without ever holding more than one block.
+class ProgramBuf : public streambuf {
+private:
+    string head, block, tail;
+    unsigned long long blocksLeft;
+    int phase;
+    string current;
+
+public:
+    ProgramBuf(unsigned long long bytes)
+        : head("int main() {\n    int total = 0, i = 0;\n"),
+          block("    /* a block comment\n       spanning lines */\n"
+                "    while (i < 10 && total >= 0) {   // loop\n"
+                "        total = total + i * (i - 1) % 7;\n"
+                "        if (!(total != 3) || i <= 2) { i = i + 1; } else { i = i + 2; }\n"
+                "    }\n"),
+          tail("    return total;\n}\n"), phase(0) {
+        blocksLeft = bytes / block.size() + 1;
+    }
+
+protected:
+    int_type underflow() {
+        if (gptr() < egptr()) {
+            return traits_type::to_int_type(*gptr());
+        }
+        if (phase == 0) {
+            current = head;
+            phase = 1;
+        } else if (phase == 1 && blocksLeft > 0) {
+            // Hand out many blocks at a time so the test measures the
+            // lexer, not this generator.
+            current.clear();
+            while (blocksLeft > 0 && current.size() < 65536) {
+                current += block;
+                blocksLeft--;
+            }
+        } else if (phase == 1) {
+            current = tail;
+            phase = 2;
+        } else {
+            return traits_type::eof();
+        }
+        char* p = &current[0];
+        setg(p, p, p + current.size());
+        return traits_type::to_int_type(*p);
+    }
+};
+
+static long peakRssKb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    unsigned long long gigabytes = argc > 2 ? strtoull(argv[2], 0, 10) : 1;
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        checkWindows(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 300; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        checkWindows(name.str(), randomSource(seed));
+    }
+    printf("window sizes: %d files, 300 random inputs, %d failures\n", (int)files.size(), failures);
+
+    // Cap the address space well below the input size: the parse only
+    // succeeds if memory use is independent of input length.
+    const long capMb = 256;
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = (rlim_t)capMb << 20;
+    setrlimit(RLIMIT_AS, &limit);
+
+    long rssBefore = peakRssKb();
+    ProgramBuf buf(gigabytes << 30);
+    istream in(&buf);
+    Parser parser(in, 64 * 1024);
+    bool ok = parser.parse();
+    long rssAfter = peakRssKb();
+    printf("%llu GB stream under a %ld MB cap: %s, peak RSS %ld KB -> %ld KB\n",
+           gigabytes, capMb, ok ? "accept" : "reject", rssBefore, rssAfter);
+    if (!ok || rssAfter - rssBefore > 8 * 1024) {
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include "parser.h"
+#include "thread_pool.h"
+#include "test_util.h"
+#include <cstdio>
+
+// Interning gives one dense id per distinct name, survives table growth,
+// and is the same whichever engine or input mode the lexer runs in. A
+// locking table shared by several threads hands out consistent ids.
+
+static int failures = 0;
+
+static void fail(const string& what) {
+    printf("FAIL %s\n", what.c_str());
+    failures++;
+}
+
+static string nameFor(int i) {
+    stringstream s;
+    s << "name_" << i;
+    return s.str();
+}
+
+static void checkTable() {
+    SymbolTable table;
+    if (table.find("main", 4) != SYM_MAIN || table.intern("main", 4) != SYM_MAIN) {
+        fail("main is not SYM_MAIN");
+    }
+    for (int i = 0; i < 10000; i++) {
+        string name = nameFor(i);
+        if (table.intern(name.data(), name.size()) != (uint32_t)i + 1) {
+            fail("ids are not dense: " + name);
+            return;
+        }
+    }
+    for (int i = 0; i < 10000; i++) {
+        string name = nameFor(i);
+        size_t size;
+        const char* text = table.text(i + 1, size);
+        if (table.find(name.data(), name.size()) != (uint32_t)i + 1 || string(text, size) != name) {
+            fail("lookup after growth: " + name);
+            return;
+        }
+    }
+    if (table.find("absent", 6) != NO_SYMBOL || table.size() != 10001) {
+        fail("find of a new name");
+    }
+}
+
+// Every identifier token's sym matches interning its text directly, in
+// every lexer mode, and keywords get none.
+static void checkLexer(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    LexerEngine engines[] = { LEX_CLASSIC, LEX_TABLE };
+    for (int e = 0; e < 2; e++) {
+        for (int streamed = 0; streamed < 2; streamed++) {
+            SymbolTable table;
+            istringstream in(src);
+            Lexer memory(src.data(), src.size(), engines[e]);
+            Lexer window(in, 7, engines[e]);
+            Lexer& lexer = streamed ? window : memory;
+            lexer.setSymbols(&table);
+            for (Token t = lexer.nextToken(); t.type != END_OF_FILE; t = lexer.nextToken()) {
+                uint32_t expected = t.type == IDENTIFIER ? table.find(t.value.data, t.value.size)
+                                                         : NO_SYMBOL;
+                if (t.sym != expected || (t.type == IDENTIFIER && expected == NO_SYMBOL)) {
+                    stringstream what;
+                    what << name << ": token " << t.index << ", engine " << e
+                         << ", streamed " << streamed;
+                    fail(what.str());
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void checkShared() {
+    SymbolTable shared(true);
+    ThreadPool pool(4);
+    vector<vector<uint32_t> > ids(8);
+    pool.run(ids.size(), [&](size_t k) {
+        for (int i = 0; i < 2000; i++) {
+            string name = nameFor((i * 7 + (int)k * 13) % 2000);
+            ids[k].push_back(shared.intern(name.data(), name.size()));
+        }
+    });
+    if (shared.size() != 2001) {
+        fail("shared table size");
+    }
+    for (size_t k = 0; k < ids.size(); k++) {
+        for (int i = 0; i < 2000; i++) {
+            string name = nameFor((i * 7 + (int)k * 13) % 2000);
+            if (shared.find(name.data(), name.size()) != ids[k][i]) {
+                fail("shared table ids");
+                return;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    checkTable();
+    for (size_t i = 0; i < files.size(); i++) {
+        checkLexer(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 300; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        checkLexer(name.str(), randomSource(seed));
+    }
+    checkShared();
+    printf("%d files, 300 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
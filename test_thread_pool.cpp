@@ -0,0 +1,64 @@
+#include "thread_pool.h"
+#include <cstdio>
+#include <vector>
+
+// Every index runs exactly once, on a thread numbered within the pool, for
+// every count and however uneven the work, with stealing in play.
+
+static int failures = 0;
+
+static void check(ThreadPool& pool, size_t count, bool uneven) {
+    std::vector<std::atomic<int> > runs(count);
+    for (size_t i = 0; i < count; i++) {
+        runs[i] = 0;
+    }
+    std::atomic<int> badThread(0);
+    pool.run(count, [&](size_t i, int thread) {
+        if (thread < 0 || thread >= pool.size()) {
+            badThread++;
+        }
+        // Early indices are the slow ones, so the first thread's share
+        // lags and the others have to steal from it.
+        volatile unsigned spin = 0;
+        for (size_t k = uneven && i < count / 8 ? 20000 : 10; k > 0; k--) {
+            spin = spin + (unsigned)k;
+        }
+        runs[i]++;
+    });
+    for (size_t i = 0; i < count; i++) {
+        if (runs[i] != 1) {
+            printf("FAIL %d threads, count %zu: index %zu ran %d times\n", pool.size(), count, i,
+                   (int)runs[i]);
+            failures++;
+            return;
+        }
+    }
+    if (badThread != 0) {
+        printf("FAIL %d threads, count %zu: thread number out of range\n", pool.size(), count);
+        failures++;
+    }
+}
+
+int main() {
+    int threadCounts[] = { 1, 2, 3, 8 };
+    int runs = 0;
+    for (int t = 0; t < 4; t++) {
+        ThreadPool pool(threadCounts[t]);
+        for (size_t count = 0; count < 40; count++) {
+            check(pool, count, false);
+            runs++;
+        }
+        for (int r = 0; r < 20; r++) {
+            check(pool, 1000, r % 2 == 0);
+            runs++;
+        }
+        std::atomic<size_t> sum(0);
+        pool.run(100, [&](size_t i) { sum += i; });
+        if (sum != 4950) {
+            printf("FAIL %d threads: index-only run summed to %zu\n", threadCounts[t], (size_t)sum);
+            failures++;
+        }
+    }
+    printf("%d runs, %d failures\n", runs, failures);
+    return failures == 0 ? 0 : 1;
+}
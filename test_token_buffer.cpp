@@ -0,0 +1,83 @@
+#include "parser.h"
+#include "test_util.h"
+#include <cstdio>
+
+// TokenBuffer must hold exactly what Lexer::getAllTokens() returns, a
+// Parser walking it must report exactly what a lexing Parser reports, and
+// the side tables for offsets past 4 GB and long tokens must round-trip.
+
+static int failures = 0;
+
+static string parseOutput(Parser& parser) {
+    stringstream out;
+    streambuf* saved = cout.rdbuf(out.rdbuf());
+    parser.parse();
+    parser.printErrors(true);
+    cout.rdbuf(saved);
+    return out.str();
+}
+
+static void check(const string& name, string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    LexerEngine engines[] = { LEX_CLASSIC, LEX_TABLE };
+    for (int e = 0; e < 2; e++) {
+        Lexer lexer(src.data(), src.size(), engines[e]);
+        vector<Token> expected = lexer.getAllTokens();
+        TokenBuffer tokens;
+        tokens.lex(src.data(), src.size(), engines[e]);
+        vector<Token> actual;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            actual.push_back(tokens.token(i));
+        }
+        if (!sameTokens(expected, actual)) {
+            printf("FAIL %s: tokens, engine %d\n", name.c_str(), e);
+            failures++;
+        }
+        Parser direct(src.data(), src.size(), engines[e]);
+        Parser walked(tokens);
+        if (parseOutput(direct) != parseOutput(walked)) {
+            printf("FAIL %s: parse, engine %d\n", name.c_str(), e);
+            failures++;
+        }
+    }
+}
+
+static void checkSideTables() {
+    TokenBuffer tokens;
+    uint64_t offsets[] = { 0, 5, 0xFFFFFFF0ULL, 0x100000000ULL, 0x100000007ULL,
+                           0x500000000ULL, 0x500000001ULL };
+    uint64_t lengths[] = { 1, 0xFFFE, 0xFFFF, 3, 1 << 20, 2, 0 };
+    size_t n = sizeof(offsets) / sizeof(offsets[0]);
+    for (size_t i = 0; i < n; i++) {
+        tokens.push(IDENTIFIER, offsets[i], lengths[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (tokens.offset(i) != offsets[i] || tokens.length(i) != lengths[i]) {
+            printf("FAIL side tables: token %d\n", (int)i);
+            failures++;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        check(files[i], readFile(dir + "/" + files[i]));
+    }
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomSource(seed));
+    }
+    check("empty", "");
+    checkSideTables();
+    printf("%d files, 1000 random inputs, %d failures\n", (int)files.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
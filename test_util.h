@@ -0,0 +1,71 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+// Shared helpers for the standalone test programs.
+
+#include "lexer.h"
+#include <dirent.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+inline std::string readFile(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Sorted names of the *.c files in dir; false if it cannot be opened.
+inline bool listTestCases(const std::string& dir, std::vector<std::string>& files) {
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) {
+        return false;
+    }
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() > 2 && name.compare(name.size() - 2, 2, ".c") == 0) {
+            files.push_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return true;
+}
+
+// Random mix of whitespace, comment delimiters and token fragments, so
+// token, comment and newline boundaries land at every offset.
+inline std::string randomSource(unsigned seed) {
+    static const char* pieces[] = {
+        " ", "  ", "\t", "\n", "\r\n", "\f", "\v", "/*", "*/", "*", "/", "//",
+        "x", "int", "42", "0", "007", "==", "=", "!", "!=", "<", "<=", ">", ">=",
+        "&", "&&", "|", "||", "+", "-", "%", "(", ")", ";", "{", "}", ",",
+        "a_long_name", "while", "return", "returned", "@", "#", "\xe4\xb8\xad",
+        "                                        ",
+    };
+    srand(seed);
+    std::string s;
+    int n = rand() % 400;
+    for (int i = 0; i < n; i++) {
+        s += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    return s;
+}
+
+inline bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].type != b[i].type || a[i].value != b[i].value ||
+            a[i].index != b[i].index || a[i].offset != b[i].offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,287 @@
+#include "batch.h"
+#include "parser.h"
+#include "verdict_cache.h"
+#include "test_util.h"
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// A cache hit must give exactly the errors a parse with the same limits
+// would, whatever limits the entry was stored under, and entries must stay
+// intact while threads and processes read and replace them.
+
+static std::atomic<int> failures(0);
+
+struct Limits {
+    size_t maxErrors;
+    bool failFast;
+};
+
+static const Limits limits[] = { { 0, false }, { 1, false }, { 3, false }, { 0, true } };
+static const size_t LIMITS = sizeof(limits) / sizeof(limits[0]);
+
+static vector<ErrorInfo> parseErrors(const string& src, const Limits& l) {
+    Parser parser(src.data(), src.size());
+    parser.setMaxErrors(l.maxErrors);
+    if (l.failFast) {
+        parser.failFast();
+    }
+    parser.parse();
+    return parser.errorList();
+}
+
+static bool sameErrors(const vector<ErrorInfo>& a, const vector<ErrorInfo>& b, bool verdictOnly) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size() && !verdictOnly; i++) {
+        if (a[i].line != b[i].line || a[i].column != b[i].column || a[i].message != b[i].message) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static string withNewline(string src) {
+    if (!src.empty() && src[src.size() - 1] != '\n') {
+        src += '\n';
+    }
+    return src;
+}
+
+// Looks every source up under every limit, parsing and storing on a miss;
+// every hit must match a fresh parse.
+static void exercise(VerdictCache& cache, const vector<string>& sources, size_t first, size_t step,
+                     const string& who) {
+    vector<ErrorInfo> got;
+    for (size_t i = first; i < sources.size(); i += step) {
+        for (size_t l = 0; l < LIMITS; l++) {
+            const Limits& lim = limits[(i + l) % LIMITS];
+            Hash128 key = cache.key(sources[i].data(), sources[i].size(), 0);
+            vector<ErrorInfo> expected = parseErrors(sources[i], lim);
+            if (cache.lookup(key, lim.maxErrors, lim.failFast, got)) {
+                if (!sameErrors(got, expected, lim.failFast)) {
+                    printf("FAIL %s: source %zu, limits #%zu: hit differs\n", who.c_str(), i, l);
+                    failures++;
+                }
+            } else {
+                cache.store(key, expected, lim.maxErrors, lim.failFast);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> names;
+    if (!listTestCases(dir, names)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    vector<string> sources;
+    for (size_t i = 0; i < names.size(); i++) {
+        sources.push_back(withNewline(readFile(dir + "/" + names[i])));
+    }
+    for (unsigned seed = 0; seed < 300; seed++) {
+        sources.push_back(withNewline(randomSource(seed)));
+    }
+    // More errors than a slot holds.
+    string manyErrors;
+    for (int i = 0; i < 300; i++) {
+        manyErrors += "int x = ;\n";
+    }
+    sources.push_back(manyErrors);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/toyc_test_cache.%d", (int)getpid());
+    unlink(path);
+    string err;
+
+    // Stored under each limit, looked up under each.
+    {
+        VerdictCache cache;
+        if (!cache.open(path, 4 << 20, err)) {
+            printf("cannot open cache: %s\n", err.c_str());
+            return 1;
+        }
+        vector<ErrorInfo> got;
+        for (size_t i = 0; i < sources.size(); i++) {
+            for (size_t s = 0; s < LIMITS; s++) {
+                Hash128 key = cache.key(sources[i].data(), sources[i].size(), s + 1);
+                cache.store(key, parseErrors(sources[i], limits[s]), limits[s].maxErrors, limits[s].failFast);
+                for (size_t l = 0; l < LIMITS; l++) {
+                    vector<ErrorInfo> expected = parseErrors(sources[i], limits[l]);
+                    bool hit = cache.lookup(key, limits[l].maxErrors, limits[l].failFast, got);
+                    // Fewer errors stored than asked for must miss; when
+                    // they are all there it must hit.
+                    vector<ErrorInfo> stored = parseErrors(sources[i], limits[s]);
+                    bool complete = stored.empty() || (!limits[s].failFast &&
+                                    (limits[s].maxErrors == 0 || stored.size() < limits[s].maxErrors));
+                    bool enough = limits[l].failFast || complete ||
+                                  (!limits[s].failFast && limits[l].maxErrors != 0 &&
+                                   limits[l].maxErrors <= limits[s].maxErrors);
+                    if (hit && !sameErrors(got, expected, limits[l].failFast)) {
+                        printf("FAIL source %zu stored under #%zu, looked up under #%zu: differs\n", i, s, l);
+                        failures++;
+                    } else if (hit != enough && sources[i] != manyErrors) {
+                        printf("FAIL source %zu stored under #%zu, looked up under #%zu: %s\n", i, s, l,
+                               hit ? "unexpected hit" : "unexpected miss");
+                        failures++;
+                    }
+                }
+            }
+        }
+        // Options that change the verdict are part of the key.
+        Hash128 a = cache.key(sources[0].data(), sources[0].size(), 0);
+        Hash128 b = cache.key(sources[0].data(), sources[0].size(), 20);
+        if (a == b) {
+            printf("FAIL maxDepth does not change the key\n");
+            failures++;
+        }
+        if (cache.hits() + cache.misses() != sources.size() * LIMITS * LIMITS ||
+            cache.sharedHits() != cache.hits() || cache.sharedMisses() != cache.misses()) {
+            printf("FAIL counters: %llu hits, %llu misses\n", (unsigned long long)cache.hits(),
+                   (unsigned long long)cache.misses());
+            failures++;
+        }
+    }
+
+    // Entries outlive the process that stored them; another size starts over.
+    {
+        VerdictCache cache;
+        vector<ErrorInfo> got;
+        cache.open(path, 4 << 20, err);
+        Hash128 key = cache.key(sources[0].data(), sources[0].size(), 1);
+        if (!cache.lookup(key, 0, false, got) || cache.sharedHits() == 0) {
+            printf("FAIL reopened cache lost its entries\n");
+            failures++;
+        }
+        cache.open(path, 2 << 20, err);
+        key = cache.key(sources[0].data(), sources[0].size(), 1);
+        if (cache.lookup(key, 0, false, got) || cache.sharedMisses() != 1) {
+            printf("FAIL resized cache kept old entries\n");
+            failures++;
+        }
+    }
+
+    // One set of eight: the ninth entry replaces the least recently used.
+    {
+        unlink(path);
+        VerdictCache cache;
+        cache.open(path, 0, err);
+        vector<ErrorInfo> got;
+        vector<Hash128> keys;
+        for (int i = 0; i < 9; i++) {
+            keys.push_back(cache.key(sources[i].data(), sources[i].size(), 0));
+            if (i == 8) {
+                cache.lookup(keys[0], 0, false, got);
+            }
+            cache.store(keys[i], parseErrors(sources[i], limits[0]), 0, false);
+        }
+        bool kept[9];
+        for (int i = 0; i < 9; i++) {
+            kept[i] = cache.lookup(keys[i], 0, false, got);
+        }
+        if (!kept[0] || kept[1] || !kept[8]) {
+            printf("FAIL eviction is not least recently used\n");
+            failures++;
+        }
+    }
+
+    // A writer that died halfway through the least recently used slot
+    // leaves its sequence odd; the set must still take new entries. Slots
+    // follow a 4096-byte header, 512 bytes each, with the sequence first
+    // and the last use at byte 24.
+    {
+        VerdictCache cache;
+        cache.open(path, 0, err);
+        vector<ErrorInfo> got;
+        int fd = open(path, O_RDWR);
+        off_t oldest = 0;
+        uint64_t oldestUse = UINT64_MAX;
+        for (off_t slot = 4096; slot < 4096 + 8 * 512; slot += 512) {
+            uint64_t use;
+            if (pread(fd, &use, sizeof(use), slot + 24) == sizeof(use) && use < oldestUse) {
+                oldest = slot;
+                oldestUse = use;
+            }
+        }
+        uint32_t odd = 1;
+        ssize_t n = pwrite(fd, &odd, sizeof(odd), oldest);
+        close(fd);
+        Hash128 key = cache.key(sources[9].data(), sources[9].size(), 0);
+        cache.store(key, parseErrors(sources[9], limits[0]), 0, false);
+        if (n != sizeof(odd) || !cache.lookup(key, 0, false, got)) {
+            printf("FAIL a slot left mid-write stops its set from storing\n");
+            failures++;
+        }
+    }
+
+    // Threads and a second process on a cache small enough to evict all
+    // the time.
+    {
+        unlink(path);
+        VerdictCache cache;
+        cache.open(path, 16 << 10, err);
+        pid_t child = fork();
+        if (child == 0) {
+            VerdictCache own;
+            own.open(path, 16 << 10, err);
+            int before = failures;
+            for (int round = 0; round < 3; round++) {
+                exercise(own, sources, 0, 1, "child process");
+            }
+            _exit(failures == before ? 0 : 1);
+        }
+        vector<std::thread> threads;
+        for (size_t t = 0; t < 4; t++) {
+            threads.push_back(std::thread([&, t]() {
+                for (int round = 0; round < 3; round++) {
+                    exercise(cache, sources, t, 2, "thread " + std::to_string(t));
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        int status;
+        if (waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("FAIL child process\n");
+            failures++;
+        }
+        if (cache.hits() == 0 || cache.sharedHits() + cache.sharedMisses() <= cache.hits() + cache.misses()) {
+            printf("FAIL shared counters do not add up\n");
+            failures++;
+        }
+    }
+
+    // A batch answered from the cache prints what it printed when parsing.
+    {
+        unlink(path);
+        VerdictCache cache;
+        cache.open(path, 1 << 20, err);
+        vector<string> files;
+        for (size_t i = 0; i < names.size(); i++) {
+            files.push_back(dir + "/" + names[i]);
+        }
+        BatchOptions opt;
+        opt.threads = 2;
+        opt.columns = true;
+        stringstream plain, first, second;
+        runBatch(files, opt, plain);
+        opt.cache = &cache;
+        runBatch(files, opt, first);
+        runBatch(files, opt, second);
+        if (first.str() != plain.str() || second.str() != plain.str() || cache.hits() != files.size()) {
+            printf("FAIL batch with cache: %llu hits\n", (unsigned long long)cache.hits());
+            failures++;
+        }
+    }
+    unlink(path);
+
+    printf("%d sources, %d failures\n", (int)sources.size(), (int)failures);
+    return failures == 0 ? 0 : 1;
+}
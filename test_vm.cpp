@@ -0,0 +1,465 @@
+#include "parser.h"
+#include "vm.h"
+#include "test_util.h"
+#include <cstdio>
+#include <map>
+
+// Bytecode run under either dispatch must give what a plain tree walker
+// gives, error for error, and what a C compiler gives for the accepted
+// test cases; deep recursion must grow the stack up to its limit.
+
+static int failures = 0;
+
+// The obvious implementation: evaluates the tree directly, with one map
+// per open scope and exceptions for control flow.
+class Walker {
+private:
+    struct Return {
+        int32_t value;
+    };
+    struct Break {};
+    struct Continue {};
+
+    Ast& ast;
+    std::map<uint32_t, uint32_t> functions;     // sym to FUNC
+    std::vector<std::map<uint32_t, int32_t> > scopes;
+
+    int32_t& variable(uint32_t sym) {
+        for (size_t i = scopes.size(); i > 0; i--) {
+            std::map<uint32_t, int32_t>::iterator it = scopes[i - 1].find(sym);
+            if (it != scopes[i - 1].end()) {
+                return it->second;
+            }
+        }
+        throw string("Undeclared variable");
+    }
+
+    int32_t eval(uint32_t id) {
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_NUMBER:
+            return (int32_t)n.a;
+        case AST_NAME:
+            return variable(n.a);
+        case AST_UNARY: {
+            int32_t x = eval(n.a);
+            return n.op == MINUS ? (int32_t)(0u - (uint32_t)x) : n.op == NOT ? x == 0 : x;
+        }
+        case AST_CALL: {
+            std::vector<int32_t> args;
+            for (uint32_t a = n.b; a != AST_NONE; a = ast.node(a).next) {
+                args.push_back(eval(a));
+            }
+            return call(n.a, args);
+        }
+        default:
+            break;
+        }
+        if (n.op == AND) {
+            return eval(n.a) != 0 && eval(n.b) != 0;
+        }
+        if (n.op == OR) {
+            return eval(n.a) != 0 || eval(n.b) != 0;
+        }
+        int64_t x = eval(n.a);
+        int64_t y = eval(n.b);
+        switch (n.op) {
+        case PLUS: return (int32_t)(uint32_t)(x + y);
+        case MINUS: return (int32_t)(uint32_t)(x - y);
+        case MULTIPLY: return (int32_t)(uint32_t)(x * y);
+        case DIVIDE:
+        case MODULO:
+            if (y == 0) {
+                throw string("Division by zero");
+            }
+            return (int32_t)(uint32_t)(n.op == DIVIDE ? x / y : x % y);
+        case LESS: return x < y;
+        case LESS_EQUAL: return x <= y;
+        case GREATER: return x > y;
+        case GREATER_EQUAL: return x >= y;
+        case EQUAL: return x == y;
+        default: return x != y;
+        }
+    }
+
+    void exec(uint32_t id) {
+        if (id == AST_NONE) {
+            return;
+        }
+        const AstNode& n = ast.node(id);
+        switch (Ast::kind(id)) {
+        case AST_BLOCK:
+            scopes.push_back(std::map<uint32_t, int32_t>());
+            try {
+                for (uint32_t s = n.a; s != AST_NONE; s = ast.node(s).next) {
+                    exec(s);
+                }
+            } catch (...) {
+                scopes.pop_back();
+                throw;
+            }
+            scopes.pop_back();
+            break;
+        case AST_DECL:
+            for (uint32_t v = n.a; v != AST_NONE; v = ast.node(v).next) {
+                const AstNode& var = ast.node(v);
+                scopes.back()[var.a] = 0;
+                scopes.back()[var.a] = var.b == AST_NONE ? 0 : eval(var.b);
+            }
+            break;
+        case AST_ASSIGN: {
+            int32_t value = eval(n.b);
+            variable(n.a) = value;
+            break;
+        }
+        case AST_IF:
+            if (eval(n.a)) {
+                exec(n.b);
+            } else {
+                exec(n.c);
+            }
+            break;
+        case AST_WHILE:
+            while (eval(n.a)) {
+                try {
+                    exec(n.b);
+                } catch (Break&) {
+                    break;
+                } catch (Continue&) {
+                }
+            }
+            break;
+        case AST_BREAK:
+            throw Break();
+        case AST_CONTINUE:
+            throw Continue();
+        case AST_RETURN: {
+            Return r = { eval(n.a) };
+            throw r;
+        }
+        case AST_EXPR_STMT:
+            eval(n.a);
+            break;
+        default:
+            break;
+        }
+    }
+
+public:
+    explicit Walker(Ast& tree) : ast(tree) {
+        for (uint32_t f = ast.functions; f != AST_NONE; f = ast.node(f).next) {
+            functions[ast.node(f).a] = f;
+        }
+    }
+
+    int32_t call(uint32_t sym, const std::vector<int32_t>& args) {
+        const AstNode& func = ast.node(functions.at(sym));
+        std::vector<std::map<uint32_t, int32_t> > saved;
+        saved.swap(scopes);
+        scopes.push_back(std::map<uint32_t, int32_t>());
+        size_t i = 0;
+        for (uint32_t p = func.b; p != AST_NONE; p = ast.node(p).next) {
+            scopes.back()[ast.node(p).a] = args[i++];
+        }
+        int32_t value = 0;
+        try {
+            for (uint32_t s = ast.node(func.c).a; s != AST_NONE; s = ast.node(s).next) {
+                exec(s);
+            }
+        } catch (Return& r) {
+            value = r.value;
+        } catch (...) {
+            scopes.swap(saved);
+            throw;
+        }
+        scopes.swap(saved);
+        return value;
+    }
+};
+
+// "value" or "error: message", as the walker or the VM sees the program.
+static string walked(Ast& tree) {
+    Walker walker(tree);
+    try {
+        stringstream out;
+        out << walker.call(SYM_MAIN, std::vector<int32_t>());
+        return out.str();
+    } catch (string& err) {
+        return "error: " + err;
+    }
+}
+
+static string ran(const BytecodeProgram& program, VmDispatch dispatch, size_t maxStack = Vm::DEFAULT_MAX_STACK) {
+    Vm vm;
+    vm.setDispatch(dispatch);
+    vm.setMaxStack(maxStack);
+    int32_t result;
+    string err;
+    if (!vm.run(program, result, err)) {
+        return "error: " + err;
+    }
+    stringstream out;
+    out << result;
+    return out.str();
+}
+
+static bool lower(const string& name, const string& src, Parser& parser, Ast& tree, BytecodeProgram& program) {
+    parser.checkScopes();
+    parser.checkCalls();
+    if (!parser.parse(&tree)) {
+        printf("FAIL %s rejected\n", name.c_str());
+        failures++;
+        return false;
+    }
+    BytecodeCompiler compiler;
+    string err;
+    if (!compiler.compile(tree, parser.callGraph(), program, err)) {
+        printf("FAIL %s not lowered: %s\n", name.c_str(), err.c_str());
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+// Runs src every way; expected is what it should give, or empty to take
+// the walker's word for it.
+static void check(const string& name, const string& src, const string& expected = "") {
+    Parser parser(src.data(), src.size());
+    Ast tree;
+    BytecodeProgram program;
+    if (!lower(name, src, parser, tree, program)) {
+        return;
+    }
+    string want = walked(tree);
+    if (!expected.empty() && want != expected) {
+        printf("FAIL %s walker: got %s, expected %s\n", name.c_str(), want.c_str(), expected.c_str());
+        failures++;
+    }
+    for (int d = VM_SWITCH; d <= VM_THREADED; d++) {
+        if (!vmDispatchSupported((VmDispatch)d)) {
+            continue;
+        }
+        string got = ran(program, (VmDispatch)d);
+        if (got != want) {
+            printf("FAIL %s (%s): got %s, expected %s\n", name.c_str(), vmDispatchName((VmDispatch)d),
+                   got.c_str(), want.c_str());
+            dumpBytecode(program, parser.symbolTable(), std::cout);
+            failures++;
+        }
+    }
+}
+
+static bool callsAllowed;
+
+// An expression over the variables v0 .. v{vars - 1}, with division by
+// zero now and then.
+static string randomExpr(int vars, int depth) {
+    static const char* ops[] = { "+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+    if (depth == 0 || rand() % 3 == 0) {
+        if (vars > 0 && rand() % 2) {
+            return "v" + std::to_string(rand() % vars);
+        }
+        return std::to_string(rand() % 7 == 0 ? 2147483647 : rand() % 10);
+    }
+    switch (rand() % 6) {
+    case 0:
+        return string(rand() % 2 ? "-" : "!") + "(" + randomExpr(vars, depth - 1) + ")";
+    case 1:
+        if (!callsAllowed) {
+            return randomExpr(vars, depth - 1);
+        }
+        return "f(" + randomExpr(vars, depth - 1) + ", " + randomExpr(vars, depth - 1) + ")";
+    default:
+        return "(" + randomExpr(vars, depth - 1) + " " + ops[rand() % 13] + " " + randomExpr(vars, depth - 1) + ")";
+    }
+}
+
+// Statements that declare, assign and test the variables inside bounded
+// loops with break and continue.
+static string randomBody(int& vars, int depth, int loops) {
+    string s;
+    int statements = 1 + rand() % 5;
+    for (int i = 0; i < statements; i++) {
+        switch (rand() % 7) {
+        case 0:
+        case 1:
+            s += "int v" + std::to_string(vars) + " = " + randomExpr(vars, 3) + ";\n";
+            vars++;
+            break;
+        case 2:
+            if (vars > 0) {
+                s += "v" + std::to_string(rand() % vars) + " = " + randomExpr(vars, 3) + ";\n";
+            }
+            break;
+        case 3:
+            if (depth > 0) {
+                int inner = vars;
+                s += "if (" + randomExpr(vars, 2) + ") {\n" + randomBody(inner, depth - 1, loops) + "} else {\n";
+                inner = vars;
+                s += randomBody(inner, depth - 1, loops) + "}\n";
+            }
+            break;
+        case 4:
+            if (depth > 0) {
+                string counter = "i" + std::to_string(depth) + "_" + std::to_string(i);
+                string n = std::to_string(rand() % 5);
+                // The same bound, written so that every comparison is the test.
+                string tests[] = {
+                    counter + " < " + n, counter + " <= " + n + " - 1", n + " > " + counter,
+                    n + " - 1 >= " + counter, "!(" + counter + " >= " + n + ")", counter + " != " + n,
+                    "!(" + counter + " == " + n + ")", counter + " < " + n + " && " + randomExpr(vars, 1) + " != 12345",
+                };
+                int inner = vars;
+                s += "int " + counter + " = 0;\nwhile (" + tests[rand() % 8] + ") {\n" + counter + " = " + counter +
+                     " + 1;\n" + randomBody(inner, depth - 1, loops + 1) + "}\n";
+            }
+            break;
+        case 5:
+            if (loops > 0) {
+                s += string("if (") + randomExpr(vars, 1) + ") " + (rand() % 2 ? "break;\n" : "continue;\n");
+            }
+            break;
+        default:
+            s += "if (" + randomExpr(vars, 2) + ") return " + randomExpr(vars, 2) + ";\n";
+            break;
+        }
+    }
+    return s;
+}
+
+static string randomProgram(unsigned seed) {
+    srand(seed);
+    int vars = 2;
+    callsAllowed = false;
+    string s = "int f(int v0, int v1) {\n" + randomBody(vars, 2, 0) + "return v0 - v1;\n}\n";
+    vars = 0;
+    callsAllowed = true;
+    s += "int main() {\n" + randomBody(vars, 3, 0) + "return " + randomExpr(vars, 2) + ";\n}\n";
+    return s;
+}
+
+int main(int argc, char** argv) {
+    string dir = argc > 1 ? argv[1] : "parser_testcases/functional";
+    vector<string> files;
+    if (!listTestCases(dir, files)) {
+        printf("cannot open %s\n", dir.c_str());
+        return 1;
+    }
+    // Exit codes of the accepted cases built with a C compiler.
+    std::map<string, int> exitCodes;
+    exitCodes["f01_minimal.c"] = 32;
+    exitCodes["f02_assignment.c"] = 15;
+    exitCodes["f03_if_else.c"] = 2;
+    exitCodes["f04_while_break.c"] = 5;
+    exitCodes["f05_function_call.c"] = 153;
+    exitCodes["f06_continue.c"] = 236;
+    exitCodes["f07_scope_shadow.c"] = 23;
+    exitCodes["f08_short_circuit.c"] = 234;
+    exitCodes["f09_recursion.c"] = 120;
+    exitCodes["f10_void_fn.c"] = 134;
+    exitCodes["f20_comprehensive.c"] = 151;
+    int run = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        string src = readFile(dir + "/" + files[i]);
+        Parser parser(src.data(), src.size());
+        if (!parser.parse()) {
+            continue;
+        }
+        run++;
+        if (!exitCodes.count(files[i])) {
+            printf("FAIL %s: no exit code to compare with\n", files[i].c_str());
+            failures++;
+            continue;
+        }
+        check(files[i], src);
+        Parser again(src.data(), src.size());
+        Ast tree;
+        BytecodeProgram program;
+        if (lower(files[i], src, again, tree, program)) {
+            int code = atoi(ran(program, VM_SWITCH).c_str()) & 0xFF;
+            if (code != exitCodes[files[i]]) {
+                printf("FAIL %s: exit code %d, expected %d\n", files[i].c_str(), code, exitCodes[files[i]]);
+                failures++;
+            }
+        }
+    }
+
+    check("wraparound", "int main() {\n    int x = 2147483647;\n    return x + 1 == -2147483647 - 1;\n}\n", "1");
+    check("INT_MIN / -1", "int main() {\n    int m = -2147483647 - 1;\n    return m / -1 == m && m % -1 == 0;\n}\n", "1");
+    check("division by zero", "int main() {\n    int z = 0;\n    return 1 / z;\n}\n", "error: Division by zero");
+    check("short circuit", "int main() {\n    int z = 0;\n    return (z && 1 / z) + (1 || 1 / z);\n}\n", "1");
+    check("value of && and ||", "int main() {\n    int a = 5;\n    a = a && a;\n    int b = 0 || a - 1;\n"
+          "    return a * 10 + b;\n}\n", "10");
+    check("fall off the end", "int f() {\n    int x = 1;\n}\nint main() {\n    return f() + 7;\n}\n", "7");
+    check("uninitialized", "int main() {\n    int x = 3;\n    { int x; return x; }\n}\n", "0");
+    check("nested loops", "int main() {\n    int s = 0;\n    int i = 0;\n    while (i < 10) {\n"
+          "        i = i + 1;\n        if (i % 2 == 0) continue;\n        int j = 0;\n"
+          "        while (1) {\n            j = j + 1;\n            if (j > i) break;\n            s = s + j;\n"
+          "        }\n    }\n    return s;\n}\n", "95");
+    check("arguments in order", "int f(int a, int b, int c) {\n    return a * 100 + b * 10 + c;\n}\n"
+          "int main() {\n    return f(1, f(0, 0, 2), 3) + f(f(0, 0, 4), 5, 6);\n}\n", "579");
+
+    // Recursion far deeper than a native stack of this size would allow.
+    string deep = "int down(int n) {\n    if (n == 0) return 0;\n    return down(n - 1) + 1;\n}\n"
+                  "int main() {\n    return down(1000000);\n}\n";
+    Parser parser(deep.data(), deep.size());
+    Ast tree;
+    BytecodeProgram program;
+    if (lower("deep", deep, parser, tree, program)) {
+        for (int d = VM_SWITCH; d <= VM_THREADED; d++) {
+            if (vmDispatchSupported((VmDispatch)d) && ran(program, (VmDispatch)d) != "1000000") {
+                printf("FAIL deep recursion (%s)\n", vmDispatchName((VmDispatch)d));
+                failures++;
+            }
+        }
+        if (ran(program, VM_SWITCH, 100000) != "error: Stack overflow") {
+            printf("FAIL deep recursion past the stack limit\n");
+            failures++;
+        }
+    }
+
+    // Nesting the lowering will not follow.
+    size_t depth = BytecodeCompiler::MAX_NESTING + 1;
+    string nested = "int main() {\n" + string(depth, '{') + "return 1;" + string(depth, '}') + "\n}\n";
+    Parser nestedParser(nested.data(), nested.size());
+    nestedParser.useExplicitStack();
+    nestedParser.checkScopes();
+    nestedParser.checkCalls();
+    Ast nestedTree;
+    BytecodeCompiler compiler;
+    string err;
+    if (!nestedParser.parse(&nestedTree) ||
+        compiler.compile(nestedTree, nestedParser.callGraph(), program, err) ||
+        err != "Program nested too deeply to run") {
+        printf("FAIL %zu nested blocks: %s\n", depth, err.c_str());
+        failures++;
+    }
+
+    // Without the scope check, an initializer that names its own variable
+    // reads the one the declaration hides.
+    string self = "int main() {\n    int x = 70;\n    { int x = x + 1; return x; }\n}\n";
+    Parser selfParser(self.data(), self.size());
+    selfParser.checkCalls();
+    Ast selfTree;
+    if (!selfParser.parse(&selfTree) || !compiler.compile(selfTree, selfParser.callGraph(), program, err)) {
+        printf("FAIL own initializer not lowered: %s\n", err.c_str());
+        failures++;
+    } else {
+        for (int d = VM_SWITCH; d <= VM_THREADED; d++) {
+            if (vmDispatchSupported((VmDispatch)d) && ran(program, (VmDispatch)d) != "71") {
+                printf("FAIL own initializer (%s): got %s\n", vmDispatchName((VmDispatch)d),
+                       ran(program, (VmDispatch)d).c_str());
+                failures++;
+            }
+        }
+    }
+
+    for (unsigned seed = 0; seed < 1000; seed++) {
+        stringstream name;
+        name << "random#" << seed;
+        check(name.str(), randomProgram(seed));
+    }
+
+    printf("%d files run, 1000 random programs, %d failures\n", run, failures);
+    return failures == 0 ? 0 : 1;
+}
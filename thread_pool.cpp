@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+
+namespace {
+
+inline uint64_t packRange(uint64_t begin, uint64_t end) {
+    return begin | end << 32;
+}
+
+inline uint64_t rangeBegin(uint64_t range) {
+    return range & 0xFFFFFFFFu;
+}
+
+inline uint64_t rangeEnd(uint64_t range) {
+    return range >> 32;
+}
+
+}
+
+ThreadPool::ThreadPool(int threads)
+    : shares(threads > 1 ? threads : 1), task(0), pending(0), generation(0), stopping(false) {
+    for (size_t i = 0; i < shares.size(); i++) {
+        shares[i].range = 0;
+    }
+    for (int i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+// Takes the back half of the first other share with anything left; the
+// thief's own share is empty, so nobody else touches it meanwhile. An
+// index is handed out once, so a range that was emptied can never come
+// back with the same bounds and fool a compare-exchange.
+bool ThreadPool::steal(int thread, size_t& index) {
+    int n = (int)shares.size();
+    for (int k = 1; k < n; k++) {
+        Share& victim = shares[(thread + k) % n];
+        uint64_t range = victim.range.load();
+        while (rangeBegin(range) < rangeEnd(range)) {
+            uint64_t begin = rangeBegin(range);
+            uint64_t end = rangeEnd(range);
+            uint64_t middle = begin + (end - begin) / 2;
+            if (victim.range.compare_exchange_weak(range, packRange(begin, middle))) {
+                shares[thread].range = packRange(middle + 1, end);
+                index = middle;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::drain(const std::function<void(size_t, int)>& fn, int thread) {
+    Share& own = shares[thread];
+    for (;;) {
+        uint64_t range = own.range.load();
+        size_t index;
+        if (rangeBegin(range) < rangeEnd(range)) {
+            if (!own.range.compare_exchange_weak(range, packRange(rangeBegin(range) + 1, rangeEnd(range)))) {
+                continue;
+            }
+            index = rangeBegin(range);
+        } else if (!steal(thread, index)) {
+            return;
+        }
+        fn(index, thread);
+    }
+}
+
+void ThreadPool::workerLoop(int thread) {
+    unsigned long long seen = 0;
+    for (;;) {
+        const std::function<void(size_t, int)>* fn;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!stopping && generation == seen) {
+                wake.wait(guard);
+            }
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            fn = task;
+        }
+        drain(*fn, thread);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending--;
+        }
+        finished.notify_all();
+    }
+}
+
+void ThreadPool::run(size_t n, const std::function<void(size_t)>& fn) {
+    run(n, [&fn](size_t i, int) { fn(i); });
+}
+
+void ThreadPool::run(size_t n, const std::function<void(size_t, int)>& fn) {
+    std::lock_guard<std::mutex> serial(runLock);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t threads = shares.size();
+        for (size_t t = 0; t < threads; t++) {
+            shares[t].range = packRange(n * t / threads, n * (t + 1) / threads);
+        }
+        task = &fn;
+        pending = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    drain(fn, 0);
+    // Every worker checks in for every run, so none can still be looking at
+    // fn once this returns.
+    std::unique_lock<std::mutex> guard(lock);
+    while (pending > 0) {
+        finished.wait(guard);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. run() splits the
+// loop indices evenly between the threads; each thread works through its
+// own share front to back, and one that runs out steals the back half of
+// another's, so uneven pieces of work still balance without every index
+// going through one shared counter. The calling thread works alongside the
+// pool until every index is done.
+class ThreadPool {
+private:
+    // Indices [begin, end) a thread has left, packed as begin | end << 32,
+    // on a cache line of its own.
+    struct Share {
+        std::atomic<uint64_t> range;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<Share> shares;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::mutex runLock;
+
+    const std::function<void(size_t, int)>* task;
+    size_t pending;
+    unsigned long long generation;
+    bool stopping;
+
+    void workerLoop(int thread);
+    void drain(const std::function<void(size_t, int)>& fn, int thread);
+    bool steal(int thread, size_t& index);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    // threads counts the caller, so ThreadPool(1) starts no threads at all.
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    int size() const { return (int)workers.size() + 1; }
+
+    // Calls task(i) for every i in [0, count) and returns when all are done.
+    // count must be below 2^32.
+    void run(size_t count, const std::function<void(size_t)>& task);
+    // Also passes the number of the thread running task(i): 0 for the
+    // caller and 1 to size() - 1 for the workers, so that callers can keep
+    // state per thread.
+    void run(size_t count, const std::function<void(size_t, int)>& task);
+};
+
+#endif
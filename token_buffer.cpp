@@ -0,0 +1,78 @@
+#include "token_buffer.h"
+#include <algorithm>
+
+static const uint16_t LONG_LENGTH = 0xFFFF;
+
+TokenBuffer::TokenBuffer() : source(""), sourceSize(0) {}
+
+void TokenBuffer::clear() {
+    types.clear();
+    offsets.clear();
+    lengths.clear();
+    highStarts.clear();
+    longLengths.clear();
+}
+
+void TokenBuffer::lex(const char* data, size_t size, LexerEngine engine) {
+    clear();
+    source = data;
+    sourceSize = size;
+    // One token per four bytes is generous for real code, so the arrays
+    // seldom grow, and untouched capacity costs address space only.
+    size_t estimate = size / 4 + 1;
+    types.reserve(estimate);
+    offsets.reserve(estimate);
+    lengths.reserve(estimate);
+
+    Lexer lexer(data, size, engine);
+    Token t;
+    do {
+        t = lexer.nextToken();
+        push(t.type, t.offset, t.value.size);
+    } while (t.type != END_OF_FILE);
+}
+
+void TokenBuffer::push(TokenType type, uint64_t offset, uint64_t length) {
+    size_t i = types.size();
+    while ((offset >> 32) > highStarts.size()) {
+        highStarts.push_back(i);
+    }
+    types.push_back((uint8_t)type);
+    offsets.push_back((uint32_t)offset);
+    if (length < LONG_LENGTH) {
+        lengths.push_back((uint16_t)length);
+    } else {
+        lengths.push_back(LONG_LENGTH);
+        longLengths.push_back(make_pair(i, length));
+    }
+}
+
+uint64_t TokenBuffer::offset(size_t i) const {
+    uint64_t low = offsets[i];
+    if (highStarts.empty()) {
+        return low;
+    }
+    uint64_t high = upper_bound(highStarts.begin(), highStarts.end(), i) - highStarts.begin();
+    return (high << 32) | low;
+}
+
+uint64_t TokenBuffer::length(size_t i) const {
+    if (lengths[i] != LONG_LENGTH) {
+        return lengths[i];
+    }
+    vector<pair<size_t, uint64_t> >::const_iterator it =
+        lower_bound(longLengths.begin(), longLengths.end(), make_pair(i, (uint64_t)0));
+    return it->second;
+}
+
+Token TokenBuffer::token(size_t i) const {
+    return Token(type(i), text(i), (int64_t)i, offset(i));
+}
+
+size_t TokenBuffer::bytesUsed() const {
+    return types.capacity() * sizeof(uint8_t) +
+           offsets.capacity() * sizeof(uint32_t) +
+           lengths.capacity() * sizeof(uint16_t) +
+           highStarts.capacity() * sizeof(size_t) +
+           longLengths.capacity() * sizeof(pair<size_t, uint64_t>);
+}
@@ -0,0 +1,72 @@
+#ifndef TOKEN_BUFFER_H
+#define TOKEN_BUFFER_H
+
+#include "lexer.h"
+#include <utility>
+
+// Structure-of-arrays token store. Each token costs 7 bytes: its type, the
+// low 32 bits of its offset and a 16-bit length. Offsets past 4 GB and
+// tokens of 65535 bytes or more are rare, so they are kept in small side
+// tables. Token text is not stored but read back from the source buffer,
+// which must outlive the TokenBuffer.
+class TokenBuffer {
+private:
+    const char* source;
+    size_t sourceSize;
+    vector<uint8_t> types;
+    vector<uint32_t> offsets;
+    vector<uint16_t> lengths;
+    // highStarts[k] is the first token whose offset is >= (k + 1) << 32.
+    vector<size_t> highStarts;
+    // (token, length) for every token whose length does not fit 16 bits.
+    vector<pair<size_t, uint64_t> > longLengths;
+
+public:
+    TokenBuffer();
+    // Lexes all of data, which ends with END_OF_FILE, replacing any tokens
+    // already held.
+    void lex(const char* data, size_t size, LexerEngine engine = LEX_CLASSIC);
+    void push(TokenType type, uint64_t offset, uint64_t length);
+    void clear();
+
+    const char* data() const { return source; }
+    size_t dataSize() const { return sourceSize; }
+    size_t size() const { return types.size(); }
+    TokenType type(size_t i) const { return (TokenType)types[i]; }
+    uint64_t offset(size_t i) const;
+    uint64_t length(size_t i) const;
+    StrView text(size_t i) const { return StrView(source + offset(i), length(i)); }
+    // Token i in the fat form the Lexer returns; index is i.
+    Token token(size_t i) const;
+    // Heap bytes held by the arrays and side tables.
+    size_t bytesUsed() const;
+};
+
+// Walks a TokenBuffer front to back. It stops on the final END_OF_FILE
+// token, so next() can be called any number of times at the end.
+class TokenCursor {
+private:
+    const TokenBuffer* tokens;
+    size_t i;
+
+public:
+    TokenCursor() : tokens(NULL), i(0) {}
+    explicit TokenCursor(const TokenBuffer& t) : tokens(&t), i(0) {}
+
+    size_t position() const { return i; }
+    const TokenBuffer& buffer() const { return *tokens; }
+    void seek(size_t position) { i = position; }
+    TokenType type() const { return tokens->type(i); }
+    StrView text() const { return tokens->text(i); }
+    uint64_t offset() const { return tokens->offset(i); }
+    Token token() const { return tokens->token(i); }
+    void next() {
+        if (i + 1 < tokens->size()) {
+            i++;
+        }
+    }
+    // Moves to the final END_OF_FILE token.
+    void stop() { i = tokens->size() - 1; }
+};
+
+#endif
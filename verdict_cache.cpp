@@ -0,0 +1,353 @@
+#include "verdict_cache.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "the cache file is shared through lock-free atomics");
+
+namespace {
+
+const uint64_t K0 = 0xa0761d6478bd642fULL;
+const uint64_t K1 = 0xe7037ed1a0b428dbULL;
+const uint64_t K2 = 0x8ebc6af09c88c6e3ULL;
+const uint64_t K3 = 0x589965cc75374cc3ULL;
+
+inline uint64_t load64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Both halves of the 128-bit product, folded.
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+const char MAGIC[8] = { 'T', 'O', 'Y', 'C', 'V', 'C', '0', '1' };
+const uint32_t SLOT_SIZE = 512;
+const uint32_t WAYS = 8;
+const size_t HEADER_SIZE = 4096;
+
+// Payload flags.
+const uint8_t ACCEPTED = 1;
+const uint8_t COMPLETE = 2;     // every error of the program is stored
+
+}
+
+struct VerdictCache::Header {
+    char magic[8];
+    uint32_t slotSize;
+    uint32_t ways;
+    uint64_t sets;
+    uint64_t seed;                  // random per file, so keys are not guessable
+    std::atomic<uint64_t> clock;    // stamps slots for LRU
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+
+// A payload is a flags byte, the number of errors (16 bits), the number of
+// distinct messages (8 bits), the messages, each a length byte and its
+// text, then per error its line and column (32 bits each) and the index of
+// its message.
+struct VerdictCache::Slot {
+    std::atomic<uint32_t> sequence;     // 0: empty; odd: being written
+    std::atomic<uint32_t> size;
+    std::atomic<uint64_t> keyLow;
+    std::atomic<uint64_t> keyHigh;
+    std::atomic<uint64_t> lastUse;
+    char payload[SLOT_SIZE - 32];
+};
+
+Hash128 hash128(const char* data, size_t size, uint64_t seed) {
+    uint64_t a = seed ^ K0;
+    uint64_t b = seed ^ K1;
+    const char* p = data;
+    size_t n = size;
+    for (; n >= 32; p += 32, n -= 32) {
+        a = mix(load64(p) ^ K1 ^ a, load64(p + 8) ^ K2);
+        b = mix(load64(p + 16) ^ K3 ^ b, load64(p + 24) ^ K0);
+    }
+    char tail[32] = { 0 };
+    memcpy(tail, p, n);
+    a = mix(load64(tail) ^ K1 ^ a, load64(tail + 8) ^ K2);
+    b = mix(load64(tail + 16) ^ K3 ^ b, load64(tail + 24) ^ K0);
+    Hash128 h;
+    h.low = mix(a ^ K3, b ^ size);
+    h.high = mix(b ^ K2, h.low ^ a ^ K1);
+    return h;
+}
+
+VerdictCache::VerdictCache() : header(NULL), slots(NULL), sets(0), mappedSize(0), hitCount(0), missCount(0) {}
+
+VerdictCache::~VerdictCache() {
+    close();
+}
+
+void VerdictCache::close() {
+    if (header != NULL) {
+        munmap(header, mappedSize);
+        header = NULL;
+        slots = NULL;
+    }
+}
+
+bool VerdictCache::open(const std::string& path, size_t size, std::string& err) {
+    static_assert(sizeof(Slot) == SLOT_SIZE && sizeof(Header) <= HEADER_SIZE, "slots are packed");
+    close();
+    uint64_t wantSets = size / ((size_t)SLOT_SIZE * WAYS);
+    if (wantSets == 0) {
+        wantSets = 1;
+    }
+    size_t bytes = HEADER_SIZE + wantSets * WAYS * SLOT_SIZE;
+    // Checked and set up under an exclusive lock. The file at path may be
+    // replaced while we wait for it, so the lock only counts if it is
+    // still the file at path once held.
+    for (;;) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            err = path + ": " + strerror(errno);
+            return false;
+        }
+        struct stat st, current;
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+            err = path + ": " + strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        if (stat(path.c_str(), &current) != 0 || current.st_ino != st.st_ino || current.st_dev != st.st_dev) {
+            ::close(fd);
+            continue;
+        }
+        bool fresh = st.st_size == 0;
+        if (fresh && ftruncate(fd, bytes) != 0) {
+            err = path + ": " + strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        if (fresh || (size_t)st.st_size == bytes) {
+            void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                err = path + ": " + strerror(errno);
+                ::close(fd);
+                return false;
+            }
+            Header* h = (Header*)p;
+            if (fresh) {
+                std::random_device random;
+                h->slotSize = SLOT_SIZE;
+                h->ways = WAYS;
+                h->sets = wantSets;
+                h->seed = (uint64_t)random() << 32 | random();
+                memcpy(h->magic, MAGIC, sizeof(MAGIC));
+            }
+            if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 && h->slotSize == SLOT_SIZE && h->ways == WAYS &&
+                h->sets == wantSets) {
+                // The mapping holds the file open, and with it the lock,
+                // until it is dropped explicitly.
+                flock(fd, LOCK_UN);
+                ::close(fd);
+                header = h;
+                slots = (Slot*)((char*)p + HEADER_SIZE);
+                sets = wantSets;
+                mappedSize = bytes;
+                return true;
+            }
+            munmap(p, bytes);
+        }
+        // Another size or not a cache: put a new one in its place, which
+        // the next round picks up.
+        std::string temp = path + ".XXXXXX";
+        int tempFd = mkstemp(&temp[0]);
+        if (tempFd < 0 || rename(temp.c_str(), path.c_str()) != 0) {
+            err = path + ": " + strerror(errno);
+            if (tempFd >= 0) {
+                ::close(tempFd);
+                unlink(temp.c_str());
+            }
+            ::close(fd);
+            return false;
+        }
+        fchmod(tempFd, 0644);
+        ::close(tempFd);
+        ::close(fd);
+    }
+}
+
+Hash128 VerdictCache::key(const char* data, size_t size, size_t maxDepth) const {
+    return hash128(data, size, header->seed ^ mix(maxDepth ^ K0, K3));
+}
+
+bool VerdictCache::lookup(const Hash128& k, size_t maxErrors, bool verdictOnly, std::vector<ErrorInfo>& errors) {
+    Slot* set = slots + (k.low % sets) * WAYS;
+    char payload[sizeof(set->payload)];
+    for (uint32_t way = 0; way < WAYS; way++) {
+        Slot& s = set[way];
+        uint32_t sequence = s.sequence.load(std::memory_order_acquire);
+        if (sequence == 0 || (sequence & 1) != 0 || s.keyLow.load(std::memory_order_relaxed) != k.low ||
+            s.keyHigh.load(std::memory_order_relaxed) != k.high) {
+            continue;
+        }
+        uint32_t size = s.size.load(std::memory_order_relaxed);
+        if (size > sizeof(payload)) {
+            continue;
+        }
+        memcpy(payload, s.payload, size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.sequence.load(std::memory_order_relaxed) != sequence || size < 4) {
+            continue;
+        }
+
+        // A consistent copy; decode it, checking every length against the
+        // copy in case the file is damaged.
+        const unsigned char* p = (const unsigned char*)payload;
+        const unsigned char* end = p + size;
+        uint8_t flags = p[0];
+        size_t count = p[1] | p[2] << 8;
+        size_t messageCount = p[3];
+        p += 4;
+        bool usable = (flags & ACCEPTED) != 0 || verdictOnly || (flags & COMPLETE) != 0 ||
+                      (maxErrors != 0 && count >= maxErrors);
+        if (!usable) {
+            break;
+        }
+        errors.clear();
+        if ((flags & ACCEPTED) == 0 && verdictOnly) {
+            errors.push_back(ErrorInfo(0, 0, std::string()));
+        } else if ((flags & ACCEPTED) == 0) {
+            std::vector<std::string> messages;
+            for (size_t m = 0; m < messageCount && p < end && p + 1 + *p <= end; m++) {
+                messages.push_back(std::string((const char*)p + 1, *p));
+                p += 1 + *p;
+            }
+            if (maxErrors != 0 && count >= maxErrors) {
+                count = maxErrors;
+            }
+            for (size_t e = 0; e < count && p + 9 <= end && p[8] < messages.size(); e++, p += 9) {
+                uint32_t line, column;
+                memcpy(&line, p, 4);
+                memcpy(&column, p + 4, 4);
+                errors.push_back(ErrorInfo(line, column, messages[p[8]]));
+            }
+            if (messages.size() != messageCount || errors.size() != count || count == 0) {
+                break;
+            }
+        }
+        s.lastUse.store(header->clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+        hitCount++;
+        header->hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    missCount++;
+    header->misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void VerdictCache::store(const Hash128& k, const std::vector<ErrorInfo>& errors, size_t maxErrors,
+                         bool verdictOnly) {
+    char payload[sizeof(slots->payload)];
+    uint8_t flags = 0;
+    if (errors.empty()) {
+        flags = ACCEPTED | COMPLETE;
+    } else if (!verdictOnly && (maxErrors == 0 || errors.size() < maxErrors)) {
+        flags = COMPLETE;
+    }
+    // The messages first, as long as one error still fits after each, then
+    // as many errors as fit.
+    std::vector<std::string> messages;
+    std::vector<uint8_t> index;
+    size_t size = 4;
+    if (!verdictOnly) {
+        for (size_t e = 0; e < errors.size(); e++) {
+            const std::string& message = errors[e].message;
+            size_t m = 0;
+            while (m < messages.size() && messages[m] != message) {
+                m++;
+            }
+            if (m == messages.size()) {
+                if (messages.size() == 255 || message.size() > 255 ||
+                    size + 1 + message.size() + 9 > sizeof(payload)) {
+                    break;
+                }
+                payload[size] = (char)message.size();
+                memcpy(payload + size + 1, message.data(), message.size());
+                size += 1 + message.size();
+                messages.push_back(message);
+            }
+            index.push_back((uint8_t)m);
+        }
+    }
+    size_t count = 0;
+    for (; count < index.size() && size + 9 <= sizeof(payload) && count < 0xffff; count++) {
+        uint32_t line = (uint32_t)errors[count].line;
+        uint32_t column = (uint32_t)errors[count].column;
+        if (line != errors[count].line || column != errors[count].column) {
+            break;
+        }
+        memcpy(payload + size, &line, 4);
+        memcpy(payload + size + 4, &column, 4);
+        payload[size + 8] = (char)index[count];
+        size += 9;
+    }
+    if (count < errors.size()) {
+        flags &= ~COMPLETE;
+    }
+    payload[0] = (char)flags;
+    payload[1] = (char)count;
+    payload[2] = (char)(count >> 8);
+    payload[3] = (char)messages.size();
+
+    // The slot holding this key already, else an empty one, else the least
+    // recently used. Slots being written are passed over: a writer that
+    // died there left the slot odd for good, and choosing it would stop
+    // the set from ever storing again. Such a slot is simply lost.
+    Slot* set = slots + (k.low % sets) * WAYS;
+    Slot* victim = NULL;
+    for (uint32_t way = 0; way < WAYS; way++) {
+        Slot& s = set[way];
+        uint32_t sequence = s.sequence.load(std::memory_order_relaxed);
+        if ((sequence & 1) != 0) {
+            continue;
+        }
+        if (s.keyLow.load(std::memory_order_relaxed) == k.low && s.keyHigh.load(std::memory_order_relaxed) == k.high) {
+            victim = &s;
+            break;
+        }
+        if (victim == NULL || sequence == 0) {
+            victim = &s;
+        } else if (victim->sequence.load(std::memory_order_relaxed) != 0 &&
+                   s.lastUse.load(std::memory_order_relaxed) < victim->lastUse.load(std::memory_order_relaxed)) {
+            victim = &s;
+        }
+    }
+    if (victim == NULL) {
+        return;
+    }
+    // Another writer may have taken it since: skip, rather than wait.
+    uint32_t sequence = victim->sequence.load(std::memory_order_relaxed);
+    if ((sequence & 1) != 0 ||
+        !victim->sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    victim->keyLow.store(k.low, std::memory_order_relaxed);
+    victim->keyHigh.store(k.high, std::memory_order_relaxed);
+    victim->size.store((uint32_t)size, std::memory_order_relaxed);
+    memcpy(victim->payload, payload, size);
+    victim->lastUse.store(header->clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+    victim->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint64_t VerdictCache::sharedHits() const {
+    return header->hits.load(std::memory_order_relaxed);
+}
+
+uint64_t VerdictCache::sharedMisses() const {
+    return header->misses.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+#ifndef VERDICT_CACHE_H
+#define VERDICT_CACHE_H
+
+#include "parser.h"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct Hash128 {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const Hash128& o) const { return low == o.low && high == o.high; }
+};
+
+// Fast non-cryptographic hash of size bytes, 32 at a time through 64x64
+// to 128-bit multiplies. Different seeds give unrelated hashes.
+Hash128 hash128(const char* data, size_t size, uint64_t seed = 0);
+
+// Verdicts and rejected lines of programs seen before, keyed by a hash of
+// their source, so that a program resubmitted byte for byte is answered
+// without lexing or parsing it. Entries live in a memory-mapped file that
+// any number of threads and processes can share.
+//
+// The file is a table of fixed-size slots in sets of eight; a program can
+// only go in the set its hash picks, where it replaces the least recently
+// used entry, so the file never grows past the size it was created with.
+// Each slot is guarded by a sequence number: a writer makes it odd while it
+// writes, and a reader that sees it odd or changed takes a miss rather than
+// wait. A writer that dies mid-write leaves its slot odd, and everyone
+// passes it over from then on, so its set goes on one slot short. Entries
+// too long for a slot keep only their first errors.
+class VerdictCache {
+private:
+    struct Header;
+    struct Slot;
+
+    Header* header;
+    Slot* slots;
+    uint64_t sets;
+    size_t mappedSize;
+    std::atomic<uint64_t> hitCount;
+    std::atomic<uint64_t> missCount;
+
+    VerdictCache(const VerdictCache&);
+    VerdictCache& operator=(const VerdictCache&);
+
+public:
+    static const size_t DEFAULT_SIZE = 64 << 20;
+
+    VerdictCache();
+    ~VerdictCache();
+
+    // Maps the cache at path, creating it at about size bytes if it does
+    // not exist. One of another size, or not a cache, is replaced by a new
+    // one; processes that still have the old one mapped keep using it
+    // alone. False, with err set, on failure.
+    bool open(const std::string& path, size_t size, std::string& err);
+    void close();
+    bool isOpen() const { return header != NULL; }
+
+    // The key of a program: its source, as parsed, and the option that can
+    // change its verdict, hashed with a seed drawn when the file was made.
+    // maxErrors and failFast only cut the error list short, which lookup()
+    // accounts for.
+    Hash128 key(const char* data, size_t size, size_t maxDepth) const;
+
+    // On a hit, sets errors to what a parse with these limits would leave
+    // in Parser::errorList(): empty for an accepted program, one entry with
+    // no line under verdictOnly, otherwise the errors, at most maxErrors of
+    // them (0: no limit). A stored entry holding fewer errors than asked
+    // for, because it came from a parse with tighter limits, is a miss.
+    bool lookup(const Hash128& key, size_t maxErrors, bool verdictOnly, std::vector<ErrorInfo>& errors);
+    // Records the result of a parse with the given limits.
+    void store(const Hash128& key, const std::vector<ErrorInfo>& errors, size_t maxErrors, bool verdictOnly);
+
+    // Lookups through this object.
+    uint64_t hits() const { return hitCount.load(); }
+    uint64_t misses() const { return missCount.load(); }
+    // Lookups through every user of the file since it was created.
+    uint64_t sharedHits() const;
+    uint64_t sharedMisses() const;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "vm.h"
+#include <algorithm>
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+const size_t Vm::DEFAULT_MAX_STACK;
+
+bool vmDispatchSupported(VmDispatch d) {
+#ifdef VM_COMPUTED_GOTO
+    return true;
+#else
+    return d == VM_SWITCH;
+#endif
+}
+
+const char* vmDispatchName(VmDispatch d) {
+    return d == VM_THREADED ? "threaded" : "switch";
+}
+
+Vm::Vm() : maxStack(DEFAULT_MAX_STACK), dispatch(vmDispatchSupported(VM_THREADED) ? VM_THREADED : VM_SWITCH) {}
+
+bool Vm::setDispatch(VmDispatch d) {
+    if (!vmDispatchSupported(d)) {
+        return false;
+    }
+    dispatch = d;
+    return true;
+}
+
+// Each instruction's code is a switch case and, with computed goto, also a
+// label; NEXT() goes to the next instruction either way.
+#ifdef VM_COMPUTED_GOTO
+#define TARGET(op) case op: L_##op:
+#define NEXT()                        \
+    do {                              \
+        if (THREADED) {               \
+            goto *labels[pc->op];     \
+        }                             \
+        goto dispatch;                \
+    } while (0)
+#else
+#define TARGET(op) case op:
+#define NEXT() goto dispatch
+#endif
+
+#define BINARY(op, expr)                         \
+    TARGET(op) {                                 \
+        uint32_t x = (uint32_t)r[pc->b];         \
+        uint32_t y = (uint32_t)r[pc->c];         \
+        r[pc->a] = (int32_t)(expr);              \
+        pc++;                                    \
+        NEXT();                                  \
+    }
+
+#define JUMP_IF(op, cond)                        \
+    TARGET(op) {                                 \
+        int32_t x = r[pc->a];                    \
+        int32_t y = r[pc->b];                    \
+        (void)y;                                 \
+        pc = (cond) ? code + pc->c : pc + 1;     \
+        NEXT();                                  \
+    }
+
+template <bool THREADED>
+bool Vm::execute(const BytecodeProgram& program, int32_t& result, std::string& err) {
+#ifdef VM_COMPUTED_GOTO
+    static const void* const labels[OP_COUNT] = {
+        &&L_OP_MOVE, &&L_OP_LOADK, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV, &&L_OP_MOD,
+        &&L_OP_LT, &&L_OP_LE, &&L_OP_GT, &&L_OP_GE, &&L_OP_EQ, &&L_OP_NE, &&L_OP_NEG, &&L_OP_NOT,
+        &&L_OP_JMP, &&L_OP_JZ, &&L_OP_JNZ, &&L_OP_JLT, &&L_OP_JLE, &&L_OP_JGT, &&L_OP_JGE,
+        &&L_OP_JEQ, &&L_OP_JNE, &&L_OP_CALL, &&L_OP_RET,
+    };
+#endif
+    const BytecodeFunction& main = program.functions[program.main];
+    if (main.registers > maxStack) {
+        err = "Stack overflow";
+        return false;
+    }
+    if (stack.size() < main.registers) {
+        stack.resize(main.registers);
+    }
+    std::fill(stack.begin(), stack.begin() + main.registers, 0);
+    frames.clear();
+    size_t base = 0;
+    int32_t* r = &stack[0];
+    const Insn* code = entries[program.main];
+    const Insn* pc = code;
+
+    NEXT();
+dispatch:
+    switch (pc->op) {
+    TARGET(OP_MOVE) {
+        r[pc->a] = r[pc->b];
+        pc++;
+        NEXT();
+    }
+    TARGET(OP_LOADK) {
+        r[pc->a] = pc->constant();
+        pc++;
+        NEXT();
+    }
+    BINARY(OP_ADD, x + y)
+    BINARY(OP_SUB, x - y)
+    BINARY(OP_MUL, x * y)
+    BINARY(OP_LT, (int32_t)x < (int32_t)y)
+    BINARY(OP_LE, (int32_t)x <= (int32_t)y)
+    BINARY(OP_GT, (int32_t)x > (int32_t)y)
+    BINARY(OP_GE, (int32_t)x >= (int32_t)y)
+    BINARY(OP_EQ, x == y)
+    BINARY(OP_NE, x != y)
+    TARGET(OP_DIV)
+    TARGET(OP_MOD) {
+        int32_t x = r[pc->b];
+        int32_t y = r[pc->c];
+        if (y == 0) {
+            err = "Division by zero";
+            return false;
+        }
+        // INT_MIN / -1 wraps around to INT_MIN, remainder 0.
+        if (y == -1) {
+            r[pc->a] = pc->op == OP_DIV ? (int32_t)(0u - (uint32_t)x) : 0;
+        } else {
+            r[pc->a] = pc->op == OP_DIV ? x / y : x % y;
+        }
+        pc++;
+        NEXT();
+    }
+    TARGET(OP_NEG) {
+        r[pc->a] = (int32_t)(0u - (uint32_t)r[pc->b]);
+        pc++;
+        NEXT();
+    }
+    TARGET(OP_NOT) {
+        r[pc->a] = r[pc->b] == 0;
+        pc++;
+        NEXT();
+    }
+    TARGET(OP_JMP) {
+        pc = code + pc->c;
+        NEXT();
+    }
+    JUMP_IF(OP_JZ, x == 0)
+    JUMP_IF(OP_JNZ, x != 0)
+    JUMP_IF(OP_JLT, x < y)
+    JUMP_IF(OP_JLE, x <= y)
+    JUMP_IF(OP_JGT, x > y)
+    JUMP_IF(OP_JGE, x >= y)
+    JUMP_IF(OP_JEQ, x == y)
+    JUMP_IF(OP_JNE, x != y)
+    TARGET(OP_CALL) {
+        const BytecodeFunction& callee = program.functions[pc->b];
+        size_t calleeBase = base + pc->c;
+        size_t need = calleeBase + callee.registers;
+        if (need > stack.size()) {
+            if (need > maxStack) {
+                err = "Stack overflow";
+                return false;
+            }
+            stack.resize(std::min(maxStack, std::max(need, stack.size() * 2)));
+        }
+        Frame frame = { code, pc + 1, base, pc->a };
+        frames.push_back(frame);
+        base = calleeBase;
+        r = &stack[base];
+        code = entries[pc->b];
+        pc = code;
+        NEXT();
+    }
+    TARGET(OP_RET) {
+        int32_t value = r[pc->a];
+        if (frames.empty()) {
+            result = value;
+            return true;
+        }
+        const Frame& frame = frames.back();
+        base = frame.base;
+        r = &stack[base];
+        r[frame.dst] = value;
+        code = frame.code;
+        pc = frame.returnTo;
+        frames.pop_back();
+        NEXT();
+    }
+    default:
+        break;
+    }
+    err = "Invalid instruction";
+    return false;
+}
+
+bool Vm::run(const BytecodeProgram& program, int32_t& result, std::string& err) {
+    entries.clear();
+    for (size_t f = 0; f < program.functions.size(); f++) {
+        entries.push_back(&program.functions[f].code[0]);
+    }
+#ifdef VM_COMPUTED_GOTO
+    if (dispatch == VM_THREADED) {
+        return execute<true>(program, result, err);
+    }
+#endif
+    return execute<false>(program, result, err);
+}
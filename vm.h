@@ -0,0 +1,60 @@
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// How the interpreter loop gets from one instruction to the next: through
+// a switch, or (where the compiler has computed goto) by jumping straight
+// from the end of each instruction's code to the next one's, which gives
+// the branch predictor one indirect jump per opcode to learn instead of a
+// single shared one. Both run the same code and give identical results.
+enum VmDispatch {
+    VM_SWITCH, VM_THREADED
+};
+
+bool vmDispatchSupported(VmDispatch d);
+const char* vmDispatchName(VmDispatch d);
+
+// Runs bytecode with ToyC's semantics: ints are 32-bit and wrap around,
+// && and || only evaluate their right side when needed, and a function
+// that ends without a return returns 0. Frames live on one register stack
+// that grows as calls need it, up to a limit.
+class Vm {
+private:
+    struct Frame {
+        const Insn* code;   // of the caller
+        const Insn* returnTo;
+        size_t base;        // of the caller's registers
+        uint32_t dst;       // caller register for the result
+    };
+
+    std::vector<int32_t> stack;
+    std::vector<Frame> frames;
+    std::vector<const Insn*> entries;   // by function
+    size_t maxStack;
+    VmDispatch dispatch;
+
+    template <bool THREADED>
+    bool execute(const BytecodeProgram& program, int32_t& result, std::string& err);
+
+public:
+    // In registers (4 bytes each).
+    static const size_t DEFAULT_MAX_STACK = (size_t)1 << 24;
+
+    Vm();
+    // Calls that would need more registers than this fail with a stack
+    // overflow.
+    void setMaxStack(size_t registers) { maxStack = registers; }
+    // False, leaving the dispatch unchanged, if this build cannot do d.
+    bool setDispatch(VmDispatch d);
+    VmDispatch dispatchUsed() const { return dispatch; }
+
+    // Runs main and sets result to what it returns. False, with a message,
+    // on division by zero or stack overflow.
+    bool run(const BytecodeProgram& program, int32_t& result, std::string& err);
+};
+
+#endif